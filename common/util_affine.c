@@ -0,0 +1,191 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <math.h>
+#include "util_affine.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+
+void
+affine_identity (affine_t *a)
+{
+    float *m = a->m;
+
+    m[0] = 1.0f;  m[1] = 0.0f;  m[ 2] = 0.0f;  m[ 3] = 0.0f;
+    m[4] = 0.0f;  m[5] = 1.0f;  m[ 6] = 0.0f;  m[ 7] = 0.0f;
+    m[8] = 0.0f;  m[9] = 0.0f;  m[10] = 1.0f;  m[11] = 0.0f;
+}
+
+void
+affine_mult (affine_t *dst, const affine_t *a, const affine_t *b)
+{
+    const float *ma = a->m;
+    const float *mb = b->m;
+    float m[12];
+
+    for (int r = 0; r < 3; r ++)
+    {
+        const float *ra = &ma[4 * r];
+
+        for (int c = 0; c < 4; c ++)
+        {
+            m[4 * r + c] = ra[0] * mb[c] + ra[1] * mb[4 + c] + ra[2] * mb[8 + c];
+        }
+        m[4 * r + 3] += ra[3];
+    }
+
+    for (int i = 0; i < 12; i ++)
+        dst->m[i] = m[i];
+}
+
+void
+affine_roi_to_image (affine_t *a, float cx, float cy, float w, float h, float rotation)
+{
+    float *m = a->m;
+    float c = cosf (rotation);
+    float s = sinf (rotation);
+
+    m[0] = c * w;  m[1] = -s * h;  m[ 2] = 0.0f;  m[ 3] = cx - 0.5f * (m[0] + m[1]);
+    m[4] = s * w;  m[5] =  c * h;  m[ 6] = 0.0f;  m[ 7] = cy - 0.5f * (m[4] + m[5]);
+    m[8] = 0.0f;   m[9] = 0.0f;    m[10] = 1.0f;  m[11] = 0.0f;
+}
+
+void
+affine_image_to_roi (affine_t *a, float cx, float cy, float w, float h, float rotation)
+{
+    float *m = a->m;
+    float c = cosf (rotation);
+    float s = sinf (rotation);
+
+    m[0] =  c / w;  m[1] = s / w;  m[ 2] = 0.0f;  m[ 3] = 0.5f - (m[0] * cx + m[1] * cy);
+    m[4] = -s / h;  m[5] = c / h;  m[ 6] = 0.0f;  m[ 7] = 0.5f - (m[4] * cx + m[5] * cy);
+    m[8] = 0.0f;    m[9] = 0.0f;   m[10] = 1.0f;  m[11] = 0.0f;
+}
+
+void
+affine_image_to_screen (affine_t *a, float texw, float texh, float ofstx, float ofsty)
+{
+    float *m = a->m;
+
+    m[0] = texw;  m[1] = 0.0f;  m[ 2] = 0.0f;  m[ 3] = ofstx;
+    m[4] = 0.0f;  m[5] = texh;  m[ 6] = 0.0f;  m[ 7] = ofsty;
+    m[8] = 0.0f;  m[9] = 0.0f;  m[10] = 1.0f;  m[11] = 0.0f;
+}
+
+
+void
+affine_transform_vec3 (const affine_t *a, const float *src, float *dst, int num)
+{
+    const float *m = a->m;
+    int i = 0;
+
+#if defined (__SSE2__)
+    /* columns of the matrix: (x', y', z') = c0 * x + c1 * y + c2 * z + c3 */
+    __m128 c0 = _mm_setr_ps (m[0], m[4], m[ 8], 0.0f);
+    __m128 c1 = _mm_setr_ps (m[1], m[5], m[ 9], 0.0f);
+    __m128 c2 = _mm_setr_ps (m[2], m[6], m[10], 0.0f);
+    __m128 c3 = _mm_setr_ps (m[3], m[7], m[11], 0.0f);
+
+    for (; i < num; i ++)
+    {
+        __m128 r = _mm_add_ps (c3, _mm_mul_ps (c0, _mm_set1_ps (src[0])));
+        r = _mm_add_ps (r, _mm_mul_ps (c1, _mm_set1_ps (src[1])));
+        r = _mm_add_ps (r, _mm_mul_ps (c2, _mm_set1_ps (src[2])));
+
+        /* 3 floats only: the next point may be the source of the next iteration. */
+        _mm_storel_pi ((__m64 *)dst, r);
+        _mm_store_ss (&dst[2], _mm_movehl_ps (r, r));
+        src += 3;
+        dst += 3;
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t c0 = {m[0], m[4], m[ 8], 0.0f};
+    float32x4_t c1 = {m[1], m[5], m[ 9], 0.0f};
+    float32x4_t c2 = {m[2], m[6], m[10], 0.0f};
+    float32x4_t c3 = {m[3], m[7], m[11], 0.0f};
+
+    for (; i < num; i ++)
+    {
+        float32x4_t r = vmlaq_n_f32 (c3, c0, src[0]);
+        r = vmlaq_n_f32 (r, c1, src[1]);
+        r = vmlaq_n_f32 (r, c2, src[2]);
+
+        vst1_f32 (dst, vget_low_f32 (r));
+        dst[2] = vgetq_lane_f32 (r, 2);
+        src += 3;
+        dst += 3;
+    }
+#endif
+
+    for (; i < num; i ++)
+    {
+        float x = src[0];
+        float y = src[1];
+        float z = src[2];
+
+        dst[0] = m[0] * x + m[1] * y + m[ 2] * z + m[ 3];
+        dst[1] = m[4] * x + m[5] * y + m[ 6] * z + m[ 7];
+        dst[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+        src += 3;
+        dst += 3;
+    }
+}
+
+void
+affine_transform_vec2 (const affine_t *a, const float *src, float *dst, int num)
+{
+    const float *m = a->m;
+    int i = 0;
+
+#if defined (__SSE2__)
+    /* 2 points per iteration: (x0, y0, x1, y1) */
+    __m128 mx = _mm_setr_ps (m[0], m[4], m[0], m[4]);
+    __m128 my = _mm_setr_ps (m[1], m[5], m[1], m[5]);
+    __m128 mt = _mm_setr_ps (m[3], m[7], m[3], m[7]);
+
+    for (; i + 2 <= num; i += 2)
+    {
+        __m128 p  = _mm_loadu_ps (src);
+        __m128 xx = _mm_shuffle_ps (p, p, _MM_SHUFFLE (2, 2, 0, 0));
+        __m128 yy = _mm_shuffle_ps (p, p, _MM_SHUFFLE (3, 3, 1, 1));
+        __m128 r  = _mm_add_ps (mt, _mm_add_ps (_mm_mul_ps (mx, xx), _mm_mul_ps (my, yy)));
+
+        _mm_storeu_ps (dst, r);
+        src += 4;
+        dst += 4;
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x2_t mx = {m[0], m[4]};
+    float32x2_t my = {m[1], m[5]};
+    float32x2_t mt = {m[3], m[7]};
+
+    for (; i < num; i ++)
+    {
+        float32x2_t p = vld1_f32 (src);
+        float32x2_t r = vmla_lane_f32 (mt, mx, p, 0);
+        r = vmla_lane_f32 (r, my, p, 1);
+
+        vst1_f32 (dst, r);
+        src += 2;
+        dst += 2;
+    }
+#endif
+
+    for (; i < num; i ++)
+    {
+        float x = src[0];
+        float y = src[1];
+
+        dst[0] = m[0] * x + m[1] * y + m[3];
+        dst[1] = m[4] * x + m[5] * y + m[7];
+        src += 2;
+        dst += 2;
+    }
+}
@@ -0,0 +1,61 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_AFFINE_H_
+#define _UTIL_AFFINE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  3x4 affine transform of the landmark arrays.
+ *
+ *    | x' |   | m[0] m[1] m[ 2] m[ 3] |   | x |
+ *    | y' | = | m[4] m[5] m[ 6] m[ 7] | * | y |
+ *    | z' |   | m[8] m[9] m[10] m[11] |   | z |
+ *                                         | 1 |
+ *
+ *  build one transform per ROI (and combine it with the screen mapping by
+ *  affine_mult), then apply it to the whole array, instead of the per-vertex
+ *  sin/cos and the separate scaling loop.
+ */
+typedef struct _affine_t
+{
+    float m[12];
+} affine_t;
+
+void affine_identity (affine_t *a);
+
+/* dst = a * b  (b is applied first). dst may be a or b. */
+void affine_mult (affine_t *dst, const affine_t *a, const affine_t *b);
+
+/*
+ *  ROI normalized [0, 1] --> image normalized.
+ *      (x, y) = R(rotation) * S(w, h) * ((x, y) - 0.5) + (cx, cy),  z is kept.
+ */
+void affine_roi_to_image (affine_t *a, float cx, float cy, float w, float h, float rotation);
+
+/* image normalized --> ROI normalized [0, 1]. (the inverse of the above) */
+void affine_image_to_roi (affine_t *a, float cx, float cy, float w, float h, float rotation);
+
+/*
+ *  image normalized --> screen.
+ *      (x, y) = (x * texw + ofstx, y * texh + ofsty),  z is kept.
+ */
+void affine_image_to_screen (affine_t *a, float texw, float texh, float ofstx, float ofsty);
+
+/*
+ *  apply to (num) points. (dst) may be (src).
+ *    vec3: {x, y, z} packed.
+ *    vec2: {x, y} packed. the z column and the z row are ignored.
+ */
+void affine_transform_vec3 (const affine_t *a, const float *src, float *dst, int num);
+void affine_transform_vec2 (const affine_t *a, const float *src, float *dst, int num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_AFFINE_H_ */
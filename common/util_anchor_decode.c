@@ -0,0 +1,252 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "util_anchor_decode.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+
+static int
+alloc_anchor_decoder (anchor_decoder_t *dec, int num_anchors,
+                      int input_w, int input_h, int num_keys, int reg_stride)
+{
+    memset (dec, 0, sizeof (*dec));
+
+    dec->num_anchors = num_anchors;
+    dec->input_w     = input_w;
+    dec->input_h     = input_h;
+    dec->num_keys    = num_keys;
+    dec->reg_stride  = reg_stride;
+
+    dec->anchor_cx = (float *)malloc (num_anchors * sizeof (float));
+    dec->anchor_cy = (float *)malloc (num_anchors * sizeof (float));
+    dec->survivors = (int *)  malloc (num_anchors * sizeof (int));
+    dec->boxes     = (anchor_box_t *)malloc (num_anchors * sizeof (anchor_box_t));
+    dec->keys      = (float *)malloc (num_anchors * num_keys * 2 * sizeof (float) + 1);
+    if (!dec->anchor_cx || !dec->anchor_cy || !dec->survivors || !dec->boxes || !dec->keys)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        exit_anchor_decoder (dec);
+        return -1;
+    }
+
+    set_anchor_score_thresh (dec, 0.5f);
+
+    return 0;
+}
+
+int
+init_anchor_decoder (anchor_decoder_t *dec, int num_anchors,
+                     const float *anchor_cx, const float *anchor_cy,
+                     int input_w, int input_h, int num_keys, int reg_stride)
+{
+    if (alloc_anchor_decoder (dec, num_anchors, input_w, input_h, num_keys, reg_stride) < 0)
+        return -1;
+
+    memcpy (dec->anchor_cx, anchor_cx, num_anchors * sizeof (float));
+    memcpy (dec->anchor_cy, anchor_cy, num_anchors * sizeof (float));
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  anchors on a regular grid
+ * -------------------------------------------------------------------- */
+int
+count_grid_anchors (const anchor_layer_t *layers, int num_layers, int input_w, int input_h)
+{
+    int num = 0;
+
+    for (int i = 0; i < num_layers; i ++)
+    {
+        int stride = layers[i].stride;
+        int grid_w = (input_w + stride - 1) / stride;
+        int grid_h = (input_h + stride - 1) / stride;
+
+        num += grid_w * grid_h * layers[i].num_per_cell;
+    }
+    return num;
+}
+
+/*
+ *  the anchor centers are written straight into the SoA tables of the decoder,
+ *  in input pixels:  cx = (gx + 0.5) * input_w / grid_w
+ */
+int
+init_anchor_decoder_grid (anchor_decoder_t *dec, const anchor_layer_t *layers, int num_layers,
+                          int input_w, int input_h, int num_keys, int reg_stride)
+{
+    int num_anchors = count_grid_anchors (layers, num_layers, input_w, input_h);
+
+    if (alloc_anchor_decoder (dec, num_anchors, input_w, input_h, num_keys, reg_stride) < 0)
+        return -1;
+
+    float *pcx = dec->anchor_cx;
+    float *pcy = dec->anchor_cy;
+
+    for (int i = 0; i < num_layers; i ++)
+    {
+        int   stride = layers[i].stride;
+        int   num_per_cell = layers[i].num_per_cell;
+        int   grid_w = (input_w + stride - 1) / stride;
+        int   grid_h = (input_h + stride - 1) / stride;
+        float step_x = (float)input_w / (float)grid_w;
+        float step_y = (float)input_h / (float)grid_h;
+
+        for (int gy = 0; gy < grid_h; gy ++)
+        {
+            float y = step_y * (gy + 0.5f);
+            for (int gx = 0; gx < grid_w; gx ++)
+            {
+                float x = step_x * (gx + 0.5f);
+                for (int n = 0; n < num_per_cell; n ++)
+                {
+                    *pcx ++ = x;
+                    *pcy ++ = y;
+                }
+            }
+        }
+    }
+
+    return num_anchors;
+}
+
+int
+exit_anchor_decoder (anchor_decoder_t *dec)
+{
+    free (dec->anchor_cx);
+    free (dec->anchor_cy);
+    free (dec->survivors);
+    free (dec->boxes);
+    free (dec->keys);
+    memset (dec, 0, sizeof (*dec));
+
+    return 0;
+}
+
+/*
+ *  sigmoid(x) > thresh  <==>  x > log(thresh / (1 - thresh))
+ */
+int
+set_anchor_score_thresh (anchor_decoder_t *dec, float score_thresh)
+{
+    dec->score_thresh = score_thresh;
+
+    if (score_thresh <= 0.0f)
+        dec->logit_thresh = -INFINITY;
+    else if (score_thresh >= 1.0f)
+        dec->logit_thresh = INFINITY;
+    else
+        dec->logit_thresh = logf (score_thresh / (1.0f - score_thresh));
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  compact the indices of the anchors whose logit exceeds the threshold.
+ * -------------------------------------------------------------------- */
+static int
+select_survivors (const float *scores, int num, float thresh, int *survivors)
+{
+    int cnt = 0;
+    int i = 0;
+
+#if defined (__SSE2__)
+    __m128 vthresh = _mm_set1_ps (thresh);
+    for (; i + 4 <= num; i += 4)
+    {
+        int mask = _mm_movemask_ps (_mm_cmpgt_ps (_mm_loadu_ps (&scores[i]), vthresh));
+
+        /* almost all the lanes are rejected. */
+        while (mask)
+        {
+            int lane = __builtin_ctz (mask);
+            survivors[cnt ++] = i + lane;
+            mask &= mask - 1;
+        }
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    static const uint32_t s_lane_bit[4] = {1, 2, 4, 8};
+    float32x4_t vthresh = vdupq_n_f32 (thresh);
+    uint32x4_t  vbit    = vld1q_u32 (s_lane_bit);
+    for (; i + 4 <= num; i += 4)
+    {
+        uint32x4_t vcmp = vandq_u32 (vcgtq_f32 (vld1q_f32 (&scores[i]), vthresh), vbit);
+        uint32x2_t vsum = vpadd_u32 (vget_low_u32 (vcmp), vget_high_u32 (vcmp));
+        int mask = vget_lane_u32 (vpadd_u32 (vsum, vsum), 0);
+
+        while (mask)
+        {
+            int lane = __builtin_ctz (mask);
+            survivors[cnt ++] = i + lane;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    /* remainder (or the whole array without SIMD). branchless. */
+    for (; i < num; i ++)
+    {
+        survivors[cnt] = i;
+        cnt += (scores[i] > thresh);
+    }
+
+    return cnt;
+}
+
+
+/*
+ *  returns the number of decoded boxes.
+ *  the results are in dec->boxes[] and get_anchor_box_keys().
+ */
+int
+decode_anchors (anchor_decoder_t *dec, const float *scores, const float *regressors)
+{
+    float inv_w = 1.0f / (float)dec->input_w;
+    float inv_h = 1.0f / (float)dec->input_h;
+    int   num_keys = dec->num_keys;
+
+    int num = select_survivors (scores, dec->num_anchors, dec->logit_thresh, dec->survivors);
+
+    for (int n = 0; n < num; n ++)
+    {
+        int   idx = dec->survivors[n];
+        const float *p = &regressors[idx * dec->reg_stride];
+        float ax = dec->anchor_cx[idx];
+        float ay = dec->anchor_cy[idx];
+
+        float cx = (p[0] + ax) * inv_w;
+        float cy = (p[1] + ay) * inv_h;
+        float w  =  p[2]       * inv_w;
+        float h  =  p[3]       * inv_h;
+
+        anchor_box_t *box = &dec->boxes[n];
+        box->score      = 1.0f / (1.0f + expf (-scores[idx]));
+        box->x1         = cx - w * 0.5f;
+        box->y1         = cy - h * 0.5f;
+        box->x2         = cx + w * 0.5f;
+        box->y2         = cy + h * 0.5f;
+        box->anchor_idx = idx;
+
+        float *keys = get_anchor_box_keys (dec, n);
+        for (int j = 0; j < num_keys; j ++)
+        {
+            keys[2 * j + 0] = (p[4 + 2 * j + 0] + ax) * inv_w;
+            keys[2 * j + 1] = (p[4 + 2 * j + 1] + ay) * inv_h;
+        }
+    }
+
+    dec->num_boxes = num;
+    return num;
+}
@@ -0,0 +1,84 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_ANCHOR_DECODE_H_
+#define _UTIL_ANCHOR_DECODE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  Decoder for the BlazeFace/SSD style detectors (face detection, palm detection):
+ *
+ *    scores     [num_anchors]              : raw logits
+ *    regressors [num_anchors][reg_stride]  : (cx, cy, w, h, key0.x, key0.y, key1.x, ...)
+ *                                            in input pixels, relative to the anchor.
+ *
+ *  the score threshold is applied to the raw logits (logit(thresh)), so the
+ *  sigmoid, the box and the keypoints are computed only for the survivors.
+ */
+typedef struct _anchor_box_t
+{
+    float score;
+    float x1, y1;               /* normalized to [0, 1] of the input image */
+    float x2, y2;
+    int   anchor_idx;
+} anchor_box_t;
+
+typedef struct _anchor_decoder_t
+{
+    int     num_anchors;
+    float   *anchor_cx;         /* SoA anchor centers, in input pixels */
+    float   *anchor_cy;
+
+    int     input_w, input_h;
+    int     num_keys;           /* number of keypoints per anchor          */
+    int     reg_stride;         /* number of floats per anchor in regressor */
+
+    float   score_thresh;
+    float   logit_thresh;
+
+    /* preallocated work/result buffers, [num_anchors] each */
+    int          *survivors;
+    anchor_box_t *boxes;
+    float        *keys;         /* [num_anchors][num_keys][2] */
+    int          num_boxes;
+} anchor_decoder_t;
+
+/*
+ *  anchors on a regular grid (BlazeFace, and the SSD anchors of MediaPipe with
+ *  fixed_anchor_size): each layer puts (num_per_cell) anchors at the center of
+ *  every cell of the ceil (input / stride) grid. the layers are in the order of
+ *  the model output.
+ */
+typedef struct _anchor_layer_t
+{
+    int stride;
+    int num_per_cell;
+} anchor_layer_t;
+
+/* returns the number of anchors. */
+int   count_grid_anchors    (const anchor_layer_t *layers, int num_layers, int input_w, int input_h);
+
+int   init_anchor_decoder   (anchor_decoder_t *dec, int num_anchors,
+                             const float *anchor_cx, const float *anchor_cy,
+                             int input_w, int input_h, int num_keys, int reg_stride);
+int   init_anchor_decoder_grid (anchor_decoder_t *dec, const anchor_layer_t *layers, int num_layers,
+                                int input_w, int input_h, int num_keys, int reg_stride);
+int   exit_anchor_decoder   (anchor_decoder_t *dec);
+int   set_anchor_score_thresh (anchor_decoder_t *dec, float score_thresh);
+int   decode_anchors        (anchor_decoder_t *dec, const float *scores, const float *regressors);
+
+static inline float *
+get_anchor_box_keys (anchor_decoder_t *dec, int box_idx)
+{
+    return &dec->keys[box_idx * dec->num_keys * 2];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_ANCHOR_DECODE_H_ */
@@ -0,0 +1,178 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "util_async_infer.h"
+
+static pthread_t        s_infer_thread;
+static pthread_mutex_t  s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   s_cond  = PTHREAD_COND_INITIALIZER;
+static int              s_running;
+
+/* the job (protected by s_mutex) */
+static async_infer_func_t s_job_func;
+static void             *s_job_arg;
+static int              s_job_state;
+static int              s_quit;
+
+/* statistics */
+static int              s_stat_jobs;
+static float            s_stat_invoke_ms;
+static float            s_stat_fps;
+static double           s_stat_fps_time;
+static int              s_stat_fps_jobs;
+
+
+static double
+get_time_ms ()
+{
+    struct timespec tv;
+    clock_gettime (CLOCK_MONOTONIC, &tv);
+    return (tv.tv_sec * 1000.0 + tv.tv_nsec / 1000000.0);
+}
+
+static void *
+infer_thread_main (void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock (&s_mutex);
+    for (;;)
+    {
+        while (s_job_state != ASYNC_INFER_BUSY && !s_quit)
+            pthread_cond_wait (&s_cond, &s_mutex);
+
+        if (s_quit)
+            break;
+
+        async_infer_func_t func = s_job_func;
+        void *job_arg = s_job_arg;
+        pthread_mutex_unlock (&s_mutex);
+
+        double t0 = get_time_ms ();
+        func (job_arg);
+        double t1 = get_time_ms ();
+
+        pthread_mutex_lock (&s_mutex);
+        s_stat_jobs ++;
+        s_stat_invoke_ms = (float)(t1 - t0);
+        s_stat_fps_jobs ++;
+        if (t1 - s_stat_fps_time >= 1000.0)
+        {
+            s_stat_fps = (float)(s_stat_fps_jobs * 1000.0 / (t1 - s_stat_fps_time));
+            s_stat_fps_time = t1;
+            s_stat_fps_jobs = 0;
+        }
+
+        s_job_state = ASYNC_INFER_DONE;
+        pthread_cond_broadcast (&s_cond);
+    }
+    pthread_mutex_unlock (&s_mutex);
+
+    return NULL;
+}
+
+
+int
+init_async_infer ()
+{
+    if (s_running)
+        return 0;
+
+    s_job_state = ASYNC_INFER_IDLE;
+    s_quit      = 0;
+    s_stat_fps_time = get_time_ms ();
+
+    if (pthread_create (&s_infer_thread, NULL, infer_thread_main, NULL) != 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+    s_running = 1;
+
+    return 0;
+}
+
+int
+exit_async_infer ()
+{
+    if (!s_running)
+        return 0;
+
+    pthread_mutex_lock (&s_mutex);
+    while (s_job_state == ASYNC_INFER_BUSY)
+        pthread_cond_wait (&s_cond, &s_mutex);
+    s_quit = 1;
+    pthread_cond_broadcast (&s_cond);
+    pthread_mutex_unlock (&s_mutex);
+
+    pthread_join (s_infer_thread, NULL);
+    s_running = 0;
+
+    return 0;
+}
+
+int
+submit_async_infer (async_infer_func_t func, void *arg)
+{
+    int ret = 0;
+
+    pthread_mutex_lock (&s_mutex);
+    if (s_job_state == ASYNC_INFER_BUSY)
+    {
+        ret = -1;
+    }
+    else
+    {
+        s_job_func  = func;
+        s_job_arg   = arg;
+        s_job_state = ASYNC_INFER_BUSY;
+        pthread_cond_broadcast (&s_cond);
+    }
+    pthread_mutex_unlock (&s_mutex);
+
+    return ret;
+}
+
+int
+poll_async_infer ()
+{
+    int state;
+
+    pthread_mutex_lock (&s_mutex);
+    state = s_job_state;
+    if (state == ASYNC_INFER_DONE)
+        s_job_state = ASYNC_INFER_IDLE;
+    pthread_mutex_unlock (&s_mutex);
+
+    return state;
+}
+
+int
+wait_async_infer ()
+{
+    int state;
+
+    pthread_mutex_lock (&s_mutex);
+    while (s_job_state == ASYNC_INFER_BUSY)
+        pthread_cond_wait (&s_cond, &s_mutex);
+    state = s_job_state;
+    if (state == ASYNC_INFER_DONE)
+        s_job_state = ASYNC_INFER_IDLE;
+    pthread_mutex_unlock (&s_mutex);
+
+    return state;
+}
+
+void
+get_async_infer_stats (async_infer_stats_t *stats)
+{
+    pthread_mutex_lock (&s_mutex);
+    stats->num_jobs  = s_stat_jobs;
+    stats->invoke_ms = s_stat_invoke_ms;
+    stats->infer_fps = s_stat_fps;
+    pthread_mutex_unlock (&s_mutex);
+}
@@ -0,0 +1,57 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_ASYNC_INFER_H_
+#define _UTIL_ASYNC_INFER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  runs the inference on its own thread, so that the render loop isn't
+ *  paced by the model.
+ *
+ *    the render thread feeds the input tensor (with GL) only while the
+ *    inference thread is idle, then submits a job which invokes the
+ *    interpreter and decodes the outputs into a buffer owned by the job.
+ *    poll_async_infer() tells the render thread when the job is done.
+ *
+ *      if (poll_async_infer () != ASYNC_INFER_BUSY)
+ *      {
+ *          (use the result of the last job, if ASYNC_INFER_DONE)
+ *          feed_xxx_image (...);
+ *          submit_async_infer (xxx_job, &job_result);
+ *      }
+ *
+ *  the GPU delegates are bound to the GL context of the render thread,
+ *  so this is for the CPU (XNNPACK, NNAPI, EdgeTPU) interpreters only.
+ */
+typedef int (*async_infer_func_t) (void *arg);
+
+enum async_infer_state {
+    ASYNC_INFER_IDLE = 0,       /* no job has been submitted since the last poll */
+    ASYNC_INFER_BUSY,           /* the job is running */
+    ASYNC_INFER_DONE,           /* the job has finished (returned once) */
+};
+
+typedef struct _async_infer_stats_t
+{
+    int     num_jobs;
+    float   invoke_ms;          /* of the last job */
+    float   infer_fps;          /* jobs per second, averaged over the last second */
+} async_infer_stats_t;
+
+int  init_async_infer   ();
+int  exit_async_infer   ();
+int  submit_async_infer (async_infer_func_t func, void *arg);  /* -1 if busy */
+int  poll_async_infer   ();     /* enum async_infer_state. never blocks. */
+int  wait_async_infer   ();     /* blocks until the job is done */
+void get_async_infer_stats (async_infer_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_ASYNC_INFER_H_ */
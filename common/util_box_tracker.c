@@ -0,0 +1,243 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "util_box_tracker.h"
+
+/* standard deviations relative to the box height (the same as DeepSORT) */
+#define STD_POS     (1.0f / 20.0f)
+#define STD_VEL     (1.0f / 160.0f)
+
+
+void
+init_box_tracker (box_tracker_t *bt, float iou_thresh, int max_miss)
+{
+    memset (bt, 0, sizeof (*bt));
+    bt->iou_thresh = iou_thresh;
+    bt->max_miss   = max_miss;
+}
+
+void
+reset_box_tracker (box_tracker_t *bt)
+{
+    bt->num_tracks = 0;
+}
+
+void
+get_box_track_rect (box_tracker_t *bt, int idx, float *box)
+{
+    box_track_t *trk = &bt->tracks[idx];
+    float w = fmaxf (trk->x[2], 0.0f);
+    float h = fmaxf (trk->x[3], 0.0f);
+
+    box[0] = trk->x[0] - 0.5f * w;
+    box[1] = trk->x[1] - 0.5f * h;
+    box[2] = trk->x[0] + 0.5f * w;
+    box[3] = trk->x[1] + 0.5f * h;
+}
+
+static void
+box_to_meas (const float *box, float *z)
+{
+    z[0] = (box[0] + box[2]) * 0.5f;
+    z[1] = (box[1] + box[3]) * 0.5f;
+    z[2] =  box[2] - box[0];
+    z[3] =  box[3] - box[1];
+}
+
+static float
+calc_iou (const float *a, const float *b)
+{
+    float x1 = fmaxf (a[0], b[0]);
+    float y1 = fmaxf (a[1], b[1]);
+    float x2 = fminf (a[2], b[2]);
+    float y2 = fminf (a[3], b[3]);
+    float inter = fmaxf (x2 - x1, 0.0f) * fmaxf (y2 - y1, 0.0f);
+    float area_a = (a[2] - a[0]) * (a[3] - a[1]);
+    float area_b = (b[2] - b[0]) * (b[3] - b[1]);
+    float uni = area_a + area_b - inter;
+
+    return (uni > 0.0f) ? inter / uni : 0.0f;
+}
+
+
+/* -------------------------------------------------- *
+ *  Kalman filter (x, v) per coordinate, dt = 1 frame.
+ * -------------------------------------------------- */
+static void
+start_track (box_tracker_t *bt, box_track_t *trk, const float *box, float score, int det_class)
+{
+    float z[4];
+    box_to_meas (box, z);
+
+    float sp = 2.0f  * STD_POS * z[3];
+    float sv = 10.0f * STD_VEL * z[3];
+
+    for (int i = 0; i < 4; i ++)
+    {
+        trk->x[i]   = z[i];
+        trk->v[i]   = 0.0f;
+        trk->p00[i] = sp * sp;
+        trk->p01[i] = 0.0f;
+        trk->p11[i] = sv * sv;
+    }
+
+    trk->track_id  = bt->next_id ++;
+    trk->det_class = det_class;
+    trk->score     = score;
+    trk->hits      = 1;
+    trk->miss      = 0;
+    trk->age       = 0;
+}
+
+void
+predict_box_tracker (box_tracker_t *bt)
+{
+    for (int n = 0; n < bt->num_tracks; n ++)
+    {
+        box_track_t *trk = &bt->tracks[n];
+        float sp = STD_POS * trk->x[3];
+        float sv = STD_VEL * trk->x[3];
+
+        for (int i = 0; i < 4; i ++)
+        {
+            trk->x[i]   += trk->v[i];
+            trk->p00[i] += 2.0f * trk->p01[i] + trk->p11[i] + sp * sp;
+            trk->p01[i] += trk->p11[i];
+            trk->p11[i] += sv * sv;
+        }
+
+        /* don't let the box collapse while it's not observed. */
+        if (trk->x[2] + trk->v[2] <= 0.0f || trk->x[3] + trk->v[3] <= 0.0f)
+        {
+            trk->v[2] = 0.0f;
+            trk->v[3] = 0.0f;
+        }
+        trk->age ++;
+    }
+}
+
+static void
+correct_track (box_track_t *trk, const float *box, float score)
+{
+    float z[4];
+    box_to_meas (box, z);
+
+    float sr = STD_POS * trk->x[3];
+    float r  = sr * sr;
+
+    for (int i = 0; i < 4; i ++)
+    {
+        float s  = trk->p00[i] + r;
+        float k0 = trk->p00[i] / s;
+        float k1 = trk->p01[i] / s;
+        float e  = z[i] - trk->x[i];
+
+        trk->x[i]   += k0 * e;
+        trk->v[i]   += k1 * e;
+        trk->p11[i] -= k1 * trk->p01[i];
+        trk->p00[i] *= (1.0f - k0);
+        trk->p01[i] *= (1.0f - k0);
+    }
+
+    trk->score = score;
+    trk->hits ++;
+    trk->miss  = 0;
+    trk->age   = 0;
+}
+
+
+/* -------------------------------------------------- *
+ *  assignment
+ * -------------------------------------------------- */
+int
+update_box_tracker (box_tracker_t *bt, const float *boxes, const float *scores,
+                    const int *classes, int num, int *track_ids)
+{
+    unsigned char trk_used[BOX_TRACKER_MAX_TRACK];
+    int   det_match[BOX_TRACKER_MAX_TRACK];
+    float trk_box[BOX_TRACKER_MAX_TRACK][4];
+
+    if (num > BOX_TRACKER_MAX_TRACK)
+        num = BOX_TRACKER_MAX_TRACK;
+
+    memset (trk_used, 0, sizeof (trk_used));
+    for (int j = 0; j < num; j ++)
+        det_match[j] = -1;
+    for (int i = 0; i < bt->num_tracks; i ++)
+        get_box_track_rect (bt, i, trk_box[i]);
+
+    /* greedy: the pair of the highest IoU first. (an approximation of the optimal assignment) */
+    for (;;)
+    {
+        float best = bt->iou_thresh;
+        int   bi = -1, bj = -1;
+
+        for (int j = 0; j < num; j ++)
+        {
+            if (det_match[j] >= 0)
+                continue;
+            for (int i = 0; i < bt->num_tracks; i ++)
+            {
+                if (trk_used[i] || bt->tracks[i].det_class != classes[j])
+                    continue;
+                float iou = calc_iou (trk_box[i], &boxes[4 * j]);
+                if (iou >= best)
+                {
+                    best = iou;
+                    bi = i;
+                    bj = j;
+                }
+            }
+        }
+        if (bi < 0)
+            break;
+
+        det_match[bj] = bi;
+        trk_used[bi]  = 1;
+    }
+
+    /* the tracks missed this time */
+    int num_old = bt->num_tracks;
+    for (int i = 0; i < num_old; i ++)
+    {
+        if (!trk_used[i])
+            bt->tracks[i].miss ++;
+    }
+
+    for (int j = 0; j < num; j ++)
+    {
+        int i = det_match[j];
+
+        if (i >= 0)
+        {
+            correct_track (&bt->tracks[i], &boxes[4 * j], scores[j]);
+        }
+        else if (bt->num_tracks < BOX_TRACKER_MAX_TRACK)
+        {
+            i = bt->num_tracks ++;
+            start_track (bt, &bt->tracks[i], &boxes[4 * j], scores[j], classes[j]);
+        }
+
+        if (track_ids)
+            track_ids[j] = (i >= 0) ? bt->tracks[i].track_id : -1;
+    }
+
+    /* remove the lost tracks (keep the order of the rest) */
+    int num_tracks = 0;
+    for (int i = 0; i < bt->num_tracks; i ++)
+    {
+        if (bt->tracks[i].miss > bt->max_miss)
+            continue;
+        if (num_tracks != i)
+            bt->tracks[num_tracks] = bt->tracks[i];
+        num_tracks ++;
+    }
+    bt->num_tracks = num_tracks;
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_BOX_TRACKER_H_
+#define _UTIL_BOX_TRACKER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  SORT style multi object tracker of the detection boxes.
+ *
+ *    each track has a constant velocity Kalman filter per (cx, cy, w, h),
+ *    stepped once per frame. the noises are proportional to the box height,
+ *    so that the small and the large boxes behave alike.
+ *
+ *      every frame    : predict_box_tracker ()
+ *      detector frames: update_box_tracker ()  the detections are assigned
+ *                       to the tracks greedily by IoU (the same class only).
+ *                       the unassigned detections start new tracks, and the
+ *                       tracks missed more than (max_miss) times are removed.
+ */
+#define BOX_TRACKER_MAX_TRACK   100
+
+typedef struct _box_track_t
+{
+    int     track_id;
+    int     det_class;
+    float   score;              /* of the last assigned detection */
+    int     hits;               /* assigned detections */
+    int     miss;               /* detector runs since the last assigned detection */
+    int     age;                /* frames since the last assigned detection */
+
+    float   x[4];               /* cx, cy, w, h */
+    float   v[4];               /* per frame */
+    float   p00[4], p01[4], p11[4];
+} box_track_t;
+
+typedef struct _box_tracker_t
+{
+    float   iou_thresh;
+    int     max_miss;
+
+    int     num_tracks;
+    box_track_t tracks[BOX_TRACKER_MAX_TRACK];
+    int     next_id;
+} box_tracker_t;
+
+void init_box_tracker    (box_tracker_t *bt, float iou_thresh, int max_miss);
+void reset_box_tracker   (box_tracker_t *bt);
+
+/* advances the tracks by one frame. */
+void predict_box_tracker (box_tracker_t *bt);
+
+/*
+ *  corrects the tracks with the detections of this frame.
+ *    boxes    : [num][4] x1, y1, x2, y2
+ *    scores   : [num]
+ *    classes  : [num]
+ *    track_ids: [num] the track ID of each detection (may be NULL).
+ */
+int  update_box_tracker  (box_tracker_t *bt, const float *boxes, const float *scores,
+                          const int *classes, int num, int *track_ids);
+
+/* the box (x1, y1, x2, y2) of the track (idx) of [0, num_tracks). */
+void get_box_track_rect  (box_tracker_t *bt, int idx, float *box);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_BOX_TRACKER_H_ */
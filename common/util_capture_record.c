@@ -0,0 +1,235 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util_capture_record.h"
+#include "util_debug.h"
+
+#define ERRSTR strerror(errno)
+
+#define ALIGN_UP(x)  (((x) + CAPREC_ALIGN - 1) & ~(CAPREC_ALIGN - 1))
+
+
+/* ------------------------------------------------------------------------ *
+ *  writer
+ * ------------------------------------------------------------------------ */
+caprec_writer_t *
+caprec_open_writer (const char *fname)
+{
+    caprec_file_header_t hdr = {{0}};
+    caprec_writer_t *wr;
+    FILE *fp;
+
+    fp = fopen (fname, "w+b");
+    if (fp == NULL)
+    {
+        DBG_LOGE ("can't open %s: %s\n", fname, ERRSTR);
+        return NULL;
+    }
+
+    memcpy (hdr.magic, CAPREC_MAGIC, sizeof (hdr.magic));
+    hdr.header_size       = sizeof (caprec_file_header_t);
+    hdr.frame_header_size = sizeof (caprec_frame_t);
+    hdr.num_frames        = 0;
+    fwrite (&hdr, sizeof (hdr), 1, fp);
+
+    wr = (caprec_writer_t *)calloc (1, sizeof (caprec_writer_t));
+    wr->fp = fp;
+    wr->num_frames = 0;
+
+    return wr;
+}
+
+int
+caprec_write_frame (caprec_writer_t *wr, uint32_t pixformat, int width, int height,
+                    int64_t timestamp_us, int num_planes,
+                    void *plane[], int plane_size[], int plane_stride[])
+{
+    static const uint8_t s_zero[CAPREC_ALIGN] = {0};
+    caprec_frame_t frm = {0};
+
+    if (num_planes > CAPREC_MAX_PLANES)
+        return -1;
+
+    if (wr->num_frames == 0)
+        wr->first_timestamp_us = timestamp_us;
+
+    frm.pixformat    = pixformat;
+    frm.width        = width;
+    frm.height       = height;
+    frm.num_planes   = num_planes;
+    frm.timestamp_us = timestamp_us - wr->first_timestamp_us;
+    frm.frame_size   = sizeof (caprec_frame_t);
+
+    for (int i = 0; i < num_planes; i ++)
+    {
+        frm.plane_size  [i] = plane_size[i];
+        frm.plane_stride[i] = plane_stride[i];
+        frm.frame_size += ALIGN_UP (plane_size[i]);
+    }
+
+    fwrite (&frm, sizeof (frm), 1, wr->fp);
+    for (int i = 0; i < num_planes; i ++)
+    {
+        fwrite (plane[i], 1, plane_size[i], wr->fp);
+        fwrite (s_zero, 1, ALIGN_UP (plane_size[i]) - plane_size[i], wr->fp);
+    }
+
+    /* keep the file usable even if the app is killed. */
+    fflush (wr->fp);
+
+    wr->num_frames ++;
+    return 0;
+}
+
+int
+caprec_close_writer (caprec_writer_t *wr)
+{
+    caprec_file_header_t hdr;
+
+    /* finalize the number of frames in the header. */
+    fseek (wr->fp, 0, SEEK_SET);
+    if (fread (&hdr, sizeof (hdr), 1, wr->fp) == 1)
+    {
+        hdr.num_frames = wr->num_frames;
+        fseek (wr->fp, 0, SEEK_SET);
+        fwrite (&hdr, sizeof (hdr), 1, wr->fp);
+    }
+
+    fclose (wr->fp);
+    free (wr);
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------ *
+ *  reader
+ * ------------------------------------------------------------------------ */
+caprec_reader_t *
+caprec_open_reader (const char *fname)
+{
+    caprec_file_header_t *hdr;
+    caprec_reader_t *rd;
+    struct stat st;
+    uint8_t *addr;
+    size_t ofst;
+    int fd;
+
+    fd = open (fname, O_RDONLY);
+    if (fd < 0)
+    {
+        DBG_LOGE ("can't open %s: %s\n", fname, ERRSTR);
+        return NULL;
+    }
+
+    if (fstat (fd, &st) < 0 || (size_t)st.st_size < sizeof (caprec_file_header_t))
+    {
+        DBG_LOGE ("invalid file: %s\n", fname);
+        close (fd);
+        return NULL;
+    }
+
+    addr = (uint8_t *)mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (addr == MAP_FAILED)
+    {
+        DBG_LOGE ("mmap failed: %s\n", ERRSTR);
+        return NULL;
+    }
+
+    hdr = (caprec_file_header_t *)addr;
+    if (memcmp (hdr->magic, CAPREC_MAGIC, sizeof (hdr->magic)) != 0 ||
+        hdr->frame_header_size != sizeof (caprec_frame_t))
+    {
+        DBG_LOGE ("not a capture record file: %s\n", fname);
+        munmap (addr, st.st_size);
+        return NULL;
+    }
+
+    rd = (caprec_reader_t *)calloc (1, sizeof (caprec_reader_t));
+    rd->map_addr = addr;
+    rd->map_size = st.st_size;
+
+    /*
+     *  walk the frames to build the index. this also recovers the frames
+     *  of a recording which was not finalized, except a truncated last one.
+     */
+    uint32_t max_frames = 0;
+    ofst = hdr->header_size;
+    while (ofst + sizeof (caprec_frame_t) <= rd->map_size)
+    {
+        caprec_frame_t *frm = (caprec_frame_t *)(addr + ofst);
+        if (frm->frame_size < sizeof (caprec_frame_t) || ofst + frm->frame_size > rd->map_size)
+            break;
+        if (frm->num_planes > CAPREC_MAX_PLANES)
+        {
+            DBG_LOGW ("%s: broken frame %d (%d planes). ignored from here.\n", fname, rd->num_frames, frm->num_planes);
+            break;
+        }
+
+        if (rd->num_frames >= max_frames)
+        {
+            max_frames = max_frames ? max_frames * 2 : 256;
+            rd->frame_ofst = (size_t *)realloc (rd->frame_ofst, max_frames * sizeof (size_t));
+        }
+        rd->frame_ofst[rd->num_frames ++] = ofst;
+        ofst += frm->frame_size;
+    }
+
+    if (hdr->num_frames != 0 && hdr->num_frames != rd->num_frames)
+        DBG_LOGW ("%s: header says %d frames, found %d.\n", fname, hdr->num_frames, rd->num_frames);
+
+    if (rd->num_frames == 0)
+    {
+        DBG_LOGE ("no frames in %s\n", fname);
+        caprec_close_reader (rd);
+        return NULL;
+    }
+
+    return rd;
+}
+
+/* returns the frame header, and the pointers to its planes in (plane[]). */
+caprec_frame_t *
+caprec_get_frame (caprec_reader_t *rd, int idx, void *plane[])
+{
+    caprec_frame_t *frm;
+    uint8_t *ptr;
+
+    if (idx < 0 || (uint32_t)idx >= rd->num_frames)
+        return NULL;
+
+    frm = (caprec_frame_t *)(rd->map_addr + rd->frame_ofst[idx]);
+    ptr = (uint8_t *)frm + sizeof (caprec_frame_t);
+
+    if (frm->num_planes > CAPREC_MAX_PLANES)
+        return NULL;
+
+    if (plane)
+    {
+        for (uint32_t i = 0; i < frm->num_planes; i ++)
+        {
+            plane[i] = ptr;
+            ptr += ALIGN_UP (frm->plane_size[i]);
+        }
+    }
+
+    return frm;
+}
+
+int
+caprec_close_reader (caprec_reader_t *rd)
+{
+    munmap (rd->map_addr, rd->map_size);
+    free (rd->frame_ofst);
+    free (rd);
+    return 0;
+}
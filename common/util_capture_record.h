@@ -0,0 +1,78 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_CAPTURE_RECORD_H_
+#define _UTIL_CAPTURE_RECORD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ *  capture recording file:
+ *
+ *    +----------------------+
+ *    | caprec_file_header_t |  64 bytes
+ *    +----------------------+
+ *    | caprec_frame_t       |  64 bytes
+ *    | plane[0]             |
+ *    | plane[1] ...         |  each plane is padded to CAPREC_ALIGN
+ *    +----------------------+
+ *    | caprec_frame_t       |
+ *    | ...                  |
+ *
+ *  all the offsets are multiples of CAPREC_ALIGN, so the file can be
+ *  mmap()ed and the planes used in place.
+ */
+#define CAPREC_MAGIC        "CAPREC01"
+#define CAPREC_ALIGN        64
+#define CAPREC_MAX_PLANES   3
+
+typedef struct _caprec_file_header_t
+{
+    char     magic[8];
+    uint32_t header_size;       /* sizeof (caprec_file_header_t) */
+    uint32_t frame_header_size; /* sizeof (caprec_frame_t)       */
+    uint32_t num_frames;        /* 0: not finalized. count by walking the frames. */
+    uint32_t reserved[11];
+} caprec_file_header_t;
+
+typedef struct _caprec_frame_t
+{
+    uint32_t pixformat;         /* fourcc */
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_planes;
+    int64_t  timestamp_us;      /* relative to the first frame */
+    uint32_t frame_size;        /* header + padded planes */
+    uint32_t plane_size  [CAPREC_MAX_PLANES];
+    uint32_t plane_stride[CAPREC_MAX_PLANES];
+    uint32_t reserved[3];
+} caprec_frame_t;
+
+typedef struct _caprec_writer_t
+{
+    FILE     *fp;
+    uint32_t num_frames;
+    int64_t  first_timestamp_us;
+} caprec_writer_t;
+
+typedef struct _caprec_reader_t
+{
+    uint8_t  *map_addr;
+    size_t   map_size;
+    uint32_t num_frames;
+    size_t   *frame_ofst;       /* offset of each frame in the file */
+} caprec_reader_t;
+
+caprec_writer_t *caprec_open_writer  (const char *fname);
+int              caprec_write_frame  (caprec_writer_t *wr, uint32_t pixformat, int width, int height,
+                                      int64_t timestamp_us, int num_planes,
+                                      void *plane[], int plane_size[], int plane_stride[]);
+int              caprec_close_writer (caprec_writer_t *wr);
+
+caprec_reader_t *caprec_open_reader  (const char *fname);
+caprec_frame_t  *caprec_get_frame    (caprec_reader_t *rd, int idx, void *plane[]);
+int              caprec_close_reader (caprec_reader_t *rd);
+
+#endif /* _UTIL_CAPTURE_RECORD_H_ */
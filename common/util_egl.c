@@ -156,7 +156,7 @@ egl_init_with_pbuffer_surface (int gles_version, int depth_size, int stencil_siz
         return -1;
     }
 
-    config = find_egl_config (8, 8, 8, 8, depth_size, stencil_size, sample_num, EGL_WINDOW_BIT, gles_version);
+    config = find_egl_config (8, 8, 8, 8, depth_size, stencil_size, sample_num, EGL_PBUFFER_BIT, gles_version);
     if (ret != EGL_TRUE)
     {
         fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
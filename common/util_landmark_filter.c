@@ -0,0 +1,548 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "util_landmark_filter.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define TWO_PI              6.28318530718f
+#define DEFAULT_DT          (1.0f / 30.0f)
+#define KALMAN_INIT_VAR_V   1.0f        /* velocity variance of a new track */
+
+
+void
+init_landmark_filter_param (landmark_filter_param_t *param, int type)
+{
+    memset (param, 0, sizeof (*param));
+    param->type          = type;
+    param->min_cutoff    = 1.0f;
+    param->beta          = 10.0f;
+    param->d_cutoff      = 1.0f;
+    param->process_noise = 0.01f;
+    param->measure_noise = 1e-5f;
+    param->iou_thresh    = 0.3f;
+    param->dist_thresh   = 0.5f;
+    param->max_miss      = 2;
+}
+
+int
+init_landmark_filter (landmark_filter_t *lf, int num_values, const landmark_filter_param_t *param)
+{
+    memset (lf, 0, sizeof (*lf));
+    lf->param      = *param;
+    lf->num_values = num_values;
+
+    lf->buf = (float *)malloc (LANDMARK_FILTER_MAX_TRACK * 2 * num_values * sizeof (float));
+    if (lf->buf == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    for (int i = 0; i < LANDMARK_FILTER_MAX_TRACK; i ++)
+    {
+        lf->tracks[i].x  = &lf->buf[(2 * i + 0) * num_values];
+        lf->tracks[i].dx = &lf->buf[(2 * i + 1) * num_values];
+    }
+
+    return 0;
+}
+
+int
+exit_landmark_filter (landmark_filter_t *lf)
+{
+    if (lf->buf)
+        free (lf->buf);
+
+    lf->buf        = NULL;
+    lf->num_tracks = 0;
+
+    return 0;
+}
+
+void
+reset_landmark_filter (landmark_filter_t *lf)
+{
+    lf->num_tracks = 0;
+}
+
+void
+calc_landmark_bbox (const float *pts, int num_pts, int stride, float *box)
+{
+    box[0] = box[2] = pts[0];
+    box[1] = box[3] = pts[1];
+
+    for (int i = 1; i < num_pts; i ++)
+    {
+        const float *p = &pts[i * stride];
+        if (p[0] < box[0]) box[0] = p[0];
+        if (p[1] < box[1]) box[1] = p[1];
+        if (p[0] > box[2]) box[2] = p[0];
+        if (p[1] > box[3]) box[3] = p[1];
+    }
+}
+
+
+/* -------------------------------------------------- *
+ *  track association
+ * -------------------------------------------------- */
+static float
+calc_iou (const float *a, const float *b)
+{
+    float x1 = fmaxf (a[0], b[0]);
+    float y1 = fmaxf (a[1], b[1]);
+    float x2 = fminf (a[2], b[2]);
+    float y2 = fminf (a[3], b[3]);
+    float inter = fmaxf (x2 - x1, 0.0f) * fmaxf (y2 - y1, 0.0f);
+    float area_a = (a[2] - a[0]) * (a[3] - a[1]);
+    float area_b = (b[2] - b[0]) * (b[3] - b[1]);
+    float uni = area_a + area_b - inter;
+
+    return (uni > 0.0f) ? inter / uni : 0.0f;
+}
+
+/* centroid distance relative to the size of the track box */
+static float
+calc_rel_dist (const float *trk, const float *obs)
+{
+    float dx = (trk[0] + trk[2] - obs[0] - obs[2]) * 0.5f;
+    float dy = (trk[1] + trk[3] - obs[1] - obs[3]) * 0.5f;
+    float size = fmaxf (trk[2] - trk[0], trk[3] - trk[1]);
+
+    if (size <= 0.0f)
+        return FLT_MAX;
+    return sqrtf (dx * dx + dy * dy) / size;
+}
+
+/*
+ *  greedy matching: the pair of the highest IoU first, then the nearest
+ *  centroids for the objects left.  match[obs] = track index or -1.
+ */
+static void
+associate_tracks (landmark_filter_t *lf, const float *boxes, int num, int *match)
+{
+    int used[LANDMARK_FILTER_MAX_TRACK] = {0};
+
+    for (int j = 0; j < num; j ++)
+        match[j] = -1;
+
+    for (;;)
+    {
+        float best = lf->param.iou_thresh;
+        int   bi = -1, bj = -1;
+
+        for (int j = 0; j < num; j ++)
+        {
+            if (match[j] >= 0)
+                continue;
+            for (int i = 0; i < lf->num_tracks; i ++)
+            {
+                if (used[i])
+                    continue;
+                float iou = calc_iou (lf->tracks[i].box, &boxes[4 * j]);
+                if (iou >= best)
+                {
+                    best = iou;
+                    bi = i;
+                    bj = j;
+                }
+            }
+        }
+        if (bi < 0)
+            break;
+
+        match[bj] = bi;
+        used[bi]  = 1;
+    }
+
+    for (;;)
+    {
+        float best = lf->param.dist_thresh;
+        int   bi = -1, bj = -1;
+
+        for (int j = 0; j < num; j ++)
+        {
+            if (match[j] >= 0)
+                continue;
+            for (int i = 0; i < lf->num_tracks; i ++)
+            {
+                if (used[i])
+                    continue;
+                float dist = calc_rel_dist (lf->tracks[i].box, &boxes[4 * j]);
+                if (dist < best)
+                {
+                    best = dist;
+                    bi = i;
+                    bj = j;
+                }
+            }
+        }
+        if (bi < 0)
+            break;
+
+        match[bj] = bi;
+        used[bi]  = 1;
+    }
+}
+
+
+/* -------------------------------------------------- *
+ *  filters (x, dx: the state,  z: observation in, filtered value out)
+ * -------------------------------------------------- */
+static void
+update_one_euro (const landmark_filter_param_t *param, float *x, float *dx, float *z, int num, float dt)
+{
+    float rate = 1.0f / dt;
+    float te   = TWO_PI * param->d_cutoff;
+    float ad   = te / (te + rate);              /* alpha of the speed */
+    float tmin = TWO_PI * param->min_cutoff;
+    float tb   = TWO_PI * param->beta;
+    int i = 0;
+
+    /*
+     *  d   = (z - x) * rate
+     *  dx  = dx + ad * (d - dx)
+     *  t   = 2PI * (min_cutoff + beta * |dx|)
+     *  x   = x + t / (t + rate) * (z - x)
+     */
+#if defined (__SSE2__)
+    __m128 vrate = _mm_set1_ps (rate);
+    __m128 vad   = _mm_set1_ps (ad);
+    __m128 vtmin = _mm_set1_ps (tmin);
+    __m128 vtb   = _mm_set1_ps (tb);
+    __m128 vabs  = _mm_castsi128_ps (_mm_set1_epi32 (0x7FFFFFFF));
+
+    for (; i + 4 <= num; i += 4)
+    {
+        __m128 vx  = _mm_loadu_ps (&x[i]);
+        __m128 vdx = _mm_loadu_ps (&dx[i]);
+        __m128 vdz = _mm_sub_ps (_mm_loadu_ps (&z[i]), vx);
+        __m128 vd  = _mm_mul_ps (vdz, vrate);
+
+        vdx = _mm_add_ps (vdx, _mm_mul_ps (vad, _mm_sub_ps (vd, vdx)));
+        __m128 vt = _mm_add_ps (vtmin, _mm_mul_ps (vtb, _mm_and_ps (vdx, vabs)));
+        __m128 va = _mm_div_ps (vt, _mm_add_ps (vt, vrate));
+        vx = _mm_add_ps (vx, _mm_mul_ps (va, vdz));
+
+        _mm_storeu_ps (&x[i],  vx);
+        _mm_storeu_ps (&dx[i], vdx);
+        _mm_storeu_ps (&z[i],  vx);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t vrate = vdupq_n_f32 (rate);
+    float32x4_t vad   = vdupq_n_f32 (ad);
+    float32x4_t vtmin = vdupq_n_f32 (tmin);
+    float32x4_t vtb   = vdupq_n_f32 (tb);
+
+    for (; i + 4 <= num; i += 4)
+    {
+        float32x4_t vx  = vld1q_f32 (&x[i]);
+        float32x4_t vdx = vld1q_f32 (&dx[i]);
+        float32x4_t vdz = vsubq_f32 (vld1q_f32 (&z[i]), vx);
+        float32x4_t vd  = vmulq_f32 (vdz, vrate);
+
+        vdx = vmlaq_f32 (vdx, vad, vsubq_f32 (vd, vdx));
+        float32x4_t vt  = vmlaq_f32 (vtmin, vtb, vabsq_f32 (vdx));
+        float32x4_t den = vaddq_f32 (vt, vrate);
+#if defined (__aarch64__)
+        float32x4_t va  = vdivq_f32 (vt, den);
+#else
+        float32x4_t inv = vrecpeq_f32 (den);
+        inv = vmulq_f32 (inv, vrecpsq_f32 (den, inv));
+        inv = vmulq_f32 (inv, vrecpsq_f32 (den, inv));
+        float32x4_t va  = vmulq_f32 (vt, inv);
+#endif
+        vx = vmlaq_f32 (vx, va, vdz);
+
+        vst1q_f32 (&x[i],  vx);
+        vst1q_f32 (&dx[i], vdx);
+        vst1q_f32 (&z[i],  vx);
+    }
+#endif
+
+    for (; i < num; i ++)
+    {
+        float dz = z[i] - x[i];
+        dx[i] += ad * (dz * rate - dx[i]);
+        float t = tmin + tb * fabsf (dx[i]);
+        x[i] += t / (t + rate) * dz;
+        z[i]  = x[i];
+    }
+}
+
+static void
+update_kalman (const landmark_filter_param_t *param, landmark_track_t *trk, float *z, int num, float dt)
+{
+    float *x = trk->x;
+    float *v = trk->dx;
+    float q  = param->process_noise;
+    float r  = param->measure_noise;
+    int i = 0;
+
+    /* predict: P = F P F' + Q  (white noise acceleration) */
+    float p00 = trk->p00 + dt * (2.0f * trk->p01 + dt * trk->p11) + q * dt * dt * dt / 3.0f;
+    float p01 = trk->p01 + dt * trk->p11 + q * dt * dt / 2.0f;
+    float p11 = trk->p11 + q * dt;
+
+    /* update: the gains are the same for all the values. */
+    float s  = p00 + r;
+    float k0 = p00 / s;
+    float k1 = p01 / s;
+
+    trk->p00 = (1.0f - k0) * p00;
+    trk->p01 = (1.0f - k0) * p01;
+    trk->p11 = p11 - k1 * p01;
+
+    /*
+     *  xp = x + v * dt
+     *  e  = z - xp
+     *  x  = xp + k0 * e
+     *  v  = v  + k1 * e
+     */
+#if defined (__SSE2__)
+    __m128 vdt = _mm_set1_ps (dt);
+    __m128 vk0 = _mm_set1_ps (k0);
+    __m128 vk1 = _mm_set1_ps (k1);
+
+    for (; i + 4 <= num; i += 4)
+    {
+        __m128 vv  = _mm_loadu_ps (&v[i]);
+        __m128 vxp = _mm_add_ps (_mm_loadu_ps (&x[i]), _mm_mul_ps (vv, vdt));
+        __m128 ve  = _mm_sub_ps (_mm_loadu_ps (&z[i]), vxp);
+        __m128 vx  = _mm_add_ps (vxp, _mm_mul_ps (vk0, ve));
+
+        _mm_storeu_ps (&x[i], vx);
+        _mm_storeu_ps (&v[i], _mm_add_ps (vv, _mm_mul_ps (vk1, ve)));
+        _mm_storeu_ps (&z[i], vx);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t vdt = vdupq_n_f32 (dt);
+    float32x4_t vk0 = vdupq_n_f32 (k0);
+    float32x4_t vk1 = vdupq_n_f32 (k1);
+
+    for (; i + 4 <= num; i += 4)
+    {
+        float32x4_t vv  = vld1q_f32 (&v[i]);
+        float32x4_t vxp = vmlaq_f32 (vld1q_f32 (&x[i]), vv, vdt);
+        float32x4_t ve  = vsubq_f32 (vld1q_f32 (&z[i]), vxp);
+        float32x4_t vx  = vmlaq_f32 (vxp, vk0, ve);
+
+        vst1q_f32 (&x[i], vx);
+        vst1q_f32 (&v[i], vmlaq_f32 (vv, vk1, ve));
+        vst1q_f32 (&z[i], vx);
+    }
+#endif
+
+    for (; i < num; i ++)
+    {
+        float xp = x[i] + v[i] * dt;
+        float e  = z[i] - xp;
+        x[i] = xp + k0 * e;
+        v[i] = v[i] + k1 * e;
+        z[i] = x[i];
+    }
+}
+
+static void
+start_track (landmark_filter_t *lf, landmark_track_t *trk, const float *z)
+{
+    int nv = lf->num_values;
+
+    memcpy (trk->x, z, nv * sizeof (float));
+    memset (trk->dx, 0, nv * sizeof (float));
+
+    trk->track_id = lf->next_id ++;
+    trk->p00 = lf->param.measure_noise;
+    trk->p01 = 0.0f;
+    trk->p11 = KALMAN_INIT_VAR_V;
+}
+
+
+int
+apply_landmark_filter (landmark_filter_t *lf, float *values, const float *boxes,
+                       int num, double time_ms, int *track_ids)
+{
+    int match[LANDMARK_FILTER_MAX_TRACK];
+    int observed[LANDMARK_FILTER_MAX_TRACK] = {0};
+    int nv = lf->num_values;
+
+    if (num > LANDMARK_FILTER_MAX_TRACK)
+        num = LANDMARK_FILTER_MAX_TRACK;
+
+    if (lf->param.type == LANDMARK_FILTER_NONE)
+    {
+        if (track_ids)
+        {
+            for (int j = 0; j < num; j ++)
+                track_ids[j] = -1;
+        }
+        return 0;
+    }
+
+    associate_tracks (lf, boxes, num, match);
+
+    for (int j = 0; j < num; j ++)
+    {
+        float *z = &values[j * nv];
+        landmark_track_t *trk;
+
+        if (match[j] >= 0)
+        {
+            trk = &lf->tracks[match[j]];
+
+            float dt = (float)((time_ms - trk->time_ms) / 1000.0);
+            if (dt <= 0.0f)
+                dt = DEFAULT_DT;
+
+            if (lf->param.type == LANDMARK_FILTER_KALMAN)
+                update_kalman (&lf->param, trk, z, nv, dt);
+            else
+                update_one_euro (&lf->param, trk->x, trk->dx, z, nv, dt);
+
+            observed[match[j]] = 1;
+        }
+        else if (lf->num_tracks < LANDMARK_FILTER_MAX_TRACK)
+        {
+            observed[lf->num_tracks] = 1;
+            trk = &lf->tracks[lf->num_tracks ++];
+            start_track (lf, trk, z);
+        }
+        else
+        {
+            /* no room for a new track. pass through. */
+            if (track_ids)
+                track_ids[j] = -1;
+            continue;
+        }
+
+        memcpy (trk->box, &boxes[4 * j], 4 * sizeof (float));
+        trk->time_ms = time_ms;
+        trk->miss    = 0;
+
+        if (track_ids)
+            track_ids[j] = trk->track_id;
+    }
+
+    /* drop the tracks lost for a while. (swap, so that each slot keeps its buffers) */
+    for (int i = lf->num_tracks - 1; i >= 0; i --)
+    {
+        if (observed[i])
+            continue;
+
+        if (++ lf->tracks[i].miss > lf->param.max_miss)
+        {
+            landmark_track_t tmp = lf->tracks[i];
+            lf->tracks[i] = lf->tracks[lf->num_tracks - 1];
+            lf->tracks[lf->num_tracks - 1] = tmp;
+            lf->num_tracks --;
+        }
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------- *
+ *  helpers of the apps
+ * -------------------------------------------------- */
+int
+parse_landmark_filter_type (const char *str)
+{
+    char *end;
+    long type = strtol (str, &end, 10);
+
+    if (end == str || *end != '\0' || type < LANDMARK_FILTER_NONE || type > LANDMARK_FILTER_KALMAN)
+    {
+        fprintf (stderr, "unknown filter type: %s (0: off, 1: One-Euro, 2: Kalman)\n", str);
+        return -1;
+    }
+
+    return (int)type;
+}
+
+int
+set_landmark_filter (landmark_filter_t *lf, int type, int num_values)
+{
+    landmark_filter_param_t param;
+
+    if (type < LANDMARK_FILTER_NONE || type > LANDMARK_FILTER_KALMAN)
+    {
+        fprintf (stderr, "ERR: %s(%d): unknown filter type %d\n", __FILE__, __LINE__, type);
+        return -1;
+    }
+
+    exit_landmark_filter (lf);
+
+    if (type == LANDMARK_FILTER_NONE)
+        return 0;
+
+    init_landmark_filter_param (&param, type);
+    return init_landmark_filter (lf, num_values, &param);
+}
+
+int
+is_landmark_filter_enabled (landmark_filter_t *lf)
+{
+    return (lf->buf != NULL && lf->param.type != LANDMARK_FILTER_NONE);
+}
+
+int
+filter_landmark_points (landmark_filter_t *lf, float *pts, int num, int num_pts, int stride,
+                        const unsigned char *valid, double time_ms)
+{
+    float boxes[LANDMARK_FILTER_MAX_TRACK][4];
+    int   nv = num_pts * stride;
+
+    if (!is_landmark_filter_enabled (lf))
+        return 0;
+
+    if (nv != lf->num_values)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    if (num > LANDMARK_FILTER_MAX_TRACK)
+        num = LANDMARK_FILTER_MAX_TRACK;
+
+    for (int n = 0; n < num; n ++)
+    {
+        const float         *p = &pts[n * nv];
+        const unsigned char *v = valid ? &valid[n * num_pts] : NULL;
+        float *box = boxes[n];
+        int   found = 0;            /* valid points */
+
+        for (int i = 0; i < num_pts; i ++, p += stride)
+        {
+            if (v && !v[i])
+                continue;
+
+            if (found ++ == 0)
+            {
+                box[0] = box[2] = p[0];
+                box[1] = box[3] = p[1];
+                continue;
+            }
+            if (p[0] < box[0]) box[0] = p[0];
+            if (p[1] < box[1]) box[1] = p[1];
+            if (p[0] > box[2]) box[2] = p[0];
+            if (p[1] > box[3]) box[3] = p[1];
+        }
+
+        /* too few to make a box to track. the box of all the points. */
+        if (found < 2)
+            calc_landmark_bbox (&pts[n * nv], num_pts, stride, box);
+    }
+
+    return apply_landmark_filter (lf, pts, &boxes[0][0], num, time_ms, NULL);
+}
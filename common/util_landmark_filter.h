@@ -0,0 +1,120 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_LANDMARK_FILTER_H_
+#define _UTIL_LANDMARK_FILTER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  temporal filter of the landmarks (keypoints, joints, mesh vertices).
+ *
+ *    each object (a face, a hand, a pose, ...) is a vector of (num_values)
+ *    floats, and its bounding box. the boxes are associated with the tracks
+ *    of the last update by IoU (or by the centroid distance when they don't
+ *    overlap), and the values of each track are filtered in place.
+ *
+ *      One-Euro: low pass filter whose cutoff rises with the speed.
+ *                (min_cutoff: jitter at rest, beta: lag in motion)
+ *      Kalman  : constant velocity model per value. the covariance depends
+ *                only on the time steps, so it is shared by all the values
+ *                of a track, and the gains are scalars.
+ *
+ *    the state is SoA ([num_values] per track), and all the values of a
+ *    track are updated 4 at a time.
+ */
+#define LANDMARK_FILTER_MAX_TRACK   16
+
+enum landmark_filter_type {
+    LANDMARK_FILTER_NONE = 0,
+    LANDMARK_FILTER_ONE_EURO,
+    LANDMARK_FILTER_KALMAN,
+};
+
+typedef struct _landmark_filter_param_t
+{
+    int     type;               /* enum landmark_filter_type */
+
+    /* One-Euro */
+    float   min_cutoff;         /* [Hz] cutoff at rest */
+    float   beta;               /* cutoff increase per speed [1/s] */
+    float   d_cutoff;           /* [Hz] cutoff of the speed */
+
+    /* Kalman */
+    float   process_noise;      /* acceleration noise density */
+    float   measure_noise;      /* variance of the observation */
+
+    /* track association */
+    float   iou_thresh;         /* min IoU to continue a track */
+    float   dist_thresh;        /* or max centroid distance, relative to the box size */
+    int     max_miss;           /* updates a track survives without an observation */
+} landmark_filter_param_t;
+
+typedef struct _landmark_track_t
+{
+    int     track_id;
+    int     miss;               /* updates since the last observation */
+    double  time_ms;            /* of the last observation */
+    float   box[4];             /* x1, y1, x2, y2 of the last observation */
+    float   p00, p01, p11;      /* Kalman covariance */
+    float   *x;                 /* [num_values] filtered value */
+    float   *dx;                /* [num_values] One-Euro: filtered speed, Kalman: velocity */
+} landmark_track_t;
+
+typedef struct _landmark_filter_t
+{
+    landmark_filter_param_t param;
+    int     num_values;
+
+    int     num_tracks;
+    landmark_track_t tracks[LANDMARK_FILTER_MAX_TRACK];
+    int     next_id;
+
+    float   *buf;               /* [LANDMARK_FILTER_MAX_TRACK][2][num_values] */
+} landmark_filter_t;
+
+/* the defaults for the image normalized [0, 1] coordinates. */
+void init_landmark_filter_param (landmark_filter_param_t *param, int type);
+
+int  init_landmark_filter  (landmark_filter_t *lf, int num_values, const landmark_filter_param_t *param);
+int  exit_landmark_filter  (landmark_filter_t *lf);
+void reset_landmark_filter (landmark_filter_t *lf);
+
+/*
+ *  filters (num) objects observed at (time_ms).
+ *    values   : [num][num_values], filtered in place.
+ *    boxes    : [num][4] x1, y1, x2, y2.
+ *    track_ids: [num] the track ID of each object (may be NULL).
+ */
+int  apply_landmark_filter (landmark_filter_t *lf, float *values, const float *boxes,
+                            int num, double time_ms, int *track_ids);
+
+/* bounding box of (num_pts) points of (stride) floats, {x, y, ...}. */
+void calc_landmark_bbox (const float *pts, int num_pts, int stride, float *box);
+
+/*
+ *  the common use by the apps, with the filter of an object vector of points.
+ *
+ *    parse_landmark_filter_type: of the command line. -1 if it is not a type.
+ *    set_landmark_filter       : (re)initializes the filter with (type).
+ *                                LANDMARK_FILTER_NONE frees it.
+ *    filter_landmark_points    : filters (num) objects of (num_pts) points of
+ *                                (stride) floats, in place. the box of each
+ *                                object is of its points whose (valid) is not 0
+ *                                (of all the points, if less than 2 are valid).
+ *                                  valid: [num][num_pts] (may be NULL: all)
+ */
+int  parse_landmark_filter_type (const char *str);
+int  set_landmark_filter        (landmark_filter_t *lf, int type, int num_values);
+int  is_landmark_filter_enabled (landmark_filter_t *lf);
+int  filter_landmark_points     (landmark_filter_t *lf, float *pts, int num, int num_pts, int stride,
+                                 const unsigned char *valid, double time_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_LANDMARK_FILTER_H_ */
@@ -0,0 +1,248 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util_motion_gate.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+
+int
+init_motion_gate (motion_gate_t *gate, float thresh, int max_stale)
+{
+    memset (gate, 0, sizeof (*gate));
+    gate->thresh    = thresh;
+    gate->max_stale = max_stale;
+
+    return 0;
+}
+
+int
+exit_motion_gate (motion_gate_t *gate)
+{
+    if (gate->thumb_ref)
+        free (gate->thumb_ref);
+    if (gate->thumb_cur)
+        free (gate->thumb_cur);
+    if (gate->row_sum)
+        free (gate->row_sum);
+
+    gate->thumb_ref = NULL;
+    gate->thumb_cur = NULL;
+    gate->row_sum   = NULL;
+    gate->valid     = 0;
+
+    return 0;
+}
+
+void
+reset_motion_gate (motion_gate_t *gate)
+{
+    gate->valid = 0;
+}
+
+static int
+alloc_thumbnail (motion_gate_t *gate, int w, int h)
+{
+    int block = (w / MOTION_GATE_THUMB_W) & ~3;
+    if (block < 4)
+        block = 4;
+
+    exit_motion_gate (gate);
+
+    gate->img_w   = w;
+    gate->img_h   = h;
+    gate->block   = block;
+    gate->thumb_w = w / block;
+    gate->thumb_h = h / block;
+
+    if (gate->thumb_w <= 0 || gate->thumb_h <= 0)
+    {
+        fprintf (stderr, "ERR: %s(%d): image too small (%dx%d)\n", __FILE__, __LINE__, w, h);
+        return -1;
+    }
+
+    gate->thumb_ref = (uint8_t *)malloc (gate->thumb_w * gate->thumb_h);
+    gate->thumb_cur = (uint8_t *)malloc (gate->thumb_w * gate->thumb_h);
+    gate->row_sum   = (uint32_t *)malloc (gate->thumb_w * sizeof (uint32_t));
+    if (gate->thumb_ref == NULL || gate->thumb_cur == NULL || gate->row_sum == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        exit_motion_gate (gate);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* R + G + B of (num) RGBA pixels. (num) is a multiple of 4. */
+static uint32_t
+sum_rgb (const uint8_t *p, int num)
+{
+    uint32_t sum = 0;
+    int i = 0;
+
+#if defined (__SSE2__)
+    __m128i mask = _mm_set1_epi32 (0x00FFFFFF);     /* drop alpha */
+    __m128i zero = _mm_setzero_si128 ();
+    __m128i acc  = _mm_setzero_si128 ();
+
+    for (; i < num; i += 4)
+    {
+        __m128i v = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *)p), mask);
+        acc = _mm_add_epi64 (acc, _mm_sad_epu8 (v, zero));
+        p += 16;
+    }
+    sum = _mm_cvtsi128_si32 (acc) + _mm_cvtsi128_si32 (_mm_srli_si128 (acc, 8));
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    uint8x16_t mask = vreinterpretq_u8_u32 (vdupq_n_u32 (0x00FFFFFF));
+    uint32x4_t acc  = vdupq_n_u32 (0);
+
+    for (; i < num; i += 4)
+    {
+        uint8x16_t v = vandq_u8 (vld1q_u8 (p), mask);
+        acc = vpadalq_u16 (acc, vpaddlq_u8 (v));
+        p += 16;
+    }
+    uint64x2_t acc2 = vpaddlq_u32 (acc);
+    sum = (uint32_t)(vgetq_lane_u64 (acc2, 0) + vgetq_lane_u64 (acc2, 1));
+#endif
+
+    for (; i < num; i ++)
+    {
+        sum += p[0] + p[1] + p[2];
+        p += 4;
+    }
+
+    return sum;
+}
+
+static void
+make_thumbnail (motion_gate_t *gate, const uint8_t *rgba)
+{
+    int block   = gate->block;
+    int thumb_w = gate->thumb_w;
+    int stride  = gate->img_w * 4;
+    uint32_t *sum = gate->row_sum;
+    uint32_t div = block * block * 3;
+
+    for (int ty = 0; ty < gate->thumb_h; ty ++)
+    {
+        memset (sum, 0, thumb_w * sizeof (uint32_t));
+
+        for (int y = 0; y < block; y ++)
+        {
+            const uint8_t *row = rgba + (ty * block + y) * stride;
+
+            for (int tx = 0; tx < thumb_w; tx ++)
+                sum[tx] += sum_rgb (row + tx * block * 4, block);
+        }
+
+        uint8_t *dst = gate->thumb_cur + ty * thumb_w;
+        for (int tx = 0; tx < thumb_w; tx ++)
+            dst[tx] = (uint8_t)(sum[tx] / div);
+    }
+}
+
+static uint32_t
+calc_sad (const uint8_t *a, const uint8_t *b, int num)
+{
+    uint32_t sad = 0;
+    int i = 0;
+
+#if defined (__SSE2__)
+    __m128i acc = _mm_setzero_si128 ();
+
+    for (; i + 16 <= num; i += 16)
+    {
+        __m128i va = _mm_loadu_si128 ((const __m128i *)&a[i]);
+        __m128i vb = _mm_loadu_si128 ((const __m128i *)&b[i]);
+        acc = _mm_add_epi64 (acc, _mm_sad_epu8 (va, vb));
+    }
+    sad = _mm_cvtsi128_si32 (acc) + _mm_cvtsi128_si32 (_mm_srli_si128 (acc, 8));
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    uint32x4_t acc = vdupq_n_u32 (0);
+
+    for (; i + 16 <= num; i += 16)
+    {
+        uint8x16_t d = vabdq_u8 (vld1q_u8 (&a[i]), vld1q_u8 (&b[i]));
+        acc = vpadalq_u16 (acc, vpaddlq_u8 (d));
+    }
+    uint64x2_t acc2 = vpaddlq_u32 (acc);
+    sad = (uint32_t)(vgetq_lane_u64 (acc2, 0) + vgetq_lane_u64 (acc2, 1));
+#endif
+
+    for (; i < num; i ++)
+        sad += abs ((int)a[i] - (int)b[i]);
+
+    return sad;
+}
+
+
+int
+check_motion_gate (motion_gate_t *gate, const uint8_t *rgba, int w, int h)
+{
+    int run = 1;
+
+    if (gate->thresh <= 0.0f)
+    {
+        gate->num_run ++;
+        return 1;
+    }
+
+    if (gate->img_w != w || gate->img_h != h || gate->thumb_ref == NULL)
+    {
+        if (alloc_thumbnail (gate, w, h) < 0)
+        {
+            gate->num_run ++;
+            return 1;
+        }
+    }
+
+    make_thumbnail (gate, rgba);
+
+    if (gate->valid)
+    {
+        int num = gate->thumb_w * gate->thumb_h;
+        gate->last_diff = (float)calc_sad (gate->thumb_cur, gate->thumb_ref, num) / (float)num;
+
+        run = (gate->last_diff >= gate->thresh) ||
+              (gate->max_stale > 0 && gate->num_stale >= gate->max_stale);
+    }
+
+    if (run)
+    {
+        /* this frame is the new reference. */
+        uint8_t *tmp = gate->thumb_ref;
+        gate->thumb_ref = gate->thumb_cur;
+        gate->thumb_cur = tmp;
+        gate->valid     = 1;
+        gate->num_stale = 0;
+        gate->num_run ++;
+    }
+    else
+    {
+        gate->num_stale ++;
+        gate->num_skip ++;
+    }
+
+    return run;
+}
+
+float
+get_motion_gate_skip_rate (motion_gate_t *gate)
+{
+    int num_frames = gate->num_run + gate->num_skip;
+
+    if (num_frames == 0)
+        return 0.0f;
+    return (float)gate->num_skip / (float)num_frames;
+}
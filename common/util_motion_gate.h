@@ -0,0 +1,68 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_MOTION_GATE_H_
+#define _UTIL_MOTION_GATE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  change detector of the input frames, to reuse the last model output on
+ *  static scenes.
+ *
+ *    the RGBA input image is reduced to a small luma thumbnail (the mean of
+ *    R, G, B of each block), and compared with the thumbnail of the frame the
+ *    model ran last (not the previous frame, so that slow changes add up).
+ *
+ *    diff = sum of the absolute differences / number of the thumbnail pixels,
+ *           in [0, 255].
+ *
+ *    the model should run when
+ *      - diff >= thresh, or
+ *      - the last output has been reused for (max_stale) frames, or
+ *      - it is the first frame (or the size changed, or reset_motion_gate()).
+ *
+ *    thresh <= 0   : run on every frame.
+ *    max_stale <= 0: no limit of the staleness.
+ */
+#define MOTION_GATE_THUMB_W  64     /* approximate width of the thumbnail */
+
+typedef struct _motion_gate_t
+{
+    float       thresh;
+    int         max_stale;
+
+    int         img_w, img_h;       /* input image */
+    int         block;              /* block size of the thumbnail, multiple of 4 */
+    int         thumb_w, thumb_h;
+    uint8_t     *thumb_ref;         /* the frame the model ran last */
+    uint8_t     *thumb_cur;
+    uint32_t    *row_sum;           /* work buffer [thumb_w] */
+    int         valid;
+
+    /* stats */
+    int         num_stale;          /* frames since the model ran last */
+    int         num_run;
+    int         num_skip;
+    float       last_diff;
+} motion_gate_t;
+
+int   init_motion_gate  (motion_gate_t *gate, float thresh, int max_stale);
+int   exit_motion_gate  (motion_gate_t *gate);
+void  reset_motion_gate (motion_gate_t *gate);
+
+/* returns 1 when the model should run on (rgba), 0 to reuse the last output. */
+int   check_motion_gate (motion_gate_t *gate, const uint8_t *rgba, int w, int h);
+
+float get_motion_gate_skip_rate (motion_gate_t *gate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_MOTION_GATE_H_ */
@@ -0,0 +1,685 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "util_nms.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define NMS_GRID_MAX_DIM        64
+#define NMS_GRID_MIN_CANDIDATES 512
+#define NMS_GRID_MIN_SELECTED   128
+
+#define _max(A, B)    ((A) > (B) ? (A) : (B))
+#define _min(A, B)    ((A) < (B) ? (A) : (B))
+
+
+int
+init_nms (nms_context_t *nms, int capacity)
+{
+    memset (nms, 0, sizeof (*nms));
+
+    nms->capacity  = capacity;
+    nms->grid_mode = NMS_GRID_AUTO;
+
+    nms->x1         = (float *)malloc (capacity * sizeof (float));
+    nms->y1         = (float *)malloc (capacity * sizeof (float));
+    nms->x2         = (float *)malloc (capacity * sizeof (float));
+    nms->y2         = (float *)malloc (capacity * sizeof (float));
+    nms->score      = (float *)malloc (capacity * sizeof (float));
+    nms->area       = (float *)malloc (capacity * sizeof (float));
+    nms->order      = (int *)  malloc (capacity * sizeof (int));
+    nms->sel_idx    = (int *)  malloc (capacity * sizeof (int));
+    nms->sort_buf   =          malloc (capacity * sizeof (float) * 2);
+
+    /* +3: padding for the 4-wide IoU test */
+    nms->sel_x1     = (float *)malloc ((capacity + 3) * sizeof (float));
+    nms->sel_y1     = (float *)malloc ((capacity + 3) * sizeof (float));
+    nms->sel_x2     = (float *)malloc ((capacity + 3) * sizeof (float));
+    nms->sel_y2     = (float *)malloc ((capacity + 3) * sizeof (float));
+    nms->sel_area   = (float *)malloc ((capacity + 3) * sizeof (float));
+
+    nms->max_cells   = NMS_GRID_MAX_DIM * NMS_GRID_MAX_DIM;
+    nms->max_entries = capacity * 4;
+    nms->cell_head   = (int *)malloc (nms->max_cells   * sizeof (int));
+    nms->entry_next  = (int *)malloc (nms->max_entries * sizeof (int));
+    nms->entry_sel   = (int *)malloc (nms->max_entries * sizeof (int));
+
+    if (!nms->x1 || !nms->y1 || !nms->x2 || !nms->y2 || !nms->score || !nms->area ||
+        !nms->order || !nms->sel_idx || !nms->sort_buf || !nms->sel_x1 || !nms->sel_y1 || !nms->sel_x2 ||
+        !nms->sel_y2 || !nms->sel_area || !nms->cell_head || !nms->entry_next || !nms->entry_sel)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        exit_nms (nms);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+exit_nms (nms_context_t *nms)
+{
+    free (nms->x1);
+    free (nms->y1);
+    free (nms->x2);
+    free (nms->y2);
+    free (nms->score);
+    free (nms->area);
+    free (nms->order);
+    free (nms->sel_idx);
+    free (nms->sort_buf);
+    free (nms->sel_x1);
+    free (nms->sel_y1);
+    free (nms->sel_x2);
+    free (nms->sel_y2);
+    free (nms->sel_area);
+    free (nms->cell_head);
+    free (nms->entry_next);
+    free (nms->entry_sel);
+    memset (nms, 0, sizeof (*nms));
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  sort once: descending score, ties keep the input order.
+ * -------------------------------------------------------------------- */
+typedef struct _score_idx_t
+{
+    float score;
+    int   idx;
+} score_idx_t;
+
+static int
+compare_score_idx (const void *a, const void *b)
+{
+    const score_idx_t *s0 = (const score_idx_t *)a;
+    const score_idx_t *s1 = (const score_idx_t *)b;
+
+    if (s0->score > s1->score) return -1;
+    if (s0->score < s1->score) return  1;
+    return s0->idx - s1->idx;
+}
+
+static void
+sort_candidates (nms_context_t *nms)
+{
+    int num = nms->num;
+    score_idx_t *buf = (score_idx_t *)nms->sort_buf;
+
+    for (int i = 0; i < num; i ++)
+    {
+        buf[i].score = nms->score[i];
+        buf[i].idx   = i;
+
+        nms->area[i] = (nms->x2[i] - nms->x1[i]) * (nms->y2[i] - nms->y1[i]);
+    }
+
+    qsort (buf, num, sizeof (score_idx_t), compare_score_idx);
+
+    for (int i = 0; i < num; i ++)
+        nms->order[i] = buf[i].idx;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  IoU test
+ *
+ *    IoU >= t  <==>  inter * (1 + t) >= t * (area0 + area1)
+ *
+ *  boxes with zero area never overlap (IoU is defined as 0).
+ * -------------------------------------------------------------------- */
+static inline int
+is_overlapped (float ax1, float ay1, float ax2, float ay2, float aarea,
+               float bx1, float by1, float bx2, float by2, float barea, float thresh)
+{
+    if (aarea <= 0.0f || barea <= 0.0f)
+        return 0;
+
+    float iw = _min (ax2, bx2) - _max (ax1, bx1);
+    float ih = _min (ay2, by2) - _max (ay1, by1);
+    float inter = _max (iw, 0.0f) * _max (ih, 0.0f);
+
+    return (inter * (1.0f + thresh) >= thresh * (aarea + barea));
+}
+
+/* test against the selected boxes [0, num_sel), 4 at a time. */
+static int
+is_overlapped_with_selected (nms_context_t *nms, int num_sel,
+                             float x1, float y1, float x2, float y2, float area, float thresh)
+{
+    int i = 0;
+
+    if (area <= 0.0f)
+        return 0;
+
+#if defined (__SSE2__)
+    __m128 vx1 = _mm_set1_ps (x1);
+    __m128 vy1 = _mm_set1_ps (y1);
+    __m128 vx2 = _mm_set1_ps (x2);
+    __m128 vy2 = _mm_set1_ps (y2);
+    __m128 va  = _mm_set1_ps (area);
+    __m128 vt  = _mm_set1_ps (thresh);
+    __m128 vt1 = _mm_set1_ps (1.0f + thresh);
+    __m128 vz  = _mm_setzero_ps ();
+
+    for (; i + 4 <= num_sel; i += 4)
+    {
+        __m128 iw = _mm_sub_ps (_mm_min_ps (vx2, _mm_loadu_ps (&nms->sel_x2[i])),
+                                _mm_max_ps (vx1, _mm_loadu_ps (&nms->sel_x1[i])));
+        __m128 ih = _mm_sub_ps (_mm_min_ps (vy2, _mm_loadu_ps (&nms->sel_y2[i])),
+                                _mm_max_ps (vy1, _mm_loadu_ps (&nms->sel_y1[i])));
+        __m128 inter = _mm_mul_ps (_mm_max_ps (iw, vz), _mm_max_ps (ih, vz));
+        __m128 sarea = _mm_loadu_ps (&nms->sel_area[i]);
+        __m128 lhs   = _mm_mul_ps (inter, vt1);
+        __m128 rhs   = _mm_mul_ps (vt, _mm_add_ps (va, sarea));
+        __m128 hit   = _mm_and_ps (_mm_cmpge_ps (lhs, rhs), _mm_cmpgt_ps (sarea, vz));
+
+        if (_mm_movemask_ps (hit))
+            return 1;
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t vx1 = vdupq_n_f32 (x1);
+    float32x4_t vy1 = vdupq_n_f32 (y1);
+    float32x4_t vx2 = vdupq_n_f32 (x2);
+    float32x4_t vy2 = vdupq_n_f32 (y2);
+    float32x4_t va  = vdupq_n_f32 (area);
+    float32x4_t vt  = vdupq_n_f32 (thresh);
+    float32x4_t vt1 = vdupq_n_f32 (1.0f + thresh);
+    float32x4_t vz  = vdupq_n_f32 (0.0f);
+
+    for (; i + 4 <= num_sel; i += 4)
+    {
+        float32x4_t iw = vsubq_f32 (vminq_f32 (vx2, vld1q_f32 (&nms->sel_x2[i])),
+                                    vmaxq_f32 (vx1, vld1q_f32 (&nms->sel_x1[i])));
+        float32x4_t ih = vsubq_f32 (vminq_f32 (vy2, vld1q_f32 (&nms->sel_y2[i])),
+                                    vmaxq_f32 (vy1, vld1q_f32 (&nms->sel_y1[i])));
+        float32x4_t inter = vmulq_f32 (vmaxq_f32 (iw, vz), vmaxq_f32 (ih, vz));
+        float32x4_t sarea = vld1q_f32 (&nms->sel_area[i]);
+        float32x4_t lhs   = vmulq_f32 (inter, vt1);
+        float32x4_t rhs   = vmulq_f32 (vt, vaddq_f32 (va, sarea));
+        uint32x4_t  hit   = vandq_u32 (vcgeq_f32 (lhs, rhs), vcgtq_f32 (sarea, vz));
+        uint32x2_t  hit2  = vorr_u32 (vget_low_u32 (hit), vget_high_u32 (hit));
+
+        if (vget_lane_u32 (hit2, 0) | vget_lane_u32 (hit2, 1))
+            return 1;
+    }
+#endif
+
+    for (; i < num_sel; i ++)
+    {
+        if (is_overlapped (x1, y1, x2, y2, area,
+                           nms->sel_x1[i], nms->sel_y1[i], nms->sel_x2[i], nms->sel_y2[i],
+                           nms->sel_area[i], thresh))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  uniform grid of the selected boxes
+ * -------------------------------------------------------------------- */
+typedef struct _nms_grid_t
+{
+    float org_x, org_y;
+    float inv_cell_w, inv_cell_h;
+    int   dim_x, dim_y;
+    int   num_entries;
+} nms_grid_t;
+
+static void
+init_grid (nms_context_t *nms, nms_grid_t *grid)
+{
+    float minx = nms->x1[0], maxx = nms->x2[0];
+    float miny = nms->y1[0], maxy = nms->y2[0];
+    float sum_w = 0.0f, sum_h = 0.0f;
+
+    for (int i = 0; i < nms->num; i ++)
+    {
+        minx = _min (minx, nms->x1[i]);
+        miny = _min (miny, nms->y1[i]);
+        maxx = _max (maxx, nms->x2[i]);
+        maxy = _max (maxy, nms->y2[i]);
+        sum_w += nms->x2[i] - nms->x1[i];
+        sum_h += nms->y2[i] - nms->y1[i];
+    }
+
+    /* a cell is twice as large as the average box. */
+    float cell_w = 2.0f * sum_w / nms->num;
+    float cell_h = 2.0f * sum_h / nms->num;
+
+    grid->dim_x = (cell_w > 0.0f) ? (int)ceilf ((maxx - minx) / cell_w) : 1;
+    grid->dim_y = (cell_h > 0.0f) ? (int)ceilf ((maxy - miny) / cell_h) : 1;
+    grid->dim_x = _min (_max (grid->dim_x, 1), NMS_GRID_MAX_DIM);
+    grid->dim_y = _min (_max (grid->dim_y, 1), NMS_GRID_MAX_DIM);
+
+    grid->org_x = minx;
+    grid->org_y = miny;
+    grid->inv_cell_w = (maxx > minx) ? grid->dim_x / (maxx - minx) : 0.0f;
+    grid->inv_cell_h = (maxy > miny) ? grid->dim_y / (maxy - miny) : 0.0f;
+    grid->num_entries = 0;
+
+    for (int i = 0; i < grid->dim_x * grid->dim_y; i ++)
+        nms->cell_head[i] = -1;
+}
+
+static inline void
+get_cell_range (nms_grid_t *grid, float x1, float y1, float x2, float y2,
+                int *cx0, int *cy0, int *cx1, int *cy1)
+{
+    *cx0 = _max ((int)((x1 - grid->org_x) * grid->inv_cell_w), 0);
+    *cy0 = _max ((int)((y1 - grid->org_y) * grid->inv_cell_h), 0);
+    *cx1 = _min ((int)((x2 - grid->org_x) * grid->inv_cell_w), grid->dim_x - 1);
+    *cy1 = _min ((int)((y2 - grid->org_y) * grid->inv_cell_h), grid->dim_y - 1);
+}
+
+static void
+grid_insert (nms_context_t *nms, nms_grid_t *grid, int sel)
+{
+    int cx0, cy0, cx1, cy1;
+    get_cell_range (grid, nms->sel_x1[sel], nms->sel_y1[sel], nms->sel_x2[sel], nms->sel_y2[sel],
+                    &cx0, &cy0, &cx1, &cy1);
+
+    for (int cy = cy0; cy <= cy1; cy ++)
+    {
+        for (int cx = cx0; cx <= cx1; cx ++)
+        {
+            if (grid->num_entries >= nms->max_entries)
+            {
+                nms->max_entries *= 2;
+                nms->entry_next = (int *)realloc (nms->entry_next, nms->max_entries * sizeof (int));
+                nms->entry_sel  = (int *)realloc (nms->entry_sel,  nms->max_entries * sizeof (int));
+            }
+
+            int cell = cy * grid->dim_x + cx;
+            int e    = grid->num_entries ++;
+            nms->entry_sel [e]  = sel;
+            nms->entry_next[e]  = nms->cell_head[cell];
+            nms->cell_head[cell] = e;
+        }
+    }
+}
+
+/*
+ *  two boxes with a positive intersection always share a cell,
+ *  so only the cells covered by the candidate need to be tested.
+ */
+static int
+grid_is_overlapped (nms_context_t *nms, nms_grid_t *grid,
+                    float x1, float y1, float x2, float y2, float area, float thresh)
+{
+    int cx0, cy0, cx1, cy1;
+    get_cell_range (grid, x1, y1, x2, y2, &cx0, &cy0, &cx1, &cy1);
+
+    for (int cy = cy0; cy <= cy1; cy ++)
+    {
+        for (int cx = cx0; cx <= cx1; cx ++)
+        {
+            for (int e = nms->cell_head[cy * grid->dim_x + cx]; e >= 0; e = nms->entry_next[e])
+            {
+                int s = nms->entry_sel[e];
+                if (is_overlapped (x1, y1, x2, y2, area,
+                                   nms->sel_x1[s], nms->sel_y1[s], nms->sel_x2[s], nms->sel_y2[s],
+                                   nms->sel_area[s], thresh))
+                    return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  Hard NMS
+ * -------------------------------------------------------------------- */
+int
+nms_hard (nms_context_t *nms, float iou_thresh, int max_k, int *selected)
+{
+    nms_grid_t grid;
+    int num_sel = 0;
+    int use_grid;
+
+    if (nms->num <= 0 || max_k <= 0)
+        return 0;
+
+    sort_candidates (nms);
+
+    if (nms->grid_mode == NMS_GRID_AUTO)
+        use_grid = (nms->num >= NMS_GRID_MIN_CANDIDATES && max_k >= NMS_GRID_MIN_SELECTED);
+    else
+        use_grid = (nms->grid_mode == NMS_GRID_ON);
+
+    /* a non-positive threshold suppresses even the disjoint boxes. */
+    if (iou_thresh <= 0.0f)
+        use_grid = 0;
+
+    if (use_grid)
+        init_grid (nms, &grid);
+
+    for (int n = 0; n < nms->num; n ++)
+    {
+        int   i    = nms->order[n];
+        float x1   = nms->x1[i];
+        float y1   = nms->y1[i];
+        float x2   = nms->x2[i];
+        float y2   = nms->y2[i];
+        float area = nms->area[i];
+        int   hit;
+
+        if (use_grid)
+            hit = grid_is_overlapped (nms, &grid, x1, y1, x2, y2, area, iou_thresh);
+        else
+            hit = is_overlapped_with_selected (nms, num_sel, x1, y1, x2, y2, area, iou_thresh);
+
+        if (hit)
+            continue;
+
+        nms->sel_x1  [num_sel] = x1;
+        nms->sel_y1  [num_sel] = y1;
+        nms->sel_x2  [num_sel] = x2;
+        nms->sel_y2  [num_sel] = y2;
+        nms->sel_area[num_sel] = area;
+        if (use_grid)
+            grid_insert (nms, &grid, num_sel);
+
+        selected[num_sel ++] = i;
+        if (num_sel >= max_k)
+            break;
+    }
+
+    return num_sel;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  Weighted NMS
+ * -------------------------------------------------------------------- */
+static inline float
+calc_iou (nms_context_t *nms, int a, int b)
+{
+    if (nms->area[a] <= 0.0f || nms->area[b] <= 0.0f)
+        return 0.0f;
+
+    float iw = _min (nms->x2[a], nms->x2[b]) - _max (nms->x1[a], nms->x1[b]);
+    float ih = _min (nms->y2[a], nms->y2[b]) - _max (nms->y1[a], nms->y1[b]);
+    float inter = _max (iw, 0.0f) * _max (ih, 0.0f);
+
+    return inter / (nms->area[a] + nms->area[b] - inter);
+}
+
+int
+nms_weighted (nms_context_t *nms, float iou_thresh, int max_k,
+              const float *keys, int key_dim, nms_blend_t *out, float *out_keys)
+{
+    int num_out = 0;
+
+    if (nms->num <= 0 || max_k <= 0)
+        return 0;
+
+    sort_candidates (nms);
+
+    /*
+     *  the cluster members are removed from (order[]) while it is scanned,
+     *  so each scan visits only the candidates still remaining.
+     */
+    int num_remain = nms->num;
+    while (num_remain > 0 && num_out < max_k)
+    {
+        int top = nms->order[0];
+
+        float w_sum = 0.0f;
+        float x1 = 0.0f, y1 = 0.0f, x2 = 0.0f, y2 = 0.0f;
+        float *okeys = (out_keys && keys) ? &out_keys[num_out * key_dim] : NULL;
+
+        if (okeys)
+            memset (okeys, 0, key_dim * sizeof (float));
+
+        /* the top candidate and the remaining ones overlapping it */
+        int num_keep = 0;
+        for (int m = 0; m < num_remain; m ++)
+        {
+            int j = nms->order[m];
+
+            if (j != top && calc_iou (nms, top, j) <= iou_thresh)
+            {
+                nms->order[num_keep ++] = j;
+                continue;
+            }
+
+            float w = nms->score[j];
+            x1 += nms->x1[j] * w;
+            y1 += nms->y1[j] * w;
+            x2 += nms->x2[j] * w;
+            y2 += nms->y2[j] * w;
+
+            if (okeys)
+            {
+                const float *k = &keys[j * key_dim];
+                for (int d = 0; d < key_dim; d ++)
+                    okeys[d] += k[d] * w;
+            }
+
+            w_sum += w;
+        }
+        num_remain = num_keep;
+
+        if (w_sum > 0.0f)
+        {
+            float inv_w = 1.0f / w_sum;
+            out[num_out].x1 = x1 * inv_w;
+            out[num_out].y1 = y1 * inv_w;
+            out[num_out].x2 = x2 * inv_w;
+            out[num_out].y2 = y2 * inv_w;
+
+            if (okeys)
+            {
+                for (int d = 0; d < key_dim; d ++)
+                    okeys[d] *= inv_w;
+            }
+        }
+        else
+        {
+            /* all zero scores. take the top candidate as is. */
+            out[num_out].x1 = nms->x1[top];
+            out[num_out].y1 = nms->y1[top];
+            out[num_out].x2 = nms->x2[top];
+            out[num_out].y2 = nms->y2[top];
+
+            if (okeys)
+                memcpy (okeys, &keys[top * key_dim], key_dim * sizeof (float));
+        }
+        out[num_out].score   = nms->score[top];
+        out[num_out].top_idx = top;
+
+        num_out ++;
+    }
+
+    return num_out;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  Hard or Weighted NMS (by nms->weighted)
+ * -------------------------------------------------------------------- */
+int
+nms_select (nms_context_t *nms, float iou_thresh, int max_k,
+            const float *keys, int key_dim, nms_blend_t *out, float *out_keys)
+{
+    if (nms->weighted)
+        return nms_weighted (nms, iou_thresh, max_k, keys, key_dim, out, out_keys);
+
+    int num_sel = nms_hard (nms, iou_thresh, max_k, nms->sel_idx);
+    for (int i = 0; i < num_sel; i ++)
+    {
+        int idx = nms->sel_idx[i];
+
+        out[i].score   = nms->score[idx];
+        out[i].x1      = nms->x1[idx];
+        out[i].y1      = nms->y1[idx];
+        out[i].x2      = nms->x2[idx];
+        out[i].y2      = nms->y2[idx];
+        out[i].top_idx = idx;
+
+        if (out_keys && keys)
+            memcpy (&out_keys[i * key_dim], &keys[idx * key_dim], key_dim * sizeof (float));
+    }
+
+    return num_sel;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  Rotated (quad) NMS
+ *
+ *    the intersection of two convex polygons by Sutherland-Hodgman:
+ *    a quad clipped by the 4 half planes has 8 vertices at most.
+ * -------------------------------------------------------------------- */
+#define MAX_CLIP_VERTS  16
+
+static float
+calc_poly_area (const float *pts, int num)
+{
+    float area = 0.0f;
+    float px = pts[2 * (num - 1)];
+    float py = pts[2 * (num - 1) + 1];
+
+    for (int i = 0; i < num; i ++)
+    {
+        float qx = pts[2 * i], qy = pts[2 * i + 1];
+        area += px * qy - qx * py;
+        px = qx;
+        py = qy;
+    }
+    return area * 0.5f;     /* signed. positive for the counter clockwise (y up) */
+}
+
+/* keep the part of (src) on the inner side of the edge (a -> b) */
+static int
+clip_poly_by_edge (const float *src, int num, float ax, float ay, float bx, float by,
+                   float orient, float *dst)
+{
+    int num_dst = 0;
+    float ex = orient * (bx - ax);
+    float ey = orient * (by - ay);
+
+    float px = src[2 * (num - 1)];
+    float py = src[2 * (num - 1) + 1];
+    float dp = ex * (py - ay) - ey * (px - ax);
+
+    for (int i = 0; i < num; i ++)
+    {
+        float qx = src[2 * i], qy = src[2 * i + 1];
+        float dq = ex * (qy - ay) - ey * (qx - ax);
+
+        /* the edge (p -> q) crosses the clip line */
+        if ((dp >= 0.0f) != (dq >= 0.0f) && num_dst < MAX_CLIP_VERTS)
+        {
+            float t = dp / (dp - dq);
+            dst[2 * num_dst    ] = px + t * (qx - px);
+            dst[2 * num_dst + 1] = py + t * (qy - py);
+            num_dst ++;
+        }
+
+        if (dq >= 0.0f && num_dst < MAX_CLIP_VERTS)
+        {
+            dst[2 * num_dst    ] = qx;
+            dst[2 * num_dst + 1] = qy;
+            num_dst ++;
+        }
+
+        px = qx;
+        py = qy;
+        dp = dq;
+    }
+    return num_dst;
+}
+
+float
+nms_quad_iou (const float *quad0, const float *quad1)
+{
+    float buf0[2 * MAX_CLIP_VERTS];
+    float buf1[2 * MAX_CLIP_VERTS];
+    float *src = buf0;
+    float *dst = buf1;
+
+    float area0 = fabsf (calc_poly_area (quad0, 4));
+    float area1 =        calc_poly_area (quad1, 4);
+    float orient = (area1 > 0.0f) ? 1.0f : -1.0f;
+    area1 = fabsf (area1);
+
+    if (area0 <= 0.0f || area1 <= 0.0f)
+        return 0.0f;
+
+    memcpy (src, quad0, 8 * sizeof (float));
+    int num = 4;
+    for (int e = 0; e < 4 && num > 0; e ++)
+    {
+        int f = (e + 1) & 3;
+        num = clip_poly_by_edge (src, num, quad1[2 * e], quad1[2 * e + 1],
+                                 quad1[2 * f], quad1[2 * f + 1], orient, dst);
+
+        float *tmp = src; src = dst; dst = tmp;
+    }
+
+    if (num < 3)
+        return 0.0f;
+
+    float inter = fabsf (calc_poly_area (src, num));
+    return inter / (area0 + area1 - inter);
+}
+
+int
+nms_quad (nms_context_t *nms, const float *quads, float iou_thresh, int max_k, int *selected)
+{
+    int num_sel = 0;
+
+    if (nms->num <= 0 || max_k <= 0)
+        return 0;
+
+    sort_candidates (nms);
+
+    for (int n = 0; n < nms->num; n ++)
+    {
+        int i   = nms->order[n];
+        int hit = 0;
+
+        for (int s = 0; s < num_sel; s ++)
+        {
+            int j = selected[s];
+
+            /* disjoint AABBs: IoU is 0. (a non-positive threshold suppresses them too) */
+            if (iou_thresh > 0.0f &&
+                (nms->x1[i] > nms->x2[j] || nms->x2[i] < nms->x1[j] ||
+                 nms->y1[i] > nms->y2[j] || nms->y2[i] < nms->y1[j]))
+                continue;
+
+            if (nms_quad_iou (&quads[8 * i], &quads[8 * j]) >= iou_thresh)
+            {
+                hit = 1;
+                break;
+            }
+        }
+
+        if (hit)
+            continue;
+
+        selected[num_sel ++] = i;
+        if (num_sel >= max_k)
+            break;
+    }
+
+    return num_sel;
+}
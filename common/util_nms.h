@@ -0,0 +1,116 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_NMS_H_
+#define _UTIL_NMS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  Non Maximum Suppression on SoA boxes.
+ *
+ *    1) fill the candidates with nms_set_box(), and set (num).
+ *    2) run nms_hard() or nms_weighted(), or nms_select() which runs
+ *       the one chosen by (weighted).
+ *
+ *  the candidates are sorted once by score (ties keep the input order),
+ *  and each candidate is tested against the selected set only, 4 boxes
+ *  at a time. when many boxes are selected, the selected set is bucketed
+ *  into a uniform grid, and only the neighbor cells are tested.
+ */
+#define NMS_GRID_AUTO   0
+#define NMS_GRID_OFF    1
+#define NMS_GRID_ON     2
+
+typedef struct _nms_context_t
+{
+    int     capacity;
+    int     num;                /* number of candidates */
+    int     grid_mode;          /* NMS_GRID_xxx */
+    int     weighted;           /* nms_select() runs nms_weighted(). 0 by init_nms() */
+
+    /* candidates (SoA) */
+    float   *x1, *y1, *x2, *y2;
+    float   *score;
+
+    /* work buffers */
+    float   *area;
+    int     *order;
+    int     *sel_idx;           /* of nms_select() */
+    void    *sort_buf;
+    float   *sel_x1, *sel_y1, *sel_x2, *sel_y2, *sel_area;
+
+    /* uniform grid of the selected boxes */
+    int     *cell_head;
+    int     *entry_next;
+    int     *entry_sel;
+    int     max_cells;
+    int     max_entries;
+} nms_context_t;
+
+/* result of nms_weighted() */
+typedef struct _nms_blend_t
+{
+    float score;                /* score of the top candidate of the cluster */
+    float x1, y1, x2, y2;       /* score weighted average of the cluster     */
+    int   top_idx;              /* index of the top candidate                */
+} nms_blend_t;
+
+int init_nms (nms_context_t *nms, int capacity);
+int exit_nms (nms_context_t *nms);
+
+static inline void
+nms_set_box (nms_context_t *nms, int idx, float x1, float y1, float x2, float y2, float score)
+{
+    /* normalize the corner order */
+    nms->x1[idx]    = (x1 < x2) ? x1 : x2;
+    nms->x2[idx]    = (x1 < x2) ? x2 : x1;
+    nms->y1[idx]    = (y1 < y2) ? y1 : y2;
+    nms->y2[idx]    = (y1 < y2) ? y2 : y1;
+    nms->score[idx] = score;
+}
+
+/*
+ *  returns the number of the selected boxes (<= max_k).
+ *  (selected[]) receives the candidate indices in descending score order.
+ */
+int nms_hard (nms_context_t *nms, float iou_thresh, int max_k, int *selected);
+
+/*
+ *  MediaPipe style weighted NMS:
+ *    the top candidate and all the remaining candidates overlapping it
+ *    (IoU > iou_thresh) form a cluster, and the box and keypoints are
+ *    blended with the score as the weight.
+ *
+ *    keys     : [num][key_dim] keypoints of the candidates (or NULL)
+ *    out_keys : [max_k][key_dim] blended keypoints (or NULL)
+ */
+int nms_weighted (nms_context_t *nms, float iou_thresh, int max_k,
+                  const float *keys, int key_dim, nms_blend_t *out, float *out_keys);
+
+/*
+ *  nms_weighted() if (weighted), nms_hard() otherwise.
+ *  the result is the same form for both. with nms_hard(), each output
+ *  is the selected candidate itself (box, score and keypoints).
+ */
+int nms_select (nms_context_t *nms, float iou_thresh, int max_k,
+                const float *keys, int key_dim, nms_blend_t *out, float *out_keys);
+
+/*
+ *  NMS on the rotated rectangles (or any convex quads).
+ *
+ *    quads : [num][8] vertices (x0, y0, ..., x3, y3) along the outline.
+ *            the AABB of each quad must be set with nms_set_box(), and
+ *            is used to skip the disjoint pairs before the polygon clip.
+ */
+float nms_quad_iou (const float *quad0, const float *quad1);
+int   nms_quad (nms_context_t *nms, const float *quads, float iou_thresh, int max_k, int *selected);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_NMS_H_ */
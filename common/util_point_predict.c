@@ -0,0 +1,171 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "util_point_predict.h"
+
+
+int
+init_point_predictor (point_predictor_t *pp, int num_values, float max_extrapolate, float assoc_dist)
+{
+    int buf_size = 2 * POINT_PREDICT_MAX_TRACK * num_values * sizeof (float);
+
+    memset (pp, 0, sizeof (*pp));
+    pp->num_values      = num_values;
+    pp->max_extrapolate = max_extrapolate;
+    pp->assoc_dist      = assoc_dist;
+
+    pp->buf     = (float *)malloc (buf_size);
+    pp->buf_new = (float *)malloc (buf_size);
+    if (pp->buf == NULL || pp->buf_new == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        exit_point_predictor (pp);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+exit_point_predictor (point_predictor_t *pp)
+{
+    if (pp->buf)
+        free (pp->buf);
+    if (pp->buf_new)
+        free (pp->buf_new);
+
+    pp->buf        = NULL;
+    pp->buf_new    = NULL;
+    pp->num_tracks = 0;
+
+    return 0;
+}
+
+static float
+calc_mean_dist (const float *a, const float *b, int num)
+{
+    float sum = 0.0f;
+
+    for (int i = 0; i < num; i ++)
+        sum += fabsf (a[i] - b[i]);
+
+    return sum / (float)num;
+}
+
+/* the last track which matches the observation, or -1 for a new track. */
+static int
+find_track (point_predictor_t *pp, const float *val, const int *track_ids, int obs_idx, const int *used)
+{
+    int best_idx = -1;
+
+    if (track_ids)
+    {
+        for (int i = 0; i < pp->num_tracks; i ++)
+        {
+            if (!used[i] && pp->tracks[i].track_id == track_ids[obs_idx])
+                return i;
+        }
+        return -1;
+    }
+
+    float best_dist = pp->assoc_dist;
+    for (int i = 0; i < pp->num_tracks; i ++)
+    {
+        if (used[i])
+            continue;
+
+        float dist = calc_mean_dist (val, pp->tracks[i].val1, pp->num_values);
+        if (dist < best_dist)
+        {
+            best_dist = dist;
+            best_idx  = i;
+        }
+    }
+
+    return best_idx;
+}
+
+int
+update_point_predictor (point_predictor_t *pp, const float *values, const int *track_ids,
+                        int num, double time_ms, int *out_ids)
+{
+    point_track_t tracks[POINT_PREDICT_MAX_TRACK];
+    int used[POINT_PREDICT_MAX_TRACK] = {0};
+    int nv = pp->num_values;
+
+    if (num > POINT_PREDICT_MAX_TRACK)
+        num = POINT_PREDICT_MAX_TRACK;
+
+    for (int j = 0; j < num; j ++)
+    {
+        const float *val = &values[j * nv];
+        point_track_t *trk = &tracks[j];
+        int i = find_track (pp, val, track_ids, j, used);
+
+        trk->val0 = &pp->buf_new[(2 * j + 0) * nv];
+        trk->val1 = &pp->buf_new[(2 * j + 1) * nv];
+        memcpy (trk->val1, val, nv * sizeof (float));
+        trk->t1 = time_ms;
+
+        if (i >= 0)
+        {
+            point_track_t *last = &pp->tracks[i];
+            used[i] = 1;
+
+            memcpy (trk->val0, last->val1, nv * sizeof (float));
+            trk->t0       = last->t1;
+            trk->num_obs  = last->num_obs + 1;
+            trk->track_id = last->track_id;
+        }
+        else
+        {
+            memcpy (trk->val0, val, nv * sizeof (float));
+            trk->t0       = time_ms;
+            trk->num_obs  = 1;
+            trk->track_id = track_ids ? track_ids[j] : pp->next_id ++;
+        }
+
+        if (out_ids)
+            out_ids[j] = trk->track_id;
+    }
+
+    /* the unobserved tracks are dropped here. */
+    float *tmp = pp->buf;
+    pp->buf     = pp->buf_new;
+    pp->buf_new = tmp;
+
+    memcpy (pp->tracks, tracks, num * sizeof (point_track_t));
+    pp->num_tracks = num;
+
+    return 0;
+}
+
+int
+predict_point_track (point_predictor_t *pp, int idx, double time_ms, float *dst)
+{
+    point_track_t *trk = &pp->tracks[idx];
+    int nv = pp->num_values;
+    double interval = trk->t1 - trk->t0;
+
+    if (trk->num_obs < 2 || interval <= 0.0)
+    {
+        memcpy (dst, trk->val1, nv * sizeof (float));
+        return trk->track_id;
+    }
+
+    float k = (float)((time_ms - trk->t1) / interval);
+    if (k < 0.0f)
+        k = 0.0f;
+    if (k > pp->max_extrapolate)
+        k = pp->max_extrapolate;
+
+    for (int i = 0; i < nv; i ++)
+        dst[i] = trk->val1[i] + (trk->val1[i] - trk->val0[i]) * k;
+
+    return trk->track_id;
+}
@@ -0,0 +1,71 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_POINT_PREDICT_H_
+#define _UTIL_POINT_PREDICT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  constant velocity predictor of the landmarks/boxes, to render them at
+ *  the display rate while the inference runs at a lower rate.
+ *
+ *    a track is a vector of (num_values) floats (the coordinates of the
+ *    points of a hand, a pose, a face ROI, ...), observed at the capture
+ *    time of the input frame. the prediction at (time_ms) extrapolates the
+ *    last two observations linearly, up to (max_extrapolate) times the
+ *    interval of the observations, so that a stopped object doesn't
+ *    overshoot too far.
+ *
+ *    the tracks are keyed by the track ID. when the observations have no ID,
+ *    each one is associated with the nearest track of the last update
+ *    (the mean absolute difference of the values < assoc_dist), or starts a
+ *    new track. the tracks not observed in the update are dropped.
+ */
+#define POINT_PREDICT_MAX_TRACK     16
+
+typedef struct _point_track_t
+{
+    int     track_id;
+    int     num_obs;            /* 1: hold the value, 2 or more: extrapolate */
+    double  t0, t1;             /* time of the last two observations [ms] */
+    float   *val0, *val1;       /* [num_values] */
+} point_track_t;
+
+typedef struct _point_predictor_t
+{
+    int     num_values;
+    float   max_extrapolate;
+    float   assoc_dist;
+
+    int     num_tracks;
+    point_track_t tracks[POINT_PREDICT_MAX_TRACK];
+    int     next_id;
+
+    float   *buf;               /* [2][POINT_PREDICT_MAX_TRACK][num_values] */
+    float   *buf_new;           /* work buffer for the update */
+} point_predictor_t;
+
+int  init_point_predictor   (point_predictor_t *pp, int num_values, float max_extrapolate, float assoc_dist);
+int  exit_point_predictor   (point_predictor_t *pp);
+
+/*
+ *  replaces the tracks with (num) observations at (time_ms).
+ *    values   : [num][num_values]
+ *    track_ids: [num], or NULL to associate by the distance.
+ *    out_ids  : [num] the track ID of each observation (may be NULL).
+ */
+int  update_point_predictor (point_predictor_t *pp, const float *values, const int *track_ids,
+                             int num, double time_ms, int *out_ids);
+
+/* predicts the track (idx) of [0, num_tracks) at (time_ms). returns the track ID. */
+int  predict_point_track    (point_predictor_t *pp, int idx, double time_ms, float *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_POINT_PREDICT_H_ */
@@ -0,0 +1,194 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util_qos.h"
+
+#define QOS_EMA_ALPHA           0.1
+#define QOS_MAX_UPGRADE_FRAMES  (QOS_UPGRADE_FRAMES * 16)
+
+
+void
+init_qos_ctrl (qos_ctrl_t *qc, double target_ms)
+{
+    memset (qc, 0, sizeof (*qc));
+    qc->target_ms      = target_ms;
+    qc->upgrade_frames = QOS_UPGRADE_FRAMES;
+    qc->last_knob      = -1;
+    qc->logged         = 1;
+}
+
+int
+add_qos_knob (qos_ctrl_t *qc, const char *name, int max_level, qos_knob_func_t func, void *arg)
+{
+    if (qc->num_knobs >= QOS_MAX_KNOB)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    qos_knob_t *knob = &qc->knobs[qc->num_knobs];
+    knob->name      = name;
+    knob->level     = 0;
+    knob->max_level = max_level;
+    knob->func      = func;
+    knob->arg       = arg;
+
+    return qc->num_knobs ++;
+}
+
+int
+add_qos_stage (qos_ctrl_t *qc, const char *name)
+{
+    if (qc->num_stages >= QOS_MAX_STAGE)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    qc->stage_name[qc->num_stages] = name;
+    return qc->num_stages ++;
+}
+
+int
+get_qos_knob_level (qos_ctrl_t *qc, int knob)
+{
+    return qc->knobs[knob].level;
+}
+
+
+static void
+log_qos_latency (qos_ctrl_t *qc)
+{
+    fprintf (stderr, "frame %5.1f ms (target %5.1f)", qc->frame_ms, qc->target_ms);
+    for (int i = 0; i < qc->num_stages; i ++)
+        fprintf (stderr, "%s %s %5.1f", (i == 0) ? " [" : ",", qc->stage_name[i], qc->stage_ms[i]);
+    fprintf (stderr, "%s\n", (qc->num_stages > 0) ? "]" : "");
+}
+
+static int
+set_knob_level (qos_ctrl_t *qc, int idx, int level)
+{
+    qos_knob_t *knob = &qc->knobs[idx];
+
+    fprintf (stderr, "QoS: %-10s %d -> %d, ", knob->name, knob->level, level);
+    log_qos_latency (qc);
+
+    if (knob->func (knob->arg, level) != 0)
+    {
+        /* not supported. leave it as it is from now on. */
+        fprintf (stderr, "QoS: %-10s failed. disabled.\n", knob->name);
+        knob->max_level = knob->level;
+        return -1;
+    }
+
+    knob->level = level;
+    return 0;
+}
+
+static int
+degrade (qos_ctrl_t *qc)
+{
+    for (int i = 0; i < qc->num_knobs; i ++)
+    {
+        qos_knob_t *knob = &qc->knobs[i];
+        if (knob->level >= knob->max_level)
+            continue;
+
+        if (set_knob_level (qc, i, knob->level + 1) < 0)
+            continue;
+
+        /* the knob just restored was not affordable. wait longer next time. */
+        if (qc->last_upgrade && qc->last_knob == i && qc->settle < QOS_SETTLE_FRAMES * 2 + QOS_DEGRADE_FRAMES)
+        {
+            qc->upgrade_frames *= 2;
+            if (qc->upgrade_frames > QOS_MAX_UPGRADE_FRAMES)
+                qc->upgrade_frames = QOS_MAX_UPGRADE_FRAMES;
+        }
+
+        qc->last_knob    = i;
+        qc->last_upgrade = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+upgrade (qos_ctrl_t *qc)
+{
+    for (int i = qc->num_knobs - 1; i >= 0; i --)
+    {
+        qos_knob_t *knob = &qc->knobs[i];
+        if (knob->level <= 0)
+            continue;
+
+        if (set_knob_level (qc, i, knob->level - 1) < 0)
+            continue;
+
+        qc->last_knob    = i;
+        qc->last_upgrade = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+update_qos_ctrl (qos_ctrl_t *qc, double frame_ms, const double *stage_ms)
+{
+    double a = (qc->num_frames == 0) ? 1.0 : QOS_EMA_ALPHA;
+
+    qc->frame_ms += a * (frame_ms - qc->frame_ms);
+    for (int i = 0; i < qc->num_stages && stage_ms; i ++)
+        qc->stage_ms[i] += a * (stage_ms[i] - qc->stage_ms[i]);
+    qc->num_frames ++;
+
+    qc->settle ++;
+    if (qc->settle < QOS_SETTLE_FRAMES)
+        return 0;
+
+    /* the latency with the last change */
+    if (!qc->logged)
+    {
+        fprintf (stderr, "QoS: %-10s = %d, ", qc->knobs[qc->last_knob].name, qc->knobs[qc->last_knob].level);
+        log_qos_latency (qc);
+        qc->logged = 1;
+    }
+
+    if (qc->frame_ms > qc->target_ms * QOS_OVER_RATIO)
+    {
+        qc->num_over ++;
+        qc->num_under = 0;
+    }
+    else if (qc->frame_ms < qc->target_ms * QOS_UNDER_RATIO)
+    {
+        qc->num_under ++;
+        qc->num_over = 0;
+    }
+    else
+    {
+        qc->num_over  = 0;
+        qc->num_under = 0;
+    }
+
+    int changed = 0;
+    if (qc->num_over >= QOS_DEGRADE_FRAMES)
+        changed = degrade (qc);
+    else if (qc->num_under >= qc->upgrade_frames)
+        changed = upgrade (qc);
+
+    if (changed)
+    {
+        qc->settle    = 0;
+        qc->num_over  = 0;
+        qc->num_under = 0;
+        qc->logged    = 0;
+        qc->num_changes ++;
+    }
+
+    return changed;
+}
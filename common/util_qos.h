@@ -0,0 +1,97 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_QOS_H_
+#define _UTIL_QOS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  quality of service controller, to keep the frame time under the target
+ *  (e.g. when the SoC is throttled) by trading the quality.
+ *
+ *    the knobs are registered in the order they should be degraded. each
+ *    knob has the levels [0, max_level], 0 is the best quality, and the
+ *    callback applies a level.
+ *
+ *    the frame time (and the time of each stage, for the log) is smoothed by
+ *    EMA, and checked every frame after QOS_SETTLE_FRAMES since the last
+ *    change:
+ *      - over  target * QOS_OVER_RATIO  for QOS_DEGRADE_FRAMES:
+ *            the first knob which is not at its max level is degraded.
+ *      - under target * QOS_UNDER_RATIO for (upgrade_frames):
+ *            the last degraded knob is restored (reverse order).
+ *            when the restored knob is degraded again soon, the wait for
+ *            the next restore doubles, so that it doesn't oscillate.
+ *
+ *    a knob whose callback fails is not changed any more.
+ *    the changes and the latency after each of them are logged to stderr.
+ */
+#define QOS_MAX_KNOB            8
+#define QOS_MAX_STAGE           8
+
+#define QOS_SETTLE_FRAMES       30
+#define QOS_DEGRADE_FRAMES      10
+#define QOS_UPGRADE_FRAMES      90
+#define QOS_OVER_RATIO          1.05f
+#define QOS_UNDER_RATIO         0.7f
+
+/* returns 0 when the level is applied. */
+typedef int (*qos_knob_func_t) (void *arg, int level);
+
+typedef struct _qos_knob_t
+{
+    const char      *name;
+    int             level;
+    int             max_level;
+    qos_knob_func_t func;
+    void            *arg;
+} qos_knob_t;
+
+typedef struct _qos_ctrl_t
+{
+    double      target_ms;
+
+    int         num_knobs;
+    qos_knob_t  knobs[QOS_MAX_KNOB];
+
+    int         num_stages;
+    const char  *stage_name[QOS_MAX_STAGE];
+    double      stage_ms[QOS_MAX_STAGE];    /* EMA */
+    double      frame_ms;                   /* EMA */
+    int         num_frames;
+
+    int         settle;                     /* frames since the last change */
+    int         num_over;                   /* successive frames over the target */
+    int         num_under;                  /* successive frames under the target */
+    int         upgrade_frames;
+    int         last_knob;                  /* changed last */
+    int         last_upgrade;
+    int         logged;                     /* the latency after the last change */
+    int         num_changes;
+} qos_ctrl_t;
+
+void init_qos_ctrl  (qos_ctrl_t *qc, double target_ms);
+
+/* returns the index of the knob (stage), or -1. */
+int  add_qos_knob   (qos_ctrl_t *qc, const char *name, int max_level, qos_knob_func_t func, void *arg);
+int  add_qos_stage  (qos_ctrl_t *qc, const char *name);
+
+/*
+ *  call once per frame.
+ *    frame_ms: the interval of the frames.
+ *    stage_ms: [num_stages] the time of each stage in this frame (may be NULL).
+ *  returns 1 when a knob is changed.
+ */
+int  update_qos_ctrl (qos_ctrl_t *qc, double frame_ms, const double *stage_ms);
+
+int  get_qos_knob_level (qos_ctrl_t *qc, int knob);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_QOS_H_ */
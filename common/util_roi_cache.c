@@ -0,0 +1,221 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "util_roi_cache.h"
+
+
+void
+init_roi_cache (roi_cache_t *rc, float pos_thresh, int max_age)
+{
+    memset (rc, 0, sizeof (*rc));
+    rc->pos_thresh = pos_thresh;
+    rc->max_age    = max_age;
+}
+
+void
+reset_roi_cache (roi_cache_t *rc)
+{
+    for (int i = 0; i < ROI_CACHE_MAX_ENTRY; i ++)
+        rc->entry[i].valid = 0;
+}
+
+void
+begin_roi_cache_frame (roi_cache_t *rc)
+{
+    for (int i = 0; i < ROI_CACHE_MAX_ENTRY; i ++)
+        rc->entry[i].used = 0;
+}
+
+void
+end_roi_cache_frame (roi_cache_t *rc)
+{
+    for (int i = 0; i < ROI_CACHE_MAX_ENTRY; i ++)
+    {
+        roi_cache_entry_t *e = &rc->entry[i];
+
+        if (!e->valid || e->used)
+            continue;
+
+        e->miss ++;
+        if (e->miss > ROI_CACHE_MAX_MISS)
+            e->valid = 0;
+    }
+}
+
+
+/* the nearest entry of the object, or -1. */
+static int
+find_entry (roi_cache_t *rc, const float *roi)
+{
+    float best_dist = FLT_MAX;
+    int   best_idx  = -1;
+
+    for (int i = 0; i < ROI_CACHE_MAX_ENTRY; i ++)
+    {
+        roi_cache_entry_t *e = &rc->entry[i];
+        if (!e->valid || e->used)
+            continue;
+
+        float dx = roi[0] - e->roi[0];
+        float dy = roi[1] - e->roi[1];
+        float dist = sqrtf (dx * dx + dy * dy);
+        float size = fmaxf (fmaxf (roi[2], roi[3]), fmaxf (e->roi[2], e->roi[3]));
+
+        if (dist < size && dist < best_dist)
+        {
+            best_dist = dist;
+            best_idx  = i;
+        }
+    }
+
+    return best_idx;
+}
+
+/* a free entry, or the unused entry missed longest. */
+static int
+alloc_entry (roi_cache_t *rc)
+{
+    int best_miss = -1;
+    int best_idx  = -1;
+
+    for (int i = 0; i < ROI_CACHE_MAX_ENTRY; i ++)
+    {
+        roi_cache_entry_t *e = &rc->entry[i];
+        if (!e->valid)
+            return i;
+
+        if (!e->used && e->miss > best_miss)
+        {
+            best_miss = e->miss;
+            best_idx  = i;
+        }
+    }
+
+    return best_idx;
+}
+
+static int
+is_stable (roi_cache_t *rc, roi_cache_entry_t *e, const float *roi, uint64_t hash)
+{
+    float th = rc->pos_thresh;
+
+    if (rc->max_age > 0 && e->age >= rc->max_age)
+        return 0;
+
+    if (fabsf (roi[0] - e->roi[0]) > th * e->roi[2] ||
+        fabsf (roi[1] - e->roi[1]) > th * e->roi[3])
+        return 0;
+
+    if (fabsf (roi[2] - e->roi[2]) > th * e->roi[2] ||
+        fabsf (roi[3] - e->roi[3]) > th * e->roi[3])
+        return 0;
+
+    float drot = fabsf (remainderf (roi[4] - e->roi[4], 2.0f * (float)M_PI));
+    if (drot > ROI_CACHE_ROT_THRESH)
+        return 0;
+
+    if (__builtin_popcountll (hash ^ e->hash) > ROI_CACHE_HASH_THRESH)
+        return 0;
+
+    return 1;
+}
+
+int
+check_roi_cache (roi_cache_t *rc, const float *roi, uint64_t hash, int *slot)
+{
+    int idx = find_entry (rc, roi);
+
+    if (idx >= 0)
+    {
+        roi_cache_entry_t *e = &rc->entry[idx];
+
+        e->used = 1;
+        e->miss = 0;
+        *slot = idx;
+
+        if (is_stable (rc, e, roi, hash))
+        {
+            e->age ++;
+            rc->num_hit ++;
+            return 1;
+        }
+    }
+    else
+    {
+        idx = alloc_entry (rc);
+        *slot = idx;
+        if (idx < 0)
+            return 0;
+    }
+
+    /* the new output will be made for this key. */
+    roi_cache_entry_t *e = &rc->entry[idx];
+    memcpy (e->roi, roi, sizeof (e->roi));
+    e->hash  = hash;
+    e->valid = 1;
+    e->used  = 1;
+    e->miss  = 0;
+    e->age   = 0;
+
+    rc->num_miss ++;
+    return 0;
+}
+
+float
+get_roi_cache_hit_rate (roi_cache_t *rc)
+{
+    int num_check = rc->num_hit + rc->num_miss;
+
+    if (num_check == 0)
+        return 0.0f;
+    return (float)rc->num_hit / (float)num_check;
+}
+
+
+/*
+ *  dHash: the image is reduced to 9x8 blocks, and each bit is whether
+ *  the block is brighter than the left neighbor.
+ */
+uint64_t
+calc_image_dhash (const uint8_t *rgba, int w, int h)
+{
+    uint32_t sum[8][9] = {{0}};
+    uint32_t cnt[8][9] = {{0}};
+    uint64_t hash = 0;
+
+    for (int y = 0; y < h; y ++)
+    {
+        int by = y * 8 / h;
+        const uint8_t *s = rgba + y * w * 4;
+
+        for (int x = 0; x < w; x ++)
+        {
+            int bx = x * 9 / w;
+            sum[by][bx] += s[0] + s[1] + s[2];
+            cnt[by][bx] ++;
+            s += 4;
+        }
+    }
+
+    for (int by = 0; by < 8; by ++)
+    {
+        for (int bx = 0; bx < 8; bx ++)
+        {
+            /* sum0 / cnt0 < sum1 / cnt1 */
+            uint64_t l = (uint64_t)sum[by][bx    ] * cnt[by][bx + 1];
+            uint64_t r = (uint64_t)sum[by][bx + 1] * cnt[by][bx    ];
+
+            hash <<= 1;
+            if (l < r)
+                hash |= 1;
+        }
+    }
+
+    return hash;
+}
@@ -0,0 +1,88 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_ROI_CACHE_H_
+#define _UTIL_ROI_CACHE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  cache of the per object model outputs (e.g. a generated face image),
+ *  to reuse them while the object stays still.
+ *
+ *    each entry is keyed by the ROI (cx, cy, w, h, rotation) and the
+ *    perceptual hash (dHash) of the crop, at the time the output was made.
+ *    the ROI of this frame is associated with the nearest entry (within the
+ *    size of the ROI), and the entry is reused when
+ *      - the center moved less than (pos_thresh) of the ROI size, and
+ *      - the size changed less than (pos_thresh), and
+ *      - the rotation changed less than ROI_CACHE_ROT_THRESH, and
+ *      - the hash differs in ROI_CACHE_HASH_THRESH bits or less, and
+ *      - it has been reused less than (max_age) frames (<= 0: no limit).
+ *    the comparisons are with the key of the output, not of the last frame,
+ *    so that slow changes add up.
+ *
+ *    the caller keeps the outputs in its own array of [ROI_CACHE_MAX_ENTRY],
+ *    indexed by the slot of the entry.
+ *
+ *      begin_roi_cache_frame ()
+ *      for each object:
+ *          if (!check_roi_cache (roi, hash, &slot))
+ *              run the model, and store the output to [slot]
+ *          use the output of [slot]
+ *      end_roi_cache_frame ()      the entries not seen for a while are freed.
+ */
+#define ROI_CACHE_MAX_ENTRY     16
+#define ROI_CACHE_ROT_THRESH    0.087f  /* [rad] 5 [deg] */
+#define ROI_CACHE_HASH_THRESH   6       /* of 64 bits */
+#define ROI_CACHE_MAX_MISS      2       /* frames an entry survives without its object */
+
+typedef struct _roi_cache_entry_t
+{
+    int         valid;
+    int         used;               /* checked in this frame */
+    int         miss;               /* frames without the object */
+    int         age;                /* frames the output has been reused */
+    float       roi[5];             /* cx, cy, w, h, rotation of the output */
+    uint64_t    hash;
+} roi_cache_entry_t;
+
+typedef struct _roi_cache_t
+{
+    float       pos_thresh;
+    int         max_age;
+
+    roi_cache_entry_t entry[ROI_CACHE_MAX_ENTRY];
+
+    /* stats */
+    int         num_hit;
+    int         num_miss;
+} roi_cache_t;
+
+void  init_roi_cache  (roi_cache_t *rc, float pos_thresh, int max_age);
+void  reset_roi_cache (roi_cache_t *rc);
+
+void  begin_roi_cache_frame (roi_cache_t *rc);
+void  end_roi_cache_frame   (roi_cache_t *rc);
+
+/*
+ *  returns 1 to reuse the output of (*slot), 0 to make a new one into (*slot).
+ *  (*slot) is -1 if all the entries are in use by this frame.
+ */
+int   check_roi_cache (roi_cache_t *rc, const float *roi, uint64_t hash, int *slot);
+
+float get_roi_cache_hit_rate (roi_cache_t *rc);
+
+/* 64 bit difference hash of the luma of the RGBA image. */
+uint64_t calc_image_dhash (const uint8_t *rgba, int w, int h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_ROI_CACHE_H_ */
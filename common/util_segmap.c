@@ -0,0 +1,563 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include "assertgl.h"
+#include "util_shader.h"
+#include "util_matrix.h"
+#include "util_worker.h"
+#include "util_segmap.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define SEGMAP_ROWS_PER_JOB     8
+
+
+/* -------------------------------------------------------------------- *
+ *  argmax of one pixel. (the first maximum for ties)
+ *    1st pass: the max value, 4 (16) channels at a time.
+ *    2nd pass: the first channel equal to the max.
+ * -------------------------------------------------------------------- */
+static inline int
+argmax_f32 (const float *p, int ch)
+{
+    float max_val = p[0];
+    int c = 0;
+
+#if defined (__SSE2__)
+    if (ch >= 4)
+    {
+        __m128 vmax = _mm_loadu_ps (p);
+        for (c = 4; c + 4 <= ch; c += 4)
+            vmax = _mm_max_ps (vmax, _mm_loadu_ps (&p[c]));
+
+        vmax = _mm_max_ps (vmax, _mm_shuffle_ps (vmax, vmax, _MM_SHUFFLE (1, 0, 3, 2)));
+        vmax = _mm_max_ps (vmax, _mm_shuffle_ps (vmax, vmax, _MM_SHUFFLE (2, 3, 0, 1)));
+        max_val = _mm_cvtss_f32 (vmax);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    if (ch >= 4)
+    {
+        float32x4_t vmax = vld1q_f32 (p);
+        for (c = 4; c + 4 <= ch; c += 4)
+            vmax = vmaxq_f32 (vmax, vld1q_f32 (&p[c]));
+
+        float32x2_t vmax2 = vpmax_f32 (vget_low_f32 (vmax), vget_high_f32 (vmax));
+        vmax2 = vpmax_f32 (vmax2, vmax2);
+        max_val = vget_lane_f32 (vmax2, 0);
+    }
+#endif
+
+    for (; c < ch; c ++)
+    {
+        if (p[c] > max_val)
+            max_val = p[c];
+    }
+
+    c = 0;
+#if defined (__SSE2__)
+    __m128 vref = _mm_set1_ps (max_val);
+    for (; c + 4 <= ch; c += 4)
+    {
+        int mask = _mm_movemask_ps (_mm_cmpeq_ps (_mm_loadu_ps (&p[c]), vref));
+        if (mask)
+            return c + __builtin_ctz (mask);
+    }
+#endif
+
+    for (; c < ch; c ++)
+    {
+        if (p[c] == max_val)
+            return c;
+    }
+    return 0;   /* NaN */
+}
+
+static inline int
+argmax_u8 (const uint8_t *p, int ch)
+{
+    uint8_t max_val = p[0];
+    int c = 0;
+
+#if defined (__SSE2__)
+    if (ch >= 16)
+    {
+        __m128i vmax = _mm_loadu_si128 ((const __m128i *)p);
+        for (c = 16; c + 16 <= ch; c += 16)
+            vmax = _mm_max_epu8 (vmax, _mm_loadu_si128 ((const __m128i *)&p[c]));
+
+        vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 8));
+        vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 4));
+        vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 2));
+        vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 1));
+        max_val = (uint8_t)_mm_cvtsi128_si32 (vmax);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    if (ch >= 16)
+    {
+        uint8x16_t vmax = vld1q_u8 (p);
+        for (c = 16; c + 16 <= ch; c += 16)
+            vmax = vmaxq_u8 (vmax, vld1q_u8 (&p[c]));
+
+        uint8x8_t vmax8 = vpmax_u8 (vget_low_u8 (vmax), vget_high_u8 (vmax));
+        vmax8 = vpmax_u8 (vmax8, vmax8);
+        vmax8 = vpmax_u8 (vmax8, vmax8);
+        vmax8 = vpmax_u8 (vmax8, vmax8);
+        max_val = vget_lane_u8 (vmax8, 0);
+    }
+#endif
+
+    for (; c < ch; c ++)
+    {
+        if (p[c] > max_val)
+            max_val = p[c];
+    }
+
+    c = 0;
+#if defined (__SSE2__)
+    __m128i vref = _mm_set1_epi8 ((char)max_val);
+    for (; c + 16 <= ch; c += 16)
+    {
+        int mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *)&p[c]), vref));
+        if (mask)
+            return c + __builtin_ctz (mask);
+    }
+#endif
+
+    for (; c < ch; c ++)
+    {
+        if (p[c] == max_val)
+            return c;
+    }
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  row parallel argmax + palette lookup
+ * -------------------------------------------------------------------- */
+typedef struct _argmax_job_t
+{
+    const void      *segmap;
+    int             is_float;
+    int             w, h, ch;
+    const uint32_t  *palette;
+    uint32_t        *dst;
+} argmax_job_t;
+
+static void
+argmax_rows_job (void *arg, int job_idx)
+{
+    argmax_job_t *job = (argmax_job_t *)arg;
+    int w  = job->w;
+    int ch = job->ch;
+    int y0 = job_idx * SEGMAP_ROWS_PER_JOB;
+    int y1 = y0 + SEGMAP_ROWS_PER_JOB;
+
+    if (y1 > job->h)
+        y1 = job->h;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        uint32_t *dst = &job->dst[y * w];
+
+        if (job->is_float)
+        {
+            const float *src = &((const float *)job->segmap)[y * w * ch];
+            for (int x = 0; x < w; x ++, src += ch)
+                dst[x] = job->palette[argmax_f32 (src, ch)];
+        }
+        else
+        {
+            const uint8_t *src = &((const uint8_t *)job->segmap)[y * w * ch];
+            for (int x = 0; x < w; x ++, src += ch)
+                dst[x] = job->palette[argmax_u8 (src, ch)];
+        }
+    }
+}
+
+static int
+run_argmax (const void *segmap, int is_float, int w, int h, int ch,
+            const uint32_t *palette, uint32_t *dst)
+{
+    argmax_job_t job;
+
+    if (ch <= 0 || ch > SEGMAP_MAX_CLASS)
+    {
+        fprintf (stderr, "ERR: %s(%d): ch=%d\n", __FILE__, __LINE__, ch);
+        return -1;
+    }
+
+    job.segmap   = segmap;
+    job.is_float = is_float;
+    job.w        = w;
+    job.h        = h;
+    job.ch       = ch;
+    job.palette  = palette;
+    job.dst      = dst;
+
+    int num_jobs = (h + SEGMAP_ROWS_PER_JOB - 1) / SEGMAP_ROWS_PER_JOB;
+    run_worker_jobs (argmax_rows_job, &job, num_jobs);
+
+    return 0;
+}
+
+int
+segmap_argmax_f32 (const float *segmap, int w, int h, int ch,
+                   const uint32_t *palette, uint32_t *dst)
+{
+    return run_argmax (segmap, 1, w, h, ch, palette, dst);
+}
+
+int
+segmap_argmax_u8 (const uint8_t *segmap, int w, int h, int ch,
+                  const uint32_t *palette, uint32_t *dst)
+{
+    return run_argmax (segmap, 0, w, h, ch, palette, dst);
+}
+
+uint32_t
+segmap_color_to_rgba (const float *col)
+{
+    uint32_t r = ((int)(col[0] * 255)) & 0xff;
+    uint32_t g = ((int)(col[1] * 255)) & 0xff;
+    uint32_t b = ((int)(col[2] * 255)) & 0xff;
+    uint32_t a = ((int)(col[3] * 255)) & 0xff;
+
+    return (a << 24) | (b << 16) | (g << 8) | (r);
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  streaming texture
+ * -------------------------------------------------------------------- */
+int
+update_segmap_texture (segmap_texture_t *tex, const void *imgbuf, int w, int h, uint32_t glfmt)
+{
+    glPixelStorei (GL_UNPACK_ALIGNMENT, (glfmt == GL_RGBA) ? 4 : 1);
+
+    if (tex->texid == 0 || tex->width != w || tex->height != h || tex->glfmt != glfmt)
+    {
+        GLuint texid = tex->texid;
+
+        if (texid == 0)
+            glGenTextures (1, &texid);
+        glBindTexture (GL_TEXTURE_2D, texid);
+
+        glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glTexImage2D (GL_TEXTURE_2D, 0, glfmt, w, h, 0, glfmt, GL_UNSIGNED_BYTE, imgbuf);
+
+        tex->texid  = texid;
+        tex->width  = w;
+        tex->height = h;
+        tex->glfmt  = glfmt;
+    }
+    else
+    {
+        glBindTexture (GL_TEXTURE_2D, tex->texid);
+        glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, w, h, glfmt, GL_UNSIGNED_BYTE, imgbuf);
+    }
+
+    GLASSERT ();
+    return 0;
+}
+
+int
+delete_segmap_texture (segmap_texture_t *tex)
+{
+    if (tex->texid)
+    {
+        GLuint texid = tex->texid;
+        glDeleteTextures (1, &texid);
+    }
+    memset (tex, 0, sizeof (*tex));
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  argmax on GPU
+ *
+ *    the map is uploaded as a (w * groups) x (h) RGBA texture,
+ *    texel (x * groups + g, y) holds the channels [4g, 4g + 3].
+ * -------------------------------------------------------------------- */
+
+static char vs_segmap[] = "                           \n\
+attribute    vec4    a_Vertex;                        \n\
+attribute    vec2    a_TexCoord;                      \n\
+varying      vec2    v_TexCoord;                      \n\
+uniform      mat4    u_PMVMatrix;                     \n\
+                                                      \n\
+void main (void)                                      \n\
+{                                                     \n\
+    gl_Position = u_PMVMatrix * a_Vertex;             \n\
+    v_TexCoord  = a_TexCoord;                         \n\
+}                                                     \n";
+
+static char fs_segmap[] = "                           \n\
+#ifdef GL_FRAGMENT_PRECISION_HIGH                     \n\
+precision highp float;                                \n\
+#else                                                 \n\
+precision mediump float;                              \n\
+#endif                                                \n\
+varying     vec2      v_TexCoord;                     \n\
+uniform     sampler2D u_sampler;                      \n\
+uniform     sampler2D u_palette;                      \n\
+uniform     vec2      u_TexDim;     /* (w, h) */      \n\
+uniform     float     u_Groups;                       \n\
+uniform     float     u_NumClass;                     \n\
+                                                      \n\
+void main (void)                                      \n\
+{                                                     \n\
+    vec2  pix   = floor (v_TexCoord * u_TexDim);      \n\
+    float row_w = u_TexDim.x * u_Groups;              \n\
+    float v     = (pix.y + 0.5) / u_TexDim.y;         \n\
+    float max_val = 0.0;                              \n\
+    float max_id  = 0.0;                              \n\
+                                                      \n\
+    for (int g = 0; g < 8; g ++)                      \n\
+    {                                                 \n\
+        float c = float(g) * 4.0;                     \n\
+        if (c >= u_NumClass)                          \n\
+            break;                                    \n\
+                                                      \n\
+        float u  = (pix.x * u_Groups + float(g) + 0.5) / row_w; \n\
+        vec4 val = texture2D (u_sampler, vec2 (u, v));\n\
+                                                      \n\
+        if (g == 0 || val.x > max_val) { max_val = val.x; max_id = c; } \n\
+        if (c + 1.0 < u_NumClass && val.y > max_val) { max_val = val.y; max_id = c + 1.0; } \n\
+        if (c + 2.0 < u_NumClass && val.z > max_val) { max_val = val.z; max_id = c + 2.0; } \n\
+        if (c + 3.0 < u_NumClass && val.w > max_val) { max_val = val.w; max_id = c + 3.0; } \n\
+    }                                                 \n\
+                                                      \n\
+    vec2 uv_pal  = vec2 ((max_id + 0.5) / 32.0, 0.5); \n\
+    gl_FragColor = texture2D (u_palette, uv_pal);     \n\
+}                                                     \n";
+
+static shader_obj_t s_sobj;
+static int          s_loc_mtx;
+static int          s_loc_texdim;
+static int          s_loc_groups;
+static int          s_loc_numclass;
+static int          s_loc_tex0;
+static int          s_loc_tex1;
+static int          s_gpu_initialized;
+static int          s_float_tex_supported;
+
+static GLuint       s_texid_map;
+static GLuint       s_texid_palette;
+static int          s_map_w, s_map_h, s_map_isfloat;
+static void         *s_repack_buf;
+static int          s_repack_size;
+
+static float varray[] =
+{   0.0, 0.0,
+    0.0, 1.0,
+    1.0, 0.0,
+    1.0, 1.0 };
+
+static float tarray[] =
+{   0.0, 0.0,
+    0.0, 1.0,
+    1.0, 0.0,
+    1.0, 1.0 };
+
+static float s_matprj[16];
+static int
+set_projection_matrix (int w, int h)
+{
+    float mat_proj[] =
+    {
+       0.0f, 0.0f, 0.0f, 0.0f,
+       0.0f, 0.0f, 0.0f, 0.0f,
+       0.0f, 0.0f, 0.0f, 0.0f,
+      -1.0f, 1.0f, 0.0f, 1.0f};
+
+    mat_proj[0] =  2.0f / (float)w;
+    mat_proj[5] = -2.0f / (float)h;
+
+    memcpy (s_matprj, mat_proj, 16*sizeof(float));
+
+    return 0;
+}
+
+static GLuint
+create_nearest_texture ()
+{
+    GLuint texid;
+
+    glGenTextures (1, &texid);
+    glBindTexture (GL_TEXTURE_2D, texid);
+
+    /* the class ids must not be interpolated. */
+    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    return texid;
+}
+
+int
+init_segmap_gpu (int win_w, int win_h)
+{
+    if (generate_shader (&s_sobj, vs_segmap, fs_segmap) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    s_loc_mtx      = glGetUniformLocation (s_sobj.program, "u_PMVMatrix");
+    s_loc_texdim   = glGetUniformLocation (s_sobj.program, "u_TexDim");
+    s_loc_groups   = glGetUniformLocation (s_sobj.program, "u_Groups");
+    s_loc_numclass = glGetUniformLocation (s_sobj.program, "u_NumClass");
+    s_loc_tex0     = glGetUniformLocation (s_sobj.program, "u_sampler");
+    s_loc_tex1     = glGetUniformLocation (s_sobj.program, "u_palette");
+
+    const char *ext = (const char *)glGetString (GL_EXTENSIONS);
+    s_float_tex_supported = (ext && strstr (ext, "GL_OES_texture_float") != NULL);
+
+    s_texid_map     = create_nearest_texture ();
+    s_texid_palette = create_nearest_texture ();
+
+    set_projection_matrix (win_w, win_h);
+    s_gpu_initialized = 1;
+
+    GLASSERT ();
+    return 0;
+}
+
+int
+segmap_gpu_supported (int is_float)
+{
+    if (!s_gpu_initialized)
+        return 0;
+
+    return is_float ? s_float_tex_supported : 1;
+}
+
+/* pad the channels to the multiple of 4. */
+static const void *
+repack_segmap (const void *segmap, int elem_size, int w, int h, int ch, int groups)
+{
+    int ch4 = groups * 4;
+
+    if (ch == ch4)
+        return segmap;
+
+    int size = w * h * ch4 * elem_size;
+    if (size > s_repack_size)
+    {
+        free (s_repack_buf);
+        s_repack_buf  = calloc (1, size);
+        s_repack_size = s_repack_buf ? size : 0;
+        if (s_repack_buf == NULL)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            return NULL;
+        }
+    }
+
+    const uint8_t *src = (const uint8_t *)segmap;
+    uint8_t       *dst = (uint8_t *)s_repack_buf;
+    for (int i = 0; i < w * h; i ++)
+    {
+        memcpy (dst, src, ch * elem_size);
+        src += ch  * elem_size;
+        dst += ch4 * elem_size;
+    }
+
+    return s_repack_buf;
+}
+
+int
+draw_segmap_gpu (const void *segmap, int is_float, int w, int h, int ch,
+                 const uint32_t *palette, int x, int y, int draw_w, int draw_h)
+{
+    if (!segmap_gpu_supported (is_float) || ch <= 0 || ch > SEGMAP_MAX_CLASS)
+        return -1;
+
+    int groups    = (ch + 3) / 4;
+    int elem_size = is_float ? sizeof (float) : sizeof (uint8_t);
+    GLenum gltype = is_float ? GL_FLOAT : GL_UNSIGNED_BYTE;
+
+    const void *texbuf = repack_segmap (segmap, elem_size, w, h, ch, groups);
+    if (texbuf == NULL)
+        return -1;
+
+    /* upload the raw map. */
+    glActiveTexture (GL_TEXTURE0);
+    glBindTexture (GL_TEXTURE_2D, s_texid_map);
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+    if (s_map_w != w || s_map_h != h || s_map_isfloat != is_float)
+    {
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, w * groups, h, 0, GL_RGBA, gltype, texbuf);
+        s_map_w = w;
+        s_map_h = h;
+        s_map_isfloat = is_float;
+    }
+    else
+    {
+        glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, w * groups, h, GL_RGBA, gltype, texbuf);
+    }
+
+    /* palette: (32 x 1) */
+    uint32_t pal[SEGMAP_MAX_CLASS] = {0};
+    memcpy (pal, palette, ch * sizeof (uint32_t));
+    glActiveTexture (GL_TEXTURE1);
+    glBindTexture (GL_TEXTURE_2D, s_texid_palette);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, SEGMAP_MAX_CLASS, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pal);
+
+    glUseProgram (s_sobj.program);
+    glUniform1i (s_loc_tex0, 0);
+    glUniform1i (s_loc_tex1, 1);
+
+    float matrix[16];
+    matrix_identity (matrix);
+    matrix_translate (matrix, x, y, 0.0f);
+    matrix_scale (matrix, draw_w, draw_h, 1.0f);
+    matrix_mult (matrix, s_matprj, matrix);
+    glUniformMatrix4fv (s_loc_mtx, 1, GL_FALSE, matrix);
+
+    float texdim[2] = {(float)w, (float)h};
+    glUniform2fv (s_loc_texdim, 1, texdim);
+    glUniform1f (s_loc_groups, (float)groups);
+    glUniform1f (s_loc_numclass, (float)ch);
+
+    if (s_sobj.loc_uv >= 0)
+    {
+        glEnableVertexAttribArray (s_sobj.loc_uv);
+        glVertexAttribPointer (s_sobj.loc_uv, 2, GL_FLOAT, GL_FALSE, 0, tarray);
+    }
+    if (s_sobj.loc_vtx >= 0)
+    {
+        glEnableVertexAttribArray (s_sobj.loc_vtx);
+        glVertexAttribPointer (s_sobj.loc_vtx, 2, GL_FLOAT, GL_FALSE, 0, varray);
+    }
+
+    glEnable (GL_BLEND);
+    glBlendFuncSeparate (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+                         GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+
+    glDisable (GL_BLEND);
+    glActiveTexture (GL_TEXTURE0);
+
+    GLASSERT ();
+    return 0;
+}
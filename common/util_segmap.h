@@ -0,0 +1,64 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_SEGMAP_H_
+#define _UTIL_SEGMAP_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  post-process of the segmentation map (channel last: [h][w][ch]).
+ *
+ *    segmap_argmax_xxx() finds the most confident class of each pixel
+ *    (the first one for ties), and writes (palette[class]) to (dst).
+ *    the rows are split among the worker threads (util_worker).
+ *
+ *    palette: RGBA8888 in memory order. (r | g << 8 | b << 16 | a << 24)
+ */
+#define SEGMAP_MAX_CLASS    32
+
+int segmap_argmax_f32 (const float   *segmap, int w, int h, int ch,
+                       const uint32_t *palette, uint32_t *dst);
+int segmap_argmax_u8  (const uint8_t *segmap, int w, int h, int ch,
+                       const uint32_t *palette, uint32_t *dst);
+
+uint32_t segmap_color_to_rgba (const float *col);
+
+
+/*
+ *  texture updated every frame.
+ *    allocated at the first update (and when the size changes),
+ *    then updated with glTexSubImage2D().
+ */
+typedef struct _segmap_texture_t
+{
+    uint32_t    texid;
+    int         width;
+    int         height;
+    uint32_t    glfmt;      /* GL_RGBA or GL_LUMINANCE */
+} segmap_texture_t;
+
+int update_segmap_texture (segmap_texture_t *tex, const void *imgbuf, int w, int h, uint32_t glfmt);
+int delete_segmap_texture (segmap_texture_t *tex);
+
+
+/*
+ *  (optional) argmax and palette lookup in the fragment shader.
+ *    the raw map is uploaded as is (4 channels per texel), and the float map
+ *    needs GL_OES_texture_float. returns -1 if not supported.
+ */
+int init_segmap_gpu (int win_w, int win_h);
+int segmap_gpu_supported (int is_float);
+int draw_segmap_gpu (const void *segmap, int is_float, int w, int h, int ch,
+                     const uint32_t *palette, int x, int y, int draw_w, int draw_h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_SEGMAP_H_ */
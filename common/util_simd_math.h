@@ -0,0 +1,159 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_SIMD_MATH_H_
+#define _UTIL_SIMD_MATH_H_
+
+#include <math.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/*
+ *  exp() of 4 lanes (Cephes polynomial, rel. error < 2e-7 in the clamped range).
+ *      exp(x) = 2^n * exp(r),  n = floor(x / ln2 + 0.5),  r = x - n * ln2
+ */
+#if defined (__SSE2__)
+static inline __m128
+exp_ps (__m128 x)
+{
+    x = _mm_min_ps (x, _mm_set1_ps ( 88.0f));
+    x = _mm_max_ps (x, _mm_set1_ps (-87.0f));
+
+    __m128 fx = _mm_add_ps (_mm_mul_ps (x, _mm_set1_ps (1.44269504088896341f)), _mm_set1_ps (0.5f));
+    __m128 tf = _mm_cvtepi32_ps (_mm_cvttps_epi32 (fx));
+    tf = _mm_sub_ps (tf, _mm_and_ps (_mm_cmpgt_ps (tf, fx), _mm_set1_ps (1.0f)));
+
+    x = _mm_sub_ps (x, _mm_mul_ps (tf, _mm_set1_ps (0.693359375f)));
+    x = _mm_sub_ps (x, _mm_mul_ps (tf, _mm_set1_ps (-2.12194440e-4f)));
+
+    __m128 z = _mm_mul_ps (x, x);
+    __m128 y = _mm_set1_ps (1.9875691500E-4f);
+    y = _mm_add_ps (_mm_mul_ps (y, x), _mm_set1_ps (1.3981999507E-3f));
+    y = _mm_add_ps (_mm_mul_ps (y, x), _mm_set1_ps (8.3334519073E-3f));
+    y = _mm_add_ps (_mm_mul_ps (y, x), _mm_set1_ps (4.1665795894E-2f));
+    y = _mm_add_ps (_mm_mul_ps (y, x), _mm_set1_ps (1.6666665459E-1f));
+    y = _mm_add_ps (_mm_mul_ps (y, x), _mm_set1_ps (5.0000001201E-1f));
+    y = _mm_add_ps (_mm_add_ps (_mm_mul_ps (y, z), x), _mm_set1_ps (1.0f));
+
+    __m128i e = _mm_slli_epi32 (_mm_add_epi32 (_mm_cvttps_epi32 (tf), _mm_set1_epi32 (127)), 23);
+    return _mm_mul_ps (y, _mm_castsi128_ps (e));
+}
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+static inline float32x4_t
+exp_ps (float32x4_t x)
+{
+    x = vminq_f32 (x, vdupq_n_f32 ( 88.0f));
+    x = vmaxq_f32 (x, vdupq_n_f32 (-87.0f));
+
+    float32x4_t fx = vmlaq_f32 (vdupq_n_f32 (0.5f), x, vdupq_n_f32 (1.44269504088896341f));
+    float32x4_t tf = vcvtq_f32_s32 (vcvtq_s32_f32 (fx));
+    uint32x4_t  gt = vcgtq_f32 (tf, fx);
+    tf = vsubq_f32 (tf, vreinterpretq_f32_u32 (vandq_u32 (gt, vreinterpretq_u32_f32 (vdupq_n_f32 (1.0f)))));
+
+    x = vmlsq_f32 (x, tf, vdupq_n_f32 (0.693359375f));
+    x = vmlsq_f32 (x, tf, vdupq_n_f32 (-2.12194440e-4f));
+
+    float32x4_t z = vmulq_f32 (x, x);
+    float32x4_t y = vdupq_n_f32 (1.9875691500E-4f);
+    y = vmlaq_f32 (vdupq_n_f32 (1.3981999507E-3f), y, x);
+    y = vmlaq_f32 (vdupq_n_f32 (8.3334519073E-3f), y, x);
+    y = vmlaq_f32 (vdupq_n_f32 (4.1665795894E-2f), y, x);
+    y = vmlaq_f32 (vdupq_n_f32 (1.6666665459E-1f), y, x);
+    y = vmlaq_f32 (vdupq_n_f32 (5.0000001201E-1f), y, x);
+    y = vaddq_f32 (vmlaq_f32 (x, y, z), vdupq_n_f32 (1.0f));
+
+    int32x4_t e = vshlq_n_s32 (vaddq_s32 (vcvtq_s32_f32 (tf), vdupq_n_s32 (127)), 23);
+    return vmulq_f32 (y, vreinterpretq_f32_s32 (e));
+}
+#endif
+
+/* dst[i] = exp (src[i]). (src) and (dst) may be the same. */
+static inline void
+vexp (const float *src, float *dst, int num)
+{
+    int i = 0;
+
+#if defined (__SSE2__)
+    for (; i + 4 <= num; i += 4)
+        _mm_storeu_ps (&dst[i], exp_ps (_mm_loadu_ps (&src[i])));
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (; i + 4 <= num; i += 4)
+        vst1q_f32 (&dst[i], exp_ps (vld1q_f32 (&src[i])));
+#endif
+
+    for (; i < num; i ++)
+        dst[i] = expf (src[i]);
+}
+
+/*
+ *  dst[i] = 1 / (1 + exp (-src[i])), with the cutoffs of the TFLite reference logistic:
+ *      x > 16.619 : 1.0,   x < -9.0 : exp (x)
+ *  one exp() per lane: t = exp (-|x|),  x >= 0 : 1 / (1 + t),  x < 0 : t / (1 + t)
+ */
+static inline float
+sigmoidf (float x)
+{
+    if (x > 16.619047164916992188f)
+        return 1.0f;
+    if (x < -9.0f)
+        return expf (x);
+    return 1.0f / (1.0f + expf (-x));
+}
+
+static inline void
+vsigmoid (const float *src, float *dst, int num)
+{
+    int i = 0;
+
+#if defined (__SSE2__)
+    const __m128 one   = _mm_set1_ps (1.0f);
+    const __m128 upper = _mm_set1_ps (16.619047164916992188f);
+    const __m128 lower = _mm_set1_ps (-9.0f);
+    const __m128 sign  = _mm_set1_ps (-0.0f);
+    for (; i + 4 <= num; i += 4)
+    {
+        __m128 x   = _mm_loadu_ps (&src[i]);
+        __m128 t   = exp_ps (_mm_or_ps (x, sign));      /* exp (-|x|) */
+        __m128 inv = _mm_div_ps (one, _mm_add_ps (one, t));
+        __m128 neg = _mm_cmplt_ps (x, _mm_setzero_ps ());
+        __m128 y   = _mm_or_ps (_mm_and_ps (neg, _mm_mul_ps (t, inv)), _mm_andnot_ps (neg, inv));
+
+        __m128 lo  = _mm_cmplt_ps (x, lower);
+        __m128 hi  = _mm_cmpgt_ps (x, upper);
+        y = _mm_or_ps (_mm_and_ps (lo, t), _mm_andnot_ps (lo, y));
+        y = _mm_or_ps (_mm_and_ps (hi, one), _mm_andnot_ps (hi, y));
+        _mm_storeu_ps (&dst[i], y);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    const float32x4_t one   = vdupq_n_f32 (1.0f);
+    const float32x4_t upper = vdupq_n_f32 (16.619047164916992188f);
+    const float32x4_t lower = vdupq_n_f32 (-9.0f);
+    for (; i + 4 <= num; i += 4)
+    {
+        float32x4_t x   = vld1q_f32 (&src[i]);
+        float32x4_t t   = exp_ps (vnegq_f32 (vabsq_f32 (x)));
+        float32x4_t d   = vaddq_f32 (one, t);
+#if defined (__aarch64__)
+        float32x4_t inv = vdivq_f32 (one, d);
+#else
+        float32x4_t inv = vrecpeq_f32 (d);
+        inv = vmulq_f32 (inv, vrecpsq_f32 (d, inv));
+        inv = vmulq_f32 (inv, vrecpsq_f32 (d, inv));
+#endif
+        float32x4_t y   = vbslq_f32 (vcltq_f32 (x, vdupq_n_f32 (0.0f)), vmulq_f32 (t, inv), inv);
+        y = vbslq_f32 (vcltq_f32 (x, lower), t,   y);
+        y = vbslq_f32 (vcgtq_f32 (x, upper), one, y);
+        vst1q_f32 (&dst[i], y);
+    }
+#endif
+
+    for (; i < num; i ++)
+        dst[i] = sigmoidf (src[i]);
+}
+
+#endif /* _UTIL_SIMD_MATH_H_ */
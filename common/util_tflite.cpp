@@ -222,6 +222,11 @@ modify_graph_with_delegate (tflite_interpreter_t *p, tflite_createopt_t *opt)
     if (!delegate)
         return 0;
 
+    /* NNAPI delegate is a singleton, and the hexagon one is owned by delegatep. */
+#if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2) || defined (USE_XNNPACK_DELEGATE)
+    p->delegate = delegate;
+#endif
+
     if (p->interpreter->ModifyGraphWithDelegate(delegate) != kTfLiteOk)
     {
         DBG_LOGE ("ERR: %s(%d)\n", __FILE__, __LINE__);
@@ -313,6 +318,30 @@ tflite_create_interpreter_ex_from_file (tflite_interpreter_t *p, const char *mod
 }
 
 
+void
+tflite_delete_interpreter (tflite_interpreter_t *p)
+{
+    /* the interpreter refers to the delegate and the model. */
+    p->interpreter.reset ();
+
+    if (p->delegate)
+    {
+#if defined (USE_GL_DELEGATE)
+        TfLiteGpuDelegateDelete (p->delegate);
+#endif
+#if defined (USE_GPU_DELEGATEV2)
+        TfLiteGpuDelegateV2Delete (p->delegate);
+#endif
+#if defined (USE_XNNPACK_DELEGATE)
+        TfLiteXNNPackDelegateDelete (p->delegate);
+#endif
+        p->delegate = NULL;
+    }
+
+    p->model.reset ();
+}
+
+
 int
 tflite_get_tensor_by_name (tflite_interpreter_t *p, int io, const char *name, tflite_tensor_t *ptensor)
 {
@@ -36,6 +36,7 @@ typedef struct tflite_interpreter_t
     std::unique_ptr<tflite::FlatBufferModel> model;
     std::unique_ptr<tflite::Interpreter>     interpreter;
     tflite::ops::builtin::BuiltinOpResolver  resolver;
+    TfLiteDelegate                           *delegate;  /* owned, deleted by tflite_delete_interpreter() */
 } tflite_interpreter_t;
 
 typedef struct tflite_createopt_t
@@ -63,6 +64,9 @@ int tflite_get_tensor_by_name (tflite_interpreter_t *p, int io, const char *name
 int tflite_create_interpreter_from_file (tflite_interpreter_t *p, const char *model_path);
 int tflite_create_interpreter_ex_from_file (tflite_interpreter_t *p, const char *model_path, tflite_createopt_t *opt);
 
+/* frees the interpreter, its delegate and the model, to create it again. */
+void tflite_delete_interpreter (tflite_interpreter_t *p);
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,267 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "util_topk.h"
+#include "util_simd_math.h"
+
+
+/* -------------------------------------------------------------------- *
+ *  min-heap of the (k) best entries. the root is the worst one.
+ * -------------------------------------------------------------------- */
+
+/* (a) is worse than (b): the lower score, or the same score with the larger id. */
+static inline int
+is_worse (const topk_item_t *a, const topk_item_t *b)
+{
+    if (a->score != b->score)
+        return a->score < b->score;
+    return a->id > b->id;
+}
+
+static void
+sift_down (topk_item_t *heap, int num, int i)
+{
+    topk_item_t item = heap[i];
+
+    while (1)
+    {
+        int child = 2 * i + 1;
+        if (child >= num)
+            break;
+
+        if (child + 1 < num && is_worse (&heap[child + 1], &heap[child]))
+            child ++;
+
+        if (!is_worse (&heap[child], &item))
+            break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = item;
+}
+
+static void
+heapify (topk_item_t *heap, int num)
+{
+    for (int i = num / 2 - 1; i >= 0; i --)
+        sift_down (heap, num, i);
+}
+
+/* heap --> descending order (the best first) */
+static void
+sort_heap (topk_item_t *heap, int num)
+{
+    for (int n = num - 1; n > 0; n --)
+    {
+        topk_item_t tmp = heap[0];
+        heap[0] = heap[n];
+        heap[n] = tmp;
+        sift_down (heap, n, 0);
+    }
+}
+
+/*
+ *  the later entry has the larger id, so it replaces the root only when
+ *  its score is strictly higher.
+ */
+static inline void
+push_item (topk_item_t *heap, int k, int id, float score)
+{
+    if (score > heap[0].score)
+    {
+        heap[0].id    = id;
+        heap[0].score = score;
+        sift_down (heap, k, 0);
+    }
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  selection
+ * -------------------------------------------------------------------- */
+static int
+select_topk_f32 (const float *val, int num, int k, topk_item_t *heap)
+{
+    if (k > num)
+        k = num;
+    if (k <= 0)
+        return 0;
+
+    for (int i = 0; i < k; i ++)
+    {
+        heap[i].id    = i;
+        heap[i].score = val[i];
+    }
+    heapify (heap, k);
+
+    int i = k;
+#if defined (__SSE2__)
+    for (; i + 4 <= num; i += 4)
+    {
+        /* skip the block when no score beats the k-th one. */
+        __m128 vth = _mm_set1_ps (heap[0].score);
+        if (!_mm_movemask_ps (_mm_cmpgt_ps (_mm_loadu_ps (&val[i]), vth)))
+            continue;
+
+        for (int j = i; j < i + 4; j ++)
+            push_item (heap, k, j, val[j]);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (; i + 4 <= num; i += 4)
+    {
+        uint32x4_t gt = vcgtq_f32 (vld1q_f32 (&val[i]), vdupq_n_f32 (heap[0].score));
+        uint32x2_t gt2 = vorr_u32 (vget_low_u32 (gt), vget_high_u32 (gt));
+        if (!(vget_lane_u32 (gt2, 0) | vget_lane_u32 (gt2, 1)))
+            continue;
+
+        for (int j = i; j < i + 4; j ++)
+            push_item (heap, k, j, val[j]);
+    }
+#endif
+
+    for (; i < num; i ++)
+        push_item (heap, k, i, val[i]);
+
+    sort_heap (heap, k);
+    return k;
+}
+
+static int
+select_topk_u8 (const uint8_t *val, int num, int k, topk_item_t *heap)
+{
+    if (k > num)
+        k = num;
+    if (k <= 0)
+        return 0;
+
+    for (int i = 0; i < k; i ++)
+    {
+        heap[i].id    = i;
+        heap[i].score = val[i];
+    }
+    heapify (heap, k);
+
+    int i = k;
+#if defined (__SSE2__)
+    for (; i + 16 <= num; i += 16)
+    {
+        /* max (v, th) == th  <==>  v <= th */
+        __m128i vth = _mm_set1_epi8 ((char)(uint8_t)heap[0].score);
+        __m128i v   = _mm_loadu_si128 ((const __m128i *)&val[i]);
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_max_epu8 (v, vth), vth)) == 0xFFFF)
+            continue;
+
+        for (int j = i; j < i + 16; j ++)
+            push_item (heap, k, j, val[j]);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (; i + 16 <= num; i += 16)
+    {
+        uint8x16_t gt  = vcgtq_u8 (vld1q_u8 (&val[i]), vdupq_n_u8 ((uint8_t)heap[0].score));
+        uint8x8_t  gt8 = vorr_u8 (vget_low_u8 (gt), vget_high_u8 (gt));
+        if (vget_lane_u64 (vreinterpret_u64_u8 (gt8), 0) == 0)
+            continue;
+
+        for (int j = i; j < i + 16; j ++)
+            push_item (heap, k, j, val[j]);
+    }
+#endif
+
+    for (; i < num; i ++)
+        push_item (heap, k, i, val[i]);
+
+    sort_heap (heap, k);
+    return k;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  API
+ * -------------------------------------------------------------------- */
+int
+topk_f32 (const float *val, int num, int k, topk_item_t *out)
+{
+    return select_topk_f32 (val, num, k, out);
+}
+
+int
+topk_u8 (const uint8_t *val, int num, int k, float scale, float zerop, topk_item_t *out)
+{
+    int num_out = select_topk_u8 (val, num, k, out);
+
+    /* dequantize the winners only. */
+    for (int i = 0; i < num_out; i ++)
+        out[i].score = (out[i].score - zerop) * scale;
+
+    return num_out;
+}
+
+int
+topk_f32_softmax (const float *logits, int num, int k, topk_item_t *out)
+{
+    /* softmax is monotonic. select on the logits. */
+    int num_out = select_topk_f32 (logits, num, k, out);
+    if (num_out <= 0)
+        return 0;
+
+    /* the denominator needs all the entries. exp (x - max) for the stability. */
+    float max_val = out[0].score;
+    float sum = 0.0f;
+    int i = 0;
+
+#if defined (__SSE2__)
+    __m128 vmax = _mm_set1_ps (max_val);
+    __m128 vsum = _mm_setzero_ps ();
+    for (; i + 4 <= num; i += 4)
+        vsum = _mm_add_ps (vsum, exp_ps (_mm_sub_ps (_mm_loadu_ps (&logits[i]), vmax)));
+
+    float lane[4];
+    _mm_storeu_ps (lane, vsum);
+    sum = lane[0] + lane[1] + lane[2] + lane[3];
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t vmax = vdupq_n_f32 (max_val);
+    float32x4_t vsum = vdupq_n_f32 (0.0f);
+    for (; i + 4 <= num; i += 4)
+        vsum = vaddq_f32 (vsum, exp_ps (vsubq_f32 (vld1q_f32 (&logits[i]), vmax)));
+
+    float lane[4];
+    vst1q_f32 (lane, vsum);
+    sum = lane[0] + lane[1] + lane[2] + lane[3];
+#endif
+
+    for (; i < num; i ++)
+        sum += expf (logits[i] - max_val);
+
+    for (int n = 0; n < num_out; n ++)
+        out[n].score = expf (out[n].score - max_val) / sum;
+
+    return num_out;
+}
+
+int
+topk_batch_f32 (const float *val, int num_batch, int stride, int num, int k, topk_item_t *out)
+{
+    int num_out = 0;
+
+    for (int b = 0; b < num_batch; b ++)
+        num_out = topk_f32 (&val[b * stride], num, k, &out[b * k]);
+
+    return num_out;
+}
+
+int
+topk_batch_u8 (const uint8_t *val, int num_batch, int stride, int num, int k,
+               float scale, float zerop, topk_item_t *out)
+{
+    int num_out = 0;
+
+    for (int b = 0; b < num_batch; b ++)
+        num_out = topk_u8 (&val[b * stride], num, k, scale, zerop, &out[b * k]);
+
+    return num_out;
+}
@@ -0,0 +1,52 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_TOPK_H_
+#define _UTIL_TOPK_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  Top-K selection of the classifier output.
+ *
+ *    the (k) best entries are kept in a min-heap while the scores are
+ *    scanned, and a block of scores is skipped when none of them beats
+ *    the current k-th score. the result is in descending score order,
+ *    the smaller id first for ties (the same as a stable sort).
+ *
+ *    topk_u8 () selects on the raw quantized values (scale > 0), and dequantizes
+ *    only the winners:  score = (val - zerop) * scale
+ *
+ *  returns the number of the selected entries (min (k, num)).
+ */
+typedef struct _topk_item_t
+{
+    int     id;
+    float   score;
+} topk_item_t;
+
+int topk_f32 (const float   *val, int num, int k, topk_item_t *out);
+int topk_u8  (const uint8_t *val, int num, int k, float scale, float zerop, topk_item_t *out);
+
+/* select on the logits, and return the softmax probability of the winners. */
+int topk_f32_softmax (const float *logits, int num, int k, topk_item_t *out);
+
+/*
+ *  multi-crop (batched) variants.
+ *    (val) holds (num_batch) rows of (num) scores, (stride) elements apart.
+ *    out[b * k + i]: i-th entry of the batch (b). returns min (k, num).
+ */
+int topk_batch_f32 (const float   *val, int num_batch, int stride, int num, int k, topk_item_t *out);
+int topk_batch_u8  (const uint8_t *val, int num_batch, int stride, int num, int k,
+                    float scale, float zerop, topk_item_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_TOPK_H_ */
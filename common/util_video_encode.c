@@ -0,0 +1,522 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/time.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include "util_egl.h"
+#include "util_video_encode.h"
+
+/*
+ *  encode pipeline:
+ *
+ *    [render thread] --(PBO ring)--> [render thread, VENC_PBO_NUM frames later]
+ *                    --(RGBA frame queue)--> [encode thread] --> file
+ *
+ *  the render thread never waits for the encoder. when the queue is full,
+ *  the frame is dropped and counted.
+ */
+#define VENC_QUEUE_DEPTH    8
+#define VENC_PBO_NUM        3       /* a PBO is mapped this many frames after its readback */
+
+/* GLES 3.0 symbols, resolved at runtime not to depend on GLES3 at link time. */
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER    0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ          0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT         0x0001
+#endif
+
+typedef void *    (*PFN_glMapBufferRange) (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLboolean (*PFN_glUnmapBuffer)    (GLenum target);
+
+static PFN_glMapBufferRange     s_glMapBufferRange;
+static PFN_glUnmapBuffer        s_glUnmapBuffer;
+
+static pthread_t        s_encode_thread;
+static pthread_mutex_t  s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   s_cond  = PTHREAD_COND_INITIALIZER;
+
+static AVFormatContext  *s_fmt_ctx;
+static AVCodecContext   *s_enc_ctx;
+static AVStream         *s_video_st;
+static AVFrame          *s_enc_frame;
+static struct SwsContext *s_sws_ctx;
+static int              s_width, s_height;
+static int64_t          s_last_pts = -1;
+
+/* RGBA frame queue (bottom-up, as read by glReadPixels) */
+static uint8_t          *s_rgba_buf[VENC_QUEUE_DEPTH];
+static int64_t          s_rgba_pts[VENC_QUEUE_DEPTH];
+static int              s_queue_head;
+static int              s_queue_num;
+static int              s_queue_eos;
+
+/* PBO ring */
+static int              s_use_pbo;
+static GLuint           s_pbo[VENC_PBO_NUM];
+static int64_t          s_pbo_pts[VENC_PBO_NUM];
+static int              s_pbo_busy[VENC_PBO_NUM];
+static int              s_pbo_idx;
+
+/* statistics */
+static int              s_stat_captured;
+static int              s_stat_encoded;
+static int              s_stat_dropped;
+
+
+/* -------------------------------------------------------------------- *
+ *  RGBA frame queue
+ * -------------------------------------------------------------------- */
+/* never blocks. returns -1 when the queue is full. */
+static int
+queue_try_get_free ()
+{
+    int slot = -1;
+
+    pthread_mutex_lock (&s_mutex);
+    if (s_queue_num < VENC_QUEUE_DEPTH)
+        slot = (s_queue_head + s_queue_num) % VENC_QUEUE_DEPTH;
+    pthread_mutex_unlock (&s_mutex);
+
+    return slot;
+}
+
+static void
+queue_push ()
+{
+    pthread_mutex_lock (&s_mutex);
+    s_queue_num ++;
+    pthread_cond_broadcast (&s_cond);
+    pthread_mutex_unlock (&s_mutex);
+}
+
+static int
+queue_peek ()
+{
+    int slot;
+
+    pthread_mutex_lock (&s_mutex);
+    while (s_queue_num == 0 && !s_queue_eos)
+        pthread_cond_wait (&s_cond, &s_mutex);
+    slot = (s_queue_num > 0) ? s_queue_head : -1;
+    pthread_mutex_unlock (&s_mutex);
+
+    return slot;
+}
+
+static void
+queue_pop ()
+{
+    pthread_mutex_lock (&s_mutex);
+    s_queue_head = (s_queue_head + 1) % VENC_QUEUE_DEPTH;
+    s_queue_num --;
+    pthread_cond_broadcast (&s_cond);
+    pthread_mutex_unlock (&s_mutex);
+}
+
+static void
+queue_set_eos ()
+{
+    pthread_mutex_lock (&s_mutex);
+    s_queue_eos = 1;
+    pthread_cond_broadcast (&s_cond);
+    pthread_mutex_unlock (&s_mutex);
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  encoder thread
+ * -------------------------------------------------------------------- */
+static int
+write_encoded_packets ()
+{
+    AVPacket packet = {0};
+
+    while (1)
+    {
+        int ret = avcodec_receive_packet (s_enc_ctx, &packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        else if (ret < 0)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            return -1;
+        }
+
+        av_packet_rescale_ts (&packet, s_enc_ctx->time_base, s_video_st->time_base);
+        packet.stream_index = s_video_st->index;
+
+        av_interleaved_write_frame (s_fmt_ctx, &packet);
+        av_packet_unref (&packet);
+    }
+}
+
+static void *
+encode_thread_main ()
+{
+    while (1)
+    {
+        int slot = queue_peek ();
+        if (slot < 0)
+            break;
+
+        av_frame_make_writable (s_enc_frame);
+
+        /* flip vertically: start from the last row with a negative stride. */
+        const uint8_t *src[1] = {s_rgba_buf[slot] + (s_height - 1) * s_width * 4};
+        int src_stride[1]     = {-s_width * 4};
+        sws_scale (s_sws_ctx, src, src_stride, 0, s_height,
+                   s_enc_frame->data, s_enc_frame->linesize);
+        s_enc_frame->pts = s_rgba_pts[slot];
+
+        queue_pop ();
+
+        avcodec_send_frame (s_enc_ctx, s_enc_frame);
+        write_encoded_packets ();
+        s_stat_encoded ++;
+    }
+
+    /* flush encoder */
+    avcodec_send_frame (s_enc_ctx, NULL);
+    write_encoded_packets ();
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  framebuffer readback
+ * -------------------------------------------------------------------- */
+static void
+enqueue_frame (const void *rgba, int64_t pts_us)
+{
+    int slot = queue_try_get_free ();
+    if (slot < 0)
+    {
+        s_stat_dropped ++;
+        return;
+    }
+
+    /* the encoder time_base is [ms]. keep pts strictly increasing. */
+    int64_t pts = pts_us / 1000;
+    if (pts <= s_last_pts)
+        pts = s_last_pts + 1;
+    s_last_pts = pts;
+
+    memcpy (s_rgba_buf[slot], rgba, s_width * s_height * 4);
+    s_rgba_pts[slot] = pts;
+
+    queue_push ();
+}
+
+static void
+retire_pbo (int idx)
+{
+    if (!s_pbo_busy[idx])
+        return;
+
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, s_pbo[idx]);
+    void *ptr = s_glMapBufferRange (GL_PIXEL_PACK_BUFFER, 0, s_width * s_height * 4, GL_MAP_READ_BIT);
+    if (ptr)
+    {
+        enqueue_frame (ptr, s_pbo_pts[idx]);
+        s_glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+
+    s_pbo_busy[idx] = 0;
+}
+
+static int
+init_pbo_readback ()
+{
+    const char *ver = (const char *)glGetString (GL_VERSION);
+
+    /* "OpenGL ES 3.x ..." */
+    if (ver == NULL || strncmp (ver, "OpenGL ES ", 10) != 0 || ver[10] < '3')
+        return 0;
+
+    s_glMapBufferRange = (PFN_glMapBufferRange)eglGetProcAddress ("glMapBufferRange");
+    s_glUnmapBuffer    = (PFN_glUnmapBuffer)   eglGetProcAddress ("glUnmapBuffer");
+    if (s_glMapBufferRange == NULL || s_glUnmapBuffer == NULL)
+        return 0;
+
+    glGenBuffers (VENC_PBO_NUM, s_pbo);
+    for (int i = 0; i < VENC_PBO_NUM; i ++)
+    {
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, s_pbo[i]);
+        glBufferData (GL_PIXEL_PACK_BUFFER, s_width * s_height * 4, NULL, GL_STREAM_READ);
+        s_pbo_busy[i] = 0;
+    }
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+
+    return 1;
+}
+
+
+/*
+ *  read back the current framebuffer and pass it to the encoder.
+ *  call this after the frame is rendered, before egl_swap().
+ *
+ *  with PBOs, glReadPixels() only kicks the DMA, and the pixels are
+ *  picked up VENC_PBO_NUM frames later, when the ring comes back to the
+ *  same PBO, and they are surely ready.
+ */
+int
+video_encode_capture_frame (int64_t pts_us)
+{
+    if (s_enc_ctx == NULL)
+        return -1;
+
+    s_stat_captured ++;
+
+    glPixelStorei (GL_PACK_ALIGNMENT, 1);
+
+    if (s_use_pbo)
+    {
+        int idx = s_pbo_idx;
+        retire_pbo (idx);
+
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, s_pbo[idx]);
+        glReadPixels (0, 0, s_width, s_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+
+        s_pbo_pts [idx] = pts_us;
+        s_pbo_busy[idx] = 1;
+        s_pbo_idx = (idx + 1) % VENC_PBO_NUM;
+    }
+    else
+    {
+        /* no PBO (GLES2). read synchronously only when there is room. */
+        int slot = queue_try_get_free ();
+        if (slot < 0)
+        {
+            s_stat_dropped ++;
+            return 0;
+        }
+
+        static uint8_t *s_read_buf = NULL;
+        if (s_read_buf == NULL)
+            s_read_buf = (uint8_t *)malloc (s_width * s_height * 4);
+
+        glReadPixels (0, 0, s_width, s_height, GL_RGBA, GL_UNSIGNED_BYTE, s_read_buf);
+        enqueue_frame (s_read_buf, pts_us);
+    }
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  setup
+ * -------------------------------------------------------------------- */
+static const AVCodec *
+find_video_encoder (const char *fname, enum AVPixelFormat *pix_fmt)
+{
+    const char *ext = strrchr (fname, '.');
+    const AVCodec *codec = NULL;
+
+    if (ext && strcmp (ext, ".avi") == 0)
+    {
+        codec    = avcodec_find_encoder (AV_CODEC_ID_MJPEG);
+        *pix_fmt = AV_PIX_FMT_YUVJ420P;
+    }
+    else if (ext && (strcmp (ext, ".nut") == 0 || strcmp (ext, ".y4m") == 0))
+    {
+        codec    = avcodec_find_encoder (AV_CODEC_ID_RAWVIDEO);
+        *pix_fmt = AV_PIX_FMT_YUV420P;
+    }
+    else
+    {
+        codec = avcodec_find_encoder_by_name ("libx264");
+        if (codec == NULL)
+            codec = avcodec_find_encoder (AV_CODEC_ID_H264);
+        *pix_fmt = AV_PIX_FMT_YUV420P;
+    }
+
+    return codec;
+}
+
+int
+init_video_encode (const char *fname, int width, int height, int fps)
+{
+    enum AVPixelFormat pix_fmt;
+    const AVCodec *codec;
+
+    av_register_all ();
+
+    if (width <= 0 || height <= 0)
+        egl_get_current_surface_dimension (&width, &height);
+
+    /* odd sizes are not allowed by 4:2:0 */
+    s_width  = width  & ~1;
+    s_height = height & ~1;
+
+    avformat_alloc_output_context2 (&s_fmt_ctx, NULL, NULL, fname);
+    if (s_fmt_ctx == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d): unknown container: %s\n", __FILE__, __LINE__, fname);
+        return -1;
+    }
+
+    codec = find_video_encoder (fname, &pix_fmt);
+    if (codec == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d): encoder not found\n", __FILE__, __LINE__);
+        goto err_exit;
+    }
+
+    s_video_st = avformat_new_stream (s_fmt_ctx, NULL);
+    s_enc_ctx  = avcodec_alloc_context3 (codec);
+    if (s_video_st == NULL || s_enc_ctx == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        goto err_exit;
+    }
+
+    s_enc_ctx->width        = s_width;
+    s_enc_ctx->height       = s_height;
+    s_enc_ctx->pix_fmt      = pix_fmt;
+    s_enc_ctx->time_base    = (AVRational){1, 1000};
+    s_enc_ctx->framerate    = (AVRational){fps, 1};
+    s_enc_ctx->gop_size     = fps;
+    s_enc_ctx->max_b_frames = 0;
+    s_enc_ctx->thread_count = 0;
+    s_video_st->time_base   = s_enc_ctx->time_base;
+
+    if (s_fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+        s_enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    if (avcodec_open2 (s_enc_ctx, codec, NULL) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d): can't open encoder %s\n", __FILE__, __LINE__, codec->name);
+        goto err_exit;
+    }
+    avcodec_parameters_from_context (s_video_st->codecpar, s_enc_ctx);
+
+    if (!(s_fmt_ctx->oformat->flags & AVFMT_NOFILE))
+    {
+        if (avio_open (&s_fmt_ctx->pb, fname, AVIO_FLAG_WRITE) < 0)
+        {
+            fprintf (stderr, "ERR: %s(%d): can't open %s\n", __FILE__, __LINE__, fname);
+            goto err_exit;
+        }
+    }
+
+    if (avformat_write_header (s_fmt_ctx, NULL) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        goto err_exit;
+    }
+
+    s_enc_frame = av_frame_alloc ();
+    s_enc_frame->format = pix_fmt;
+    s_enc_frame->width  = s_width;
+    s_enc_frame->height = s_height;
+    av_frame_get_buffer (s_enc_frame, 32);
+
+    s_sws_ctx = sws_getContext (s_width, s_height, AV_PIX_FMT_RGBA,
+                                s_width, s_height, pix_fmt,
+                                SWS_BILINEAR, NULL, NULL, NULL);
+
+    for (int i = 0; i < VENC_QUEUE_DEPTH; i ++)
+        s_rgba_buf[i] = (uint8_t *)malloc (s_width * s_height * 4);
+
+    s_queue_head = 0;
+    s_queue_num  = 0;
+    s_queue_eos  = 0;
+    s_last_pts   = -1;
+    s_stat_captured = s_stat_encoded = s_stat_dropped = 0;
+
+    s_use_pbo = init_pbo_readback ();
+    s_pbo_idx = 0;
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " encode file : %s\n", fname);
+    fprintf (stderr, " encoder     : %s\n", codec->name);
+    fprintf (stderr, " size        : (%d, %d), %d [fps]\n", s_width, s_height, fps);
+    fprintf (stderr, " readback    : %s\n", s_use_pbo ? "PBO (async)" : "glReadPixels (sync)");
+    fprintf (stderr, "-------------------------------------------\n");
+
+    pthread_create (&s_encode_thread, NULL, encode_thread_main, NULL);
+
+    return 0;
+
+err_exit:
+    if (s_enc_ctx)
+        avcodec_free_context (&s_enc_ctx);
+    avformat_free_context (s_fmt_ctx);
+    s_fmt_ctx = NULL;
+    return -1;
+}
+
+
+int
+exit_video_encode ()
+{
+    if (s_enc_ctx == NULL)
+        return -1;
+
+    /* pick up the readbacks still in flight. */
+    if (s_use_pbo)
+    {
+        for (int i = 0; i < VENC_PBO_NUM; i ++)
+            retire_pbo ((s_pbo_idx + i) % VENC_PBO_NUM);
+        glDeleteBuffers (VENC_PBO_NUM, s_pbo);
+    }
+
+    queue_set_eos ();
+    pthread_join (s_encode_thread, NULL);
+
+    av_write_trailer (s_fmt_ctx);
+    if (!(s_fmt_ctx->oformat->flags & AVFMT_NOFILE))
+        avio_closep (&s_fmt_ctx->pb);
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " encode: %d frames captured, %d encoded, %d dropped\n",
+             s_stat_captured, s_stat_encoded, s_stat_dropped);
+    fprintf (stderr, "-------------------------------------------\n");
+
+    sws_freeContext (s_sws_ctx);
+    av_frame_free (&s_enc_frame);
+    avcodec_free_context (&s_enc_ctx);
+    avformat_free_context (s_fmt_ctx);
+    s_fmt_ctx = NULL;
+
+    for (int i = 0; i < VENC_QUEUE_DEPTH; i ++)
+    {
+        free (s_rgba_buf[i]);
+        s_rgba_buf[i] = NULL;
+    }
+
+    return 0;
+}
+
+
+int
+get_video_encode_stats (video_encode_stats_t *stats)
+{
+    stats->captured_frames = s_stat_captured;
+    stats->encoded_frames  = s_stat_encoded;
+    stats->dropped_frames  = s_stat_dropped;
+    stats->queue_depth     = VENC_QUEUE_DEPTH;
+    stats->async_readback  = s_use_pbo;
+
+    pthread_mutex_lock (&s_mutex);
+    stats->queue_num = s_queue_num;
+    pthread_mutex_unlock (&s_mutex);
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_VIDEO_ENCODE_H_
+#define _UTIL_VIDEO_ENCODE_H_
+
+#include <stdint.h>
+
+typedef struct _video_encode_stats_t
+{
+    int   captured_frames;  /* number of frames read back from the framebuffer */
+    int   encoded_frames;   /* number of frames passed to the encoder          */
+    int   dropped_frames;   /* number of frames dropped by backpressure        */
+    int   queue_num;        /* occupancy of the encode queue                   */
+    int   queue_depth;
+    int   async_readback;   /* 1: PBO readback, 0: synchronous glReadPixels    */
+} video_encode_stats_t;
+
+/*
+ *  the codec is chosen by the extension of (fname):
+ *    ".avi"          : MJPEG
+ *    ".nut", ".y4m"  : raw video
+ *    others          : H.264
+ */
+int init_video_encode (const char *fname, int width, int height, int fps);
+int exit_video_encode ();
+
+int video_encode_capture_frame (int64_t pts_us);
+int get_video_encode_stats (video_encode_stats_t *stats);
+
+#endif /* _UTIL_VIDEO_ENCODE_H_ */
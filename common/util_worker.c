@@ -0,0 +1,191 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "util_worker.h"
+
+static pthread_t        *s_threads;
+static int              s_num_threads;          /* worker threads (the caller is not included) */
+static int              s_initialized;
+
+static pthread_mutex_t  s_run_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  s_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   s_cond_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   s_cond_done  = PTHREAD_COND_INITIALIZER;
+
+/* current jobs (protected by s_mutex, except s_next_job) */
+static worker_func_t    s_func;
+static void             *s_arg;
+static int              s_num_jobs;
+static int              s_next_job;
+static unsigned int     s_generation;
+static int              s_num_finished;         /* workers done with the current generation */
+static int              s_quit;
+
+static __thread int     s_in_worker;
+
+
+static void
+do_jobs (worker_func_t func, void *arg, int num_jobs)
+{
+    while (1)
+    {
+        int idx = __sync_fetch_and_add (&s_next_job, 1);
+        if (idx >= num_jobs)
+            break;
+
+        func (arg, idx);
+    }
+}
+
+static void *
+worker_main (void *arg)
+{
+    unsigned int generation = 0;
+
+    s_in_worker = 1;
+
+    pthread_mutex_lock (&s_mutex);
+    while (1)
+    {
+        while (!s_quit && generation == s_generation)
+            pthread_cond_wait (&s_cond_start, &s_mutex);
+
+        if (s_quit)
+            break;
+
+        generation = s_generation;
+        worker_func_t func = s_func;
+        void *job_arg      = s_arg;
+        int  num_jobs      = s_num_jobs;
+        pthread_mutex_unlock (&s_mutex);
+
+        do_jobs (func, job_arg, num_jobs);
+
+        pthread_mutex_lock (&s_mutex);
+        s_num_finished ++;
+        if (s_num_finished == s_num_threads)
+            pthread_cond_signal (&s_cond_done);
+    }
+    pthread_mutex_unlock (&s_mutex);
+
+    return NULL;
+}
+
+
+int
+init_worker_pool (int num_threads)
+{
+    if (s_initialized)
+        return 0;
+
+    if (num_threads <= 0)
+        num_threads = sysconf (_SC_NPROCESSORS_ONLN);
+
+    /* the calling thread works too. */
+    s_num_threads = num_threads - 1;
+    if (s_num_threads < 0)
+        s_num_threads = 0;
+
+    s_threads = (pthread_t *)calloc (s_num_threads + 1, sizeof (pthread_t));
+    if (s_threads == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    s_quit = 0;
+    for (int i = 0; i < s_num_threads; i ++)
+    {
+        if (pthread_create (&s_threads[i], NULL, worker_main, NULL) != 0)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            s_num_threads = i;
+            break;
+        }
+    }
+
+    s_initialized = 1;
+    return 0;
+}
+
+int
+exit_worker_pool ()
+{
+    if (!s_initialized)
+        return 0;
+
+    pthread_mutex_lock (&s_mutex);
+    s_quit = 1;
+    pthread_cond_broadcast (&s_cond_start);
+    pthread_mutex_unlock (&s_mutex);
+
+    for (int i = 0; i < s_num_threads; i ++)
+        pthread_join (s_threads[i], NULL);
+
+    free (s_threads);
+    s_threads     = NULL;
+    s_num_threads = 0;
+    s_initialized = 0;
+
+    return 0;
+}
+
+int
+get_worker_num ()
+{
+    if (!s_initialized)
+        init_worker_pool (0);
+
+    return s_num_threads + 1;
+}
+
+
+int
+run_worker_jobs (worker_func_t func, void *arg, int num_jobs)
+{
+    if (num_jobs <= 0)
+        return 0;
+
+    if (!s_initialized)
+        init_worker_pool (0);
+
+    /* single job, no workers, or nested call from a worker: run inline. */
+    if (num_jobs == 1 || s_num_threads == 0 || s_in_worker)
+    {
+        for (int i = 0; i < num_jobs; i ++)
+            func (arg, i);
+        return 0;
+    }
+
+    pthread_mutex_lock (&s_run_mutex);
+
+    pthread_mutex_lock (&s_mutex);
+    s_func         = func;
+    s_arg          = arg;
+    s_num_jobs     = num_jobs;
+    s_next_job     = 0;
+    s_num_finished = 0;
+    s_generation ++;
+    pthread_cond_broadcast (&s_cond_start);
+    pthread_mutex_unlock (&s_mutex);
+
+    do_jobs (func, arg, num_jobs);
+
+    /*
+     *  wait until every worker has seen this generation, so that no worker
+     *  can pick up (func, arg) of this call after we return.
+     */
+    pthread_mutex_lock (&s_mutex);
+    while (s_num_finished < s_num_threads)
+        pthread_cond_wait (&s_cond_done, &s_mutex);
+    pthread_mutex_unlock (&s_mutex);
+
+    pthread_mutex_unlock (&s_run_mutex);
+
+    return 0;
+}
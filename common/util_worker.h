@@ -0,0 +1,30 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#ifndef _UTIL_WORKER_H_
+#define _UTIL_WORKER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  persistent worker threads for the data parallel loops.
+ *
+ *    run_worker_jobs (func, arg, num_jobs) calls func(arg, 0) ... func(arg, num_jobs-1)
+ *    on the workers and the calling thread, and returns when all the jobs are done.
+ *    the jobs are claimed one by one, so they need not be of the same size.
+ */
+typedef void (*worker_func_t) (void *arg, int job_idx);
+
+int init_worker_pool (int num_threads);     /* 0: number of the online cores */
+int exit_worker_pool ();
+int get_worker_num   ();                    /* including the calling thread */
+int run_worker_jobs  (worker_func_t func, void *arg, int num_jobs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_WORKER_H_ */
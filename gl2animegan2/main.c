@@ -4,6 +4,7 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <float.h>
@@ -14,6 +15,7 @@
 #include "util_pmeter.h"
 #include "util_texture.h"
 #include "util_render2d.h"
+#include "util_motion_gate.h"
 #include "tflite_animegan2.h"
 #include "camera_capture.h"
 #include "video_decode.h"
@@ -119,8 +121,8 @@ init_video_texture (texture_2d_t *captex, const char *fname)
 
 
 /* resize image to DNN network input size and convert to fp32. */
-void
-feed_tflite_image (texture_2d_t *srctex, int win_w, int win_h)
+int
+feed_tflite_image (texture_2d_t *srctex, int win_w, int win_h, motion_gate_t *gate)
 {
     int x, y, w, h;
     float *buf_fp32 = get_animegan2_input_buf (&w, &h);
@@ -137,6 +139,10 @@ feed_tflite_image (texture_2d_t *srctex, int win_w, int win_h)
     glPixelStorei (GL_PACK_ALIGNMENT, 4);
     glReadPixels (0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, buf_ui8);
 
+    /* the scene hasn't changed. reuse the last output of the model. */
+    if (gate && !check_motion_gate (gate, buf_ui8, w, h))
+        return 0;
+
     /* convert UI8 [0, 255] ==> FP32 [ 0, 1] */
     float mean =   0.0f;
     float std  = 255.0f;
@@ -154,7 +160,7 @@ feed_tflite_image (texture_2d_t *srctex, int win_w, int win_h)
         }
     }
 
-    return;
+    return 1;
 }
 
 static float
@@ -265,6 +271,9 @@ main(int argc, char *argv[])
     double ttime[10] = {0}, interval, invoke_ms;
     int use_quantized_tflite = 0;
     int enable_camera = 1;
+    float motion_thresh = 0.0f;
+    int motion_max_stale = 30;
+    motion_gate_t motion_gate;
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
@@ -273,7 +282,7 @@ main(int argc, char *argv[])
 
     {
         int c;
-        const char *optstring = "qv:x";
+        const char *optstring = "m:M:qv:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1)
         {
@@ -288,6 +297,12 @@ main(int argc, char *argv[])
                 input_name = optarg;
                 break;
 #endif
+            case 'm':
+                motion_thresh = atof (optarg);
+                break;
+            case 'M':
+                motion_max_stale = atoi (optarg);
+                break;
             case 'x':
                 enable_camera = 0;
                 break;
@@ -311,6 +326,7 @@ main(int argc, char *argv[])
     init_dbgstr (win_w, win_h);
 
     init_tflite_animegan2 (use_quantized_tflite);
+    init_motion_gate (&motion_gate, motion_thresh, motion_max_stale);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the context */
@@ -355,6 +371,7 @@ main(int argc, char *argv[])
     /* --------------------------------------- *
      *  Style transfer
      * --------------------------------------- */
+    int transfered_texid = 0;
     for (count = 0; ; count ++)
     {
         animegan2_t style_transfered = {0};
@@ -385,13 +402,17 @@ main(int argc, char *argv[])
 #endif
 
         /* feed style parameter and original image */
-        feed_tflite_image (&captex, win_w, win_h);
+        invoke_ms = 0;
+        if (feed_tflite_image (&captex, win_w, win_h, &motion_gate))
+        {
+            /* invoke pose estimation using TensorflowLite */
+            ttime[2] = pmeter_get_time_ms ();
+            invoke_animegan2 (&style_transfered);
+            ttime[3] = pmeter_get_time_ms ();
+            invoke_ms = ttime[3] - ttime[2];
 
-        /* invoke pose estimation using TensorflowLite */
-        ttime[2] = pmeter_get_time_ms ();
-        invoke_animegan2 (&style_transfered);
-        ttime[3] = pmeter_get_time_ms ();
-        invoke_ms = ttime[3] - ttime[2];
+            transfered_texid = update_style_transfered_texture (&style_transfered);
+        }
 
 
         /* --------------------------------------- *
@@ -399,7 +420,6 @@ main(int argc, char *argv[])
          * --------------------------------------- */
         glClear (GL_COLOR_BUFFER_BIT);
 
-        int transfered_texid = update_style_transfered_texture (&style_transfered);
         draw_2d_texture_ex (&captex, draw_x, draw_y, draw_w, draw_h, 0);
 
         /* --------------------------------------- *
@@ -415,6 +435,11 @@ main(int argc, char *argv[])
         draw_pmeter (0, 40);
 
         sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite  :%5.1f [ms]", interval, invoke_ms);
+        if (motion_thresh > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nSkip    :%5.1f [%%]",
+                get_motion_gate_skip_rate (&motion_gate) * 100);
+        }
         draw_dbgstr (strbuf, 10, 10);
 
         egl_swap();
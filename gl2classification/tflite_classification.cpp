@@ -4,7 +4,7 @@
  * ------------------------------------------------ */
 #include "util_tflite.h"
 #include "tflite_classification.h"
-#include <list>
+#include "util_topk.h"
 
 /* 
  * https://www.tensorflow.org/lite/guide/hosted_models
@@ -13,6 +13,8 @@
 #define CLASSIFY_QUANT_MODEL_PATH  "./classification_model/mobilenet_v1_1.0_224_quant.tflite"
 #define CLASSIFY_LABEL_MAP_PATH    "./classification_model/class_label.txt"
 
+#define CLASSIFY_TOPN              5
+
 static tflite_interpreter_t s_interpreter;
 static tflite_tensor_t      s_tensor_input;
 static tflite_tensor_t      s_tensor_output;
@@ -97,64 +99,10 @@ get_classification_input_buf (int *w, int *h)
 /* -------------------------------------------------- *
  * Invoke TensorFlow Lite
  * -------------------------------------------------- */
-static float
-get_scoreval (int class_id)
-{
-    if (s_tensor_output.type == kTfLiteFloat32)
-    {
-        float *val = (float *)s_tensor_output.ptr;
-        return val[class_id];
-    }
-
-    if (s_tensor_output.type == kTfLiteUInt8)
-    {
-        uint8_t *val8 = (uint8_t *)s_tensor_output.ptr;
-        float scale = s_tensor_output.quant_scale;
-        float zerop = s_tensor_output.quant_zerop;
-        float fval = (val8[class_id] - zerop) * scale;
-        return fval;
-    }
-
-    return 0;
-}
-
-static int
-push_listitem (std::list<classify_t> &class_list, classify_t &item, size_t topn)
-{
-    size_t idx = 0;
-
-    /* search insert point */
-    for (auto itr = class_list.begin(); itr != class_list.end(); itr ++)
-    {
-        if (item.score > itr->score)
-        {
-            class_list.insert (itr, item);
-            if (class_list.size() > topn)
-            {
-                class_list.pop_back();
-            }
-            return 0;
-        }
-
-        idx ++;
-        if (idx >= topn)
-        {
-            return 0;
-        }
-    }
-
-    /* if list is not full, add item to the bottom */
-    if (class_list.size() < topn)
-    {
-        class_list.push_back (item);
-    }
-    return 0;
-}
-
 int
 invoke_classification (classification_result_t *class_ret)
 {
-    size_t topn = 5;
+    topk_item_t topk[CLASSIFY_TOPN];
 
     if (s_interpreter.interpreter->Invoke() != kTfLiteOk)
     {
@@ -163,28 +111,27 @@ invoke_classification (classification_result_t *class_ret)
     }
 
 
-    std::list<classify_t> classify_list;
-    for (int i = 0; i < MAX_CLASS_NUM; i ++)
+    int num = 0;
+    if (s_tensor_output.type == kTfLiteUInt8)
     {
-        classify_t item;
-        item.id = i;
-        item.score = get_scoreval (i);
-
-        push_listitem (classify_list, item, topn);
+        /* select on the raw quantized scores, and dequantize the winners only. */
+        num = topk_u8 ((uint8_t *)s_tensor_output.ptr, MAX_CLASS_NUM, CLASSIFY_TOPN,
+                       s_tensor_output.quant_scale, s_tensor_output.quant_zerop, topk);
     }
-
-    int count = 0;
-    for (auto itr = classify_list.begin(); itr != classify_list.end(); itr ++)
+    else if (s_tensor_output.type == kTfLiteFloat32)
     {
-        classify_t *item = &class_ret->classify[count];
+        num = topk_f32 ((float *)s_tensor_output.ptr, MAX_CLASS_NUM, CLASSIFY_TOPN, topk);
+    }
 
-        item->id    = itr->id;
-        item->score = itr->score;
-        memcpy (item->name, s_class_name[itr->id], 64);
+    for (int i = 0; i < num; i ++)
+    {
+        classify_t *item = &class_ret->classify[i];
 
-        count ++;
-        class_ret->num = count;
+        item->id    = topk[i].id;
+        item->score = topk[i].score;
+        memcpy (item->name, s_class_name[topk[i].id], 64);
     }
+    class_ret->num = num;
 
     return 0;
 }
@@ -9,13 +9,16 @@
 #include <algorithm>
 #include <numeric>
 #include <cmath>
+#include <stdint.h>
+#include "util_worker.h"
+#include "util_simd_math.h"
 #include "detect_postprocess.h"
 
-static float    *s_anchors;
-static int      s_anchors_count;
-
-static float    *s_decoded_boxes;
-static uint8_t  *s_active_candidate;
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 /* Attrubutes of TFLite_Detection_PostProcess */
 #define ATTR_X_SCALE                      10.0
@@ -30,9 +33,184 @@ static uint8_t  *s_active_candidate;
 #define ATTR_NMS_IOU_THRESHOLD            0.6
 #define ATTR_USE_REGULAR_NMS              false
 
+/* The row index offset is 1 if background class is included and 0 otherwise. */
+#define LABEL_OFFSET                      1
+#define NUM_CLASSES_WITH_BACKGROUND       (ATTR_NUM_CLASSES + LABEL_OFFSET)
+
+static float    *s_anchors;
+static int      s_anchors_count;
+static bool     s_use_regular_nms = ATTR_USE_REGULAR_NMS;
+
+static float    *s_decoded_boxes;               /* only the survivors are decoded */
+
+/* work buffers, allocated once in init_detect_postprocess() */
+static int      *s_survivors;                   /* [num_anchors] anchors with a score above the threshold */
+static float    *s_max_scores;                  /* [num_anchors] max class score of each survivor */
+static float    *s_exp_buf;                     /* [num_anchors * 2] */
+static uint8_t  *s_active_candidate;            /* [num_anchors * num_classes] */
+
+/* per class candidates (CSR layout) for the regular NMS */
+static int      s_class_ofst [ATTR_NUM_CLASSES + 1];
+static int      *s_class_cand;                  /* [num_anchors * num_classes] anchor index */
+static float    *s_class_score;                 /* [num_anchors * num_classes] */
+static int      *s_class_sorted;                /* [num_anchors * num_classes] */
+static int      s_class_selected    [ATTR_NUM_CLASSES][ATTR_DETECTIONS_PER_CLASS];
+static float    s_class_sel_score   [ATTR_NUM_CLASSES][ATTR_DETECTIONS_PER_CLASS];
+static int      s_class_num_selected[ATTR_NUM_CLASSES];
+
+
+/* -------------------------------------------------------------------- *
+ *  input of the post process.
+ *    float model: (ptr_f) is used.
+ *    quant model: (ptr_q) is used, and dequantized only where it is needed.
+ *                 the score threshold is applied in the uint8 domain.
+ * -------------------------------------------------------------------- */
+struct PostProcessInput {
+    const float   *ptr_f;
+    const uint8_t *ptr_q;
+    float         scale;
+    int           zerop;
+};
+
+static inline float
+get_value (const PostProcessInput &in, int idx)
+{
+    if (in.ptr_q)
+        return (in.ptr_q[idx] - in.zerop) * in.scale;
+    else
+        return in.ptr_f[idx];
+}
+
+/*
+ *  the smallest (q) which satisfies ((q - zerop) * scale >= thresh).
+ *  evaluated in the same way as the dequantization, so the uint8 compare
+ *  gives exactly the same result as the float compare. (256: none)
+ */
+static int
+calc_quant_threshold (float thresh, float scale, int zerop)
+{
+    for (int q = 0; q < 256; q ++)
+    {
+        if ((q - zerop) * scale >= thresh)
+            return q;
+    }
+    return 256;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  SIMD helpers
+ * -------------------------------------------------------------------- */
+static inline int
+row_max_u8 (const uint8_t *p, int num)
+{
+    int i = 0;
+    int max_val = 0;
+
+#if defined (__SSE2__)
+    __m128i vmax = _mm_setzero_si128 ();
+    for (; i + 16 <= num; i += 16)
+        vmax = _mm_max_epu8 (vmax, _mm_loadu_si128 ((const __m128i *)&p[i]));
+
+    vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 8));
+    vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 4));
+    vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 2));
+    vmax = _mm_max_epu8 (vmax, _mm_srli_si128 (vmax, 1));
+    max_val = _mm_cvtsi128_si32 (vmax) & 0xff;
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    uint8x16_t vmax = vdupq_n_u8 (0);
+    for (; i + 16 <= num; i += 16)
+        vmax = vmaxq_u8 (vmax, vld1q_u8 (&p[i]));
+
+    uint8x8_t vmax8 = vpmax_u8 (vget_low_u8 (vmax), vget_high_u8 (vmax));
+    vmax8 = vpmax_u8 (vmax8, vmax8);
+    vmax8 = vpmax_u8 (vmax8, vmax8);
+    vmax8 = vpmax_u8 (vmax8, vmax8);
+    max_val = vget_lane_u8 (vmax8, 0);
+#endif
+
+    for (; i < num; i ++)
+        max_val = std::max (max_val, (int)p[i]);
+
+    return max_val;
+}
+
+static inline float
+row_max_f32 (const float *p, int num)
+{
+    int i = 0;
+    float max_val = -INFINITY;
+
+#if defined (__SSE2__)
+    __m128 vmax = _mm_set1_ps (-INFINITY);
+    for (; i + 4 <= num; i += 4)
+        vmax = _mm_max_ps (vmax, _mm_loadu_ps (&p[i]));
+
+    vmax = _mm_max_ps (vmax, _mm_movehl_ps (vmax, vmax));
+    vmax = _mm_max_ss (vmax, _mm_shuffle_ps (vmax, vmax, 1));
+    max_val = _mm_cvtss_f32 (vmax);
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t vmax = vdupq_n_f32 (-INFINITY);
+    for (; i + 4 <= num; i += 4)
+        vmax = vmaxq_f32 (vmax, vld1q_f32 (&p[i]));
+
+    float32x2_t vmax2 = vpmax_f32 (vget_low_f32 (vmax), vget_high_f32 (vmax));
+    vmax2 = vpmax_f32 (vmax2, vmax2);
+    max_val = vget_lane_f32 (vmax2, 0);
+#endif
+
+    for (; i < num; i ++)
+        max_val = std::max (max_val, p[i]);
+
+    return max_val;
+}
+
+/* -------------------------------------------------------------------- *
+ *  pick up the anchors which have at least one class score above the
+ *  threshold. all the other anchors are never decoded nor sorted.
+ * -------------------------------------------------------------------- */
+static int
+SelectAnchorsAboveScoreThreshold (const PostProcessInput &scores, float threshold)
+{
+    const int num_boxes = s_anchors_count;
+    int num = 0;
+
+    if (scores.ptr_q)
+    {
+        int q_thresh = calc_quant_threshold (threshold, scores.scale, scores.zerop);
+        if (q_thresh > 255)
+            return 0;
+
+        for (int row = 0; row < num_boxes; row++) {
+            const uint8_t *box_scores = scores.ptr_q + row * NUM_CLASSES_WITH_BACKGROUND + LABEL_OFFSET;
+            int q_max = row_max_u8 (box_scores, ATTR_NUM_CLASSES);
+            if (q_max >= q_thresh) {
+                s_survivors [num] = row;
+                s_max_scores[num] = (q_max - scores.zerop) * scores.scale;
+                num ++;
+            }
+        }
+    }
+    else
+    {
+        for (int row = 0; row < num_boxes; row++) {
+            const float *box_scores = scores.ptr_f + row * NUM_CLASSES_WITH_BACKGROUND + LABEL_OFFSET;
+            float max_score = row_max_f32 (box_scores, ATTR_NUM_CLASSES);
+            if (max_score >= threshold) {
+                s_survivors [num] = row;
+                s_max_scores[num] = max_score;
+                num ++;
+            }
+        }
+    }
+
+    return num;
+}
+
+
 /* -------------------------------------------------------------------- *
  *  Decode detection boxes and apply NMS.
- *    These functions are clone codes of: 
+ *    These functions are clone codes of:
  *    https://github.com/tensorflow/tensorflow/blob/master/tensorflow/lite/kernels/detection_postprocess.cc
  * -------------------------------------------------------------------- */
 
@@ -63,31 +241,42 @@ struct CenterSizeEncoding {
     float w;
 };
 
+/*
+ *  decode the boxes of (indices[]) only.
+ *  exp() of (h, w) is computed for all of them at once with SIMD.
+ */
 int
-DecodeCenterSizeBoxes (float *decoded_boxes, const float *input_box_encodings) 
+DecodeCenterSizeBoxes (float *decoded_boxes, const PostProcessInput &input_box_encodings,
+                       const int *indices, int num_indices)
 {
-    int num_boxes        = s_anchors_count;
     float *input_anchors = s_anchors;
+    float *exp_buf       = s_exp_buf;
 
     // Decode the boxes to get (ymin, xmin, ymax, xmax) based on the anchors
-    CenterSizeEncoding box_centersize;
     CenterSizeEncoding scale_values = {ATTR_X_SCALE, ATTR_Y_SCALE,
                                        ATTR_W_SCALE, ATTR_H_SCALE};
-    CenterSizeEncoding anchor;
 
-    for (int idx = 0; idx < num_boxes; ++idx) 
+    for (int i = 0; i < num_indices; ++i)
+    {
+        int idx = indices[i];
+        exp_buf[2 * i + 0] = get_value (input_box_encodings, idx * 4 + 2) / scale_values.h;
+        exp_buf[2 * i + 1] = get_value (input_box_encodings, idx * 4 + 3) / scale_values.w;
+    }
+
+    vexp (exp_buf, exp_buf, num_indices * 2);
+
+    for (int i = 0; i < num_indices; ++i)
     {
-        box_centersize = reinterpret_cast<const CenterSizeEncoding*>(input_box_encodings)[idx];
-        anchor         = reinterpret_cast<const CenterSizeEncoding*>(input_anchors)[idx];
-
-        float ycenter = box_centersize.y / scale_values.y * anchor.h + anchor.y;
-        float xcenter = box_centersize.x / scale_values.x * anchor.w + anchor.x;
-        float half_h =
-            0.5f * static_cast<float>(std::exp(box_centersize.h / scale_values.h)) *
-            anchor.h;
-        float half_w =
-            0.5f * static_cast<float>(std::exp(box_centersize.w / scale_values.w)) *
-            anchor.w;
+        int idx = indices[i];
+        const CenterSizeEncoding &anchor = reinterpret_cast<const CenterSizeEncoding*>(input_anchors)[idx];
+
+        float box_y = get_value (input_box_encodings, idx * 4 + 0);
+        float box_x = get_value (input_box_encodings, idx * 4 + 1);
+
+        float ycenter = box_y / scale_values.y * anchor.h + anchor.y;
+        float xcenter = box_x / scale_values.x * anchor.w + anchor.x;
+        float half_h  = 0.5f * exp_buf[2 * i + 0] * anchor.h;
+        float half_w  = 0.5f * exp_buf[2 * i + 1] * anchor.w;
 
         auto& box = reinterpret_cast<BoxCornerEncoding*>(decoded_boxes)[idx];
         box.ymin = ycenter - half_h;
@@ -108,19 +297,6 @@ void DecreasingPartialArgSort(const float* values, int num_values,
 }
 
 
-void SelectDetectionsAboveScoreThreshold(const std::vector<float>& values,
-                                         const float threshold,
-                                         std::vector<float>* keep_values,
-                                         std::vector<int>* keep_indices) {
-  for (unsigned int i = 0; i < values.size(); i++) {
-    if (values[i] >= threshold) {
-      keep_values->emplace_back(values[i]);
-      keep_indices->emplace_back(i);
-    }
-  }
-}
-
-
 float ComputeIntersectionOverUnion(const float* decoded_boxes,
                                    const int i, const int j) {
   auto& box_i = reinterpret_cast<const BoxCornerEncoding*>(decoded_boxes)[i];
@@ -145,41 +321,34 @@ float ComputeIntersectionOverUnion(const float* decoded_boxes,
 // If lower-scoring box has too much overlap with a higher-scoring box,
 // we get rid of the lower-scoring box.
 // Complexity is O(N^2) pairwise comparison between boxes
+//
+// (keep_indices, keep_scores) are the candidates already above the score
+// threshold. (sorted_indices, active_box_candidate) are the work buffers of
+// the caller, so that the classes can be processed in parallel.
 int
 NonMaxSuppressionSingleClassHelper(const float *decoded_boxes,
-                                   const std::vector<float>& scores, 
-                                   std::vector<int>* selected, int max_detections) {
+                                   const int *keep_indices, const float *keep_scores,
+                                   int num_scores_kept, int *sorted_indices,
+                                   uint8_t *active_box_candidate,
+                                   int *selected, int max_detections) {
 
-    const float non_max_suppression_score_threshold = ATTR_NMS_SCORE_THRESHOLD;
-    const float intersection_over_union_threshold   = ATTR_NMS_IOU_THRESHOLD;
-
-    // threshold scores
-    std::vector<int> keep_indices;
-    // TODO (chowdhery): Remove the dynamic allocation and replace it
-    // with temporaries, esp for std::vector<float>
-    std::vector<float> keep_scores;
-    SelectDetectionsAboveScoreThreshold(
-        scores, non_max_suppression_score_threshold, &keep_scores, &keep_indices);
-
-    int num_scores_kept = keep_scores.size();
-    std::vector<int> sorted_indices;
-    sorted_indices.resize(num_scores_kept);
-    DecreasingPartialArgSort(keep_scores.data(), num_scores_kept, num_scores_kept,
-                                sorted_indices.data());
+    const float intersection_over_union_threshold = ATTR_NMS_IOU_THRESHOLD;
+
+    DecreasingPartialArgSort(keep_scores, num_scores_kept, num_scores_kept,
+                                sorted_indices);
     const int num_boxes_kept = num_scores_kept;
-    const unsigned int output_size = std::min(num_boxes_kept, max_detections);
-    selected->clear();
+    const int output_size = std::min(num_boxes_kept, max_detections);
+    int num_selected = 0;
 
     int num_active_candidate = num_boxes_kept;
-    uint8_t* active_box_candidate = s_active_candidate;
     for (int row = 0; row < num_boxes_kept; row++) {
         active_box_candidate[row] = 1;
     }
 
     for (int i = 0; i < num_boxes_kept; ++i) {
-        if (num_active_candidate == 0 || selected->size() >= output_size) break;
+        if (num_active_candidate == 0 || num_selected >= output_size) break;
         if (active_box_candidate[i] == 1) {
-            selected->push_back(keep_indices[sorted_indices[i]]);
+            selected[num_selected++] = sorted_indices[i];
             active_box_candidate[i] = 0;
             num_active_candidate--;
         } else {
@@ -199,7 +368,31 @@ NonMaxSuppressionSingleClassHelper(const float *decoded_boxes,
             }
         }
     }
-    return 0;
+
+    // (selected) holds the positions in (keep_indices)
+    return num_selected;
+}
+
+
+static void
+nms_single_class_job (void *arg, int col)
+{
+    const float *decoded_boxes = (const float *)arg;
+    int ofst = s_class_ofst[col];
+    int num  = s_class_ofst[col + 1] - ofst;
+    int *selected = s_class_selected[col];
+
+    int num_selected = NonMaxSuppressionSingleClassHelper (decoded_boxes,
+                            &s_class_cand[ofst], &s_class_score[ofst], num,
+                            &s_class_sorted[ofst], &s_active_candidate[ofst],
+                            selected, ATTR_DETECTIONS_PER_CLASS);
+
+    for (int i = 0; i < num_selected; i ++)
+    {
+        s_class_sel_score[col][i] = s_class_score[ofst + selected[i]];
+        selected[i]               = s_class_cand [ofst + selected[i]];
+    }
+    s_class_num_selected[col] = num_selected;
 }
 
 
@@ -210,56 +403,83 @@ NonMaxSuppressionSingleClassHelper(const float *decoded_boxes,
 // 3) The worst runtime of the regular NMS is O(K*N^2)
 // where N is the number of anchors and K the number of
 // classes.
+//
+// only the survivor anchors are bucketed into the classes, and the per-class
+// NMS runs on the worker threads. the merge of the classes is sequential, in
+// the class order, so the result is the same as the single-threaded one.
 int
-NonMaxSuppressionMultiClassRegularHelper(std::vector<DetectionBox> &detection_boxes, 
-                                         const float *decoded_boxes, const float* scores) {
-    const int num_boxes   = s_anchors_count;
+NonMaxSuppressionMultiClassRegularHelper(std::vector<DetectionBox> &detection_boxes,
+                                         const float *decoded_boxes, const PostProcessInput &scores,
+                                         int num_survivors) {
     const int num_classes = ATTR_NUM_CLASSES;
-    const int num_detections_per_class = ATTR_DETECTIONS_PER_CLASS;
     const int max_detections = ATTR_MAX_DETECTIONS;
+    const int label_offset = LABEL_OFFSET;
+    const int num_classes_with_background = NUM_CLASSES_WITH_BACKGROUND;
+    const float non_max_suppression_score_threshold = ATTR_NMS_SCORE_THRESHOLD;
 
-    // The row index offset is 1 if background class is included and 0 otherwise.
-    const int label_offset = 1;
-    const int num_classes_with_background = num_classes + label_offset;
+    int q_thresh = 0;
+    if (scores.ptr_q)
+        q_thresh = calc_quant_threshold (non_max_suppression_score_threshold, scores.scale, scores.zerop);
+
+    // bucket the candidates into the classes (CSR), keeping the anchor order.
+    int class_count[ATTR_NUM_CLASSES] = {0};
+    for (int pass = 0; pass < 2; pass ++) {
+        if (pass == 1) {
+            s_class_ofst[0] = 0;
+            for (int col = 0; col < num_classes; col++) {
+                s_class_ofst[col + 1] = s_class_ofst[col] + class_count[col];
+                class_count[col] = 0;
+            }
+        }
+
+        for (int n = 0; n < num_survivors; n++) {
+            int row  = s_survivors[n];
+            int base = row * num_classes_with_background + label_offset;
+
+            for (int col = 0; col < num_classes; col++) {
+                bool above = scores.ptr_q ? (scores.ptr_q[base + col] >= q_thresh)
+                                          : (scores.ptr_f[base + col] >= non_max_suppression_score_threshold);
+                if (!above)
+                    continue;
+
+                if (pass == 1) {
+                    int pos = s_class_ofst[col] + class_count[col];
+                    s_class_cand [pos] = row;
+                    s_class_score[pos] = get_value (scores, base + col);
+                }
+                class_count[col]++;
+            }
+        }
+    }
 
     // For each class, perform non-max suppression.
-    std::vector<float> class_scores(num_boxes);
+    run_worker_jobs (nms_single_class_job, (void *)decoded_boxes, num_classes);
 
-    std::vector<int> box_indices_after_regular_non_max_suppression(num_boxes + max_detections);
-    std::vector<float> scores_after_regular_non_max_suppression(num_boxes +  max_detections);
+    int box_indices_after_regular_non_max_suppression[ATTR_MAX_DETECTIONS + ATTR_DETECTIONS_PER_CLASS];
+    float scores_after_regular_non_max_suppression  [ATTR_MAX_DETECTIONS + ATTR_DETECTIONS_PER_CLASS];
 
     int size_of_sorted_indices = 0;
-    std::vector<int> sorted_indices;
-    sorted_indices.resize(num_boxes + max_detections);
-    std::vector<float> sorted_values;
-    sorted_values.resize(max_detections);
+    int sorted_indices[ATTR_MAX_DETECTIONS + ATTR_DETECTIONS_PER_CLASS];
+    float sorted_values[ATTR_MAX_DETECTIONS];
 
     for (int col = 0; col < num_classes; col++) {
-        for (int row = 0; row < num_boxes; row++) {
-            // Get scores of boxes corresponding to all anchors for single class
-            class_scores[row] =
-                *(scores + row * num_classes_with_background + col + label_offset);
-        }
-        // Perform non-maximal suppression on single class
-        std::vector<int> selected;
-        NonMaxSuppressionSingleClassHelper(decoded_boxes, class_scores, &selected, num_detections_per_class);
-
         // Add selected indices from non-max suppression of boxes in this class
         int output_index = size_of_sorted_indices;
-        for (const auto& selected_index : selected) {
+        for (int i = 0; i < s_class_num_selected[col]; i++) {
+            int selected_index = s_class_selected[col][i];
             box_indices_after_regular_non_max_suppression[output_index] =
                 (selected_index * num_classes_with_background + col + label_offset);
             scores_after_regular_non_max_suppression[output_index] =
-                class_scores[selected_index];
+                s_class_sel_score[col][i];
             output_index++;
         }
 
         // Sort the max scores among the selected indices
         // Get the indices for top scores
         int num_indices_to_sort = std::min(output_index, max_detections);
-        DecreasingPartialArgSort(scores_after_regular_non_max_suppression.data(),
+        DecreasingPartialArgSort(scores_after_regular_non_max_suppression,
                              output_index, num_indices_to_sort,
-                             sorted_indices.data());
+                             sorted_indices);
 
         // Copy values to temporary vectors
         for (int row = 0; row < num_indices_to_sort; row++) {
@@ -276,29 +496,23 @@ NonMaxSuppressionMultiClassRegularHelper(std::vector<DetectionBox> &detection_bo
     }
 
     // Allocate output tensors
-    for (int output_box_index = 0; output_box_index < max_detections; output_box_index++) {
-        if (output_box_index < size_of_sorted_indices) {
-            const int anchor_index = floor(
-                        box_indices_after_regular_non_max_suppression[output_box_index] /
-                        num_classes_with_background);
-            const int class_index =
-                        box_indices_after_regular_non_max_suppression[output_box_index] -
-                        anchor_index * num_classes_with_background - label_offset;
-            const float selected_score =
-                        scores_after_regular_non_max_suppression[output_box_index];
-
-            BoxCornerEncoding box = reinterpret_cast<const BoxCornerEncoding*>(s_decoded_boxes)[anchor_index];
-
-            detection_boxes.push_back({box.xmin, box.ymin,
-                                       box.xmax, box.ymax,
-                                       selected_score, class_index});
-        } else {
-        }
+    for (int output_box_index = 0; output_box_index < size_of_sorted_indices; output_box_index++) {
+        const int anchor_index =
+                    box_indices_after_regular_non_max_suppression[output_box_index] /
+                    num_classes_with_background;
+        const int class_index =
+                    box_indices_after_regular_non_max_suppression[output_box_index] -
+                    anchor_index * num_classes_with_background - label_offset;
+        const float selected_score =
+                    scores_after_regular_non_max_suppression[output_box_index];
+
+        BoxCornerEncoding box = reinterpret_cast<const BoxCornerEncoding*>(decoded_boxes)[anchor_index];
+
+        detection_boxes.push_back({box.xmin, box.ymin,
+                                   box.xmax, box.ymax,
+                                   selected_score, class_index});
     }
 
-    box_indices_after_regular_non_max_suppression.clear();
-    scores_after_regular_non_max_suppression.clear();
-
     return 0;
 }
 
@@ -310,42 +524,36 @@ NonMaxSuppressionMultiClassRegularHelper(std::vector<DetectionBox> &detection_bo
 // 3) Compared to standard NMS, the worst runtime of this version is O(N^2)
 // instead of O(KN^2) where N is the number of anchors and K the number of
 // classes.
+//
+// the top-k classes are sorted only for the selected anchors.
 int
-NonMaxSuppressionMultiClassFastHelper (std::vector<DetectionBox> &detection_boxes, 
-                                       const float *decoded_boxes, const float* scores) {
-    const int num_boxes   = s_anchors_count;
+NonMaxSuppressionMultiClassFastHelper (std::vector<DetectionBox> &detection_boxes,
+                                       const float *decoded_boxes, const PostProcessInput &scores,
+                                       int num_survivors) {
     const int num_classes = ATTR_NUM_CLASSES;
     const int max_categories_per_anchor = ATTR_MAX_CLASSES_PER_DETECTION;
-
-    // The row index offset is 1 if background class is included and 0 otherwise.
-    const int label_offset = 1;
-    const int num_classes_with_background = num_classes + label_offset;
+    const int num_classes_with_background = NUM_CLASSES_WITH_BACKGROUND;
     const int num_categories_per_anchor   = std::min(max_categories_per_anchor, num_classes);
 
-    std::vector<float> max_scores;
-    max_scores.resize(num_boxes);
-    std::vector<int> sorted_class_indices;
-    sorted_class_indices.resize(num_boxes * num_classes);
-
-    for (int row = 0; row < num_boxes; row++) {
-        const float* box_scores =
-                    scores + row * num_classes_with_background + label_offset;
-        int* class_indices = sorted_class_indices.data() + row * num_classes;
-        DecreasingPartialArgSort(box_scores, num_classes, num_categories_per_anchor,
-                             class_indices);
-        max_scores[row] = box_scores[class_indices[0]];
-    }
-
     // Perform non-maximal suppression on max scores
-    std::vector<int> selected;
-    NonMaxSuppressionSingleClassHelper(decoded_boxes, max_scores, &selected, ATTR_MAX_DETECTIONS);
+    int selected[ATTR_MAX_DETECTIONS];
+    int num_selected = NonMaxSuppressionSingleClassHelper(decoded_boxes,
+                            s_survivors, s_max_scores, num_survivors,
+                            s_class_sorted, s_active_candidate,
+                            selected, ATTR_MAX_DETECTIONS);
 
     // Allocate output tensors
-    for (const auto& selected_index : selected) {
-        const float* box_scores =
-                scores + selected_index * num_classes_with_background + label_offset;
-        const int* class_indices =
-                sorted_class_indices.data() + selected_index * num_classes;
+    for (int i = 0; i < num_selected; i++) {
+        const int selected_index = s_survivors[selected[i]];
+        const int base = selected_index * num_classes_with_background + LABEL_OFFSET;
+
+        float box_scores[ATTR_NUM_CLASSES];
+        int   class_indices[ATTR_NUM_CLASSES];
+        for (int col = 0; col < num_classes; col++)
+            box_scores[col] = get_value (scores, base + col);
+
+        DecreasingPartialArgSort(box_scores, num_classes, num_categories_per_anchor,
+                             class_indices);
 
         for (int col = 0; col < num_categories_per_anchor; ++col) {
 
@@ -374,7 +582,7 @@ NonMaxSuppressionMultiClassFastHelper (std::vector<DetectionBox> &detection_boxe
  *  software routine for "TFLite_Detection_PostProcess" Op.
  * -------------------------------------------------------------------- */
 float *
-read_anchors_file (std::string filename, int& size) 
+read_anchors_file (std::string filename, int& size)
 {
     std::vector<std::string> lines;
     std::ifstream file (filename);
@@ -388,7 +596,7 @@ read_anchors_file (std::string filename, int& size)
     size = lines.size();
     float *result = new float[size * 4]();
 
-    for (int i = 0; i < size; i++) 
+    for (int i = 0; i < size; i++)
     {
         int index = i * 4;
         std::stringstream(lines[i]) >> result[index]
@@ -401,9 +609,10 @@ read_anchors_file (std::string filename, int& size)
 
 
 int
-init_detect_postprocess (std::string filename)
+init_detect_postprocess (std::string filename, bool use_regular_nms)
 {
     s_anchors = read_anchors_file (filename, s_anchors_count);
+    s_use_regular_nms = use_regular_nms;
 
 #if 0
     for (int i = 0; i < s_anchors_count; i ++)
@@ -413,35 +622,74 @@ init_detect_postprocess (std::string filename)
     }
 #endif
 
+    int num_cand = s_anchors_count * ATTR_NUM_CLASSES;
+
     s_decoded_boxes    = new float  [s_anchors_count * 4];
-    s_active_candidate = new uint8_t[s_anchors_count];
+    s_survivors        = new int    [s_anchors_count];
+    s_max_scores       = new float  [s_anchors_count];
+    s_exp_buf          = new float  [s_anchors_count * 2];
+    s_active_candidate = new uint8_t[num_cand];
+    s_class_cand       = new int    [num_cand];
+    s_class_score      = new float  [num_cand];
+    s_class_sorted     = new int    [num_cand];
+
+    if (s_use_regular_nms)
+        init_worker_pool (0);
 
     return 0;
 }
 
 
-int
-invoke_detection_postprocess (std::vector<DetectionBox> &detection_boxes,  /* [OUT] */
-                              const float *boxes_ptr,                      /* [IN ] */
-                              const float *scores_ptr)                     /* [IN ] */
+static int
+invoke_postprocess (std::vector<DetectionBox> &detection_boxes,
+                    const PostProcessInput &boxes, const PostProcessInput &scores)
 {
     float *decoded_boxes = s_decoded_boxes;
 
+    /* thresholding first. most of the anchors end here. */
+    int num_survivors = SelectAnchorsAboveScoreThreshold (scores, ATTR_NMS_SCORE_THRESHOLD);
+    if (num_survivors == 0)
+        return 0;
+
     /*
-     *  decode detected bbox. 
+     *  decode detected bbox of the survivors.
      *      (decoded_boxes) = (boxes_ptr) * (anchor.wh) + (anchor.xy);
      */
-    DecodeCenterSizeBoxes (decoded_boxes, boxes_ptr);
+    DecodeCenterSizeBoxes (decoded_boxes, boxes, s_survivors, num_survivors);
 
-    if (ATTR_USE_REGULAR_NMS)
+    if (s_use_regular_nms)
     {
-        NonMaxSuppressionMultiClassRegularHelper(detection_boxes, decoded_boxes, scores_ptr);
+        NonMaxSuppressionMultiClassRegularHelper (detection_boxes, decoded_boxes, scores, num_survivors);
     }
     else
     {
-        NonMaxSuppressionMultiClassFastHelper (detection_boxes, decoded_boxes, scores_ptr);
+        NonMaxSuppressionMultiClassFastHelper (detection_boxes, decoded_boxes, scores, num_survivors);
     }
 
     return 0;
 }
 
+
+int
+invoke_detection_postprocess (std::vector<DetectionBox> &detection_boxes,  /* [OUT] */
+                              const float *boxes_ptr,                      /* [IN ] */
+                              const float *scores_ptr)                     /* [IN ] */
+{
+    PostProcessInput boxes  = {boxes_ptr,  NULL, 1.0f, 0};
+    PostProcessInput scores = {scores_ptr, NULL, 1.0f, 0};
+
+    return invoke_postprocess (detection_boxes, boxes, scores);
+}
+
+int
+invoke_detection_postprocess_quant (std::vector<DetectionBox> &detection_boxes,  /* [OUT] */
+                                    const uint8_t *boxes_ptr,                    /* [IN ] */
+                                    float boxes_scale,  int boxes_zerop,
+                                    const uint8_t *scores_ptr,                   /* [IN ] */
+                                    float scores_scale, int scores_zerop)
+{
+    PostProcessInput boxes  = {NULL, boxes_ptr,  boxes_scale,  boxes_zerop };
+    PostProcessInput scores = {NULL, scores_ptr, scores_scale, scores_zerop};
+
+    return invoke_postprocess (detection_boxes, boxes, scores);
+}
@@ -15,11 +15,19 @@ struct DetectionBox {
     int   class_id;
 };
 
-int init_detect_postprocess (std::string filename);
+int init_detect_postprocess (std::string filename, bool use_regular_nms);
 
 int
 invoke_detection_postprocess (std::vector<DetectionBox> &detection_boxes,  /* [OUT] */
                               const float *boxes_ptr,                      /* [IN ] */
                               const float *_scores_ptr);                   /* [IN ] */
 
+/* quantized model: the scores are thresholded in the uint8 domain. */
+int
+invoke_detection_postprocess_quant (std::vector<DetectionBox> &detection_boxes,  /* [OUT] */
+                                    const uint8_t *boxes_ptr,                    /* [IN ] */
+                                    float boxes_scale,  int boxes_zerop,
+                                    const uint8_t *scores_ptr,                   /* [IN ] */
+                                    float scores_scale, int scores_zerop);
+
 #endif /* _DETECT_POSTPROCESS_H_ */
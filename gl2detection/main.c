@@ -4,8 +4,10 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
 #include <GLES2/gl2.h>
 #include "util_egl.h"
 #include "util_debugstr.h"
@@ -15,6 +17,7 @@
 #include "tflite_detect.h"
 #include "camera_capture.h"
 #include "video_decode.h"
+#include "util_video_encode.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -109,7 +112,6 @@ init_video_texture (texture_2d_t *captex, const char *fname)
     get_video_pixformat (&vid_fmt);
 
     create_2d_texture_ex (captex, NULL, vid_w, vid_h, vid_fmt);
-    start_video_decode ();
 
     return 0;
 }
@@ -218,15 +220,95 @@ render_detect_region (int ofstx, int ofsty, int texw, int texh, detect_result_t
         float *col = get_detect_class_color(det_class);
         draw_2d_rect (x1, y1, x2-x1, y2-y1, col, 2.0f);
 
-        /* class name */
+        /* class name (and the track ID) */
         char *name = get_detect_class_name (det_class);
         char buf[512];
-        sprintf (buf, "%s(%d)", name, (int)(score * 100));
+        if (detection->obj[i].track_id >= 0)
+            sprintf (buf, "%s#%d(%d)", name, detection->obj[i].track_id, (int)(score * 100));
+        else
+            sprintf (buf, "%s(%d)", name, (int)(score * 100));
         draw_dbgstr_ex (buf, x1, y1, 1.0f, col_white, col);
     }
 }
 
 
+/* stop recording (the video or the camera frames) and finalize the file on Ctrl-C. */
+static volatile sig_atomic_t s_stop_request = 0;
+
+static void
+on_sigint (int sig)
+{
+    UNUSED (sig);
+    s_stop_request = 1;
+}
+
+#if defined (USE_INPUT_VIDEO_DECODE)
+
+/* -------------------------------------------------------------------- *
+ *  Offline mode:
+ *    run every frame of the video file through the whole pipeline
+ *    exactly once, as fast as possible, and dump the per-frame results.
+ * -------------------------------------------------------------------- */
+static void
+write_detect_result (FILE *fp, int frame_no, int64_t pts_us, detect_result_t *detection)
+{
+    fprintf (fp, "frame %d pts %lld objs %d\n", frame_no, (long long)pts_us, detection->num);
+
+    for (int i = 0; i < detection->num; i ++)
+    {
+        detect_obj_t *obj = &detection->obj[i];
+        fprintf (fp, "%d %s %f %f %f %f %f\n", obj->det_class, get_detect_class_name (obj->det_class),
+                 obj->score, obj->x1, obj->y1, obj->x2, obj->y2);
+    }
+}
+
+static int
+run_offline_video (texture_2d_t *captex, int win_w, int win_h, const char *fname, int frame_base)
+{
+    int64_t pts_us;
+    int num_frames = 0;
+
+    FILE *fp = fopen (fname, "w");
+    if (fp == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d): can't open %s\n", __FILE__, __LINE__, fname);
+        return -1;
+    }
+
+    double ttime_start = pmeter_get_time_ms ();
+
+    while (decode_next_video_frame (&pts_us) == 0)
+    {
+        detect_result_t detection;
+
+        update_video_texture (captex);
+
+        feed_detect_image (captex, win_w, win_h);
+        invoke_detect (&detection);
+
+        write_detect_result (fp, frame_base + num_frames, pts_us, &detection);
+        num_frames ++;
+    }
+
+    double elapsed_ms = pmeter_get_time_ms () - ttime_start;
+    fclose (fp);
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " offline: %d frames, %.1f [ms], %.2f [frames/s]\n", num_frames,
+             elapsed_ms, (elapsed_ms > 0) ? num_frames * 1000.0 / elapsed_ms : 0);
+    fprintf (stderr, " result : %s\n", fname);
+
+    video_decode_stats_t vstats;
+    get_video_decode_stats (&vstats);
+    fprintf (stderr, " decode : %d frames, %.2f [frames/s], %d threads\n",
+             vstats.decoded_frames, vstats.decode_fps, vstats.decode_threads);
+    fprintf (stderr, "-------------------------------------------\n");
+
+    return 0;
+}
+#endif /* USE_INPUT_VIDEO_DECODE */
+
+
 /* Adjust the texture size to fit the window size
  *
  *                      Portrait
@@ -288,28 +370,61 @@ main(int argc, char *argv[])
     double ttime[10] = {0}, interval, invoke_ms;
     int use_quantized_tflite = 0;
     int enable_camera = 1;
+    int detect_interval = 1;
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
     int enable_video = 0;
+    char *offline_fname = NULL;
+    char *record_fname = NULL;
+    char seg_out_fname[256];
+    int num_segments = 1;
+    int frame_base = 0;
 #endif
 
     {
         int c;
-        const char *optstring = "qv:x";
+        const char *optstring = "b:c:d:j:o:p:P:qs:v:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1)
         {
             switch (c)
             {
+            case 'd':
+                detect_interval = atoi (optarg);
+                break;
             case 'q':
                 use_quantized_tflite = 1;
                 break;
 #if defined (USE_INPUT_VIDEO_DECODE)
+            case 'b':
+                offline_fname = optarg;
+                break;
+            case 'j':
+                set_video_decode_threads (atoi (optarg));
+                break;
+            case 'o':
+                record_fname = optarg;
+                break;
+            case 's':
+                num_segments = atoi (optarg);
+                break;
             case 'v':
                 enable_video = 1;
                 input_name = optarg;
                 break;
+#endif
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+            case 'c':
+                if (set_capture_record_file (optarg) == 0)
+                    signal (SIGINT, on_sigint);
+                break;
+            case 'p':
+                set_capture_replay_file (optarg, 1);
+                break;
+            case 'P':
+                set_capture_replay_file (optarg, 0);
+                break;
 #endif
             case 'x':
                 enable_camera = 0;
@@ -327,6 +442,28 @@ main(int argc, char *argv[])
     if (input_name == NULL)
         input_name = input_name_default;
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+    /*
+     *  segment-parallel offline mode:
+     *  fork one worker process per segment. each worker continues below
+     *  with its own EGL context, interpreters and decoder.
+     */
+    if (enable_video && offline_fname && num_segments > 1)
+    {
+        int ret = start_video_segment_workers (input_name, num_segments, offline_fname,
+                                               seg_out_fname, &frame_base);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            return 0;   /* parent: all the segments are merged. */
+
+        offline_fname = seg_out_fname;
+    }
+
+    if (offline_fname)
+        egl_init_with_pbuffer_surface (2, 0, 0, 0, win_w, win_h);
+    else
+#endif
     egl_init_with_platform_window_surface (2, 0, 0, 0, win_w, win_h);
 
     init_2d_renderer (win_w, win_h);
@@ -334,6 +471,7 @@ main(int argc, char *argv[])
     init_dbgstr (win_w, win_h);
 
     init_tflite_detection (use_quantized_tflite);
+    set_detect_tracking_param (detect_interval, 0.3f);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the context */
@@ -349,6 +487,15 @@ main(int argc, char *argv[])
         texw = captex.width;
         texh = captex.height;
         enable_camera = 0;
+
+        if (offline_fname)
+        {
+            glViewport (0, 0, win_w, win_h);
+            if (run_offline_video (&captex, win_w, win_h, offline_fname, frame_base) < 0)
+                return -1;
+            return 0;
+        }
+        start_video_decode ();
     }
     else
 #endif
@@ -373,6 +520,14 @@ main(int argc, char *argv[])
 
     glClearColor (0.f, 0.f, 0.f, 1.0f);
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+    /* record the rendered frames (with overlays) to a video file. */
+    if (record_fname && init_video_encode (record_fname, 0, 0, 30) == 0)
+        signal (SIGINT, on_sigint);
+    else
+        record_fname = NULL;
+#endif
+
     for (count = 0; ; count ++)
     {
         detect_result_t detection;
@@ -401,13 +556,23 @@ main(int argc, char *argv[])
         }
 #endif
 
-        /* invoke object detection using TensorflowLite */
-        feed_detect_image (&captex, win_w, win_h);
+        /* invoke object detection using TensorflowLite (or propagate the tracked objects) */
+        invoke_ms = 0;
+        if (need_detect ())
+        {
+            feed_detect_image (&captex, win_w, win_h);
 
-        ttime[2] = pmeter_get_time_ms ();
-        invoke_detect (&detection);
-        ttime[3] = pmeter_get_time_ms ();
-        invoke_ms = ttime[3] - ttime[2];
+            ttime[2] = pmeter_get_time_ms ();
+            invoke_detect (&detection);
+            ttime[3] = pmeter_get_time_ms ();
+            invoke_ms = ttime[3] - ttime[2];
+
+            update_detect_tracking (&detection);
+        }
+        else
+        {
+            get_tracked_objects (&detection);
+        }
 
         glClear (GL_COLOR_BUFFER_BIT);
 
@@ -417,12 +582,53 @@ main(int argc, char *argv[])
 
         draw_pmeter (0, 40);
 
-        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite  :%5.1f [ms]", interval, invoke_ms);
+        detect_tracking_stats_t tstats;
+        get_detect_tracking_stats (&tstats);
+        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite  :%5.1f [ms]\nDetSkip :%5.1f [%%]",
+            interval, invoke_ms, tstats.detect_skip_rate * 100);
+#if defined (USE_INPUT_VIDEO_DECODE)
+        if (enable_video)
+        {
+            video_decode_stats_t vstats;
+            get_video_decode_stats (&vstats);
+            sprintf (strbuf + strlen (strbuf), "\nVDEC    :%5.1f [fps] Q(%d, %d)/%d",
+                vstats.decode_fps, vstats.yuv_queue_num, vstats.rgba_queue_num, vstats.queue_depth);
+        }
+        if (record_fname)
+        {
+            video_encode_stats_t estats;
+            get_video_encode_stats (&estats);
+            sprintf (strbuf + strlen (strbuf), "\nVENC    : drop %d Q %d/%d",
+                estats.dropped_frames, estats.queue_num, estats.queue_depth);
+        }
+#endif
         draw_dbgstr (strbuf, 10, 10);
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+        if (record_fname)
+        {
+            video_encode_capture_frame ((int64_t)(ttime[1] * 1000));
+        }
+#endif
         egl_swap();
+
+        if (s_stop_request)
+            break;
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+        /* the max speed replay runs through the recording once. */
+        if (is_capture_replay_end ())
+            break;
+#endif
     }
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+    if (record_fname)
+        exit_video_encode ();
+#endif
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+    stop_capture ();
+#endif
+
     return 0;
 }
 
@@ -6,6 +6,7 @@
 #include "util_debug.h"
 #include "tflite_detect.h"
 #include "detect_postprocess.h"
+#include "util_box_tracker.h"
 
 /* 
  * https://github.com/tensorflow/models/blob/master/research/object_detection/data/mscoco_label_map.pbtxt
@@ -34,6 +35,9 @@
 #error "Please choose a TFLite Model."
 #endif
 
+/* NMS of the software TFLite_Detection_PostProcess. (0: fast NMS, 1: regular (per-class) NMS) */
+#define POSTPROCESS_USE_REGULAR_NMS     0
+
 
 static tflite_interpreter_t s_interpreter;
 static tflite_tensor_t  s_tensor_input;
@@ -41,8 +45,6 @@ static tflite_tensor_t  s_tensor_input;
 #if defined (INVOKE_POSTPROCESS_AFTER_TFLITE)
 static tflite_tensor_t  s_tensor_boxes;
 static tflite_tensor_t  s_tensor_scores;
-static float            *s_boxes_buf;
-static float            *s_scores_buf;
 #else
 static tflite_tensor_t  s_tensor_boxes;
 static tflite_tensor_t  s_tensor_scores;
@@ -50,6 +52,17 @@ static tflite_tensor_t  s_tensor_classes;
 static tflite_tensor_t  s_tensor_num;
 #endif
 
+/* object tracking */
+#define TRACK_IOU_THRESH    0.3f
+#define TRACK_MAX_MISS      2       /* detector runs a lost object is kept for */
+#define TRACK_SCORE_DECAY   0.95f   /* per frame without the detector */
+
+static box_tracker_t            s_tracker;
+static int                      s_track_detect_interval = 1;
+static float                    s_track_score_thresh    = 0.3f;
+static int                      s_track_frame_cnt;
+static detect_tracking_stats_t  s_track_stats;
+
 static char  s_class_name [MAX_DETECT_CLASS + 1][128];
 static float s_class_color[MAX_DETECT_CLASS + 1][4];
 
@@ -187,17 +200,7 @@ init_tflite_detection(int use_quantized_tflite)
     tflite_get_tensor_by_name (&s_interpreter, 1, "raw_outputs/box_encodings",     &s_tensor_boxes);
     tflite_get_tensor_by_name (&s_interpreter, 1, "raw_outputs/class_predictions", &s_tensor_scores);
 
-    /* if it's a quantized model, allocate buffers for (uint8 -> float) convertion */
-    if (s_tensor_scores.type == kTfLiteUInt8)
-    {
-        int num_anchors = s_tensor_scores.dims[1];
-        int num_classes = s_tensor_scores.dims[2];
-
-        s_scores_buf = new float[num_anchors * num_classes];
-        s_boxes_buf  = new float[num_anchors * 4]; /* float4 {x0, y0, x1, y1} */
-    }
-
-    init_detect_postprocess (ANCHORS_FILE);
+    init_detect_postprocess (ANCHORS_FILE, POSTPROCESS_USE_REGULAR_NMS);
 #else
     /* get output tensor */
     tflite_get_tensor_by_name (&s_interpreter, 1, "TFLite_Detection_PostProcess",   &s_tensor_boxes);
@@ -253,28 +256,19 @@ invoke_detect (detect_result_t *detection)
 
 #if defined (INVOKE_POSTPROCESS_AFTER_TFLITE)
     std::vector<DetectionBox> detection_boxes = {};
-    float *scores = (float *)s_tensor_scores.ptr;
-    float *boxes  = (float *)s_tensor_boxes.ptr;
 
-    /* if it's a quantized model, convert uint8 -> float */
+    /* if it's a quantized model, the uint8 tensors are passed as they are. */
     if (s_tensor_scores.type == kTfLiteUInt8)
     {
-        int num_anchors = s_tensor_scores.dims[1];
-        int num_classes = s_tensor_scores.dims[2];
-        uint8_t *scores_u8 = (uint8_t *)s_tensor_scores.ptr;
-        uint8_t *boxes_u8  = (uint8_t *)s_tensor_boxes.ptr;
-
-        scores = s_scores_buf;
-        boxes  = s_boxes_buf;
-
-        for (int i = 0; i < num_anchors * num_classes; i ++)
-            scores[i] = (scores_u8[i] - s_tensor_scores.quant_zerop) * s_tensor_scores.quant_scale;
-
-        for (int i = 0; i < num_anchors * 4; i ++)
-            boxes[i] = (boxes_u8[i] - s_tensor_boxes.quant_zerop) * s_tensor_boxes.quant_scale;
+        invoke_detection_postprocess_quant (detection_boxes,
+            (uint8_t *)s_tensor_boxes.ptr,  s_tensor_boxes.quant_scale,  s_tensor_boxes.quant_zerop,
+            (uint8_t *)s_tensor_scores.ptr, s_tensor_scores.quant_scale, s_tensor_scores.quant_zerop);
+    }
+    else
+    {
+        invoke_detection_postprocess (detection_boxes,
+            (float *)s_tensor_boxes.ptr, (float *)s_tensor_scores.ptr);
     }
-
-    invoke_detection_postprocess (detection_boxes, boxes, scores);
 
     int num = detection_boxes.size();
     num = std::min (num, MAX_DETECT_OBJS);
@@ -288,6 +282,7 @@ invoke_detect (detect_result_t *detection)
         detection->obj[i].y2        = detection_boxes[i].y2;
         detection->obj[i].score     = detection_boxes[i].score;
         detection->obj[i].det_class = detection_boxes[i].class_id;
+        detection->obj[i].track_id  = -1;
     }
 #else
     float *boxes   = (float *)s_tensor_boxes.ptr;
@@ -306,9 +301,149 @@ invoke_detect (detect_result_t *detection)
         detection->obj[i].x2        = boxes[i * sizeof(float) + 3];
         detection->obj[i].score     = scores[i];
         detection->obj[i].det_class = int(classes[i]);
+        detection->obj[i].track_id  = -1;
     }
 #endif
 
     return 0;
 }
 
+
+/* -------------------------------------------------- *
+ *  Object tracking
+ * -------------------------------------------------- */
+void
+set_detect_tracking_param (int detect_interval, float score_thresh)
+{
+    s_track_detect_interval = detect_interval;
+    s_track_score_thresh    = score_thresh;
+
+    init_box_tracker (&s_tracker, TRACK_IOU_THRESH, TRACK_MAX_MISS);
+}
+
+/* the confidence of a track decays while the detector doesn't see it. */
+static float
+get_track_score (box_track_t *trk)
+{
+    return trk->score * powf (TRACK_SCORE_DECAY, (float)trk->age);
+}
+
+int
+need_detect ()
+{
+    int num_live = 0;
+    int decayed  = 0;
+
+    predict_box_tracker (&s_tracker);
+
+    for (int i = 0; i < s_tracker.num_tracks; i ++)
+    {
+        box_track_t *trk = &s_tracker.tracks[i];
+        if (trk->miss > 0)
+            continue;
+
+        num_live ++;
+        if (get_track_score (trk) < s_track_score_thresh)
+            decayed = 1;
+    }
+
+    int need_detect = (s_track_detect_interval <= 1) ||
+                      (num_live == 0) || decayed ||
+                      (s_track_frame_cnt >= s_track_detect_interval);
+
+    if (need_detect)
+    {
+        s_track_frame_cnt = 0;
+        s_track_stats.num_detect ++;
+    }
+    s_track_frame_cnt ++;
+    s_track_stats.num_frames ++;
+
+    s_track_stats.detect_skip_rate = 1.0f - (float)s_track_stats.num_detect / (float)s_track_stats.num_frames;
+
+    return need_detect;
+}
+
+/* the objects seen by the last detector run, propagated to this frame. */
+void
+get_tracked_objects (detect_result_t *detection)
+{
+    int num = 0;
+
+    for (int i = 0; i < s_tracker.num_tracks && num < MAX_DETECT_OBJS; i ++)
+    {
+        box_track_t  *trk = &s_tracker.tracks[i];
+        detect_obj_t *obj = &detection->obj[num];
+        float box[4];
+
+        if (trk->miss > 0)
+            continue;
+
+        get_box_track_rect (&s_tracker, i, box);
+        obj->x1        = box[0];
+        obj->y1        = box[1];
+        obj->x2        = box[2];
+        obj->y2        = box[3];
+        obj->score     = get_track_score (trk);
+        obj->det_class = trk->det_class;
+        obj->track_id  = trk->track_id;
+        num ++;
+    }
+
+    detection->num = num;
+}
+
+int
+update_detect_tracking (detect_result_t *detection)
+{
+    float boxes  [MAX_DETECT_OBJS][4];
+    float scores [MAX_DETECT_OBJS];
+    int   classes[MAX_DETECT_OBJS];
+    int   track_ids[MAX_DETECT_OBJS];
+    int   num = 0;
+
+    /*
+     *  the tracks start at or above the threshold only, so that the decay
+     *  (need_detect()) measures the frames without the detector, not a low
+     *  initial score. the weaker objects are dropped from the result.
+     *  without the propagation (detect on every frame), all the detections
+     *  are kept, as before the tracking.
+     */
+    if (s_track_detect_interval > 1)
+    {
+        for (int i = 0; i < detection->num; i ++)
+        {
+            if (detection->obj[i].score >= s_track_score_thresh)
+                detection->obj[num ++] = detection->obj[i];
+        }
+        detection->num = num;
+    }
+    else
+    {
+        num = detection->num;
+    }
+
+    for (int i = 0; i < num; i ++)
+    {
+        detect_obj_t *obj = &detection->obj[i];
+        boxes[i][0] = obj->x1;
+        boxes[i][1] = obj->y1;
+        boxes[i][2] = obj->x2;
+        boxes[i][3] = obj->y2;
+        scores [i]  = obj->score;
+        classes[i]  = obj->det_class;
+    }
+
+    update_box_tracker (&s_tracker, &boxes[0][0], scores, classes, num, track_ids);
+
+    for (int i = 0; i < num; i ++)
+        detection->obj[i].track_id = track_ids[i];
+
+    return s_tracker.num_tracks;
+}
+
+void
+get_detect_tracking_stats (detect_tracking_stats_t *stats)
+{
+    *stats = s_track_stats;
+}
@@ -17,6 +17,7 @@ typedef struct _detect_obj_t
     float x1, x2, y1, y2;
     float score;
     int det_class;
+    int track_id;               /* -1: not tracked */
 } detect_obj_t;
 
 typedef struct _detect_result_t
@@ -34,6 +35,27 @@ char  *get_detect_class_name (int class_idx);
 float *get_detect_class_color (int class_idx);
 
 int invoke_detect(detect_result_t *detection);
+
+/*
+ *  object tracking:
+ *    the detector runs every (detect_interval) frames, or earlier when the
+ *    confidence of a tracked object decays below (score_thresh). in between,
+ *    the boxes are propagated by the tracker (util_box_tracker).
+ *    the detections get the track IDs even when the detector runs on every frame.
+ */
+typedef struct _detect_tracking_stats_t
+{
+    int     num_frames;
+    int     num_detect;         /* frames the detector ran */
+    float   detect_skip_rate;   /* [0, 1] */
+} detect_tracking_stats_t;
+
+/* detect_interval <= 1: detect on every frame */
+void set_detect_tracking_param (int detect_interval, float score_thresh);
+int  need_detect ();            /* call once per frame */
+void get_tracked_objects (detect_result_t *detection);
+int  update_detect_tracking (detect_result_t *detection);  /* drops the objects under score_thresh, if detect_interval > 1 */
+void get_detect_tracking_stats (detect_tracking_stats_t *stats);
     
 #ifdef __cplusplus
 }
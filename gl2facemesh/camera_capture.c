@@ -5,10 +5,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
 #include "util_v4l2.h"
 #include "util_debug.h"
 #include "util_texture.h"
+#include "util_capture_record.h"
 
 //#define USE_YUYV_TO_RGB_CONVERSION
 
@@ -20,6 +22,15 @@ static int          s_capture_w, s_capture_h;
 static int          s_capcrop_w, s_capcrop_h;
 static unsigned int s_capture_fmt;
 
+/* recording / replay of the captured frames */
+static caprec_writer_t *s_recorder;
+static pthread_mutex_t s_recorder_mutex = PTHREAD_MUTEX_INITIALIZER;
+static caprec_reader_t *s_replayer;
+static int          s_replay_realtime;
+static int          s_replay_idx;
+static int64_t      s_replay_start_us;
+static int          s_replay_end;
+
 #define _max(A, B)    ((A) > (B) ? (A) : (B))
 #define _min(A, B)    ((A) < (B) ? (A) : (B))
 
@@ -128,6 +139,36 @@ copy_yuyv_image (void *buf, int ofstx, int ofsty, int cap_w, int cap_h, unsigned
 }
 #endif
 
+static int64_t
+get_time_us ()
+{
+    struct timespec tv;
+    clock_gettime (CLOCK_MONOTONIC, &tv);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec / 1000;
+}
+
+static void
+record_capture_frame (struct timeval *tv)
+{
+    uint32_t pixfmt;
+    int      bpp;
+
+#if defined(USE_YUYV_TO_RGB_CONVERSION)
+    pixfmt = pixfmt_fourcc('R', 'G', 'B', 'A');
+    bpp    = 4;
+#else
+    pixfmt = pixfmt_fourcc('Y', 'U', 'Y', 'V');
+    bpp    = 2;
+#endif
+
+    void *plane[1]  = {s_capture_buf};
+    int   size[1]   = {s_capcrop_w * s_capcrop_h * bpp};
+    int   stride[1] = {s_capcrop_w * bpp};
+    int64_t ts_us   = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+
+    caprec_write_frame (s_recorder, pixfmt, s_capcrop_w, s_capcrop_h, ts_us, 1, plane, size, stride);
+}
+
 static void *
 capture_thread_main ()
 {
@@ -145,12 +186,108 @@ capture_thread_main ()
 #else
         copy_yuyv_image (frame->vaddr, ofstx, ofsty, s_capcrop_w, s_capcrop_h, s_capture_fmt);
 #endif
+        pthread_mutex_lock (&s_recorder_mutex);
+        if (s_recorder)
+            record_capture_frame (&frame->v4l_buf.timestamp);
+        pthread_mutex_unlock (&s_recorder_mutex);
+
         v4l2_release_capture_frame (s_cap_dev, frame);
     }
     return 0;
 }
 
 
+/* record the captured frames to (fname). must be called before start_capture() */
+int
+set_capture_record_file (const char *fname)
+{
+    s_recorder = caprec_open_writer (fname);
+    if (s_recorder == NULL)
+        return -1;
+
+    return 0;
+}
+
+/*
+ *  replay the recorded frames instead of the camera. must be called before init_capture()
+ *    realtime = 1: at the original speed, following the recorded timestamps.
+ *    realtime = 0: as fast as possible, once. every get_capture_buffer() returns the next
+ *                  frame, and is_capture_replay_end() returns 1 after the last one.
+ */
+int
+set_capture_replay_file (const char *fname, int realtime)
+{
+    s_replayer = caprec_open_reader (fname);
+    if (s_replayer == NULL)
+        return -1;
+
+    s_replay_realtime = realtime;
+    return 0;
+}
+
+static int
+init_capture_replay ()
+{
+    caprec_frame_t *frm = caprec_get_frame (s_replayer, 0, NULL);
+
+    s_capture_fmt = frm->pixformat;
+    s_capture_w   = s_capcrop_w = frm->width;
+    s_capture_h   = s_capcrop_h = frm->height;
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " replay      : %d frames, %s\n", s_replayer->num_frames,
+                     s_replay_realtime ? "original speed" : "max speed");
+    fprintf (stderr, " size        : (%d, %d)\n", s_capture_w, s_capture_h);
+    fprintf (stderr, " pixformat   : %.4s\n", (char *)&s_capture_fmt);
+    fprintf (stderr, "-------------------------------------------\n");
+
+    return 0;
+}
+
+static void *
+get_replay_buffer ()
+{
+    void *plane[CAPREC_MAX_PLANES];
+    int num_frames = s_replayer->num_frames;
+
+    if (s_replay_realtime)
+    {
+        /* the length of the recording, including the duration of the last frame */
+        caprec_frame_t *last = caprec_get_frame (s_replayer, num_frames - 1, NULL);
+        int64_t period_us = last->timestamp_us + last->timestamp_us / _max (num_frames - 1, 1);
+        int64_t now_us    = get_time_us () - s_replay_start_us;
+
+        /* rewind at the end */
+        if (period_us > 0 && now_us >= period_us)
+        {
+            s_replay_start_us += (now_us / period_us) * period_us;
+            now_us %= period_us;
+            s_replay_idx = 0;
+        }
+
+        /* the last frame whose timestamp has come. */
+        caprec_frame_t *next;
+        while ((next = caprec_get_frame (s_replayer, s_replay_idx + 1, NULL)) != NULL &&
+               next->timestamp_us <= now_us)
+        {
+            s_replay_idx ++;
+        }
+        caprec_get_frame (s_replayer, s_replay_idx, plane);
+    }
+    else
+    {
+        /* no rewind, so that a benchmark run finishes. */
+        caprec_get_frame (s_replayer, s_replay_idx, plane);
+        if (s_replay_idx + 1 < num_frames)
+            s_replay_idx ++;
+        else
+            s_replay_end = 1;
+    }
+
+    return plane[0];
+}
+
+
 int
 init_capture ()
 {
@@ -159,6 +296,9 @@ init_capture ()
     int cap_w, cap_h;
     unsigned int cap_fmt;
 
+    if (s_replayer)
+        return init_capture_replay ();
+
     cap_dev = v4l2_open_capture_device (cap_devid);
     if (cap_dev == NULL)
     {
@@ -188,7 +328,7 @@ int
 get_capture_dimension (int *width, int *height)
 {
     *width  = s_capcrop_w;
-    *height = s_capcrop_w;
+    *height = s_capcrop_h;
 
     return 0;
 }
@@ -196,6 +336,12 @@ get_capture_dimension (int *width, int *height)
 int
 get_capture_pixformat (int *pixformat)
 {
+    if (s_replayer)
+    {
+        *pixformat = s_capture_fmt;
+        return 0;
+    }
+
 #if defined(USE_YUYV_TO_RGB_CONVERSION)
     *pixformat = pixfmt_fourcc('R', 'G', 'B', 'A');
 #else
@@ -207,6 +353,12 @@ get_capture_pixformat (int *pixformat)
 int 
 get_capture_buffer (void ** buf)
 {
+    if (s_replayer)
+    {
+        *buf = get_replay_buffer ();
+        return 0;
+    }
+
     *buf = s_capture_buf;
     return 0;
 }
@@ -214,7 +366,39 @@ get_capture_buffer (void ** buf)
 int
 start_capture ()
 {
+    if (s_replayer)
+    {
+        s_replay_idx = 0;
+        s_replay_start_us = get_time_us ();
+        return 0;
+    }
+
     pthread_create (&s_capture_thread, NULL, capture_thread_main, NULL);
     return 0;
 }
 
+int
+is_capture_replay_end ()
+{
+    return s_replay_end;
+}
+
+/* finalize the recording. call at the end of the app. */
+int
+stop_capture ()
+{
+    pthread_mutex_lock (&s_recorder_mutex);
+    if (s_recorder)
+    {
+        caprec_close_writer (s_recorder);
+        s_recorder = NULL;
+    }
+    pthread_mutex_unlock (&s_recorder_mutex);
+
+    if (s_replayer)
+    {
+        caprec_close_reader (s_replayer);
+        s_replayer = NULL;
+    }
+    return 0;
+}
@@ -8,11 +8,15 @@
 #include <stdint.h>
 
 int init_capture ();
+int set_capture_record_file (const char *fname);
+int set_capture_replay_file (const char *fname, int realtime);
 int get_capture_dimension (int *width, int *height);
 int get_capture_pixformat (uint32_t *pixformat);
 int get_capture_buffer (void ** buf);
 
 int start_capture ();
+int stop_capture ();
+int is_capture_replay_end ();
 
 
 #endif
@@ -4,8 +4,10 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
 #include <float.h>
 #include <math.h>
 #include <GLES2/gl2.h>
@@ -14,11 +16,17 @@
 #include "util_pmeter.h"
 #include "util_texture.h"
 #include "util_render2d.h"
+#include "util_async_infer.h"
+#include "util_point_predict.h"
+#include "util_landmark_filter.h"
 #include "util_matrix.h"
+#include "util_affine.h"
+#include "util_qos.h"
 #include "tflite_facemesh.h"
 #include "render_facemesh.h"
 #include "camera_capture.h"
 #include "video_decode.h"
+#include "util_video_encode.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -131,7 +139,6 @@ init_video_texture (texture_2d_t *captex, const char *fname)
     get_video_pixformat (&vid_fmt);
 
     create_2d_texture_ex (captex, NULL, vid_w, vid_h, vid_fmt);
-    start_video_decode ();
 
     return 0;
 }
@@ -144,10 +151,18 @@ feed_face_detect_image(texture_2d_t *srctex, int win_w, int win_h)
     int x, y, w, h;
     float *buf_fp32 = (float *)get_face_detect_input_buf (&w, &h);
     unsigned char *buf_ui8 = NULL;
+    static int buf_w = 0, buf_h = 0;
     static unsigned char *pui8 = NULL;
 
-    if (pui8 == NULL)
+    /* the input size may be changed by QoS */
+    if (buf_w != w || buf_h != h)
+    {
+        if (pui8)
+            free (pui8);
         pui8 = (unsigned char *)malloc(w * h * 4);
+        buf_w = w;
+        buf_h = h;
+    }
 
     buf_ui8 = pui8;
 
@@ -274,41 +289,22 @@ render_detect_region (int ofstx, int ofsty, int texw, int texh, face_detect_resu
 }
 
 
+/* ROI normalized --> image normalized (--> screen, if texw > 0) */
 static void
-rot_vec (float *x, float *y, float rotation)
-{
-    *x = (*x) * cos(rotation) - (*y) * sin(rotation);
-    *y = (*x) * sin(rotation) + (*y) * cos(rotation);
-}
-
-static void
-compute_3d_face_pos (face_landmark_result_t *dst_facemesh, int texw, int texh,
+compute_3d_face_pos (face_landmark_result_t *dst_facemesh, int ofstx, int ofsty, int texw, int texh,
                      face_landmark_result_t *src_facemesh, face_t *face)
 {
-    float xoffset   = face->face_cx;// - 0.5f;
-    float yoffset   = face->face_cy;// - 0.5f;
-    float xsize     = face->face_w;
-    float ysize     = face->face_h;
-    float rotation  = face->rotation;
+    affine_t mat;
+    affine_roi_to_image (&mat, face->face_cx, face->face_cy, face->face_w, face->face_h, face->rotation);
 
-    for (int i = 0; i < FACE_KEY_NUM; i ++)
+    if (texw > 0 && texh > 0)
     {
-        float x = src_facemesh->joint[i].x;
-        float y = src_facemesh->joint[i].y;
-        float z = src_facemesh->joint[i].z;
-
-        x = x - 0.5f;
-        y = y - 0.5f;
-        rot_vec (&x, &y, rotation);
-        x *= xsize;
-        y *= ysize;
-        x += xoffset;
-        y += yoffset;
-
-        dst_facemesh->joint[i].x = x;
-        dst_facemesh->joint[i].y = y;
-        dst_facemesh->joint[i].z = z;
+        affine_t mat_screen;
+        affine_image_to_screen (&mat_screen, texw, texh, ofstx, ofsty);
+        affine_mult (&mat, &mat_screen, &mat);
     }
+
+    affine_transform_vec3 (&mat, (float *)src_facemesh->joint, (float *)dst_facemesh->joint, FACE_KEY_NUM);
 }
 
 static void
@@ -321,28 +317,19 @@ render_face_landmark (int ofstx, int ofsty, int texw, int texh,
     float col_red[]   = {0.0f, 1.0f, 0.0f, 1.0f};
     float col_white[] = {1.0f, 1.0f, 1.0f, 1.0f};
 
+    /* screen coordinate */
     face_landmark_result_t facemesh_draw;
-    compute_3d_face_pos (&facemesh_draw, texw, texh, facemesh, face);
+    compute_3d_face_pos (&facemesh_draw, ofstx, ofsty, texw, texh, facemesh, face);
 
+    /* texture coordinate of the mask image */
     face_landmark_result_t facemesh_draw_mask;
-    compute_3d_face_pos (&facemesh_draw_mask, texw, texh, facemesh_mask, face_mask);
+    compute_3d_face_pos (&facemesh_draw_mask, 0, 0, 0, 0, facemesh_mask, face_mask);
 
     float score = facemesh->score;
     char buf[512];
     sprintf (buf, "score:%4.1f", score * 100);
     draw_dbgstr_ex (buf, texw - 120, 0, 1.0f, col_white, col_red);
 
-    for (int i = 0; i < FACE_KEY_NUM; i ++)
-    {
-        float x = facemesh_draw.joint[i].x  * texw + ofstx;
-        float y = facemesh_draw.joint[i].y  * texh + ofsty;
-        facemesh_draw.joint[i].x = x;
-        facemesh_draw.joint[i].y = y;
-
-        //int r = 4;
-        //draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_red);
-    }
-
     int num_idx;
     int *mesh_tris = get_facemesh_tri_indicies (&num_idx, eyehole);
 
@@ -414,6 +401,267 @@ render_cropped_face_image (texture_2d_t *srctex, int ofstx, int ofsty, int texw,
 }
 
 
+/* stop recording (the video or the camera frames) and finalize the file on Ctrl-C. */
+static volatile sig_atomic_t s_stop_request = 0;
+
+static void
+on_sigint (int sig)
+{
+    UNUSED (sig);
+    s_stop_request = 1;
+}
+
+#if defined (USE_INPUT_VIDEO_DECODE)
+
+/* -------------------------------------------------------------------- *
+ *  Offline mode:
+ *    run every frame of the video file through the whole pipeline
+ *    exactly once, as fast as possible, and dump the per-frame results.
+ *    landmarks are written in image-normalized coordinates.
+ * -------------------------------------------------------------------- */
+static void
+write_facemesh_result (FILE *fp, int frame_no, int64_t pts_us,
+                       face_detect_result_t *detection, face_landmark_result_t *facemesh)
+{
+    fprintf (fp, "frame %d pts %lld faces %d\n", frame_no, (long long)pts_us, detection->num);
+
+    for (int face_id = 0; face_id < detection->num; face_id ++)
+    {
+        face_t *face = &detection->faces[face_id];
+        face_landmark_result_t mesh_img;
+
+        compute_3d_face_pos (&mesh_img, 0, 0, 0, 0, &facemesh[face_id], face);
+
+        fprintf (fp, "face %d score %f rect %f %f %f %f mesh_score %f\n", face_id, face->score,
+                 face->topleft.x, face->topleft.y, face->btmright.x, face->btmright.y,
+                 facemesh[face_id].score);
+
+        for (int i = 0; i < FACE_KEY_NUM; i ++)
+        {
+            fprintf (fp, "%f %f %f\n",
+                     mesh_img.joint[i].x, mesh_img.joint[i].y, mesh_img.joint[i].z);
+        }
+    }
+}
+
+static int
+run_offline_video (texture_2d_t *captex, int win_w, int win_h, const char *fname, int frame_base)
+{
+    int64_t pts_us;
+    int num_frames = 0;
+
+    FILE *fp = fopen (fname, "w");
+    if (fp == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d): can't open %s\n", __FILE__, __LINE__, fname);
+        return -1;
+    }
+
+    double ttime_start = pmeter_get_time_ms ();
+
+    while (decode_next_video_frame (&pts_us) == 0)
+    {
+        face_detect_result_t    face_detect_ret = {0};
+        face_landmark_result_t  face_mesh_ret[MAX_FACE_NUM] = {0};
+
+        update_video_texture (captex);
+
+        feed_face_detect_image (captex, win_w, win_h);
+        invoke_face_detect (&face_detect_ret);
+
+        for (int face_id = 0; face_id < face_detect_ret.num; face_id ++)
+        {
+            feed_face_landmark_image (captex, win_w, win_h, &face_detect_ret, face_id);
+            invoke_facemesh_landmark (&face_mesh_ret[face_id]);
+        }
+
+        write_facemesh_result (fp, frame_base + num_frames, pts_us, &face_detect_ret, face_mesh_ret);
+        num_frames ++;
+    }
+
+    double elapsed_ms = pmeter_get_time_ms () - ttime_start;
+    fclose (fp);
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " offline: %d frames, %.1f [ms], %.2f [frames/s]\n", num_frames,
+             elapsed_ms, (elapsed_ms > 0) ? num_frames * 1000.0 / elapsed_ms : 0);
+    fprintf (stderr, " result : %s\n", fname);
+
+    video_decode_stats_t vstats;
+    get_video_decode_stats (&vstats);
+    fprintf (stderr, " decode : %d frames, %.2f [frames/s], %d threads\n",
+             vstats.decoded_frames, vstats.decode_fps, vstats.decode_threads);
+    fprintf (stderr, "-------------------------------------------\n");
+
+    return 0;
+}
+#endif /* USE_INPUT_VIDEO_DECODE */
+
+
+/* -------------------------------------------------- *
+ *  asynchronous inference:
+ *    the face detection and the face landmarks of each face run one by one
+ *    on the inference thread. the render loop feeds the next stage when the
+ *    last one is done, and renders the last complete result with the face
+ *    ROIs extrapolated to the display time. (the landmarks are ROI relative,
+ *    so they move with the ROI.)
+ * -------------------------------------------------- */
+enum face_job_stage {
+    FACE_JOB_START = 0,
+    FACE_JOB_DETECT,
+    FACE_JOB_LANDMARK,
+};
+
+typedef struct _face_job_t
+{
+    int    stage;
+    int    face_id;
+    double capture_time;            /* of the pixels of the landmark stage */
+    double landmark_time_sum;       /* capture time of each landmark feed */
+    face_detect_result_t   face_detect_ret;
+    face_landmark_result_t face_mesh_ret[MAX_FACE_NUM];
+} face_job_t;
+
+#define FACE_PREDICT_VALUES     (4 + kFaceKeyNum * 2 + 4 * 2 + 4)
+
+static int
+face_job (void *arg)
+{
+    face_job_t *job = (face_job_t *)arg;
+
+    if (job->stage == FACE_JOB_DETECT)
+        return invoke_face_detect (&job->face_detect_ret);
+    else
+        return invoke_facemesh_landmark (&job->face_mesh_ret[job->face_id]);
+}
+
+static void
+pack_face (face_t *face, float *val)
+{
+    *val ++ = face->topleft.x;
+    *val ++ = face->topleft.y;
+    *val ++ = face->btmright.x;
+    *val ++ = face->btmright.y;
+    for (int j = 0; j < kFaceKeyNum; j ++)
+    {
+        *val ++ = face->keys[j].x;
+        *val ++ = face->keys[j].y;
+    }
+    for (int j = 0; j < 4; j ++)
+    {
+        *val ++ = face->face_pos[j].x;
+        *val ++ = face->face_pos[j].y;
+    }
+    *val ++ = face->face_cx;
+    *val ++ = face->face_cy;
+    *val ++ = face->face_w;
+    *val ++ = face->face_h;
+}
+
+static void
+unpack_face (face_t *face, const float *val)
+{
+    face->topleft.x  = *val ++;
+    face->topleft.y  = *val ++;
+    face->btmright.x = *val ++;
+    face->btmright.y = *val ++;
+    for (int j = 0; j < kFaceKeyNum; j ++)
+    {
+        face->keys[j].x = *val ++;
+        face->keys[j].y = *val ++;
+    }
+    for (int j = 0; j < 4; j ++)
+    {
+        face->face_pos[j].x = *val ++;
+        face->face_pos[j].y = *val ++;
+    }
+    face->face_cx = *val ++;
+    face->face_cy = *val ++;
+    face->face_w  = *val ++;
+    face->face_h  = *val ++;
+
+    /* extrapolating the angle itself breaks at +-PI. take it from the ROI edge. */
+    face->rotation = atan2f (face->face_pos[1].y - face->face_pos[0].y,
+                             face->face_pos[1].x - face->face_pos[0].x);
+}
+
+static void
+update_face_predictor (point_predictor_t *pp, face_detect_result_t *face_ret, double time_ms)
+{
+    float values[MAX_FACE_NUM][FACE_PREDICT_VALUES];
+
+    for (int i = 0; i < face_ret->num; i ++)
+        pack_face (&face_ret->faces[i], values[i]);
+
+    /* the faces have no ID. they are associated by the distance. */
+    update_point_predictor (pp, &values[0][0], NULL, face_ret->num, time_ms, NULL);
+}
+
+static void
+predict_faces (point_predictor_t *pp, face_detect_result_t *face_last, double time_ms,
+               face_detect_result_t *face_ret)
+{
+    /* the tracks are in the order of the last result. */
+    *face_ret = *face_last;
+
+    for (int i = 0; i < pp->num_tracks; i ++)
+    {
+        float values[FACE_PREDICT_VALUES];
+        predict_point_track (pp, i, time_ms, values);
+        unpack_face (&face_ret->faces[i], values);
+    }
+}
+
+/* feeds and submits the next stage. returns 1 when a face mesh result is complete. */
+static int
+step_face_job (face_job_t *job, texture_2d_t *captex, int win_w, int win_h, double capture_time)
+{
+    if (job->stage == FACE_JOB_START)
+    {
+        job->capture_time = capture_time;
+        job->landmark_time_sum = 0;
+
+        if (need_face_detect ())
+        {
+            feed_face_detect_image (captex, win_w, win_h);
+            job->stage = FACE_JOB_DETECT;
+            submit_async_infer (face_job, job);
+            return 0;
+        }
+
+        get_tracked_faces (&job->face_detect_ret);
+        job->stage   = FACE_JOB_LANDMARK;
+        job->face_id = -1;
+    }
+    else if (job->stage == FACE_JOB_DETECT)
+    {
+        job->stage   = FACE_JOB_LANDMARK;
+        job->face_id = -1;
+    }
+
+    /* the next face, or the end of the landmark stage */
+    job->face_id ++;
+    if (job->face_id < job->face_detect_ret.num)
+    {
+        /* the display frame moves on while the stages run. */
+        job->landmark_time_sum += capture_time;
+        feed_face_landmark_image (captex, win_w, win_h, &job->face_detect_ret, job->face_id);
+        submit_async_infer (face_job, job);
+        return 0;
+    }
+
+    /* the landmarks (and the ROIs tracked from them) are of these pixels. */
+    if (job->face_detect_ret.num > 0)
+        job->capture_time = job->landmark_time_sum / job->face_detect_ret.num;
+
+    filter_face_landmark (&job->face_detect_ret, job->face_mesh_ret, job->capture_time);
+    update_face_tracking (&job->face_detect_ret, job->face_mesh_ret);
+
+    job->stage = FACE_JOB_START;
+    return 1;
+}
+
+
 /* Adjust the texture size to fit the window size
  *
  *                      Portrait
@@ -458,6 +706,111 @@ adjust_texture (int win_w, int win_h, int texw, int texh,
 }
 
 
+/* -------------------------------------------------- *
+ *  QoS knobs (in the order to degrade)
+ *    1. inference interval : the models run every Nth frame.
+ *    2. detector interval  : (-d) x 2^level
+ *    3. detector input size: 128 ==> 96
+ *    4. model              : float ==> quantized
+ *    5. max faces          : MAX_FACE_NUM ==> 2 ==> 1
+ * -------------------------------------------------- */
+typedef struct _qos_state_t
+{
+    int infer_interval;
+    int detect_interval;            /* of the command line */
+    int detect_size;
+    int detect_size_max;
+    int max_faces;
+    int win_w, win_h;
+} qos_state_t;
+
+static int s_qos_max_faces[] = {MAX_FACE_NUM, 2, 1};
+
+static int
+qos_set_infer_interval (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    qs->infer_interval = level + 1;
+    return 0;
+}
+
+static int
+qos_set_detect_interval (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    int interval = (qs->detect_interval > 1) ? qs->detect_interval : 1;
+
+    set_face_tracking_param (interval << level, 0.5f);
+    return 0;
+}
+
+static int
+qos_set_detect_size (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    int size = (level == 0) ? qs->detect_size_max : (qs->detect_size_max * 3 / 4) & ~15;
+
+    if (set_face_detect_input_size (size) < 0)
+        return -1;
+
+    qs->detect_size = size;
+    return 0;
+}
+
+static int
+qos_set_quantized (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+
+    if (reload_tflite_facemesh (level) < 0)
+        return -1;
+
+#if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
+    glBindFramebuffer (GL_FRAMEBUFFER, 0);
+    glViewport (0, 0, qs->win_w, qs->win_h);
+#endif
+
+    /* the reloaded detector is of the model size. */
+    if (qs->detect_size != qs->detect_size_max)
+        set_face_detect_input_size (qs->detect_size);
+
+    return 0;
+}
+
+static int
+qos_set_max_faces (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    qs->max_faces = s_qos_max_faces[level];
+    return 0;
+}
+
+static void
+init_facemesh_qos (qos_ctrl_t *qc, qos_state_t *qs, double target_ms, int detect_interval,
+                   int use_quantized_tflite, int win_w, int win_h)
+{
+    int w, h;
+    get_face_detect_input_buf (&w, &h);
+
+    qs->infer_interval  = 1;
+    qs->detect_interval = detect_interval;
+    qs->detect_size     = w;
+    qs->detect_size_max = w;
+    qs->max_faces       = MAX_FACE_NUM;
+    qs->win_w           = win_w;
+    qs->win_h           = win_h;
+
+    init_qos_ctrl (qc, target_ms);
+    add_qos_knob (qc, "infer_int", 2, qos_set_infer_interval,  qs);
+    add_qos_knob (qc, "detect_int", 2, qos_set_detect_interval, qs);
+    add_qos_knob (qc, "detect_sz", 1, qos_set_detect_size,     qs);
+    add_qos_knob (qc, "quantized", use_quantized_tflite ? 0 : 1, qos_set_quantized, qs);
+    add_qos_knob (qc, "max_faces", 2, qos_set_max_faces,       qs);
+    add_qos_stage (qc, "detect");
+    add_qos_stage (qc, "landmark");
+}
+
+
 /*--------------------------------------------------------------------------- *
  *      M A I N    F U N C T I O N
  *--------------------------------------------------------------------------- */
@@ -476,27 +829,84 @@ main(int argc, char *argv[])
     int enable_video = 0;
     int enable_camera = 1;
     int drill_eye_hole = 0;
+    int detect_interval = 30;
+    int enable_async = 0;
+    int filter_type = LANDMARK_FILTER_NONE;
+    float qos_target_ms = 0.0f;
+    qos_ctrl_t  qos_ctrl;
+    qos_state_t qos_state;
+    static face_job_t job;              /* written by the inference thread */
+    face_detect_result_t   face_detect_last = {0};
+    face_landmark_result_t face_mesh_last[MAX_FACE_NUM] = {0};
+    point_predictor_t face_predictor;
+    char *offline_fname = NULL;
+#if defined (USE_INPUT_VIDEO_DECODE)
+    char *record_fname = NULL;
+    char seg_out_fname[256];
+    int num_segments = 1;
+    int frame_base = 0;
+#endif
     UNUSED (argc);
     UNUSED (*argv);
 
     {
         int c;
-        const char *optstring = "eqv:x";
+        const char *optstring = "ab:c:d:ef:j:o:p:P:qs:t:v:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1) 
         {
             switch (c)
             {
+            case 'a':
+                enable_async = 1;
+                break;
+            case 'b':
+                offline_fname = optarg;
+                break;
+            case 'd':
+                detect_interval = atoi (optarg);
+                break;
             case 'e':
                 drill_eye_hole = 1;
                 break;
+            case 'f':
+                filter_type = parse_landmark_filter_type (optarg);
+                if (filter_type < 0)
+                    return -1;
+                break;
+#if defined (USE_INPUT_VIDEO_DECODE)
+            case 'j':
+                set_video_decode_threads (atoi (optarg));
+                break;
+            case 'o':
+                record_fname = optarg;
+                break;
+            case 's':
+                num_segments = atoi (optarg);
+                break;
+#endif
             case 'q':
                 use_quantized_tflite = 1;
                 break;
+            case 't':
+                qos_target_ms = atof (optarg);
+                break;
             case 'v':
                 enable_video = 1;
                 input_name = optarg;
                 break;
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+            case 'c':
+                if (set_capture_record_file (optarg) == 0)
+                    signal (SIGINT, on_sigint);
+                break;
+            case 'p':
+                set_capture_replay_file (optarg, 1);
+                break;
+            case 'P':
+                set_capture_replay_file (optarg, 0);
+                break;
+#endif
             case 'x':
                 enable_camera = 0;
                 break;
@@ -516,7 +926,29 @@ main(int argc, char *argv[])
     if (input_name == NULL)
         input_name = input_name_default;
 
-    egl_init_with_platform_window_surface (2, 0, 0, 0, win_w * 2, win_h);
+#if defined (USE_INPUT_VIDEO_DECODE)
+    /*
+     *  segment-parallel offline mode:
+     *  fork one worker process per segment. each worker continues below
+     *  with its own EGL context, interpreters and decoder.
+     */
+    if (enable_video && offline_fname && num_segments > 1)
+    {
+        int ret = start_video_segment_workers (input_name, num_segments, offline_fname,
+                                               seg_out_fname, &frame_base);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            return 0;   /* parent: all the segments are merged. */
+
+        offline_fname = seg_out_fname;
+    }
+#endif
+
+    if (offline_fname)
+        egl_init_with_pbuffer_surface (2, 0, 0, 0, win_w * 2, win_h);
+    else
+        egl_init_with_platform_window_surface (2, 0, 0, 0, win_w * 2, win_h);
 
     init_2d_renderer (win_w, win_h);
     init_face_2d_renderer (win_w, win_h);
@@ -525,6 +957,32 @@ main(int argc, char *argv[])
     init_cube ((float)win_w / (float)win_h);
 
     init_tflite_facemesh (use_quantized_tflite);
+    set_face_tracking_param (detect_interval, 0.5f);
+    set_face_landmark_filter (filter_type);
+
+#if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
+    if (enable_async)
+    {
+        fprintf (stderr, "the GPU delegate needs the GL context. async inference disabled.\n");
+        enable_async = 0;
+    }
+#endif
+    if (enable_async)
+    {
+        init_async_infer ();
+        init_point_predictor (&face_predictor, FACE_PREDICT_VALUES, 1.0f, 0.05f);
+    }
+
+    if (enable_async && qos_target_ms > 0.0f)
+    {
+        fprintf (stderr, "the frame rate doesn't wait for the inference. QoS disabled.\n");
+        qos_target_ms = 0.0f;
+    }
+    if (qos_target_ms > 0.0f)
+    {
+        init_facemesh_qos (&qos_ctrl, &qos_state, qos_target_ms, detect_interval,
+                           use_quantized_tflite, win_w, win_h);
+    }
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the FBO binding */
@@ -540,6 +998,15 @@ main(int argc, char *argv[])
         texw = captex.width;
         texh = captex.height;
         enable_camera = 0;
+
+        if (offline_fname)
+        {
+            glViewport (0, 0, win_w, win_h);
+            if (run_offline_video (&captex, win_w, win_h, offline_fname, frame_base) < 0)
+                return -1;
+            return 0;
+        }
+        start_video_decode ();
     }
     else
 #endif
@@ -615,6 +1082,14 @@ main(int argc, char *argv[])
     /* --------------------------------------- *
      *  Render Loop
      * --------------------------------------- */
+#if defined (USE_INPUT_VIDEO_DECODE)
+    /* record the rendered frames (with overlays) to a video file. */
+    if (record_fname && init_video_encode (record_fname, 0, 0, 30) == 0)
+        signal (SIGINT, on_sigint);
+    else
+        record_fname = NULL;
+#endif
+
     for (count = 0; ; count ++)
     {
         face_detect_result_t    face_detect_ret = {0};
@@ -651,28 +1126,85 @@ main(int argc, char *argv[])
         }
 #endif
 
-        /* --------------------------------------- *
-         *  face detection
-         * --------------------------------------- */
-        feed_face_detect_image (&captex, win_w, win_h);
+        if (enable_async)
+        {
+            /* run the stages on the inference thread, one at a time. */
+            if (poll_async_infer () != ASYNC_INFER_BUSY)
+            {
+                if (step_face_job (&job, &captex, win_w, win_h, ttime[1]))
+                {
+                    face_detect_last = job.face_detect_ret;
+                    memcpy (face_mesh_last, job.face_mesh_ret, sizeof (face_mesh_last));
+                    update_face_predictor (&face_predictor, &face_detect_last, job.capture_time);
+                }
+            }
 
-        ttime[2] = pmeter_get_time_ms ();
-        invoke_face_detect (&face_detect_ret);
-        ttime[3] = pmeter_get_time_ms ();
-        invoke_ms0 = ttime[3] - ttime[2];
+            predict_faces (&face_predictor, &face_detect_last, pmeter_get_time_ms (), &face_detect_ret);
+            memcpy (face_mesh_ret, face_mesh_last, sizeof (face_mesh_last));
 
-        /* --------------------------------------- *
-         *  face landmark
-         * --------------------------------------- */
-        invoke_ms1 = 0;
-        for (int face_id = 0; face_id < face_detect_ret.num; face_id ++)
+            async_infer_stats_t astats;
+            get_async_infer_stats (&astats);
+            invoke_ms0 = astats.invoke_ms;
+            invoke_ms1 = 0;
+        }
+        else if (qos_target_ms > 0.0f && (count % qos_state.infer_interval) != 0)
+        {
+            /* QoS: reuse the last results on this frame. */
+            face_detect_ret = face_detect_last;
+            memcpy (face_mesh_ret, face_mesh_last, sizeof (face_mesh_last));
+            invoke_ms0 = 0;
+            invoke_ms1 = 0;
+        }
+        else
         {
-            feed_face_landmark_image (&captex, win_w, win_h, &face_detect_ret, face_id);
+            /* --------------------------------------- *
+             *  face detection (or the ROIs tracked from the last landmarks)
+             * --------------------------------------- */
+            invoke_ms0 = 0;
+            if (need_face_detect ())
+            {
+                feed_face_detect_image (&captex, win_w, win_h);
 
-            ttime[4] = pmeter_get_time_ms ();
-            invoke_facemesh_landmark (&face_mesh_ret[face_id]);
-            ttime[5] = pmeter_get_time_ms ();
-            invoke_ms1 += ttime[5] - ttime[4];
+                ttime[2] = pmeter_get_time_ms ();
+                invoke_face_detect (&face_detect_ret);
+                ttime[3] = pmeter_get_time_ms ();
+                invoke_ms0 = ttime[3] - ttime[2];
+            }
+            else
+            {
+                get_tracked_faces (&face_detect_ret);
+            }
+
+            if (qos_target_ms > 0.0f && face_detect_ret.num > qos_state.max_faces)
+                face_detect_ret.num = qos_state.max_faces;
+
+            /* --------------------------------------- *
+             *  face landmark
+             * --------------------------------------- */
+            invoke_ms1 = 0;
+            for (int face_id = 0; face_id < face_detect_ret.num; face_id ++)
+            {
+                feed_face_landmark_image (&captex, win_w, win_h, &face_detect_ret, face_id);
+
+                ttime[4] = pmeter_get_time_ms ();
+                invoke_facemesh_landmark (&face_mesh_ret[face_id]);
+                ttime[5] = pmeter_get_time_ms ();
+                invoke_ms1 += ttime[5] - ttime[4];
+            }
+            filter_face_landmark (&face_detect_ret, face_mesh_ret, ttime[1]);
+            update_face_tracking (&face_detect_ret, face_mesh_ret);
+
+            if (qos_target_ms > 0.0f)
+            {
+                face_detect_last = face_detect_ret;
+                memcpy (face_mesh_last, face_mesh_ret, sizeof (face_mesh_last));
+            }
+        }
+
+        if (qos_target_ms > 0.0f && count > 0)
+        {
+            double stage_ms[] = {invoke_ms0, invoke_ms1};
+            update_qos_ctrl (&qos_ctrl, interval, stage_ms);
         }
 
         /* --------------------------------------- *
@@ -732,12 +1264,70 @@ main(int argc, char *argv[])
         glViewport (0, 0, win_w, win_h);
         draw_pmeter (0, 40);
 
-        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite0 :%5.1f [ms]\nTFLite1 :%5.1f [ms]",
-            interval, invoke_ms0, invoke_ms1);
+        face_tracking_stats_t tstats;
+        get_face_tracking_stats (&tstats);
+        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite0 :%5.1f [ms]\nTFLite1 :%5.1f [ms]\nDetSkip :%5.1f [%%]",
+            interval, invoke_ms0, invoke_ms1, tstats.detect_skip_rate * 100);
+        if (enable_async)
+        {
+            async_infer_stats_t astats;
+            get_async_infer_stats (&astats);
+            sprintf (strbuf + strlen (strbuf), "\nInfer   :%5.1f [fps]", astats.infer_fps);
+        }
+        if (qos_target_ms > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nQoS     :%5.1f/%.1f [ms] L(", qos_ctrl.frame_ms, qos_target_ms);
+            for (int i = 0; i < qos_ctrl.num_knobs; i ++)
+                sprintf (strbuf + strlen (strbuf), "%s%d", i ? "," : "", get_qos_knob_level (&qos_ctrl, i));
+            strcat (strbuf, ")");
+        }
+#if defined (USE_INPUT_VIDEO_DECODE)
+        if (enable_video)
+        {
+            video_decode_stats_t vstats;
+            get_video_decode_stats (&vstats);
+            sprintf (strbuf + strlen (strbuf), "\nVDEC    :%5.1f [fps] Q(%d, %d)/%d",
+                vstats.decode_fps, vstats.yuv_queue_num, vstats.rgba_queue_num, vstats.queue_depth);
+        }
+        if (record_fname)
+        {
+            video_encode_stats_t estats;
+            get_video_encode_stats (&estats);
+            sprintf (strbuf + strlen (strbuf), "\nVENC    : drop %d Q %d/%d",
+                estats.dropped_frames, estats.queue_num, estats.queue_depth);
+        }
+#endif
         draw_dbgstr (strbuf, 10, 10);
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+        if (record_fname)
+        {
+            video_encode_capture_frame ((int64_t)(ttime[1] * 1000));
+        }
+#endif
         egl_swap();
+
+        if (s_stop_request)
+            break;
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+        /* the max speed replay runs through the recording once. */
+        if (is_capture_replay_end ())
+            break;
+#endif
+    }
+
+    if (enable_async)
+    {
+        exit_async_infer ();
+        exit_point_predictor (&face_predictor);
     }
+#if defined (USE_INPUT_VIDEO_DECODE)
+    if (record_fname)
+        exit_video_encode ();
+#endif
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+    stop_capture ();
+#endif
 
     return 0;
 }
@@ -3,8 +3,12 @@
  * Copyright (c) 2020 terryky1220@gmail.com
  * ------------------------------------------------ */
 #include "util_tflite.h"
+#include "util_anchor_decode.h"
+#include "util_nms.h"
+#include "util_affine.h"
+#include "util_landmark_filter.h"
 #include "tflite_facemesh.h"
-#include <list>
+#include <algorithm>
 
 /* 
  * https://github.com/google/mediapipe/tree/master/mediapipe/models/face_detection_front.tflite
@@ -26,7 +30,16 @@ static tflite_tensor_t      s_mesh_tensor_input;
 static tflite_tensor_t      s_mesh_tensor_landmark;
 static tflite_tensor_t      s_mesh_tensor_score;
 
-static std::list<fvec2> s_anchors;
+static anchor_decoder_t s_anchor_decoder;
+static nms_context_t    s_nms;
+
+/* face tracking */
+static int                  s_track_detect_interval = 30;
+static float                s_track_score_thresh    = 0.5f;
+static float                s_track_logit_thresh    = 0.0f;    /* the mesh score is a logit */
+static int                  s_track_frame_cnt;
+static face_detect_result_t s_track_faces;
+static face_tracking_stats_t s_track_stats;
 
 /*
  * determine where the anchor points are scatterd.
@@ -36,33 +49,15 @@ static int
 create_blazeface_anchors(int input_w, int input_h)
 {
     /* ANCHORS_CONFIG  */
-    int strides[2] = {8, 16};
-    int anchors[2] = {2,  6};
-
-    int numtotal = 0;
-
-    for (int i = 0; i < 2; i ++)
-    {
-        int stride = strides[i];
-        int gridCols = (input_w + stride -1) / stride;
-        int gridRows = (input_h + stride -1) / stride;
-        int anchorNum = anchors[i];
-
-        fvec2 anchor;
-        for (int gridY = 0; gridY < gridRows; gridY ++)
-        {
-            anchor.y = stride * (gridY + 0.5f);
-            for (int gridX = 0; gridX < gridCols; gridX ++)
-            {
-                anchor.x = stride * (gridX + 0.5f);
-                for (int n = 0; n < anchorNum; n ++)
-                {
-                    s_anchors.push_back (anchor);
-                    numtotal ++;
-                }
-            }
-        }
-    }
+    static const anchor_layer_t s_layers[] = {
+        { 8, 2},    /* stride, anchors per cell */
+        {16, 6},
+    };
+    int num_layers = sizeof (s_layers) / sizeof (s_layers[0]);
+
+    int numtotal = init_anchor_decoder_grid (&s_anchor_decoder, s_layers, num_layers,
+                                             input_w, input_h, kFaceKeyNum, 16);
+    init_nms (&s_nms, numtotal);
     return numtotal;
 }
 
@@ -89,13 +84,21 @@ init_tflite_facemesh (int use_quantized_tflite)
     }
 
     /* Face detect */
-    tflite_create_interpreter_from_file (&s_detect_interpreter, detect_model);
+    if (tflite_create_interpreter_from_file (&s_detect_interpreter, detect_model) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
     tflite_get_tensor_by_name (&s_detect_interpreter, 0, "input",          &s_detect_tensor_input);
     tflite_get_tensor_by_name (&s_detect_interpreter, 1, "regressors",     &s_detect_tensor_bboxes);
     tflite_get_tensor_by_name (&s_detect_interpreter, 1, "classificators", &s_detect_tensor_scores);
 
     /* Facemesh Landmark */
-    tflite_create_interpreter_from_file (&s_mesh_interpreter, mesh_model);
+    if (tflite_create_interpreter_from_file (&s_mesh_interpreter, mesh_model) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
     tflite_get_tensor_by_name (&s_mesh_interpreter, 0, "input_1",   &s_mesh_tensor_input);
     tflite_get_tensor_by_name (&s_mesh_interpreter, 1, "conv2d_20", &s_mesh_tensor_landmark);
     tflite_get_tensor_by_name (&s_mesh_interpreter, 1, "conv2d_30", &s_mesh_tensor_score);
@@ -107,6 +110,81 @@ init_tflite_facemesh (int use_quantized_tflite)
     return 0;
 }
 
+/*
+ *  switch the float / quantized models at runtime.
+ *  (the detector input size is back to the size of the model)
+ *  on failure, the other models are loaded back and -1 is returned.
+ */
+int
+reload_tflite_facemesh (int use_quantized_tflite)
+{
+    tflite_delete_interpreter (&s_detect_interpreter);
+    tflite_delete_interpreter (&s_mesh_interpreter);
+
+    exit_anchor_decoder (&s_anchor_decoder);
+    exit_nms (&s_nms);
+
+    if (init_tflite_facemesh (use_quantized_tflite) < 0)
+    {
+        tflite_delete_interpreter (&s_detect_interpreter);
+        tflite_delete_interpreter (&s_mesh_interpreter);
+        init_tflite_facemesh (!use_quantized_tflite);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *  resize the input of the face detector. (a multiple of 16)
+ *  the anchors are rebuilt for the new grid.
+ */
+int
+set_face_detect_input_size (int size)
+{
+    tflite::Interpreter *interpreter = s_detect_interpreter.interpreter.get ();
+    std::vector<int> dims = {1, size, size, 3};
+    std::vector<int> prev_dims = {1, s_detect_tensor_input.dims[1], s_detect_tensor_input.dims[2], 3};
+
+    if (s_detect_tensor_input.dims[1] == size && s_detect_tensor_input.dims[2] == size)
+        return 0;
+
+    /* fails with the delegates which don't support the dynamic shapes. */
+    if (interpreter->ResizeInputTensor (s_detect_tensor_input.idx, dims) != kTfLiteOk)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    if (interpreter->AllocateTensors () != kTfLiteOk)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+
+        /* back to the previous size, which the tensors and anchors are made for. */
+        if (interpreter->ResizeInputTensor (s_detect_tensor_input.idx, prev_dims) != kTfLiteOk ||
+            interpreter->AllocateTensors () != kTfLiteOk)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        }
+
+        /* the buffers may have moved with the reallocation. */
+        tflite_get_tensor_by_name (&s_detect_interpreter, 0, "input",          &s_detect_tensor_input);
+        tflite_get_tensor_by_name (&s_detect_interpreter, 1, "regressors",     &s_detect_tensor_bboxes);
+        tflite_get_tensor_by_name (&s_detect_interpreter, 1, "classificators", &s_detect_tensor_scores);
+        return -1;
+    }
+
+    tflite_get_tensor_by_name (&s_detect_interpreter, 0, "input",          &s_detect_tensor_input);
+    tflite_get_tensor_by_name (&s_detect_interpreter, 1, "regressors",     &s_detect_tensor_bboxes);
+    tflite_get_tensor_by_name (&s_detect_interpreter, 1, "classificators", &s_detect_tensor_scores);
+
+    exit_anchor_decoder (&s_anchor_decoder);
+    exit_nms (&s_nms);
+    create_blazeface_anchors (size, size);
+
+    return 0;
+}
+
 void *
 get_face_detect_input_buf (int *w, int *h)
 {
@@ -127,157 +205,67 @@ get_facemesh_landmark_input_buf (int *w, int *h)
 /* -------------------------------------------------- *
  * Invoke TensorFlow Lite (Face detection)
  * -------------------------------------------------- */
-static float *
-get_bbox_ptr (int anchor_idx)
+static int
+decode_bounds (float score_thresh)
 {
-    int idx = 16 * anchor_idx;
-    float *bboxes_ptr = (float *)s_detect_tensor_bboxes.ptr;
+    anchor_decoder_t *dec = &s_anchor_decoder;
 
-    return &bboxes_ptr[idx];
-}
+    /* only the anchors above the threshold are decoded. */
+    set_anchor_score_thresh (dec, score_thresh);
+    int num = decode_anchors (dec, (float *)s_detect_tensor_scores.ptr,
+                                   (float *)s_detect_tensor_bboxes.ptr);
 
-static int
-decode_bounds (std::list<face_t> &face_list, float score_thresh, int input_img_w, int input_img_h)
-{
-    face_t face_item;
-    float  *scores_ptr = (float *)s_detect_tensor_scores.ptr;
-    
-    int i = 0;
-    for (auto itr = s_anchors.begin(); itr != s_anchors.end(); i ++, itr ++)
+    /* NMS candidates (SoA) */
+    for (int i = 0; i < num; i ++)
     {
-        fvec2 anchor = *itr;
-        float score0 = scores_ptr[i];
-        float score = 1.0f / (1.0f + exp(-score0));
-
-        if (score > score_thresh)
-        {
-            float *p = get_bbox_ptr (i);
-
-            /* boundary box */
-            float sx = p[0];
-            float sy = p[1];
-            float w  = p[2];
-            float h  = p[3];
-
-            float cx = sx + anchor.x;
-            float cy = sy + anchor.y;
-
-            cx /= (float)input_img_w;
-            cy /= (float)input_img_h;
-            w  /= (float)input_img_w;
-            h  /= (float)input_img_h;
-
-            fvec2 topleft, btmright;
-            topleft.x  = cx - w * 0.5f;
-            topleft.y  = cy - h * 0.5f;
-            btmright.x = cx + w * 0.5f;
-            btmright.y = cy + h * 0.5f;
-
-            face_item.score    = score;
-            face_item.topleft  = topleft;
-            face_item.btmright = btmright;
-
-            /* landmark positions (6 keys) */
-            for (int j = 0; j < kFaceKeyNum; j ++)
-            {
-                float lx = p[4 + (2 * j) + 0];
-                float ly = p[4 + (2 * j) + 1];
-                lx += anchor.x;
-                ly += anchor.y;
-                lx /= (float)input_img_w;
-                ly /= (float)input_img_h;
-
-                face_item.keys[j].x = lx;
-                face_item.keys[j].y = ly;
-            }
-
-            face_list.push_back (face_item);
-        }
+        anchor_box_t *box = &dec->boxes[i];
+        nms_set_box (&s_nms, i, box->x1, box->y1, box->x2, box->y2, box->score);
     }
-    return 0;
+    s_nms.num = num;
+
+    return num;
 }
 
 /* -------------------------------------------------- *
  *  Apply NonMaxSuppression:
  *      https://github.com/tensorflow/tfjs/blob/master/tfjs-core/src/ops/image_ops.ts
  * -------------------------------------------------- */
-static float
-calc_intersection_over_union (face_t &face0, face_t &face1)
-{
-    float sx0 = face0.topleft.x;
-    float sy0 = face0.topleft.y;
-    float ex0 = face0.btmright.x;
-    float ey0 = face0.btmright.y;
-    float sx1 = face1.topleft.x;
-    float sy1 = face1.topleft.y;
-    float ex1 = face1.btmright.x;
-    float ey1 = face1.btmright.y;
-    
-    float xmin0 = std::min (sx0, ex0);
-    float ymin0 = std::min (sy0, ey0);
-    float xmax0 = std::max (sx0, ex0);
-    float ymax0 = std::max (sy0, ey0);
-    float xmin1 = std::min (sx1, ex1);
-    float ymin1 = std::min (sy1, ey1);
-    float xmax1 = std::max (sx1, ex1);
-    float ymax1 = std::max (sy1, ey1);
-    
-    float area0 = (ymax0 - ymin0) * (xmax0 - xmin0);
-    float area1 = (ymax1 - ymin1) * (xmax1 - xmin1);
-    if (area0 <= 0 || area1 <= 0)
-        return 0.0f;
-
-    float intersect_xmin = std::max (xmin0, xmin1);
-    float intersect_ymin = std::max (ymin0, ymin1);
-    float intersect_xmax = std::min (xmax0, xmax1);
-    float intersect_ymax = std::min (ymax0, ymax1);
-
-    float intersect_area = std::max (intersect_ymax - intersect_ymin, 0.0f) *
-                           std::max (intersect_xmax - intersect_xmin, 0.0f);
-    
-    return intersect_area / (area0 + area1 - intersect_area);
-}
-
-static bool
-compare (face_t &v1, face_t &v2)
+static void
+set_face_item (face_t &face, float score, float x1, float y1, float x2, float y2, const float *keys)
 {
-    if (v1.score > v2.score)
-        return true;
-    else
-        return false;
+    face.score      = score;
+    face.topleft.x  = x1;
+    face.topleft.y  = y1;
+    face.btmright.x = x2;
+    face.btmright.y = y2;
+
+    /* landmark positions (6 keys) */
+    for (int j = 0; j < kFaceKeyNum; j ++)
+    {
+        face.keys[j].x = keys[2 * j + 0];
+        face.keys[j].y = keys[2 * j + 1];
+    }
 }
 
 static int
-non_max_suppression (std::list<face_t> &face_list, std::list<face_t> &face_sel_list, float iou_thresh)
+non_max_suppression (face_t *face_sel, int max_faces, float iou_thresh)
 {
-    face_list.sort (compare);
+    anchor_decoder_t *dec = &s_anchor_decoder;
+    int num_sel;
 
-    for (auto itr = face_list.begin(); itr != face_list.end(); itr ++)
-    {
-        face_t face_candidate = *itr;
-
-        int ignore_candidate = false;
-        for (auto itr_sel = face_sel_list.rbegin(); itr_sel != face_sel_list.rend(); itr_sel ++)
-        {
-            face_t face_sel = *itr_sel;
-
-            float iou = calc_intersection_over_union (face_candidate, face_sel);
-            if (iou >= iou_thresh)
-            {
-                ignore_candidate = true;
-                break;
-            }
-        }
+    nms_blend_t blend[MAX_FACE_NUM];
+    float       blend_keys[MAX_FACE_NUM * kFaceKeyNum * 2];
 
-        if (!ignore_candidate)
-        {
-            face_sel_list.push_back(face_candidate);
-            if (face_sel_list.size() >= MAX_FACE_NUM)
-                break;
-        }
+    num_sel = nms_select (&s_nms, iou_thresh, max_faces,
+                          dec->keys, kFaceKeyNum * 2, blend, blend_keys);
+    for (int i = 0; i < num_sel; i ++)
+    {
+        nms_blend_t *b = &blend[i];
+        set_face_item (face_sel[i], b->score, b->x1, b->y1, b->x2, b->y2,
+                       &blend_keys[i * kFaceKeyNum * 2]);
     }
 
-    return 0;
+    return num_sel;
 }
 
 /* -------------------------------------------------- *
@@ -369,23 +357,18 @@ compute_face_rect (face_t &face)
 
 
 static void
-pack_face_result (face_detect_result_t *facedet_result, std::list<face_t> &face_list)
+pack_face_result (face_detect_result_t *facedet_result, face_t *face_sel, int num_faces)
 {
-    int num_faces = 0;
-    for (auto itr = face_list.begin(); itr != face_list.end(); itr ++)
+    for (int i = 0; i < num_faces; i ++)
     {
-        face_t face = *itr;
+        face_t &face = face_sel[i];
 
         compute_rotation (face);
         compute_face_rect (face);
 
-        memcpy (&facedet_result->faces[num_faces], &face, sizeof (face));
-        num_faces ++;
-        facedet_result->num = num_faces;
-
-        if (num_faces >= MAX_FACE_NUM)
-            break;
+        memcpy (&facedet_result->faces[i], &face, sizeof (face));
     }
+    facedet_result->num = num_faces;
 }
 
 
@@ -403,22 +386,13 @@ invoke_face_detect (face_detect_result_t *facedet_result)
 
     /* decode boundary box and landmark keypoints */
     float score_thresh = 0.75f;
-    std::list<face_t> face_list;
+    face_t face_sel[MAX_FACE_NUM];
 
-    int input_img_w = s_detect_tensor_input.dims[2];
-    int input_img_h = s_detect_tensor_input.dims[1];
-    decode_bounds (face_list, score_thresh, input_img_w, input_img_h);
+    decode_bounds (score_thresh);
 
-
-#if 1 /* USE NMS */
     float iou_thresh = 0.3f;
-    std::list<face_t> face_nms_list;
-
-    non_max_suppression (face_list, face_nms_list, iou_thresh);
-    pack_face_result (facedet_result, face_nms_list);
-#else
-    pack_face_result (facedet_result, face_list);
-#endif
+    int num_faces = non_max_suppression (face_sel, MAX_FACE_NUM, iou_thresh);
+    pack_face_result (facedet_result, face_sel, num_faces);
 
     return 0;
 }
@@ -457,6 +431,192 @@ invoke_facemesh_landmark (face_landmark_result_t *facemesh_result)
 }
 
 
+/* -------------------------------------------------- *
+ *  Face tracking
+ * -------------------------------------------------- */
+void
+set_face_tracking_param (int detect_interval, float score_thresh)
+{
+    s_track_detect_interval = detect_interval;
+    s_track_score_thresh    = score_thresh;
+    s_track_logit_thresh    = logf (score_thresh / (1.0f - score_thresh));
+    s_track_faces.num       = 0;
+}
+
+int
+need_face_detect ()
+{
+    int need_detect = (s_track_detect_interval <= 1) ||
+                      (s_track_faces.num == 0) ||
+                      (s_track_frame_cnt >= s_track_detect_interval);
+
+    if (need_detect)
+    {
+        s_track_frame_cnt = 0;
+        s_track_stats.num_detect ++;
+    }
+    s_track_frame_cnt ++;
+    s_track_stats.num_frames ++;
+
+    return need_detect;
+}
+
+void
+get_tracked_faces (face_detect_result_t *facedet_result)
+{
+    *facedet_result = s_track_faces;
+}
+
+/*
+ *  the same ROI as the detector gives:
+ *    the rotation from the outer corners of the eyes, and the bounding box
+ *    of the landmarks (square, x1.5) by compute_face_rect().
+ */
+static void
+compute_face_from_landmark (face_t &face, face_t &face_prev, face_landmark_result_t *facemesh, float score)
+{
+    static const int s_key_idx[kFaceKeyNum] = {
+        33,     /* kRightEye : outer corner */
+        263,    /* kLeftEye  : outer corner */
+        1,      /* kNose     */
+        13,     /* kMouth    */
+        234,    /* kRightEar */
+        454,    /* kLeftEar  */
+    };
+    fvec3 joint[FACE_KEY_NUM];
+
+    /* ROI normalized --> image normalized */
+    affine_t mat;
+    affine_roi_to_image (&mat, face_prev.face_cx, face_prev.face_cy,
+                         face_prev.face_w, face_prev.face_h, face_prev.rotation);
+    affine_transform_vec3 (&mat, (float *)facemesh->joint, (float *)joint, FACE_KEY_NUM);
+
+    float x1 = joint[0].x, y1 = joint[0].y;
+    float x2 = joint[0].x, y2 = joint[0].y;
+    for (int i = 1; i < FACE_KEY_NUM; i ++)
+    {
+        x1 = std::min (x1, joint[i].x);
+        y1 = std::min (y1, joint[i].y);
+        x2 = std::max (x2, joint[i].x);
+        y2 = std::max (y2, joint[i].y);
+    }
+
+    float keys[kFaceKeyNum * 2];
+    for (int j = 0; j < kFaceKeyNum; j ++)
+    {
+        keys[2 * j + 0] = joint[s_key_idx[j]].x;
+        keys[2 * j + 1] = joint[s_key_idx[j]].y;
+    }
+
+    set_face_item (face, score, x1, y1, x2, y2, keys);
+    compute_rotation (face);
+    compute_face_rect (face);
+}
+
+/*
+ *  keep the faces whose mesh score is above the threshold, as the ROIs of
+ *  the next frame. returns the number of the tracked faces.
+ */
+int
+update_face_tracking (face_detect_result_t *facedet_result, face_landmark_result_t *facemesh_result)
+{
+    int num_track = 0;
+
+    for (int i = 0; i < facedet_result->num; i ++)
+    {
+        float logit = facemesh_result[i].score;
+        if (logit < s_track_logit_thresh)
+            continue;
+
+        float score = 1.0f / (1.0f + expf (-logit));
+        compute_face_from_landmark (s_track_faces.faces[num_track], facedet_result->faces[i],
+                                    &facemesh_result[i], score);
+        num_track ++;
+    }
+
+    /* a face is lost. run the detection on the next frame. */
+    if (num_track < facedet_result->num)
+        num_track = 0;
+
+    s_track_faces.num = num_track;
+
+    s_track_stats.detect_skip_rate = (s_track_stats.num_frames > 0) ?
+        1.0f - (float)s_track_stats.num_detect / (float)s_track_stats.num_frames : 0.0f;
+
+    return num_track;
+}
+
+void
+get_face_tracking_stats (face_tracking_stats_t *stats)
+{
+    *stats = s_track_stats;
+}
+
+
+/* -------------------------------------------------- *
+ *  Landmark filter
+ * -------------------------------------------------- */
+static landmark_filter_t    s_filter;
+
+int
+set_face_landmark_filter (int filter_type)
+{
+    return set_landmark_filter (&s_filter, filter_type, FACE_KEY_NUM * 3);
+}
+
+/*
+ *  the mesh is ROI relative, and the ROI moves. it is filtered in the image
+ *  coordinates (z scaled as x), and mapped back to the same ROI.
+ */
+void
+filter_face_landmark (face_detect_result_t *facedet_result, face_landmark_result_t *facemesh_result,
+                      double time_ms)
+{
+    static float s_mesh[MAX_FACE_NUM][FACE_KEY_NUM * 3];
+    int   face_idx[MAX_FACE_NUM];
+    int   num = 0;
+
+    if (!is_landmark_filter_enabled (&s_filter))
+        return;
+
+    float img_w = s_mesh_tensor_input.dims[2];
+
+    for (int i = 0; i < facedet_result->num; i ++)
+    {
+        face_t &face = facedet_result->faces[i];
+        float  *mesh = s_mesh[num];
+        affine_t mat;
+
+        /* the lost faces are not filtered. */
+        if (facemesh_result[i].score < s_track_logit_thresh)
+            continue;
+
+        affine_roi_to_image (&mat, face.face_cx, face.face_cy, face.face_w, face.face_h, face.rotation);
+        affine_transform_vec3 (&mat, (float *)facemesh_result[i].joint, mesh, FACE_KEY_NUM);
+
+        for (int j = 0; j < FACE_KEY_NUM; j ++)
+            mesh[3 * j + 2] *= face.face_w / img_w;
+
+        face_idx[num ++] = i;
+    }
+
+    filter_landmark_points (&s_filter, &s_mesh[0][0], num, FACE_KEY_NUM, 3, NULL, time_ms);
+
+    for (int n = 0; n < num; n ++)
+    {
+        face_t &face = facedet_result->faces[face_idx[n]];
+        float  *mesh = s_mesh[n];
+        affine_t mat;
+
+        for (int j = 0; j < FACE_KEY_NUM; j ++)
+            mesh[3 * j + 2] *= img_w / face.face_w;
+
+        affine_image_to_roi (&mat, face.face_cx, face.face_cy, face.face_w, face.face_h, face.rotation);
+        affine_transform_vec3 (&mat, mesh, (float *)facemesh_result[face_idx[n]].joint, FACE_KEY_NUM);
+    }
+}
+
+
 /*
  * Mesh Indices.
  * https://github.com/tensorflow/tfjs-models/blob/master/facemesh/demo/triangulation.js
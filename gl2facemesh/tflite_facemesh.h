@@ -72,7 +72,23 @@ typedef struct _face_landmark_result_t
 
 
 
+/*
+ *  face tracking:
+ *    the ROI of the next frame is derived from the landmarks, and the face
+ *    detection runs only when a face is lost, or every (detect_interval) frames
+ *    to pick up the new faces.
+ */
+typedef struct _face_tracking_stats_t
+{
+    int     num_frames;
+    int     num_detect;         /* frames the face detection ran */
+    float   detect_skip_rate;   /* [0, 1] */
+} face_tracking_stats_t;
+
+
 int  init_tflite_facemesh (int use_quantized_tflite);
+int  reload_tflite_facemesh (int use_quantized_tflite);
+int  set_face_detect_input_size (int size);
 
 void *get_face_detect_input_buf (int *w, int *h);
 int  invoke_face_detect (face_detect_result_t *facedet_result);
@@ -86,6 +102,21 @@ get_static_facemesh_landmark (face_detect_result_t   *facedet_result,
 
 int *get_facemesh_tri_indicies (int *num_tris, int flags);
 
+/* detect_interval <= 1: detect on every frame (no tracking) */
+void set_face_tracking_param (int detect_interval, float score_thresh);
+int  need_face_detect ();       /* call once per frame */
+void get_tracked_faces (face_detect_result_t *facedet_result);
+int  update_face_tracking (face_detect_result_t *facedet_result, face_landmark_result_t *facemesh_result);
+void get_face_tracking_stats (face_tracking_stats_t *stats);
+
+/*
+ *  temporal filter of the mesh (enum landmark_filter_type, 0: off).
+ *  call after the landmarks of all the faces, before update_face_tracking().
+ */
+int  set_face_landmark_filter (int filter_type);
+void filter_face_landmark (face_detect_result_t *facedet_result, face_landmark_result_t *facemesh_result,
+                           double time_ms);
+
 #ifdef __cplusplus
 }
 #endif
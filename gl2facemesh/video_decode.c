@@ -2,25 +2,79 @@
  * The MIT License (MIT)
  * Copyright (c) 2020 terryky1220@gmail.com
  * ------------------------------------------------ */
+#include <string.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <sys/wait.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/time.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include "util_texture.h"
+#include "video_decode.h"
+
+/*
+ *  decode pipeline:
+ *
+ *    [demux/decode thread] --(decoded frame queue)--> [color convert thread]
+ *                          --(RGBA frame queue)---> [consumer]
+ *
+ *  the consumer is either the pts pacing thread (realtime playback, loops forever),
+ *  or the caller of decode_next_video_frame() (offline, every frame exactly once).
+ */
+#define VDEC_QUEUE_DEPTH    4
+
+typedef struct frame_queue_t
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             head;       /* slot index of the oldest frame */
+    int             num;        /* number of filled slots         */
+    int             eos;        /* producer reached end of stream */
+} frame_queue_t;
 
 static pthread_t        s_decode_thread;
+static pthread_t        s_convert_thread;
+static pthread_t        s_present_thread;
 static AVFormatContext  *s_fmt_ctx;
 static AVCodecContext   *s_dec_ctx;
 static AVStream         *s_video_st;
 static int              s_video_stream_index = -1;
 static int              s_video_w, s_video_h;
+static int              s_crop_w, s_crop_h;
 static unsigned int     s_video_fmt;
 static int64_t          s_duration_base;
+static int              s_dec_thread_num = 0;   /* 0: auto detect */
+static int              s_loop_playback;
+static int              s_pipeline_started = 0;
+
+/* decode range in stream time_base. [start, end) */
+static int64_t          s_range_start = INT64_MIN;
+static int64_t          s_range_end   = INT64_MAX;
 
 static void             *s_decode_buf = NULL;
 
+/* decoded frame queue (decoder pix_fmt) */
+static frame_queue_t    s_yuv_queue;
+static AVFrame          *s_yuv_frame[VDEC_QUEUE_DEPTH];
+static int64_t          s_yuv_pts  [VDEC_QUEUE_DEPTH];
+
+/* converted frame queue (RGBA8888, cropped) */
+static frame_queue_t    s_rgba_queue;
+static uint8_t          *s_rgba_buf[VDEC_QUEUE_DEPTH];
+static int64_t          s_rgba_pts[VDEC_QUEUE_DEPTH];
+static int              s_rgba_held = 0;
+
+static struct SwsContext *s_sws_ctx;
+static uint8_t          *s_conv_buf;
+
+/* statistics */
+static int              s_stat_decoded_frames;
+static int64_t          s_stat_decode_start_us;
+static int64_t          s_stat_decode_wait_us;
+
+
 int
 init_video_decode ()
 {
@@ -30,6 +84,14 @@ init_video_decode ()
     return 0;
 }
 
+/* must be called before open_video_file() */
+int
+set_video_decode_threads (int num_threads)
+{
+    s_dec_thread_num = num_threads;
+    return 0;
+}
+
 
 int
 open_video_file (const char *fname)
@@ -74,6 +136,10 @@ open_video_file (const char *fname)
     }
     avcodec_parameters_to_context (dec_ctx, fmt_ctx->streams[video_stream_index]->codecpar);
 
+    /* enable frame/slice threading (thread_count=0: one thread per core) */
+    dec_ctx->thread_count = s_dec_thread_num;
+    dec_ctx->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
     /* init the video decoder */
     ret = avcodec_open2 (dec_ctx, dec, NULL);
     if (ret < 0)
@@ -90,11 +156,25 @@ open_video_file (const char *fname)
     s_video_w = dec_ctx->width;
     s_video_h = dec_ctx->height;
     s_video_fmt = s_dec_ctx->pix_fmt;
-    
+
+#if 0
+    if (s_video_w > s_video_h)
+        s_crop_w = s_crop_h = s_video_h;
+    else
+        s_crop_w = s_crop_h = s_video_w;
+#else
+    s_crop_w = s_video_w;
+    s_crop_h = s_video_h;
+#endif
+
     fprintf (stderr, "-------------------------------------------\n");
     fprintf (stderr, " file  : %s\n", fname);
     fprintf (stderr, " format: %s\n", av_get_pix_fmt_name (s_video_fmt));
-    fprintf (stderr, " sizet : (%d, %d)\n", s_video_w, s_video_h);
+    fprintf (stderr, " size  : (%d, %d)\n", s_video_w, s_video_h);
+    fprintf (stderr, " crop  : (%d, %d)\n", s_crop_w,  s_crop_h);
+    fprintf (stderr, " thread: %d (%s)\n", dec_ctx->thread_count,
+             (dec_ctx->active_thread_type & FF_THREAD_FRAME) ? "frame" :
+             (dec_ctx->active_thread_type & FF_THREAD_SLICE) ? "slice" : "none");
     fprintf (stderr, "-------------------------------------------\n");
 
     return 0;
@@ -104,14 +184,14 @@ open_video_file (const char *fname)
 int
 get_video_dimension (int *width, int *height)
 {
-    *width  = s_video_w;
-    *height = s_video_h;
+    *width  = s_crop_w;
+    *height = s_crop_h;
 
     return 0;
 }
 
-int 
-get_video_pixformat (int *pixformat)
+int
+get_video_pixformat (uint32_t *pixformat)
 {
     *pixformat = pixfmt_fourcc('R', 'G', 'B', 'A');
     return 0;
@@ -124,8 +204,102 @@ get_video_buffer (void ** buf)
     return 0;
 }
 
-static int 
-save_to_ppm (AVFrame *frame, int width, int height, int icnt)
+int
+get_video_decode_stats (video_decode_stats_t *stats)
+{
+    int64_t busy_us = av_gettime () - s_stat_decode_start_us - s_stat_decode_wait_us;
+
+    stats->decoded_frames = s_stat_decoded_frames;
+    stats->decode_fps     = (busy_us > 0) ? s_stat_decoded_frames * 1000000.0f / busy_us : 0;
+    stats->decode_threads = s_dec_ctx ? s_dec_ctx->thread_count : 0;
+    stats->yuv_queue_num  = s_yuv_queue.num;
+    stats->rgba_queue_num = s_rgba_queue.num;
+    stats->queue_depth    = VDEC_QUEUE_DEPTH;
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  bounded single-producer/single-consumer frame queue.
+ *    the producer fills the slot returned by frame_queue_get_free(),
+ *    then publishes it with frame_queue_push().
+ *    the consumer reads the slot returned by frame_queue_peek(),
+ *    then releases the oldest slot with frame_queue_pop().
+ * -------------------------------------------------------------------- */
+static void
+frame_queue_init (frame_queue_t *q)
+{
+    pthread_mutex_init (&q->mutex, NULL);
+    pthread_cond_init  (&q->cond,  NULL);
+    q->head = 0;
+    q->num  = 0;
+    q->eos  = 0;
+}
+
+static int
+frame_queue_get_free (frame_queue_t *q)
+{
+    int slot;
+
+    pthread_mutex_lock (&q->mutex);
+    while (q->num >= VDEC_QUEUE_DEPTH)
+        pthread_cond_wait (&q->cond, &q->mutex);
+
+    slot = (q->head + q->num) % VDEC_QUEUE_DEPTH;
+    pthread_mutex_unlock (&q->mutex);
+
+    return slot;
+}
+
+static void
+frame_queue_push (frame_queue_t *q)
+{
+    pthread_mutex_lock (&q->mutex);
+    q->num ++;
+    pthread_cond_broadcast (&q->cond);
+    pthread_mutex_unlock (&q->mutex);
+}
+
+static void
+frame_queue_set_eos (frame_queue_t *q)
+{
+    pthread_mutex_lock (&q->mutex);
+    q->eos = 1;
+    pthread_cond_broadcast (&q->cond);
+    pthread_mutex_unlock (&q->mutex);
+}
+
+/* wait until the (skip)th frame from the oldest one is available. -1: end of stream */
+static int
+frame_queue_peek (frame_queue_t *q, int skip)
+{
+    int slot = -1;
+
+    pthread_mutex_lock (&q->mutex);
+    while (q->num <= skip && q->eos == 0)
+        pthread_cond_wait (&q->cond, &q->mutex);
+
+    if (q->num > skip)
+        slot = (q->head + skip) % VDEC_QUEUE_DEPTH;
+    pthread_mutex_unlock (&q->mutex);
+
+    return slot;
+}
+
+static void
+frame_queue_pop (frame_queue_t *q)
+{
+    pthread_mutex_lock (&q->mutex);
+    q->head = (q->head + 1) % VDEC_QUEUE_DEPTH;
+    q->num --;
+    pthread_cond_broadcast (&q->cond);
+    pthread_mutex_unlock (&q->mutex);
+}
+
+
+static int
+save_to_ppm (uint8_t *rgba, int width, int height, int icnt)
 {
     FILE *fp;
     char fname[64];
@@ -139,9 +313,9 @@ save_to_ppm (AVFrame *frame, int width, int height, int icnt)
     }
 
     fprintf (fp, "P6\n%d %d\n255\n", width, height);
-    for (int y = 0; y < height; y++)
+    for (int i = 0; i < width * height; i++)
     {
-        fwrite (frame->data[0] + y * frame->linesize[0], 1, width * 3, fp);
+        fwrite (rgba + i * 4, 1, 3, fp);
     }
 
     fclose (fp);
@@ -149,44 +323,36 @@ save_to_ppm (AVFrame *frame, int width, int height, int icnt)
     return 0;
 }
 
+/* convert to RGBA8888 and crop the center region. */
 static int
-convert_to_rgba8888 (AVFrame *frame, int width, int height)
+convert_to_rgba8888 (AVFrame *frame, uint8_t *dst)
 {
-    if (s_decode_buf == NULL)
-    {
-        s_decode_buf = (unsigned char *)malloc (width * height * 4);
-    }
+    uint8_t *dst_data[4]     = {0};
+    int      dst_linesize[4] = {0};
+    int ofstx = (s_video_w - s_crop_w) * 0.5f;
+    int ofsty = (s_video_h - s_crop_h) * 0.5f;
 
-    for (int y = 0; y < height; y ++)
+    if (ofstx == 0 && ofsty == 0)
     {
-        unsigned char *src8 = frame->data[0] + y * frame->linesize[0];
-        unsigned char *dst8 = s_decode_buf + y * width * 4;
-
-        for (int x = 0; x < width; x ++)
-        {
-           *dst8 ++ = *src8 ++;
-           *dst8 ++ = *src8 ++;
-           *dst8 ++ = *src8 ++;
-           *dst8 ++ = 255;
-        }
+        dst_data[0]     = dst;
+        dst_linesize[0] = s_video_w * 4;
+        sws_scale (s_sws_ctx, (const uint8_t * const *) frame->data,
+                   frame->linesize, 0, s_video_h, dst_data, dst_linesize);
+        return 0;
     }
-    return 0;
-}
 
-static int
-on_frame_decoded (AVFrame *frame)
-{
-    int dec_w = s_dec_ctx->width;
-    int dec_h = s_dec_ctx->height;
+    dst_data[0]     = s_conv_buf;
+    dst_linesize[0] = s_video_w * 4;
+    sws_scale (s_sws_ctx, (const uint8_t * const *) frame->data,
+               frame->linesize, 0, s_video_h, dst_data, dst_linesize);
 
-    if (0)
+    for (int y = 0; y < s_crop_h; y ++)
     {
-        static int i = 0;
-        save_to_ppm (frame, dec_w, dec_h, i++);
-    }
-
-    convert_to_rgba8888 (frame, dec_w, dec_h);
+        uint8_t *src8 = s_conv_buf + (y + ofsty) * s_video_w * 4 + ofstx * 4;
+        uint8_t *dst8 = dst + y * s_crop_w * 4;
 
+        memcpy (dst8, src8, s_crop_w * 4);
+    }
     return 0;
 }
 
@@ -205,48 +371,84 @@ get_duration_us ()
 }
 
 static void
-sleep_to_pts (AVPacket *packet)
+sleep_to_pts (int64_t pts_us)
 {
-    int64_t pts_us = 0;
-    if (packet->dts != AV_NOPTS_VALUE)
-        pts_us = packet->dts;
-
-    pts_us *= (av_q2d (s_video_st->time_base) * 1000 * 1000);
-
     int64_t delay_us = pts_us - get_duration_us ();
     if (delay_us > 0)
         av_usleep (delay_us);
 }
 
-
-static void *
-decode_thread_main ()
+static int64_t
+get_frame_pts_us (AVFrame *frame)
 {
-    AVFrame *frame    = av_frame_alloc();
-    AVFrame *framergb = av_frame_alloc();
+    int64_t pts = frame->best_effort_timestamp;
+    if (pts == AV_NOPTS_VALUE)
+        pts = 0;
 
-    if (frame == NULL || framergb == NULL)
+    return pts * av_q2d (s_video_st->time_base) * 1000 * 1000;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  [Stage 1] demux and decode.
+ * -------------------------------------------------------------------- */
+static int
+receive_decoded_frames ()
+{
+    while (1)
     {
-        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
-        return 0;
-    }
+        int64_t t0 = av_gettime ();
+        int slot = frame_queue_get_free (&s_yuv_queue);
+        s_stat_decode_wait_us += av_gettime () - t0;
 
-    int dec_w = s_dec_ctx->width;
-    int dec_h = s_dec_ctx->height;
-    int numBytes = av_image_get_buffer_size (AV_PIX_FMT_RGB24, dec_w, dec_h, 1);
+        AVFrame *frame = s_yuv_frame[slot];
+        int ret = avcodec_receive_frame (s_dec_ctx, frame);
+        if (ret == AVERROR(EAGAIN))
+        {
+            return 0;
+        }
+        else if (ret == AVERROR_EOF)
+        {
+            fprintf (stderr, "EOF.\n");
+            return 0;
+        }
+        else if (ret < 0)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            return -1;
+        }
 
-    uint8_t *buffer = (uint8_t *) av_malloc (numBytes * sizeof(uint8_t));
+        s_stat_decoded_frames ++;
 
-    av_image_fill_arrays (framergb->data, framergb->linesize, buffer, 
-                          AV_PIX_FMT_RGB24, dec_w, dec_h, 1);
+        int64_t pts = frame->best_effort_timestamp;
+        if (pts != AV_NOPTS_VALUE && pts < s_range_start)
+        {
+            /* leading frames before the start of the segment */
+            av_frame_unref (frame);
+            continue;
+        }
+        if (pts != AV_NOPTS_VALUE && pts >= s_range_end)
+        {
+            /* reached the start of the next segment */
+            av_frame_unref (frame);
+            return 1;
+        }
 
-    struct SwsContext *sws_ctx = sws_getContext(dec_w, dec_h, s_dec_ctx->pix_fmt,
-                                                dec_w, dec_h, AV_PIX_FMT_RGB24,
-                                                SWS_FAST_BILINEAR, NULL, NULL, NULL);
-    if (sws_ctx == NULL)
+        s_yuv_pts[slot] = get_frame_pts_us (frame);
+        frame_queue_push (&s_yuv_queue);
+    }
+}
+
+static void *
+decode_thread_main ()
+{
+    s_stat_decode_start_us = av_gettime ();
+
+    if (s_range_start != INT64_MIN)
     {
-        fprintf(stderr, "Cannot initialize the sws context\n");
-        return 0;
+        /* s_range_start is a keyframe pts, so this lands exactly on it. */
+        av_seek_frame (s_fmt_ctx, s_video_stream_index, s_range_start, AVSEEK_FLAG_BACKWARD);
+        avcodec_flush_buffers (s_dec_ctx);
     }
 
     while (1)
@@ -254,8 +456,6 @@ decode_thread_main ()
         AVPacket packet;
         int ret;
 
-        init_duration ();
-
         while (av_read_frame(s_fmt_ctx, &packet) >= 0)
         {
             if (packet.stream_index == s_video_stream_index)
@@ -264,34 +464,14 @@ decode_thread_main ()
                 if (ret < 0)
                 {
                     fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+                    av_packet_unref(&packet);
                     break;
                 }
 
-                while (ret >= 0)
+                if (receive_decoded_frames () != 0)
                 {
-                    ret = avcodec_receive_frame (s_dec_ctx, frame);
-                    if (ret == AVERROR(EAGAIN))
-                    {
-                        //fprintf (stderr, "retry.\n");
-                        break;
-                    }
-                    else if (ret == AVERROR_EOF)
-                    {
-                        fprintf (stderr, "EOF.\n");
-                        break;
-                    }
-                    else if (ret < 0)
-                    {
-                        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
-                        return 0;
-                    }
-
-                    sws_scale(sws_ctx, (const uint8_t * const *) frame->data,
-                                       frame->linesize, 0, dec_h,
-                                       framergb->data, framergb->linesize);
-
-                    sleep_to_pts (&packet);
-                    on_frame_decoded (framergb);
+                    av_packet_unref(&packet);
+                    goto exit;
                 }
             }
 
@@ -299,41 +479,413 @@ decode_thread_main ()
         }
 
         /* flush decoder */
-        ret = avcodec_send_packet (s_dec_ctx, &packet);
-        if (ret < 0)
-        {
-            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
-        }
+        avcodec_send_packet (s_dec_ctx, NULL);
+        if (receive_decoded_frames () < 0)
+            goto exit;
 
-        while (avcodec_receive_frame(s_dec_ctx, frame) == 0)
-        {
-            sws_scale(sws_ctx, (const uint8_t * const *) frame->data,
-                               frame->linesize, 0, dec_h,
-                               framergb->data, framergb->linesize);
-
-            sleep_to_pts (&packet);
-            on_frame_decoded (framergb);
-        }
+        if (s_loop_playback == 0)
+            break;
 
         /* rewind to restart */
         av_seek_frame (s_fmt_ctx, -1, 0, AVSEEK_FLAG_BACKWARD);
         avcodec_flush_buffers (s_dec_ctx);
     }
 
-    av_free (buffer);
-    av_frame_free (&framergb);
-    av_frame_free (&frame);
+exit:
+    frame_queue_set_eos (&s_yuv_queue);
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  [Stage 2] color conversion.
+ * -------------------------------------------------------------------- */
+static void *
+convert_thread_main ()
+{
+    while (1)
+    {
+        int src = frame_queue_peek (&s_yuv_queue, 0);
+        if (src < 0)
+            break;
+
+        int dst = frame_queue_get_free (&s_rgba_queue);
+
+        convert_to_rgba8888 (s_yuv_frame[src], s_rgba_buf[dst]);
+        s_rgba_pts[dst] = s_yuv_pts[src];
+
+        if (0)
+        {
+            static int i = 0;
+            save_to_ppm (s_rgba_buf[dst], s_crop_w, s_crop_h, i++);
+        }
+
+        av_frame_unref (s_yuv_frame[src]);
+        frame_queue_pop  (&s_yuv_queue);
+        frame_queue_push (&s_rgba_queue);
+    }
+
+    frame_queue_set_eos (&s_rgba_queue);
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  [Stage 3] consumer.
+ *    the consumer keeps the current frame in the queue while it is used,
+ *    and releases it when the next frame arrives.
+ * -------------------------------------------------------------------- */
+static int
+acquire_next_rgba_frame (int64_t *pts_us)
+{
+    int slot = frame_queue_peek (&s_rgba_queue, s_rgba_held);
+    if (slot < 0)
+        return -1;
+
+    if (s_rgba_held)
+        frame_queue_pop (&s_rgba_queue);
+    s_rgba_held = 1;
+
+    *pts_us = s_rgba_pts[slot];
+    s_decode_buf = s_rgba_buf[slot];
+
+    return 0;
+}
+
+static void *
+present_thread_main ()
+{
+    int64_t pts_us, last_pts_us = 0;
+
+    init_duration ();
 
+    while (acquire_next_rgba_frame (&pts_us) == 0)
+    {
+        /* rewound to the beginning of the stream */
+        if (pts_us < last_pts_us)
+            init_duration ();
+        last_pts_us = pts_us;
+
+        sleep_to_pts (pts_us);
+    }
     return 0;
 }
 
 
+static int
+start_decode_pipeline (int loop_playback)
+{
+    int numBytes = s_crop_w * s_crop_h * 4;
+
+    frame_queue_init (&s_yuv_queue);
+    frame_queue_init (&s_rgba_queue);
 
+    for (int i = 0; i < VDEC_QUEUE_DEPTH; i ++)
+    {
+        s_yuv_frame[i] = av_frame_alloc ();
+        s_rgba_buf[i]  = (uint8_t *)av_malloc (numBytes);
+        if (s_yuv_frame[i] == NULL || s_rgba_buf[i] == NULL)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            return -1;
+        }
+    }
 
+    if (s_crop_w != s_video_w || s_crop_h != s_video_h)
+        s_conv_buf = (uint8_t *)av_malloc (s_video_w * s_video_h * 4);
+
+    s_sws_ctx = sws_getContext(s_video_w, s_video_h, s_dec_ctx->pix_fmt,
+                               s_video_w, s_video_h, AV_PIX_FMT_RGBA,
+                               SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (s_sws_ctx == NULL)
+    {
+        fprintf(stderr, "Cannot initialize the sws context\n");
+        return -1;
+    }
+
+    s_loop_playback = loop_playback;
+    s_pipeline_started = 1;
+
+    pthread_create (&s_decode_thread,  NULL, decode_thread_main,  NULL);
+    pthread_create (&s_convert_thread, NULL, convert_thread_main, NULL);
+
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  Realtime playback:
+ *    frames are paced by their pts, and the stream loops forever.
+ *    get_video_buffer() returns the latest frame.
+ * -------------------------------------------------------------------- */
 int
 start_video_decode ()
 {
-    pthread_create (&s_decode_thread, NULL, decode_thread_main, NULL);
+    if (start_decode_pipeline (1) < 0)
+        return -1;
+
+    pthread_create (&s_present_thread, NULL, present_thread_main, NULL);
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  Offline decode:
+ *    return the next frame without pts pacing and without rewinding at
+ *    EOF, so that every frame in the stream is delivered exactly once
+ *    and in order. decoding runs ahead of the caller on its own threads.
+ *
+ *    return  0: a new frame is available via get_video_buffer().
+ *           -1: end of stream (or error).
+ * -------------------------------------------------------------------- */
+int
+decode_next_video_frame (int64_t *pts_us)
+{
+    int64_t pts;
+
+    if (s_pipeline_started == 0)
+    {
+        if (start_decode_pipeline (0) < 0)
+            return -1;
+    }
+
+    if (acquire_next_rgba_frame (&pts) < 0)
+        return -1;
+
+    if (pts_us)
+        *pts_us = pts;
+
     return 0;
 }
 
+
+/* -------------------------------------------------------------------- *
+ *  Segment-parallel offline processing:
+ *    split the file into keyframe-aligned segments, and process each
+ *    segment in its own worker process, which owns its own decoder and
+ *    its own set of TFLite interpreters.
+ *
+ *    the segment boundaries and the number of frames in each segment
+ *    are found by demuxing the whole file once (no decoding).
+ * -------------------------------------------------------------------- */
+static int
+probe_video_segments (const char *fname, int num_segments,
+                      int64_t *seg_start, int *seg_frame_base)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVPacket packet;
+    int64_t *pts_array = NULL;
+    uint8_t *key_array = NULL;
+    int num_pkts = 0, max_pkts = 0;
+    int stream_idx, num_segs = 0;
+
+    if (avformat_open_input (&fmt_ctx, fname, NULL, NULL) < 0 ||
+        avformat_find_stream_info (fmt_ctx, NULL) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    stream_idx = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (stream_idx < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        avformat_close_input (&fmt_ctx);
+        return -1;
+    }
+
+    while (av_read_frame (fmt_ctx, &packet) >= 0)
+    {
+        if (packet.stream_index == stream_idx)
+        {
+            if (num_pkts >= max_pkts)
+            {
+                max_pkts  = max_pkts ? max_pkts * 2 : 4096;
+                pts_array = (int64_t *)realloc (pts_array, max_pkts * sizeof (int64_t));
+                key_array = (uint8_t *)realloc (key_array, max_pkts);
+            }
+            pts_array[num_pkts] = (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+            key_array[num_pkts] = (packet.flags & AV_PKT_FLAG_KEY) ? 1 : 0;
+            num_pkts ++;
+        }
+        av_packet_unref (&packet);
+    }
+    avformat_close_input (&fmt_ctx);
+
+    if (num_pkts == 0)
+        goto exit;
+
+    int64_t pts_min = INT64_MAX, pts_max = INT64_MIN;
+    for (int i = 0; i < num_pkts; i ++)
+    {
+        if (pts_array[i] < pts_min) pts_min = pts_array[i];
+        if (pts_array[i] > pts_max) pts_max = pts_array[i];
+    }
+
+    /* the first segment starts from the head of the stream. */
+    seg_start[num_segs ++] = INT64_MIN;
+
+    for (int n = 1; n < num_segments; n ++)
+    {
+        /* the last keyframe at or before the ideal split point. */
+        int64_t target = pts_min + (pts_max - pts_min) * n / num_segments;
+        int64_t key_pts = INT64_MIN;
+
+        for (int i = 0; i < num_pkts; i ++)
+        {
+            if (key_array[i] && pts_array[i] <= target && pts_array[i] > key_pts)
+                key_pts = pts_array[i];
+        }
+
+        if (key_pts > pts_min && key_pts > seg_start[num_segs - 1])
+            seg_start[num_segs ++] = key_pts;
+    }
+
+    for (int n = 0; n < num_segs; n ++)
+    {
+        int cnt = 0;
+        for (int i = 0; i < num_pkts; i ++)
+        {
+            if (pts_array[i] < seg_start[n])
+                cnt ++;
+        }
+        seg_frame_base[n] = cnt;
+    }
+
+exit:
+    free (pts_array);
+    free (key_array);
+
+    return num_segs;
+}
+
+
+static int
+merge_segment_results (const char *out_fname, char seg_fname[][256], int num_segs)
+{
+    char buf[64 * 1024];
+    size_t len;
+    int ret = 0;
+
+    FILE *fp_out = fopen (out_fname, "wb");
+    if (fp_out == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d): can't open %s\n", __FILE__, __LINE__, out_fname);
+        return -1;
+    }
+
+    /* segments are disjoint and ascending in pts, so concatenation is timestamp order. */
+    for (int n = 0; n < num_segs; n ++)
+    {
+        FILE *fp_in = fopen (seg_fname[n], "rb");
+        if (fp_in == NULL)
+        {
+            fprintf (stderr, "ERR: %s(%d): can't open %s\n", __FILE__, __LINE__, seg_fname[n]);
+            ret = -1;
+            continue;
+        }
+
+        while ((len = fread (buf, 1, sizeof (buf), fp_in)) > 0)
+            fwrite (buf, 1, len, fp_out);
+
+        fclose (fp_in);
+        unlink (seg_fname[n]);
+    }
+
+    fclose (fp_out);
+    return ret;
+}
+
+
+/*
+ *  return 1: in a worker process. the decode range is already applied,
+ *            and the worker writes its results to (seg_out_fname),
+ *            numbering its frames from (frame_base).
+ *  return 0: in the parent process, after all the workers finished
+ *            and their results were merged into (out_fname).
+ *  return -1: the video can't be split, or a worker (or the merge) failed.
+ */
+#define VDEC_MAX_SEGMENTS   64
+
+int
+start_video_segment_workers (const char *fname, int num_segments, const char *out_fname,
+                             char *seg_out_fname, int *frame_base)
+{
+    int64_t seg_start[VDEC_MAX_SEGMENTS];
+    int     seg_frame_base[VDEC_MAX_SEGMENTS];
+    char    seg_fname[VDEC_MAX_SEGMENTS][256];
+    pid_t   pid[VDEC_MAX_SEGMENTS];
+    int     num_segs;
+
+    if (num_segments > VDEC_MAX_SEGMENTS)
+        num_segments = VDEC_MAX_SEGMENTS;
+
+    init_video_decode ();
+
+    num_segs = probe_video_segments (fname, num_segments, seg_start, seg_frame_base);
+    if (num_segs <= 0)
+        return -1;
+
+    /* share the cores between the workers, unless given explicitly. */
+    if (s_dec_thread_num == 0)
+    {
+        int num_cores = sysconf (_SC_NPROCESSORS_ONLN);
+        s_dec_thread_num = (num_cores / num_segs > 1) ? num_cores / num_segs : 1;
+    }
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " %d segments\n", num_segs);
+    for (int n = 0; n < num_segs; n ++)
+    {
+        sprintf (seg_fname[n], "%s.seg%02d", out_fname, n);
+        fprintf (stderr, " [%2d] frame %6d- : %s\n", n, seg_frame_base[n], seg_fname[n]);
+    }
+    fprintf (stderr, "-------------------------------------------\n");
+
+    fflush (stdout);
+    fflush (stderr);
+
+    for (int n = 0; n < num_segs; n ++)
+    {
+        pid[n] = fork ();
+        if (pid[n] < 0)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            return -1;
+        }
+
+        if (pid[n] == 0)
+        {
+            s_range_start = seg_start[n];
+            s_range_end   = (n + 1 < num_segs) ? seg_start[n + 1] : INT64_MAX;
+
+            strcpy (seg_out_fname, seg_fname[n]);
+            *frame_base = seg_frame_base[n];
+            return 1;
+        }
+    }
+
+    int ret = 0;
+    int64_t t0 = av_gettime ();
+    for (int n = 0; n < num_segs; n ++)
+    {
+        int status;
+        waitpid (pid[n], &status, 0);
+        if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        {
+            fprintf (stderr, "ERR: %s(%d): segment %d failed.\n", __FILE__, __LINE__, n);
+            ret = -1;
+        }
+    }
+    int64_t elapsed_us = av_gettime () - t0;
+
+    if (merge_segment_results (out_fname, seg_fname, num_segs) < 0)
+        ret = -1;
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " %d segments: %.1f [ms]\n", num_segs, elapsed_us / 1000.0f);
+    fprintf (stderr, " result : %s%s\n", out_fname, ret ? " (incomplete)" : "");
+    fprintf (stderr, "-------------------------------------------\n");
+
+    return ret;
+}
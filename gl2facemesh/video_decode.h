@@ -5,13 +5,31 @@
 #ifndef VIDEO_DECODE_H_
 #define VIDEO_DECODE_H_
 
+#include <stdint.h>
+
+typedef struct _video_decode_stats_t
+{
+    int   decoded_frames;   /* number of frames decoded so far                    */
+    float decode_fps;       /* decoder throughput, excluding time blocked on queue */
+    int   decode_threads;   /* number of codec threads                            */
+    int   yuv_queue_num;    /* occupancy of the decoded frame queue               */
+    int   rgba_queue_num;   /* occupancy of the RGBA frame queue                  */
+    int   queue_depth;
+} video_decode_stats_t;
+
 int init_video_decode ();
+int set_video_decode_threads (int num_threads);
 int open_video_file (const char *fname);
 int get_video_dimension (int *width, int *height);
 int get_video_pixformat (uint32_t *pixformat);
 int get_video_buffer (void ** buf);
+int get_video_decode_stats (video_decode_stats_t *stats);
 
 int start_video_decode ();
+int decode_next_video_frame (int64_t *pts_us);
+
+int start_video_segment_workers (const char *fname, int num_segments, const char *out_fname,
+                                 char *seg_out_fname, int *frame_base);
 
 
 #endif
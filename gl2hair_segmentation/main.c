@@ -4,6 +4,7 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
@@ -15,8 +16,10 @@
 #include "util_texture.h"
 #include "util_render2d.h"
 #include "util_matrix.h"
+#include "util_motion_gate.h"
 #include "tflite_hair_segmentation.h"
 #include "render_hair.h"
+#include "util_segmap.h"
 #include "camera_capture.h"
 #include "video_decode.h"
 
@@ -121,8 +124,8 @@ init_video_texture (texture_2d_t *captex, const char *fname)
 
 
 /* resize image to DNN network input size and convert to fp32. */
-void
-feed_segmentation_image (texture_2d_t *srctex, int win_w, int win_h)
+int
+feed_segmentation_image (texture_2d_t *srctex, int win_w, int win_h, motion_gate_t *gate)
 {
     int x, y, w, h;
     float *buf_fp32 = (float *)get_segmentation_input_buf (&w, &h);
@@ -139,6 +142,10 @@ feed_segmentation_image (texture_2d_t *srctex, int win_w, int win_h)
     glPixelStorei (GL_PACK_ALIGNMENT, 4);
     glReadPixels (0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, buf_ui8);
 
+    /* the scene hasn't changed. reuse the last output of the model. */
+    if (gate && !check_motion_gate (gate, buf_ui8, w, h))
+        return 0;
+
     /* convert UI8 [0, 255] ==> FP32 [0, 1] */
     float mean =   0.0f;
     float std  = 255.0f;
@@ -157,7 +164,7 @@ feed_segmentation_image (texture_2d_t *srctex, int win_w, int win_h)
         }
     }
 
-    return;
+    return 1;
 }
 
 static void 
@@ -245,12 +252,17 @@ render_segment_result (int ofstx, int ofsty, int draw_w, int draw_h,
     int segmap_w  = segment_ret->segmentmap_dims[0];
     int segmap_h  = segment_ret->segmentmap_dims[1];
     int segmap_c  = segment_ret->segmentmap_dims[2];
-    int x, y, c;
-    unsigned int imgbuf[segmap_h][segmap_w];
+    int c;
+    static uint32_t *s_imgbuf = NULL;
+    static segmap_texture_t s_segmap_tex;
+    uint32_t palette[SEGMAP_MAX_CLASS];
     float hair_color[4] = {0};
     float back_color[4] = {0};
     static float s_hsv_h = 0.0f;
 
+    if (s_imgbuf == NULL)
+        s_imgbuf = (uint32_t *)malloc (segmap_w * segmap_h * sizeof (uint32_t));
+
     s_hsv_h += 5.0f;
     if (s_hsv_h >= 360.0f)
         s_hsv_h = 0.0f;
@@ -263,46 +275,13 @@ render_segment_result (int ofstx, int ofsty, int draw_w, int draw_h,
 #endif
 
     /* find the most confident class for each pixel. */
-    for (y = 0; y < segmap_h; y ++)
-    {
-        for (x = 0; x < segmap_w; x ++)
-        {
-            int max_id;
-            float conf_max = 0;
-            for (c = 0; c < MAX_SEGMENT_CLASS; c ++)
-            {
-                float confidence = segmap[(y * segmap_w * segmap_c)+ (x * segmap_c) + c];
-                if (c == 0 || confidence > conf_max)
-                {
-                    conf_max = confidence;
-                    max_id = c;
-                }
-            }
-
-            float *col = (max_id > 0) ? hair_color : back_color;
-            unsigned char r = ((int)(col[0] * 255)) & 0xff;
-            unsigned char g = ((int)(col[1] * 255)) & 0xff;
-            unsigned char b = ((int)(col[2] * 255)) & 0xff;
-            unsigned char a = ((int)(col[3] * 255)) & 0xff;
-
-            imgbuf[y][x] = (a << 24) | (b << 16) | (g << 8) | (r);
-        }
-    }
-
-    GLuint texid;
-    glGenTextures (1, &texid );
-    glBindTexture (GL_TEXTURE_2D, texid);
-
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    for (c = 0; c < SEGMAP_MAX_CLASS; c ++)
+        palette[c] = segmap_color_to_rgba ((c > 0) ? hair_color : back_color);
 
-    glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+    segmap_argmax_f32 (segmap, segmap_w, segmap_h, segmap_c, palette, s_imgbuf);
 
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA,
-        segmap_w, segmap_h, 0, GL_RGBA,
-        GL_UNSIGNED_BYTE, imgbuf);
+    update_segmap_texture (&s_segmap_tex, s_imgbuf, segmap_w, segmap_h, GL_RGBA);
+    GLuint texid = s_segmap_tex.texid;
 
 #if !defined (RENDER_BY_BLEND)
     draw_colored_hair (srctex, texid, ofstx, ofsty, draw_w, draw_h, 0, hair_color);
@@ -313,8 +292,6 @@ render_segment_result (int ofstx, int ofsty, int draw_w, int draw_h,
     draw_2d_texture_blendfunc (texid, ofstx, ofsty, draw_w, draw_h, 0, blend_add);
 #endif
 
-    glDeleteTextures (1, &texid);
-
     render_hsv_circle (ofstx + draw_w - 100, ofsty + 100, s_hsv_h);
 }
 
@@ -379,6 +356,9 @@ main(int argc, char *argv[])
     texture_2d_t captex = {0};
     double ttime[10] = {0}, interval, invoke_ms;
     int enable_camera = 1;
+    float motion_thresh = 0.0f;
+    int motion_max_stale = 30;
+    motion_gate_t motion_gate;
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
@@ -387,7 +367,7 @@ main(int argc, char *argv[])
 
     {
         int c;
-        const char *optstring = "v:x";
+        const char *optstring = "m:M:v:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1) 
         {
@@ -399,6 +379,12 @@ main(int argc, char *argv[])
                 input_name = optarg;
                 break;
 #endif
+            case 'm':
+                motion_thresh = atof (optarg);
+                break;
+            case 'M':
+                motion_max_stale = atoi (optarg);
+                break;
             case 'x':
                 enable_camera = 0;
                 break;
@@ -422,6 +408,7 @@ main(int argc, char *argv[])
     init_pmeter (win_w, win_h, 500);
     init_dbgstr (win_w, win_h);
     init_tflite_segmentation ();
+    init_motion_gate (&motion_gate, motion_thresh, motion_max_stale);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the context */
@@ -460,9 +447,9 @@ main(int argc, char *argv[])
     adjust_texture (win_w, win_h, texw, texh, &draw_x, &draw_y, &draw_w, &draw_h);
 
     glClearColor (0.0f, 0.0f, 0.0f, 1.0f);
+    segmentation_result_t segment_result = {0};
     for (count = 0; ; count ++)
     {
-        segmentation_result_t segment_result;
         char strbuf[512];
 
         PMETER_RESET_LAP ();
@@ -490,12 +477,14 @@ main(int argc, char *argv[])
 #endif
 
         /* invoke hair segmentation using TensorflowLite */
-        feed_segmentation_image (&captex, win_w, win_h);
-
-        ttime[2] = pmeter_get_time_ms ();
-        invoke_segmentation (&segment_result);
-        ttime[3] = pmeter_get_time_ms ();
-        invoke_ms = ttime[3] - ttime[2];
+        invoke_ms = 0;
+        if (feed_segmentation_image (&captex, win_w, win_h, &motion_gate))
+        {
+            ttime[2] = pmeter_get_time_ms ();
+            invoke_segmentation (&segment_result);
+            ttime[3] = pmeter_get_time_ms ();
+            invoke_ms = ttime[3] - ttime[2];
+        }
 
         glClear (GL_COLOR_BUFFER_BIT);
 
@@ -510,6 +499,11 @@ main(int argc, char *argv[])
         draw_pmeter (0, 40);
 
         sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite  :%5.1f [ms]", interval, invoke_ms);
+        if (motion_thresh > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nSkip    :%5.1f [%%]",
+                get_motion_gate_skip_rate (&motion_gate) * 100);
+        }
         draw_dbgstr (strbuf, 10, 10);
 
         egl_swap();
@@ -4,6 +4,8 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <unistd.h>
 #include <time.h>
 #include <float.h>
@@ -13,7 +15,12 @@
 #include "util_pmeter.h"
 #include "util_texture.h"
 #include "util_render2d.h"
+#include "util_async_infer.h"
+#include "util_point_predict.h"
+#include "util_landmark_filter.h"
 #include "util_matrix.h"
+#include "util_affine.h"
+#include "util_qos.h"
 #include "tflite_handpose.h"
 #include "camera_capture.h"
 #include "render_handpose.h"
@@ -171,13 +178,18 @@ feed_hand_landmark_image(texture_2d_t *srctex, int win_w, int win_h, palm_detect
 static void
 render_palm_region (int ofstx, int ofsty, int texw, int texh, palm_detection_result_t *detection)
 {
-    float col_blue[]  = {0.0f, 0.0f, 1.0f, 1.0f};
     float col_red[]   = {1.0f, 0.0f, 0.0f, 1.0f};
     float col_white[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    float col_track[][4] = {{0.0f, 0.0f, 1.0f, 1.0f},   /* the color follows the track ID */
+                            {0.0f, 0.6f, 0.0f, 1.0f},
+                            {0.8f, 0.0f, 0.8f, 1.0f},
+                            {0.8f, 0.5f, 0.0f, 1.0f}};
+    int num_col = sizeof (col_track) / sizeof (col_track[0]);
 
     for (int i = 0; i < detection->num; i ++)
     {
         palm_t *palm = &(detection->palms[i]);
+        float *col_palm = col_track[palm->track_id % num_col];
         float x1 = palm->rect.topleft.x  * texw + ofstx;
         float y1 = palm->rect.topleft.y  * texh + ofsty;
         float x2 = palm->rect.btmright.x * texw + ofstx;
@@ -185,12 +197,12 @@ render_palm_region (int ofstx, int ofsty, int texw, int texh, palm_detection_res
         float score = palm->score;
 
         /* rectangle region */
-        draw_2d_rect (x1, y1, x2-x1, y2-y1, col_blue, 2.0f);
+        draw_2d_rect (x1, y1, x2-x1, y2-y1, col_palm, 2.0f);
 
         /* class name */
         char buf[512];
-        sprintf (buf, "%d", (int)(score * 100));
-        draw_dbgstr_ex (buf, x1, y1, 1.0f, col_white, col_blue);
+        sprintf (buf, "#%d:%d", palm->track_id, (int)(score * 100));
+        draw_dbgstr_ex (buf, x1, y1, 1.0f, col_white, col_palm);
 
         /* key points */
         for (int j = 0; j < 7; j ++)
@@ -199,7 +211,7 @@ render_palm_region (int ofstx, int ofsty, int texw, int texh, palm_detection_res
             float y = palm->keys[j].y * texh + ofsty;
 
             int r = 4;
-            draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_blue);
+            draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_palm);
         }
 
         for (int j0 = 0; j0 < 4; j0 ++)
@@ -245,26 +257,18 @@ compute_3d_hand_pos (hand_landmark_result_t *dst_hand, int texw, int texh, hand_
 
     xoffset *= (1.0f / palm->hand_w);
 
-    //fprintf (stderr, "------------------------------\n");
-    for (int i = 0; i < HAND_JOINT_NUM; i ++)
-    {
-        float x = src_hand->joint[i].x;
-        float y = src_hand->joint[i].y;
-        float z = src_hand->joint[i].z;
-
-        x = (x + xoffset) - 0.5f;
-        y = (y + yoffset) - 0.5f;
-        z = (z + zoffset);
-        y = -y;
-        z = -z;
-        x = x * texw;
-        y = y * texh;
-
-        dst_hand->joint[i].x = x;
-        dst_hand->joint[i].y = y;
-        dst_hand->joint[i].z = z;
-        //fprintf (stderr, "(%8.1f, %8.1f, %8.1f)\n", x, y, z);
-    }
+    /*
+     *  x = ( x + xoffset - 0.5) * texw
+     *  y = (-y - yoffset + 0.5) * texh
+     *  z =  -z - zoffset
+     */
+    affine_t mat;
+    float *m = mat.m;
+    m[0] = texw;  m[1] =  0.0f;  m[ 2] =  0.0f;  m[ 3] =  (xoffset - 0.5f) * texw;
+    m[4] = 0.0f;  m[5] = -texh;  m[ 6] =  0.0f;  m[ 7] = -(yoffset - 0.5f) * texh;
+    m[8] = 0.0f;  m[9] =  0.0f;  m[10] = -1.0f;  m[11] = -zoffset;
+
+    affine_transform_vec3 (&mat, (float *)src_hand->joint, (float *)dst_hand->joint, HAND_JOINT_NUM);
 }
 
 static void
@@ -467,6 +471,178 @@ render_cropped_hand_image (texture_2d_t *srctex, int ofstx, int ofsty, int texw,
 }
 
 
+/* -------------------------------------------------- *
+ *  asynchronous inference:
+ *    the palm detection and the hand landmarks of each palm run one by one
+ *    on the inference thread. the render loop feeds the next stage when the
+ *    last one is done, and renders the last complete result with the hand
+ *    ROIs extrapolated to the display time. (the joints are ROI relative,
+ *    so they move with the ROI.)
+ * -------------------------------------------------- */
+enum hand_job_stage {
+    HAND_JOB_START = 0,
+    HAND_JOB_PALM,
+    HAND_JOB_LANDMARK,
+};
+
+typedef struct _hand_job_t
+{
+    int    stage;
+    int    hand_id;
+    double capture_time;            /* of the pixels of the landmark stage */
+    double landmark_time_sum;       /* capture time of each landmark feed */
+    palm_detection_result_t palm_ret;
+    hand_landmark_result_t  hand_ret[MAX_PALM_NUM];
+} hand_job_t;
+
+#define PALM_PREDICT_VALUES     (4 + 7 * 2 + 4 * 2 + 4)
+
+static int
+hand_job (void *arg)
+{
+    hand_job_t *job = (hand_job_t *)arg;
+
+    if (job->stage == HAND_JOB_PALM)
+        return invoke_palm_detection (&job->palm_ret, 0);
+    else
+        return invoke_hand_landmark (&job->hand_ret[job->hand_id]);
+}
+
+static void
+pack_palm (palm_t *palm, float *val)
+{
+    *val ++ = palm->rect.topleft.x;
+    *val ++ = palm->rect.topleft.y;
+    *val ++ = palm->rect.btmright.x;
+    *val ++ = palm->rect.btmright.y;
+    for (int j = 0; j < 7; j ++)
+    {
+        *val ++ = palm->keys[j].x;
+        *val ++ = palm->keys[j].y;
+    }
+    for (int j = 0; j < 4; j ++)
+    {
+        *val ++ = palm->hand_pos[j].x;
+        *val ++ = palm->hand_pos[j].y;
+    }
+    *val ++ = palm->hand_cx;
+    *val ++ = palm->hand_cy;
+    *val ++ = palm->hand_w;
+    *val ++ = palm->hand_h;
+}
+
+static void
+unpack_palm (palm_t *palm, const float *val)
+{
+    palm->rect.topleft.x  = *val ++;
+    palm->rect.topleft.y  = *val ++;
+    palm->rect.btmright.x = *val ++;
+    palm->rect.btmright.y = *val ++;
+    for (int j = 0; j < 7; j ++)
+    {
+        palm->keys[j].x = *val ++;
+        palm->keys[j].y = *val ++;
+    }
+    for (int j = 0; j < 4; j ++)
+    {
+        palm->hand_pos[j].x = *val ++;
+        palm->hand_pos[j].y = *val ++;
+    }
+    palm->hand_cx = *val ++;
+    palm->hand_cy = *val ++;
+    palm->hand_w  = *val ++;
+    palm->hand_h  = *val ++;
+
+    /* extrapolating the angle itself breaks at +-PI. take it from the ROI edge. */
+    palm->rotation = atan2f (palm->hand_pos[1].y - palm->hand_pos[0].y,
+                             palm->hand_pos[1].x - palm->hand_pos[0].x);
+}
+
+static void
+update_palm_predictor (point_predictor_t *pp, palm_detection_result_t *palm_ret, double time_ms)
+{
+    float values[MAX_PALM_NUM][PALM_PREDICT_VALUES];
+    int   track_ids[MAX_PALM_NUM];
+
+    for (int i = 0; i < palm_ret->num; i ++)
+    {
+        pack_palm (&palm_ret->palms[i], values[i]);
+        track_ids[i] = palm_ret->palms[i].track_id;
+    }
+    update_point_predictor (pp, &values[0][0], track_ids, palm_ret->num, time_ms, NULL);
+}
+
+static void
+predict_palms (point_predictor_t *pp, palm_detection_result_t *palm_last, double time_ms,
+               palm_detection_result_t *palm_ret)
+{
+    /* the tracks are in the order of the last result. */
+    *palm_ret = *palm_last;
+
+    for (int i = 0; i < pp->num_tracks; i ++)
+    {
+        float values[PALM_PREDICT_VALUES];
+        predict_point_track (pp, i, time_ms, values);
+        unpack_palm (&palm_ret->palms[i], values);
+    }
+}
+
+/* feeds and submits the next stage. returns 1 when a hand pose result is complete. */
+static int
+step_hand_job (hand_job_t *job, texture_2d_t *captex, int win_w, int win_h,
+               int enable_palm_detect, double capture_time)
+{
+    if (job->stage == HAND_JOB_START)
+    {
+        job->capture_time = capture_time;
+        job->landmark_time_sum = 0;
+
+        if (enable_palm_detect && need_palm_detect ())
+        {
+            feed_palm_detection_image (captex, win_w, win_h);
+            job->stage = HAND_JOB_PALM;
+            submit_async_infer (hand_job, job);
+            return 0;
+        }
+
+        if (enable_palm_detect)
+            get_tracked_palms (&job->palm_ret);
+        else
+            invoke_palm_detection (&job->palm_ret, 1);
+
+        job->stage   = HAND_JOB_LANDMARK;
+        job->hand_id = -1;
+    }
+    else if (job->stage == HAND_JOB_PALM)
+    {
+        job->stage   = HAND_JOB_LANDMARK;
+        job->hand_id = -1;
+    }
+
+    /* the next hand, or the end of the landmark stage */
+    job->hand_id ++;
+    if (job->hand_id < job->palm_ret.num)
+    {
+        /* the display frame moves on while the stages run. */
+        job->landmark_time_sum += capture_time;
+        feed_hand_landmark_image (captex, win_w, win_h, &job->palm_ret, job->hand_id);
+        submit_async_infer (hand_job, job);
+        return 0;
+    }
+
+    /* the landmarks (and the ROIs tracked from them) are of these pixels. */
+    if (job->palm_ret.num > 0)
+        job->capture_time = job->landmark_time_sum / job->palm_ret.num;
+
+    filter_hand_landmark (&job->palm_ret, job->hand_ret, job->capture_time);
+    if (enable_palm_detect)
+        update_hand_tracking (&job->palm_ret, job->hand_ret);
+
+    job->stage = HAND_JOB_START;
+    return 1;
+}
+
+
 /* Adjust the texture size to fit the window size
  *
  *                      Portrait
@@ -511,6 +687,84 @@ adjust_texture (int win_w, int win_h, int texw, int texh,
 }
 
 
+/* -------------------------------------------------- *
+ *  QoS knobs (in the order to degrade)
+ *    1. landmark interval      : the models run every Nth frame.
+ *    2. palm detection interval: (-d) x 2^level (with -m)
+ *    3. model                  : float ==> quantized
+ *    4. max hands              : MAX_PALM_NUM ==> 2 ==> 1
+ * -------------------------------------------------- */
+typedef struct _qos_state_t
+{
+    int infer_interval;
+    int detect_interval;            /* of the command line */
+    int max_hands;
+    int win_w, win_h;
+} qos_state_t;
+
+static int s_qos_max_hands[] = {MAX_PALM_NUM, 2, 1};
+
+static int
+qos_set_infer_interval (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    qs->infer_interval = level + 1;
+    return 0;
+}
+
+static int
+qos_set_detect_interval (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    int interval = (qs->detect_interval > 1) ? qs->detect_interval : 1;
+
+    set_hand_tracking_param (interval << level, 0.5f);
+    return 0;
+}
+
+static int
+qos_set_quantized (void *arg, int level)
+{
+    if (reload_tflite_hand_landmark (level) < 0)
+        return -1;
+
+#if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
+    qos_state_t *qs = (qos_state_t *)arg;
+    glBindFramebuffer (GL_FRAMEBUFFER, 0);
+    glViewport (0, 0, qs->win_w, qs->win_h);
+#endif
+
+    return 0;
+}
+
+static int
+qos_set_max_hands (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    qs->max_hands = s_qos_max_hands[level];
+    return 0;
+}
+
+static void
+init_handpose_qos (qos_ctrl_t *qc, qos_state_t *qs, double target_ms, int detect_interval,
+                   int enable_palm_detect, int use_quantized_tflite, int win_w, int win_h)
+{
+    qs->infer_interval  = 1;
+    qs->detect_interval = detect_interval;
+    qs->max_hands       = MAX_PALM_NUM;
+    qs->win_w           = win_w;
+    qs->win_h           = win_h;
+
+    init_qos_ctrl (qc, target_ms);
+    add_qos_knob (qc, "infer_int",  2, qos_set_infer_interval,  qs);
+    add_qos_knob (qc, "detect_int", enable_palm_detect ? 2 : 0, qos_set_detect_interval, qs);
+    add_qos_knob (qc, "quantized",  use_quantized_tflite ? 0 : 1, qos_set_quantized, qs);
+    add_qos_knob (qc, "max_hands",  2, qos_set_max_hands,       qs);
+    add_qos_stage (qc, "palm");
+    add_qos_stage (qc, "landmark");
+}
+
+
 /*--------------------------------------------------------------------------- *
  *      M A I N    F U N C T I O N
  *--------------------------------------------------------------------------- */
@@ -528,23 +782,47 @@ main(int argc, char *argv[])
     int use_quantized_tflite = 0;
     int enable_palm_detect = 0;
     int enable_camera = 1;
+    int detect_interval = 30;
+    int enable_async = 0;
+    int filter_type = LANDMARK_FILTER_NONE;
+    float qos_target_ms = 0.0f;
+    qos_ctrl_t  qos_ctrl;
+    qos_state_t qos_state;
+    static hand_job_t job;              /* written by the inference thread */
+    palm_detection_result_t palm_last = {0};
+    hand_landmark_result_t  hand_last[MAX_PALM_NUM] = {0};
+    point_predictor_t palm_predictor;
     UNUSED (argc);
     UNUSED (*argv);
 
     {
         int c;
-        const char *optstring = "mqx";
+        const char *optstring = "ad:f:mqt:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1) 
         {
             switch (c)
             {
+            case 'a':
+                enable_async = 1;
+                break;
+            case 'd':
+                detect_interval = atoi (optarg);
+                break;
+            case 'f':
+                filter_type = parse_landmark_filter_type (optarg);
+                if (filter_type < 0)
+                    return -1;
+                break;
             case 'm':
                 enable_palm_detect = 1;
                 break;
             case 'q':
                 use_quantized_tflite = 1;
                 break;
+            case 't':
+                qos_target_ms = atof (optarg);
+                break;
             case 'x':
                 enable_camera = 0;
                 break;
@@ -566,6 +844,32 @@ main(int argc, char *argv[])
     init_cube ((float)win_w / (float)win_h);
 
     init_tflite_hand_landmark (use_quantized_tflite);
+    set_hand_tracking_param (detect_interval, 0.5f);
+    set_hand_landmark_filter (filter_type);
+
+#if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
+    if (enable_async)
+    {
+        fprintf (stderr, "the GPU delegate needs the GL context. async inference disabled.\n");
+        enable_async = 0;
+    }
+#endif
+    if (enable_async)
+    {
+        init_async_infer ();
+        init_point_predictor (&palm_predictor, PALM_PREDICT_VALUES, 1.0f, 0.0f);
+    }
+
+    if (enable_async && qos_target_ms > 0.0f)
+    {
+        fprintf (stderr, "the frame rate doesn't wait for the inference. QoS disabled.\n");
+        qos_target_ms = 0.0f;
+    }
+    if (qos_target_ms > 0.0f)
+    {
+        init_handpose_qos (&qos_ctrl, &qos_state, qos_target_ms, detect_interval,
+                           enable_palm_detect, use_quantized_tflite, win_w, win_h);
+    }
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the FBO binding */
@@ -623,35 +927,93 @@ main(int argc, char *argv[])
         }
 #endif
 
-        /* --------------------------------------- *
-         *  palm detection
-         * --------------------------------------- */
-        if (enable_palm_detect)
+        if (enable_async)
         {
-            feed_palm_detection_image (&captex, win_w, win_h);
+            /* run the stages on the inference thread, one at a time. */
+            int state = poll_async_infer ();
+            if (state != ASYNC_INFER_BUSY)
+            {
+                if (step_hand_job (&job, &captex, win_w, win_h, enable_palm_detect, ttime[1]))
+                {
+                    palm_last = job.palm_ret;
+                    memcpy (hand_last, job.hand_ret, sizeof (hand_last));
+                    update_palm_predictor (&palm_predictor, &palm_last, job.capture_time);
+                }
+            }
+
+            predict_palms (&palm_predictor, &palm_last, pmeter_get_time_ms (), &palm_ret);
+            memcpy (hand_ret, hand_last, sizeof (hand_last));
 
-            ttime[2] = pmeter_get_time_ms ();
-            invoke_palm_detection (&palm_ret, 0);
-            ttime[3] = pmeter_get_time_ms ();
-            invoke_ms0 = ttime[3] - ttime[2];
+            async_infer_stats_t astats;
+            get_async_infer_stats (&astats);
+            invoke_ms0 = astats.invoke_ms;
+            invoke_ms1 = 0;
+        }
+        else if (qos_target_ms > 0.0f && (count % qos_state.infer_interval) != 0)
+        {
+            /* QoS: reuse the last results on this frame. */
+            palm_ret = palm_last;
+            memcpy (hand_ret, hand_last, sizeof (hand_last));
+            invoke_ms0 = 0;
+            invoke_ms1 = 0;
         }
         else
         {
-            invoke_palm_detection (&palm_ret, 1);
+            /* --------------------------------------- *
+             *  palm detection (or the ROIs tracked from the last joints)
+             * --------------------------------------- */
+            invoke_ms0 = 0;
+            if (enable_palm_detect && need_palm_detect ())
+            {
+                feed_palm_detection_image (&captex, win_w, win_h);
+
+                ttime[2] = pmeter_get_time_ms ();
+                invoke_palm_detection (&palm_ret, 0);
+                ttime[3] = pmeter_get_time_ms ();
+                invoke_ms0 = ttime[3] - ttime[2];
+            }
+            else if (enable_palm_detect)
+            {
+                get_tracked_palms (&palm_ret);
+            }
+            else
+            {
+                invoke_palm_detection (&palm_ret, 1);
+            }
+
+            if (qos_target_ms > 0.0f && palm_ret.num > qos_state.max_hands)
+                palm_ret.num = qos_state.max_hands;
+
+            /* --------------------------------------- *
+             *  hand landmark
+             * --------------------------------------- */
+            invoke_ms1 = 0;
+            for (int hand_id = 0; hand_id < palm_ret.num; hand_id ++)
+            {
+                feed_hand_landmark_image (&captex, win_w, win_h, &palm_ret, hand_id);
+
+                ttime[4] = pmeter_get_time_ms ();
+                invoke_hand_landmark (&hand_ret[hand_id]);
+                ttime[5] = pmeter_get_time_ms ();
+                invoke_ms1 += ttime[5] - ttime[4];
+            }
+            filter_hand_landmark (&palm_ret, hand_ret, ttime[1]);
+            if (enable_palm_detect)
+            {
+                update_hand_tracking (&palm_ret, hand_ret);
+            }
+
+            if (qos_target_ms > 0.0f)
+            {
+                palm_last = palm_ret;
+                memcpy (hand_last, hand_ret, sizeof (hand_last));
+            }
         }
 
-        /* --------------------------------------- *
-         *  hand landmark
-         * --------------------------------------- */
-        invoke_ms1 = 0;
-        for (int hand_id = 0; hand_id < palm_ret.num; hand_id ++)
+        if (qos_target_ms > 0.0f && count > 0)
         {
-            feed_hand_landmark_image (&captex, win_w, win_h, &palm_ret, hand_id);
-
-            ttime[4] = pmeter_get_time_ms ();
-            invoke_hand_landmark (&hand_ret[hand_id]);
-            ttime[5] = pmeter_get_time_ms ();
-            invoke_ms1 += ttime[5] - ttime[4];
+            double stage_ms[] = {invoke_ms0, invoke_ms1};
+            update_qos_ctrl (&qos_ctrl, interval, stage_ms);
         }
 
         /* --------------------------------------- *
@@ -690,8 +1052,23 @@ main(int argc, char *argv[])
         glViewport (0, 0, win_w, win_h);
         draw_pmeter (0, 40);
 
-        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite0 :%5.1f [ms]\nTFLite1 :%5.1f [ms]",
-            interval, invoke_ms0, invoke_ms1);
+        hand_tracking_stats_t tstats;
+        get_hand_tracking_stats (&tstats);
+        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite0 :%5.1f [ms]\nTFLite1 :%5.1f [ms]\nDetSkip :%5.1f [%%]",
+            interval, invoke_ms0, invoke_ms1, tstats.detect_skip_rate * 100);
+        if (enable_async)
+        {
+            async_infer_stats_t astats;
+            get_async_infer_stats (&astats);
+            sprintf (strbuf + strlen (strbuf), "\nInfer   :%5.1f [fps]", astats.infer_fps);
+        }
+        if (qos_target_ms > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nQoS     :%5.1f/%.1f [ms] L(", qos_ctrl.frame_ms, qos_target_ms);
+            for (int i = 0; i < qos_ctrl.num_knobs; i ++)
+                sprintf (strbuf + strlen (strbuf), "%s%d", i ? "," : "", get_qos_knob_level (&qos_ctrl, i));
+            strcat (strbuf, ")");
+        }
         draw_dbgstr (strbuf, 10, 10);
 
         egl_swap();
@@ -3,9 +3,14 @@
  * Copyright (c) 2020 terryky1220@gmail.com
  * ------------------------------------------------ */
 #include "util_tflite.h"
+#include "util_anchor_decode.h"
+#include "util_nms.h"
+#include "util_affine.h"
+#include "util_landmark_filter.h"
 #include "tflite_handpose.h"
 #include "custom_ops/transpose_conv_bias.h"
-#include <list>
+#include <algorithm>
+#include <cfloat>
 
 /* 
  * https://github.com/google/mediapipe/tree/master/mediapipe/models/hand_landmark_3d.tflite
@@ -27,186 +32,44 @@ static tflite_tensor_t      s_hand_tensor_landmark;
 static tflite_tensor_t      s_hand_tensor_handflag;
 
 
-typedef struct Anchor
-{
-    float x_center, y_center, w, h;
-} Anchor;
-
-static std::vector<Anchor>  s_anchors;
-
-typedef struct SsdAnchorsCalculatorOptions 
-{
-    int input_size_width;
-    int input_size_height;
-    float min_scale;
-    float max_scale;
-    float anchor_offset_x;
-    float anchor_offset_y;
-
-    int num_layers;
-    std::vector<int> feature_map_width;
-    std::vector<int> feature_map_height;
-
-    std::vector<int>   strides;
-    std::vector<float> aspect_ratios;
-    bool reduce_boxes_in_lowest_layer;
-    float interpolated_scale_aspect_ratio;
-    bool fixed_anchor_size;
-
-} SsdAnchorsCalculatorOptions;
-
-
-
-/* ---------------------------------------------------------------------- *
- *   mediapipe/calculators/tflite/ssd_anchors_calculator_test.cc
- * ---------------------------------------------------------------------- */
- 
-// Copyright 2019 The MediaPipe Authors.
-//
-// Licensed under the Apache License, Version 2.0 (the "License");
-// you may not use this file except in compliance with the License.
-// You may obtain a copy of the License at
-//
-//      http://www.apache.org/licenses/LICENSE-2.0
-//
-// Unless required by applicable law or agreed to in writing, software
-// distributed under the License is distributed on an "AS IS" BASIS,
-// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-// See the License for the specific language governing permissions and
-// limitations under the License.
-
-
-float
-CalculateScale(float min_scale, float max_scale, int stride_index, int num_strides) 
-{
-    return min_scale + (max_scale - min_scale) * 1.0 * stride_index / (num_strides - 1.0f);
-}
-
-
-int
-GenerateAnchors(std::vector<Anchor>* anchors, const SsdAnchorsCalculatorOptions& options)
-{
-    int layer_id = 0;
-    while (layer_id < (int)options.strides.size()) {
-        std::vector<float> anchor_height;
-        std::vector<float> anchor_width;
-        std::vector<float> aspect_ratios;
-        std::vector<float> scales;
-
-        // For same strides, we merge the anchors in the same order.
-        int last_same_stride_layer = layer_id;
-        while (last_same_stride_layer < (int)options.strides.size() &&
-               options.strides[last_same_stride_layer] == options.strides[layer_id]) 
-        {
-          const float scale =
-              CalculateScale(options.min_scale, options.max_scale,
-                last_same_stride_layer, options.strides.size());
-          if (last_same_stride_layer == 0 && options.reduce_boxes_in_lowest_layer) {
-            // For first layer, it can be specified to use predefined anchors.
-            aspect_ratios.push_back(1.0);
-            aspect_ratios.push_back(2.0);
-            aspect_ratios.push_back(0.5);
-            scales.push_back(0.1);
-            scales.push_back(scale);
-            scales.push_back(scale);
-          } else {
-            for (int aspect_ratio_id = 0;
-                aspect_ratio_id < (int)options.aspect_ratios.size();
-                 ++aspect_ratio_id) {
-              aspect_ratios.push_back(options.aspect_ratios[aspect_ratio_id]);
-              scales.push_back(scale);
-            }
-            if (options.interpolated_scale_aspect_ratio > 0.0) {
-              const float scale_next =
-                last_same_stride_layer == (int)options.strides.size() - 1
-                      ? 1.0f
-                      : CalculateScale(options.min_scale, options.max_scale,
-                                       last_same_stride_layer + 1,
-                                       options.strides.size());
-              scales.push_back(std::sqrt(scale * scale_next));
-              aspect_ratios.push_back(options.interpolated_scale_aspect_ratio);
-            }
-          }
-          last_same_stride_layer++;
-        }
-
-        for (int i = 0; i < (int)aspect_ratios.size(); ++i) {
-          const float ratio_sqrts = std::sqrt(aspect_ratios[i]);
-          anchor_height.push_back(scales[i] / ratio_sqrts);
-          anchor_width .push_back(scales[i] * ratio_sqrts);
-        }
-
-        int feature_map_height = 0;
-        int feature_map_width  = 0;
-        if (options.feature_map_height.size()) {
-          feature_map_height = options.feature_map_height[layer_id];
-          feature_map_width  = options.feature_map_width [layer_id];
-        } else {
-          const int stride = options.strides[layer_id];
-          feature_map_height = std::ceil(1.0f * options.input_size_height / stride);
-          feature_map_width  = std::ceil(1.0f * options.input_size_width  / stride);
-        }
+static anchor_decoder_t     s_anchor_decoder;
+static nms_context_t        s_nms;
 
-        for (int y = 0; y < feature_map_height; ++y) {
-          for (int x = 0; x < feature_map_width; ++x) {
-            for (int anchor_id = 0; anchor_id < (int)anchor_height.size(); ++anchor_id) {
-              // TODO: Support specifying anchor_offset_x, anchor_offset_y.
-              const float x_center = (x + options.anchor_offset_x) * 1.0f / feature_map_width;
-              const float y_center = (y + options.anchor_offset_y) * 1.0f / feature_map_height;
-
-              Anchor new_anchor;
-              new_anchor.x_center = x_center;
-              new_anchor.y_center = y_center;
-
-              if (options.fixed_anchor_size) {
-                new_anchor.w = 1.0f;
-                new_anchor.h = 1.0f;
-              } else {
-                new_anchor.w = anchor_width [anchor_id];
-                new_anchor.h = anchor_height[anchor_id];
-              }
-              anchors->push_back(new_anchor);
-            }
-          }
-        }
-        layer_id = last_same_stride_layer;
-    }
-    return 0;
-}
+/* hand tracking */
+static int                      s_track_detect_interval = 30;
+static float                    s_track_score_thresh    = 0.5f;
+static int                      s_track_frame_cnt;
+static int                      s_track_id_next;
+static palm_detection_result_t  s_track_palms;  /* ROIs of the next frame */
+static palm_detection_result_t  s_track_prev;   /* palms of the last frame, for the track ID */
+static hand_tracking_stats_t    s_track_stats;
 
 
+/*
+ *  SSD anchors of the palm detection (SsdAnchorsCalculator of MediaPipe):
+ *    strides {8, 16, 32, 32, 32}, aspect_ratios {1.0},
+ *    interpolated_scale_aspect_ratio 1.0, fixed_anchor_size: true,
+ *    anchor_offset 0.5
+ *
+ *  with the fixed anchor size, only the centers are used: 2 anchors per cell
+ *  for each layer, and the layers of the same stride are merged.
+ */
 static int
 generate_ssd_anchors ()
 {
-    SsdAnchorsCalculatorOptions anchor_options;
-    anchor_options.num_layers = 5;
-    anchor_options.min_scale = 0.1171875;
-    anchor_options.max_scale = 0.75;
-    anchor_options.input_size_height = 256;
-    anchor_options.input_size_width  = 256;
-    anchor_options.anchor_offset_x  = 0.5f;
-    anchor_options.anchor_offset_y  = 0.5f;
-//  anchor_options.feature_map_width .push_back(0);
-//  anchor_options.feature_map_height.push_back(0);
-    anchor_options.strides.push_back( 8);
-    anchor_options.strides.push_back(16);
-    anchor_options.strides.push_back(32);
-    anchor_options.strides.push_back(32);
-    anchor_options.strides.push_back(32);
-    anchor_options.aspect_ratios.push_back(1.0);
-    anchor_options.reduce_boxes_in_lowest_layer = false;
-    anchor_options.interpolated_scale_aspect_ratio = 1.0;
-    anchor_options.fixed_anchor_size = true;
-
-    GenerateAnchors (&s_anchors, anchor_options);
-
-#if 0
-    for (int i = 0; i < (int)s_anchors.size(); i ++)
-    {
-        fprintf (stderr, "[%4d](%f, %f, %f, %f)\n", i,
-            s_anchors[i].x_center, s_anchors[i].y_center, s_anchors[i].w, s_anchors[i].h);
-    }
-#endif
+    static const anchor_layer_t s_layers[] = {
+        { 8, 2},    /* stride, anchors per cell */
+        {16, 2},
+        {32, 6},
+    };
+    int num_layers = sizeof (s_layers) / sizeof (s_layers[0]);
+
+    /* anchor centers in input pixels, as the regressors are. */
+    int img_w = s_palm_tensor_input.dims[2];
+    int img_h = s_palm_tensor_input.dims[1];
+    int num_anchors = init_anchor_decoder_grid (&s_anchor_decoder, s_layers, num_layers,
+                                                img_w, img_h, 7, 18);
+    init_nms (&s_nms, num_anchors);
 
     return 0;
 }
@@ -236,13 +99,21 @@ init_tflite_hand_landmark(int use_quantized_tflite)
     s_palm_interpreter.resolver.AddCustom("Convolution2DTransposeBias",
             mediapipe::tflite_operations::RegisterConvolution2DTransposeBias());
 
-    tflite_create_interpreter_from_file (&s_palm_interpreter, palm_model);
+    if (tflite_create_interpreter_from_file (&s_palm_interpreter, palm_model) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
     tflite_get_tensor_by_name (&s_palm_interpreter, 0, "input",           &s_palm_tensor_input);
     tflite_get_tensor_by_name (&s_palm_interpreter, 1, "classificators",  &s_palm_tensor_scores);
     tflite_get_tensor_by_name (&s_palm_interpreter, 1, "regressors",      &s_palm_tensor_points);
 
     /* Hand Landmark */
-    tflite_create_interpreter_from_file (&s_hand_interpreter, hand_model);
+    if (tflite_create_interpreter_from_file (&s_hand_interpreter, hand_model) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
     tflite_get_tensor_by_name (&s_hand_interpreter, 0, "input_1",         &s_hand_tensor_input);
     tflite_get_tensor_by_name (&s_hand_interpreter, 1, "ld_21_3d",        &s_hand_tensor_landmark);
     tflite_get_tensor_by_name (&s_hand_interpreter, 1, "output_handflag", &s_hand_tensor_handflag);
@@ -252,6 +123,30 @@ init_tflite_hand_landmark(int use_quantized_tflite)
     return 0;
 }
 
+/*
+ *  switch the float / quantized models at runtime.
+ *  on failure, the other models are loaded back and -1 is returned.
+ */
+int
+reload_tflite_hand_landmark (int use_quantized_tflite)
+{
+    tflite_delete_interpreter (&s_palm_interpreter);
+    tflite_delete_interpreter (&s_hand_interpreter);
+
+    exit_anchor_decoder (&s_anchor_decoder);
+    exit_nms (&s_nms);
+
+    if (init_tflite_hand_landmark (use_quantized_tflite) < 0)
+    {
+        tflite_delete_interpreter (&s_palm_interpreter);
+        tflite_delete_interpreter (&s_hand_interpreter);
+        init_tflite_hand_landmark (!use_quantized_tflite);
+        return -1;
+    }
+
+    return 0;
+}
+
 void *
 get_palm_detection_input_buf (int *w, int *h)
 {
@@ -272,67 +167,24 @@ get_hand_landmark_input_buf (int *w, int *h)
 /* -------------------------------------------------- *
  *  Decode palm detection result
  * -------------------------------------------------- */static int
-decode_keypoints (std::list<palm_t> &palm_list, float score_thresh)
+decode_keypoints (float score_thresh)
 {
-    palm_t palm_item;
-    float *scores_ptr = (float *)s_palm_tensor_scores.ptr;
-    float *points_ptr = (float *)s_palm_tensor_points.ptr;
-    int img_w = s_palm_tensor_input.dims[2];
-    int img_h = s_palm_tensor_input.dims[1];
+    anchor_decoder_t *dec = &s_anchor_decoder;
 
-    int i = 0;
-    for (auto itr = s_anchors.begin(); itr != s_anchors.end(); i ++, itr ++)
-    {
-        Anchor anchor = *itr;
-        float score0 = scores_ptr[i];
-        float score = 1.0f / (1.0f + exp(-score0));
+    /* only the anchors above the threshold are decoded. */
+    set_anchor_score_thresh (dec, score_thresh);
+    int num = decode_anchors (dec, (float *)s_palm_tensor_scores.ptr,
+                                   (float *)s_palm_tensor_points.ptr);
 
-        if (score > score_thresh)
-        {
-            float *p = points_ptr + (i * 18);
-
-            /* boundary box */
-            float sx = p[0];
-            float sy = p[1];
-            float w  = p[2];
-            float h  = p[3];
-
-            float cx = sx + anchor.x_center * img_w;
-            float cy = sy + anchor.y_center * img_w;
-
-            cx /= (float)img_w;
-            cy /= (float)img_h;
-            w  /= (float)img_w;
-            h  /= (float)img_h;
-
-            fvec2 topleft, btmright;
-            topleft.x  = cx - w * 0.5f;
-            topleft.y  = cy - h * 0.5f;
-            btmright.x = cx + w * 0.5f;
-            btmright.y = cy + h * 0.5f;
-
-            palm_item.score         = score;
-            palm_item.rect.topleft  = topleft;
-            palm_item.rect.btmright = btmright;
-
-            /* landmark positions (7 keys) */
-            for (int j = 0; j < 7; j ++)
-            {
-                float lx = p[4 + (2 * j) + 0];
-                float ly = p[4 + (2 * j) + 1];
-                lx += anchor.x_center * img_w;
-                ly += anchor.y_center * img_w;
-                lx /= (float)img_w;
-                ly /= (float)img_h;
-
-                palm_item.keys[j].x = lx;
-                palm_item.keys[j].y = ly;
-            }
-
-            palm_list.push_back (palm_item);
-        }
+    /* NMS candidates (SoA) */
+    for (int i = 0; i < num; i ++)
+    {
+        anchor_box_t *box = &dec->boxes[i];
+        nms_set_box (&s_nms, i, box->x1, box->y1, box->x2, box->y2, box->score);
     }
-    return 0;
+    s_nms.num = num;
+
+    return num;
 }
 
 
@@ -340,83 +192,42 @@ decode_keypoints (std::list<palm_t> &palm_list, float score_thresh)
 /* -------------------------------------------------- *
  *  Apply NonMaxSuppression:
  * -------------------------------------------------- */
-static float
-calc_intersection_over_union (rect_t &rect0, rect_t &rect1)
-{
-    float sx0 = rect0.topleft.x;
-    float sy0 = rect0.topleft.y;
-    float ex0 = rect0.btmright.x;
-    float ey0 = rect0.btmright.y;
-    float sx1 = rect1.topleft.x;
-    float sy1 = rect1.topleft.y;
-    float ex1 = rect1.btmright.x;
-    float ey1 = rect1.btmright.y;
-    
-    float xmin0 = std::min (sx0, ex0);
-    float ymin0 = std::min (sy0, ey0);
-    float xmax0 = std::max (sx0, ex0);
-    float ymax0 = std::max (sy0, ey0);
-    float xmin1 = std::min (sx1, ex1);
-    float ymin1 = std::min (sy1, ey1);
-    float xmax1 = std::max (sx1, ex1);
-    float ymax1 = std::max (sy1, ey1);
-    
-    float area0 = (ymax0 - ymin0) * (xmax0 - xmin0);
-    float area1 = (ymax1 - ymin1) * (xmax1 - xmin1);
-    if (area0 <= 0 || area1 <= 0)
-        return 0.0f;
-
-    float intersect_xmin = std::max (xmin0, xmin1);
-    float intersect_ymin = std::max (ymin0, ymin1);
-    float intersect_xmax = std::min (xmax0, xmax1);
-    float intersect_ymax = std::min (ymax0, ymax1);
-
-    float intersect_area = std::max (intersect_ymax - intersect_ymin, 0.0f) *
-                           std::max (intersect_xmax - intersect_xmin, 0.0f);
-    
-    return intersect_area / (area0 + area1 - intersect_area);
-}
-
-static bool
-compare (palm_t &v1, palm_t &v2)
+static void
+set_palm_item (palm_t &palm, float score, float x1, float y1, float x2, float y2, const float *keys)
 {
-    if (v1.score > v2.score)
-        return true;
-    else
-        return false;
+    palm.score           = score;
+    palm.rect.topleft.x  = x1;
+    palm.rect.topleft.y  = y1;
+    palm.rect.btmright.x = x2;
+    palm.rect.btmright.y = y2;
+
+    /* landmark positions (7 keys) */
+    for (int j = 0; j < 7; j ++)
+    {
+        palm.keys[j].x = keys[2 * j + 0];
+        palm.keys[j].y = keys[2 * j + 1];
+    }
 }
 
 static int
-non_max_suppression (std::list<palm_t> &face_list, std::list<palm_t> &face_sel_list, float iou_thresh)
+non_max_suppression (palm_t *palm_sel, int max_palms, float iou_thresh)
 {
-    face_list.sort (compare);
-
-    for (auto itr = face_list.begin(); itr != face_list.end(); itr ++)
-    {
-        palm_t face_candidate = *itr;
+    anchor_decoder_t *dec = &s_anchor_decoder;
+    int num_sel;
 
-        int ignore_candidate = false;
-        for (auto itr_sel = face_sel_list.rbegin(); itr_sel != face_sel_list.rend(); itr_sel ++)
-        {
-            palm_t face_sel = *itr_sel;
-
-            float iou = calc_intersection_over_union (face_candidate.rect, face_sel.rect);
-            if (iou >= iou_thresh)
-            {
-                ignore_candidate = true;
-                break;
-            }
-        }
+    nms_blend_t blend[MAX_PALM_NUM];
+    float       blend_keys[MAX_PALM_NUM * 7 * 2];
 
-        if (!ignore_candidate)
-        {
-            face_sel_list.push_back(face_candidate);
-            if (face_sel_list.size() >= MAX_PALM_NUM)
-                break;
-        }
+    num_sel = nms_select (&s_nms, iou_thresh, max_palms,
+                          dec->keys, 7 * 2, blend, blend_keys);
+    for (int i = 0; i < num_sel; i ++)
+    {
+        nms_blend_t *b = &blend[i];
+        set_palm_item (palm_sel[i], b->score, b->x1, b->y1, b->x2, b->y2,
+                       &blend_keys[i * 7 * 2]);
     }
 
-    return 0;
+    return num_sel;
 }
 
 
@@ -452,6 +263,33 @@ rot_vec (fvec2 &vec, float rotation)
     vec.y = sx * std::sin(rotation) + sy * std::cos(rotation);
 }
 
+/* the hand ROI: (hand_w x hand_h) centered at (hand_cx, hand_cy), rotated by palm.rotation */
+static void
+set_hand_pos (palm_t &palm, float hand_cx, float hand_cy, float hand_w, float hand_h)
+{
+    float rotation = palm.rotation;
+
+    palm.hand_cx = hand_cx;
+    palm.hand_cy = hand_cy;
+    palm.hand_w  = hand_w;
+    palm.hand_h  = hand_h;
+
+    float dx = hand_w * 0.5f;
+    float dy = hand_h * 0.5f;
+
+    palm.hand_pos[0].x = - dx;  palm.hand_pos[0].y = - dy;
+    palm.hand_pos[1].x = + dx;  palm.hand_pos[1].y = - dy;
+    palm.hand_pos[2].x = + dx;  palm.hand_pos[2].y = + dy;
+    palm.hand_pos[3].x = - dx;  palm.hand_pos[3].y = + dy;
+
+    for (int i = 0; i < 4; i ++)
+    {
+        rot_vec (palm.hand_pos[i], rotation);
+        palm.hand_pos[i].x += hand_cx;
+        palm.hand_pos[i].y += hand_cy;
+    }
+}
+
 static void
 compute_hand_rect (palm_t &palm)
 {
@@ -486,49 +324,105 @@ compute_hand_rect (palm_t &palm)
     float hand_w = width  * 2.6f;
     float hand_h = height * 2.6f;
 
-    palm.hand_cx = hand_cx;
-    palm.hand_cy = hand_cy;
-    palm.hand_w  = hand_w;
-    palm.hand_h  = hand_h;
+    set_hand_pos (palm, hand_cx, hand_cy, hand_w, hand_h);
+}
 
-    float dx = hand_w * 0.5f;
-    float dy = hand_h * 0.5f;
+static void
+pack_palm_result (palm_detection_result_t *palm_result, palm_t *palm_sel, int num_palms)
+{
+    for (int i = 0; i < num_palms; i ++)
+    {
+        palm_t &palm = palm_sel[i];
 
-    palm.hand_pos[0].x = - dx;  palm.hand_pos[0].y = - dy;
-    palm.hand_pos[1].x = + dx;  palm.hand_pos[1].y = - dy;
-    palm.hand_pos[2].x = + dx;  palm.hand_pos[2].y = + dy;
-    palm.hand_pos[3].x = - dx;  palm.hand_pos[3].y = + dy;
+        compute_rotation (palm);
+        compute_hand_rect (palm);
 
-    for (int i = 0; i < 4; i ++)
+        memcpy (&palm_result->palms[i], &palm, sizeof (palm));
+    }
+    palm_result->num = num_palms;
+}
+
+
+
+/* -------------------------------------------------- *
+ *  Track ID
+ * -------------------------------------------------- */
+static void
+get_hand_bounds (palm_t &palm, float &x1, float &y1, float &x2, float &y2)
+{
+    x1 = x2 = palm.hand_pos[0].x;
+    y1 = y2 = palm.hand_pos[0].y;
+    for (int i = 1; i < 4; i ++)
     {
-        rot_vec (palm.hand_pos[i], rotation);
-        palm.hand_pos[i].x += hand_cx;
-        palm.hand_pos[i].y += hand_cy;
+        x1 = std::min (x1, palm.hand_pos[i].x);
+        y1 = std::min (y1, palm.hand_pos[i].y);
+        x2 = std::max (x2, palm.hand_pos[i].x);
+        y2 = std::max (y2, palm.hand_pos[i].y);
     }
 }
 
+static float
+calc_hand_iou (palm_t &palm0, palm_t &palm1)
+{
+    float ax1, ay1, ax2, ay2;
+    float bx1, by1, bx2, by2;
+    get_hand_bounds (palm0, ax1, ay1, ax2, ay2);
+    get_hand_bounds (palm1, bx1, by1, bx2, by2);
+
+    float iw = std::min (ax2, bx2) - std::max (ax1, bx1);
+    float ih = std::min (ay2, by2) - std::max (ay1, by1);
+    if (iw <= 0.0f || ih <= 0.0f)
+        return 0.0f;
+
+    float area_i = iw * ih;
+    float area_a = (ax2 - ax1) * (ay2 - ay1);
+    float area_b = (bx2 - bx1) * (by2 - by1);
+    return area_i / (area_a + area_b - area_i);
+}
+
+/*
+ *  a detected palm takes over the track ID of the hand of the last frame
+ *  which overlaps it most. the palms are in descending order of the score,
+ *  so the better detection wins when two palms overlap the same hand.
+ */
 static void
-pack_palm_result (palm_detection_result_t *palm_result, std::list<palm_t> &palm_list)
+assign_palm_track_id (palm_detection_result_t *palm_result)
 {
-    int num_palms = 0;
-    for (auto itr = palm_list.begin(); itr != palm_list.end(); itr ++)
+    float iou_thresh = 0.3f;
+    int   used[MAX_PALM_NUM] = {0};
+
+    for (int i = 0; i < palm_result->num; i ++)
     {
-        palm_t palm = *itr;
-        
-        compute_rotation (palm);
-        compute_hand_rect (palm);
+        palm_t &palm = palm_result->palms[i];
+        float  best_iou = iou_thresh;
+        int    best_idx = -1;
 
-        memcpy (&palm_result->palms[num_palms], &palm, sizeof (palm));
-        num_palms ++;
-        palm_result->num = num_palms;
+        for (int j = 0; j < s_track_prev.num; j ++)
+        {
+            if (used[j])
+                continue;
+
+            float iou = calc_hand_iou (palm, s_track_prev.palms[j]);
+            if (iou > best_iou)
+            {
+                best_iou = iou;
+                best_idx = j;
+            }
+        }
 
-        if (num_palms >= MAX_PALM_NUM)
-            break;
+        if (best_idx >= 0)
+        {
+            used[best_idx] = 1;
+            palm.track_id = s_track_prev.palms[best_idx].track_id;
+        }
+        else
+        {
+            palm.track_id = s_track_id_next ++;
+        }
     }
 }
 
 
-
 /* -------------------------------------------------- *
  * Invoke TensorFlow Lite (Palm detection)
  * -------------------------------------------------- */
@@ -542,19 +436,14 @@ detect_palm (palm_detection_result_t *palm_result)
     }
 
     float score_thresh = 0.7f;
-    std::list<palm_t> palm_list;
+    palm_t palm_sel[MAX_PALM_NUM];
 
-    decode_keypoints (palm_list, score_thresh);
+    decode_keypoints (score_thresh);
 
-#if 1 /* USE NMS */
     float iou_thresh = 0.3f;
-    std::list<palm_t> palm_nms_list;
-
-    non_max_suppression (palm_list, palm_nms_list, iou_thresh);
-    pack_palm_result (palm_result, palm_nms_list);
-#else
-    pack_palm_result (palm_result, palm_list);
-#endif
+    int num_palms = non_max_suppression (palm_sel, MAX_PALM_NUM, iou_thresh);
+    pack_palm_result (palm_result, palm_sel, num_palms);
+    assign_palm_track_id (palm_result);
 
     return 0;
 }
@@ -574,6 +463,7 @@ detect_palm_stub (palm_detection_result_t *palm_result)
     palm->hand_w   = 1.0f;
     palm->hand_h   = 1.0f;
     palm->rotation = 0.0f;
+    palm->track_id = 0;
 
     return 0;
 }
@@ -625,3 +515,227 @@ invoke_hand_landmark (hand_landmark_result_t *hand_result)
     return 0;
 }
 
+
+/* -------------------------------------------------- *
+ *  Hand tracking
+ * -------------------------------------------------- */
+void
+set_hand_tracking_param (int detect_interval, float score_thresh)
+{
+    s_track_detect_interval = detect_interval;
+    s_track_score_thresh    = score_thresh;
+    s_track_palms.num       = 0;
+}
+
+int
+need_palm_detect ()
+{
+    int need_detect = (s_track_detect_interval <= 1) ||
+                      (s_track_palms.num == 0) ||
+                      (s_track_frame_cnt >= s_track_detect_interval);
+
+    if (need_detect)
+    {
+        s_track_frame_cnt = 0;
+        s_track_stats.num_detect ++;
+    }
+    s_track_frame_cnt ++;
+    s_track_stats.num_frames ++;
+
+    return need_detect;
+}
+
+void
+get_tracked_palms (palm_detection_result_t *palm_result)
+{
+    *palm_result = s_track_palms;
+}
+
+/*
+ *  the hand ROI from the joints (HandLandmarkLandmarksToRoi of MediaPipe):
+ *    the rotation from the wrist to the MCP of the middle finger, and the
+ *    bounding box of the palm joints aligned to that rotation,
+ *    shifted by -0.1 along the hand, square, x2.0.
+ */
+static void
+compute_palm_from_landmark (palm_t &palm, palm_t &palm_prev, hand_landmark_result_t *hand, float score)
+{
+    /* the joints which don't move much with the fingers */
+    static const int s_roi_idx[] = {0, 1, 2, 3, 5, 6, 9, 10, 13, 14, 17, 18};
+    /* the palm detector keys: wrist, MCP of index/middle/ring/pinky, CMC/MCP of thumb */
+    static const int s_key_idx[7] = {0, 5, 9, 13, 17, 1, 2};
+    int num_roi = sizeof (s_roi_idx) / sizeof (s_roi_idx[0]);
+    fvec3 joint[HAND_JOINT_NUM];
+
+    /* ROI normalized --> image normalized */
+    affine_t mat;
+    affine_roi_to_image (&mat, palm_prev.hand_cx, palm_prev.hand_cy,
+                         palm_prev.hand_w, palm_prev.hand_h, palm_prev.rotation);
+    affine_transform_vec3 (&mat, (float *)hand->joint, (float *)joint, HAND_JOINT_NUM);
+
+    palm.score    = score;
+    palm.track_id = palm_prev.track_id;
+
+    palm.rect.topleft.x  = palm.rect.btmright.x = joint[0].x;
+    palm.rect.topleft.y  = palm.rect.btmright.y = joint[0].y;
+    for (int i = 1; i < HAND_JOINT_NUM; i ++)
+    {
+        palm.rect.topleft.x  = std::min (palm.rect.topleft.x,  joint[i].x);
+        palm.rect.topleft.y  = std::min (palm.rect.topleft.y,  joint[i].y);
+        palm.rect.btmright.x = std::max (palm.rect.btmright.x, joint[i].x);
+        palm.rect.btmright.y = std::max (palm.rect.btmright.y, joint[i].y);
+    }
+
+    for (int j = 0; j < 7; j ++)
+    {
+        palm.keys[j].x = joint[s_key_idx[j]].x;
+        palm.keys[j].y = joint[s_key_idx[j]].y;
+    }
+    compute_rotation (palm);
+
+    /* axis aligned center of the palm joints */
+    float x1 = joint[s_roi_idx[0]].x, y1 = joint[s_roi_idx[0]].y;
+    float x2 = x1, y2 = y1;
+    for (int i = 1; i < num_roi; i ++)
+    {
+        x1 = std::min (x1, joint[s_roi_idx[i]].x);
+        y1 = std::min (y1, joint[s_roi_idx[i]].y);
+        x2 = std::max (x2, joint[s_roi_idx[i]].x);
+        y2 = std::max (y2, joint[s_roi_idx[i]].y);
+    }
+    float axis_cx = (x1 + x2) * 0.5f;
+    float axis_cy = (y1 + y2) * 0.5f;
+
+    /* bounding box in the rotated frame */
+    float c = std::cos (palm.rotation);
+    float s = std::sin (palm.rotation);
+    float rx1 =  FLT_MAX, ry1 =  FLT_MAX;
+    float rx2 = -FLT_MAX, ry2 = -FLT_MAX;
+    for (int i = 0; i < num_roi; i ++)
+    {
+        float dx = joint[s_roi_idx[i]].x - axis_cx;
+        float dy = joint[s_roi_idx[i]].y - axis_cy;
+        float rx =  dx * c + dy * s;
+        float ry = -dx * s + dy * c;
+        rx1 = std::min (rx1, rx);  rx2 = std::max (rx2, rx);
+        ry1 = std::min (ry1, ry);  ry2 = std::max (ry2, ry);
+    }
+    float width  = rx2 - rx1;
+    float height = ry2 - ry1;
+
+    float shift_x =  0.0f;
+    float shift_y = -0.1f;
+    float ofst_x  = (rx1 + rx2) * 0.5f + width  * shift_x;
+    float ofst_y  = (ry1 + ry2) * 0.5f + height * shift_y;
+    float hand_cx = axis_cx + ofst_x * c - ofst_y * s;
+    float hand_cy = axis_cy + ofst_x * s + ofst_y * c;
+
+    float long_side = std::max (width, height);
+    set_hand_pos (palm, hand_cx, hand_cy, long_side * 2.0f, long_side * 2.0f);
+}
+
+/*
+ *  keep the hands whose presence score is above the threshold, as the ROIs
+ *  of the next frame. returns the number of the tracked hands.
+ */
+int
+update_hand_tracking (palm_detection_result_t *palm_result, hand_landmark_result_t *hand_result)
+{
+    int num_track = 0;
+
+    for (int i = 0; i < palm_result->num; i ++)
+    {
+        /* the hand flag is a probability already. */
+        float score = hand_result[i].score;
+        if (score < s_track_score_thresh)
+            continue;
+
+        compute_palm_from_landmark (s_track_palms.palms[num_track], palm_result->palms[i],
+                                    &hand_result[i], score);
+        num_track ++;
+    }
+
+    /* the track IDs of the next detection come from the hands of this frame. */
+    s_track_prev = *palm_result;
+
+    /* a hand is lost. run the detection on the next frame. */
+    if (num_track < palm_result->num)
+        num_track = 0;
+
+    s_track_palms.num = num_track;
+
+    s_track_stats.detect_skip_rate = (s_track_stats.num_frames > 0) ?
+        1.0f - (float)s_track_stats.num_detect / (float)s_track_stats.num_frames : 0.0f;
+
+    return num_track;
+}
+
+void
+get_hand_tracking_stats (hand_tracking_stats_t *stats)
+{
+    *stats = s_track_stats;
+}
+
+
+/* -------------------------------------------------- *
+ *  Landmark filter
+ * -------------------------------------------------- */
+static landmark_filter_t    s_filter;
+
+int
+set_hand_landmark_filter (int filter_type)
+{
+    return set_landmark_filter (&s_filter, filter_type, HAND_JOINT_NUM * 3);
+}
+
+/*
+ *  the joints are ROI relative, and the ROI moves. they are filtered in the
+ *  image coordinates (z scaled as x), and mapped back to the same ROI.
+ */
+void
+filter_hand_landmark (palm_detection_result_t *palm_result, hand_landmark_result_t *hand_result,
+                      double time_ms)
+{
+    float joints[MAX_PALM_NUM][HAND_JOINT_NUM * 3];
+    int   hand_idx[MAX_PALM_NUM];
+    int   num = 0;
+
+    if (!is_landmark_filter_enabled (&s_filter))
+        return;
+
+    float img_w = s_hand_tensor_input.dims[2];
+
+    for (int i = 0; i < palm_result->num; i ++)
+    {
+        palm_t &palm  = palm_result->palms[i];
+        float  *joint = joints[num];
+        affine_t mat;
+
+        /* the lost hands are not filtered. */
+        if (hand_result[i].score < s_track_score_thresh)
+            continue;
+
+        affine_roi_to_image (&mat, palm.hand_cx, palm.hand_cy, palm.hand_w, palm.hand_h, palm.rotation);
+        affine_transform_vec3 (&mat, (float *)hand_result[i].joint, joint, HAND_JOINT_NUM);
+
+        for (int j = 0; j < HAND_JOINT_NUM; j ++)
+            joint[3 * j + 2] *= palm.hand_w / img_w;
+
+        hand_idx[num ++] = i;
+    }
+
+    filter_landmark_points (&s_filter, &joints[0][0], num, HAND_JOINT_NUM, 3, NULL, time_ms);
+
+    for (int n = 0; n < num; n ++)
+    {
+        palm_t &palm  = palm_result->palms[hand_idx[n]];
+        float  *joint = joints[n];
+        affine_t mat;
+
+        for (int j = 0; j < HAND_JOINT_NUM; j ++)
+            joint[3 * j + 2] *= img_w / palm.hand_w;
+
+        affine_image_to_roi (&mat, palm.hand_cx, palm.hand_cy, palm.hand_w, palm.hand_h, palm.rotation);
+        affine_transform_vec3 (&mat, joint, (float *)hand_result[hand_idx[n]].joint, HAND_JOINT_NUM);
+    }
+}
@@ -40,6 +40,8 @@ typedef struct _palm_t
     float  hand_w;
     float  hand_h;
     fvec2  hand_pos[4];
+
+    int    track_id;            /* stays the same while the hand is tracked */
 } palm_t;
 
 typedef struct _palm_detection_result_t
@@ -55,8 +57,22 @@ typedef struct _hand_landmark_result_t
 } hand_landmark_result_t;
 
 
+/*
+ *  hand tracking:
+ *    the ROI of the next frame is derived from the hand joints, and the palm
+ *    detection runs only when a hand is lost, or every (detect_interval) frames
+ *    to pick up the new hands.
+ */
+typedef struct _hand_tracking_stats_t
+{
+    int     num_frames;
+    int     num_detect;         /* frames the palm detection ran */
+    float   detect_skip_rate;   /* [0, 1] */
+} hand_tracking_stats_t;
+
 
 int   init_tflite_hand_landmark (int use_quantized_tflite);
+int   reload_tflite_hand_landmark (int use_quantized_tflite);
 
 void  *get_palm_detection_input_buf (int *w, int *h);
 int   invoke_palm_detection (palm_detection_result_t *palm_result, int flag);
@@ -64,6 +80,21 @@ int   invoke_palm_detection (palm_detection_result_t *palm_result, int flag);
 void  *get_hand_landmark_input_buf (int *w, int *h);
 int   invoke_hand_landmark (hand_landmark_result_t *hand_landmark_result);
 
+/* detect_interval <= 1: detect on every frame (no tracking) */
+void  set_hand_tracking_param (int detect_interval, float score_thresh);
+int   need_palm_detect ();      /* call once per frame */
+void  get_tracked_palms (palm_detection_result_t *palm_result);
+int   update_hand_tracking (palm_detection_result_t *palm_result, hand_landmark_result_t *hand_result);
+void  get_hand_tracking_stats (hand_tracking_stats_t *stats);
+
+/*
+ *  temporal filter of the joints (enum landmark_filter_type, 0: off).
+ *  call after the landmarks of all the hands, before update_hand_tracking().
+ */
+int   set_hand_landmark_filter (int filter_type);
+void  filter_hand_landmark (palm_detection_result_t *palm_result, hand_landmark_result_t *hand_result,
+                            double time_ms);
+
 #ifdef __cplusplus
 }
 #endif
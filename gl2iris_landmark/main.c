@@ -15,6 +15,7 @@
 #include "util_texture.h"
 #include "util_render2d.h"
 #include "util_matrix.h"
+#include "util_affine.h"
 #include "tflite_facemesh.h"
 #include "camera_capture.h"
 #include "video_decode.h"
@@ -233,46 +234,21 @@ feed_iris_landmark_image(texture_2d_t *srctex, int win_w, int win_h,
     buf_ui8 = pui8;
 
     float texcoord[8];
+    float vec[4][2];
+    affine_t mat;
+    affine_roi_to_image (&mat, face->face_cx, face->face_cy, face->face_w, face->face_h, face->rotation);
+    affine_transform_vec2 (&mat, (float *)facemesh->eye_pos[eye_id], (float *)vec, 4);
 
-    float scale_x = face->face_w;
-    float scale_y = face->face_h;
-    float pivot_x = face->face_cx;
-    float pivot_y = face->face_cy;
-    float rotation= face->rotation;
-    
-    float x0 = facemesh->eye_pos[eye_id][0].x;
-    float y0 = facemesh->eye_pos[eye_id][0].y;
-    float x1 = facemesh->eye_pos[eye_id][1].x; //    0--------1
-    float y1 = facemesh->eye_pos[eye_id][1].y; //    |        |
-    float x2 = facemesh->eye_pos[eye_id][2].x; //    |        |
-    float y2 = facemesh->eye_pos[eye_id][2].y; //    3--------2
-    float x3 = facemesh->eye_pos[eye_id][3].x;
-    float y3 = facemesh->eye_pos[eye_id][3].y;
-
-    float mat[16];
-    float vec[4][2] = {{x0, y0}, {x1, y1}, {x2, y2}, {x3, y3}};
-    matrix_identity (mat);
-    
-    matrix_translate (mat, pivot_x, pivot_y, 0);
-    matrix_rotate (mat, RAD_TO_DEG(rotation), 0, 0, 1);
-    matrix_scale (mat, scale_x, scale_y, 1.0f);
-    matrix_translate (mat, -0.5f, -0.5f, 0);
-
-    matrix_multvec2 (mat, vec[0], vec[0]);
-    matrix_multvec2 (mat, vec[1], vec[1]);
-    matrix_multvec2 (mat, vec[2], vec[2]);
-    matrix_multvec2 (mat, vec[3], vec[3]);
-
-    x0 = vec[0][0];  y0 = vec[0][1];
-    x1 = vec[1][0];  y1 = vec[1][1];
-    x2 = vec[2][0];  y2 = vec[2][1];
-    x3 = vec[3][0];  y3 = vec[3][1];
+    float x0 = vec[0][0];  float y0 = vec[0][1];
+    float x1 = vec[1][0];  float y1 = vec[1][1];    //    0--------1
+    float x2 = vec[2][0];  float y2 = vec[2][1];    //    |        |
+    float x3 = vec[3][0];  float y3 = vec[3][1];    //    3--------2
 
     /* Upside down */
     texcoord[0] = x3;   texcoord[1] = y3;
     texcoord[2] = x0;   texcoord[3] = y0;
     texcoord[4] = x2;   texcoord[5] = y2;
-    texcoord[6] = x1;   texcoord[7] = y0;
+    texcoord[6] = x1;   texcoord[7] = y1;
 
     draw_2d_texture_ex_texcoord (srctex, 0, win_h - h, w, h, texcoord);
 
@@ -371,40 +347,15 @@ render_cropped_eye_image (texture_2d_t *srctex, int ofstx, int ofsty, int texw,
                            face_t *face, face_landmark_result_t *facemesh, int eye_id)
 {
     float texcoord[8];
+    float vec[4][2];
+    affine_t mat;
+    affine_roi_to_image (&mat, face->face_cx, face->face_cy, face->face_w, face->face_h, face->rotation);
+    affine_transform_vec2 (&mat, (float *)facemesh->eye_pos[eye_id], (float *)vec, 4);
 
-    float scale_x = face->face_w;
-    float scale_y = face->face_h;
-    float pivot_x = face->face_cx;
-    float pivot_y = face->face_cy;
-    float rotation= face->rotation;
-    
-    float x0 = facemesh->eye_pos[eye_id][0].x;
-    float y0 = facemesh->eye_pos[eye_id][0].y;
-    float x1 = facemesh->eye_pos[eye_id][1].x; //    0--------1
-    float y1 = facemesh->eye_pos[eye_id][1].y; //    |        |
-    float x2 = facemesh->eye_pos[eye_id][2].x; //    |        |
-    float y2 = facemesh->eye_pos[eye_id][2].y; //    3--------2
-    float x3 = facemesh->eye_pos[eye_id][3].x;
-    float y3 = facemesh->eye_pos[eye_id][3].y;
-
-    float mat[16];
-    float vec[4][2] = {{x0, y0}, {x1, y1}, {x2, y2}, {x3, y3}};
-    matrix_identity (mat);
-    
-    matrix_translate (mat, pivot_x, pivot_y, 0);
-    matrix_rotate (mat, RAD_TO_DEG(rotation), 0, 0, 1);
-    matrix_scale (mat, scale_x, scale_y, 1.0f);
-    matrix_translate (mat, -0.5f, -0.5f, 0);
-
-    matrix_multvec2 (mat, vec[0], vec[0]);
-    matrix_multvec2 (mat, vec[1], vec[1]);
-    matrix_multvec2 (mat, vec[2], vec[2]);
-    matrix_multvec2 (mat, vec[3], vec[3]);
-
-    x0 = vec[0][0];  y0 = vec[0][1];
-    x1 = vec[1][0];  y1 = vec[1][1];
-    x2 = vec[2][0];  y2 = vec[2][1];
-    x3 = vec[3][0];  y3 = vec[3][1];
+    float x0 = vec[0][0];  float y0 = vec[0][1];
+    float x1 = vec[1][0];  float y1 = vec[1][1];    //    0--------1
+    float x2 = vec[2][0];  float y2 = vec[2][1];    //    |        |
+    float x3 = vec[3][0];  float y3 = vec[3][1];    //    3--------2
 
     texcoord[0] = x0;   texcoord[1] = y0;
     texcoord[2] = x3;   texcoord[3] = y3;
@@ -416,115 +367,106 @@ render_cropped_eye_image (texture_2d_t *srctex, int ofstx, int ofsty, int texw,
 
 
 static void
-render_lines (int ofstx, int ofsty, int texw, int texh, float *mat, irismesh_result_t *irismesh, int *idx, int num)
+render_lines (fvec3 *eye, int *idx, int num)
 {
     float col_red  [] = {1.0f, 0.0f, 0.0f, 1.0f};
-    fvec3 *eye  = irismesh->eye_landmark;
 
     for (int i = 1; i < num; i ++)
     {
-        float vec0[] = {eye[idx[i-1]].x, eye[idx[i-1]].y};
-        float vec1[] = {eye[idx[i  ]].x, eye[idx[i  ]].y};
-        matrix_multvec2 (mat, vec0, vec0);
-        matrix_multvec2 (mat, vec1, vec1);
-        float x0 = vec0[0] * texw + ofstx;   float y0 = vec0[1] * texh + ofsty;
-        float x1 = vec1[0] * texw + ofstx;   float y1 = vec1[1] * texh + ofsty;
+        float x0 = eye[idx[i-1]].x;   float y0 = eye[idx[i-1]].y;
+        float x1 = eye[idx[i  ]].x;   float y1 = eye[idx[i  ]].y;
 
         draw_2d_line (x0, y0, x1, y1, col_red, 4.0f);
     }
 }
 
+/* (mat): eye ROI --> screen */
 static void
-render_iris_landmark (int ofstx, int ofsty, int texw, int texh, irismesh_result_t *irismesh)
+render_eye_iris_mesh (affine_t *mat, irismesh_result_t *irismesh, int draw_eye_points)
 {
     float col_red  [] = {1.0f, 0.0f, 0.0f, 1.0f};
     float col_green[] = {0.0f, 1.0f, 0.0f, 1.0f};
-    fvec3 *eye  = irismesh->eye_landmark;
-    fvec3 *iris = irismesh->iris_landmark;
-    float mat[16];
+    fvec3 eye[71];
+    fvec3 iris[5];
 
-    matrix_identity (mat);
+    affine_transform_vec3 (mat, (float *)irismesh->eye_landmark,  (float *)eye,  71);
+    affine_transform_vec3 (mat, (float *)irismesh->iris_landmark, (float *)iris, 5);
 
-    for (int i = 0; i < 71; i ++)
+    if (draw_eye_points)
     {
-        float x = eye[i].x * texw + ofstx;;
-        float y = eye[i].y * texh + ofsty;;
-
-        int r = 4;
-        draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_red);
+        for (int i = 0; i < 71; i ++)
+        {
+            int r = 4;
+            draw_2d_fillrect (eye[i].x - (r/2), eye[i].y - (r/2), r, r, col_red);
+        }
     }
 
     int eye_idx0[] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
     int idx_num0 = sizeof(eye_idx0) / sizeof(int);
-    render_lines (ofstx, ofsty, texw, texh, mat, irismesh, eye_idx0, idx_num0);
+    render_lines (eye, eye_idx0, idx_num0);
 
     int eye_idx1[] = {0, 9, 10, 11, 12, 13, 14, 15, 8};
     int idx_num1 = sizeof(eye_idx1) / sizeof(int);
-    render_lines (ofstx, ofsty, texw, texh, mat, irismesh, eye_idx1, idx_num1);
+    render_lines (eye, eye_idx1, idx_num1);
 
     for (int i = 0; i < 5; i ++)
     {
-        float x = iris[i].x * texw + ofstx;;
-        float y = iris[i].y * texh + ofsty;;
-
         int r = 4;
-        draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_green);
+        draw_2d_fillrect (iris[i].x - (r/2), iris[i].y - (r/2), r, r, col_green);
     }
 
     {
-        float x0 = iris[0].x * texw + ofstx; float y0 = iris[0].y * texh + ofsty;
-        float x1 = iris[1].x * texw + ofstx; float y1 = iris[1].y * texh + ofsty;
+        float x0 = iris[0].x; float y0 = iris[0].y;
+        float x1 = iris[1].x; float y1 = iris[1].y;
         float len = sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
         draw_2d_circle (x0, y0, len, col_green, 4);
     }
 }
 
+static void
+render_iris_landmark (int ofstx, int ofsty, int texw, int texh, irismesh_result_t *irismesh)
+{
+    affine_t mat;
+    affine_image_to_screen (&mat, texw, texh, ofstx, ofsty);
+
+    render_eye_iris_mesh (&mat, irismesh, 1);
+}
+
 static void
 render_iris_landmark_on_face (int ofstx, int ofsty, int texw, int texh, 
                               face_landmark_result_t *facemesh, irismesh_result_t *irismesh)
 {
     float col_green[] = {0.0f, 1.0f, 0.0f, 1.0f};
 
+    affine_t mat_screen;
+    affine_image_to_screen (&mat_screen, texw, texh, ofstx, ofsty);
+
     for (int eye_id = 0; eye_id < 2; eye_id ++)
     {
-        fvec3 *iris = irismesh[eye_id].iris_landmark;
-
         eye_region_t *eye_rgn = &facemesh->eye_rgn[eye_id];
-        float scale_x = eye_rgn->size.x;
-        float scale_y = eye_rgn->size.y;
-        float pivot_x = eye_rgn->center.x;
-        float pivot_y = eye_rgn->center.y;
-        float rotation= eye_rgn->rotation;
-
-        float mat[16];
-        matrix_identity (mat);
-        matrix_translate (mat, pivot_x, pivot_y, 0);
-        matrix_rotate (mat, RAD_TO_DEG(rotation), 0, 0, 1);
-        matrix_scale (mat, scale_x, scale_y, 1.0f);
-        matrix_translate (mat, -0.5f, -0.5f, 0);
+        fvec3 iris[5];
+
+        affine_t mat;
+        affine_roi_to_image (&mat, eye_rgn->center.x, eye_rgn->center.y,
+                             eye_rgn->size.x, eye_rgn->size.y, eye_rgn->rotation);
+        affine_mult (&mat, &mat_screen, &mat);
+        affine_transform_vec3 (&mat, (float *)irismesh[eye_id].iris_landmark, (float *)iris, 5);
 
         for (int i = 0; i < 5; i ++)
         {
-            float vec[2] = {iris[i].x, iris[i].y};
-            matrix_multvec2 (mat, vec, vec);
-
-            float x = vec[0] * texw + ofstx;
-            float y = vec[1] * texh + ofsty;
-
             int r = 4;
-            draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_green);
+            draw_2d_fillrect (iris[i].x - (r/2), iris[i].y - (r/2), r, r, col_green);
         }
 
         for (int eye_id = 0; eye_id < 2; eye_id ++)
         {
-            float x0 = facemesh->eye_pos[eye_id][0].x * texw + ofstx;
-            float y0 = facemesh->eye_pos[eye_id][0].y * texh + ofsty;
-            float x1 = facemesh->eye_pos[eye_id][1].x * texw + ofstx; //    0--------1
-            float y1 = facemesh->eye_pos[eye_id][1].y * texh + ofsty; //    |        |
-            float x2 = facemesh->eye_pos[eye_id][2].x * texw + ofstx; //    |        |
-            float y2 = facemesh->eye_pos[eye_id][2].y * texh + ofsty; //    3--------2
-            float x3 = facemesh->eye_pos[eye_id][3].x * texw + ofstx;
-            float y3 = facemesh->eye_pos[eye_id][3].y * texh + ofsty;
+            float vec[4][2];
+            affine_transform_vec2 (&mat_screen, (float *)facemesh->eye_pos[eye_id], (float *)vec, 4);
+
+            float x0 = vec[0][0];  float y0 = vec[0][1];
+            float x1 = vec[1][0];  float y1 = vec[1][1];    //    0--------1
+            float x2 = vec[2][0];  float y2 = vec[2][1];    //    |        |
+            float x3 = vec[3][0];  float y3 = vec[3][1];    //    3--------2
 
             float col_red[] = {1.0f, 0.0f, 0.0f, 1.0f};
             draw_2d_line (x0, y0, x1, y1, col_red, 1.0f);
@@ -535,104 +477,42 @@ render_iris_landmark_on_face (int ofstx, int ofsty, int texw, int texh,
     }
 }
 
-static void
-render_facemesh_keypoint (int ofstx, int ofsty, int texw, int texh, float *mat, fvec3 *joint, int idx)
-{
-    float col_cyan[] = {0.0f, 1.0f, 1.0f, 1.0f};
-
-    float vec[2] = {joint[idx].x, joint[idx].y};
-    matrix_multvec2 (mat, vec, vec);
-
-    float x = vec[0] * texw + ofstx;
-    float y = vec[1] * texh + ofsty;
-
-    int r = 4;
-    draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_cyan);
-}
-
 static void
 render_iris_landmark_on_main (int ofstx, int ofsty, int texw, int texh, 
                               face_t *face, face_landmark_result_t *facemesh, irismesh_result_t *irismesh)
 {
-    float col_green[] = {0.0f, 1.0f, 0.0f, 1.0f};
+    float col_cyan[] = {0.0f, 1.0f, 1.0f, 1.0f};
 
-    float mat_face[16];
+    /* face ROI --> screen */
+    affine_t mat_face;
     {
-        float scale_x = face->face_w;
-        float scale_y = face->face_h;
-        float pivot_x = face->face_cx;
-        float pivot_y = face->face_cy;
-        float rotation= face->rotation;
-
-        matrix_identity (mat_face);
-        matrix_translate (mat_face, pivot_x, pivot_y, 0);
-        matrix_rotate (mat_face, RAD_TO_DEG(rotation), 0, 0, 1);
-        matrix_scale (mat_face, scale_x, scale_y, 1.0f);
-        matrix_translate (mat_face, -0.5f, -0.5f, 0);
+        affine_t mat_screen;
+        affine_image_to_screen (&mat_screen, texw, texh, ofstx, ofsty);
+        affine_roi_to_image (&mat_face, face->face_cx, face->face_cy, face->face_w, face->face_h, face->rotation);
+        affine_mult (&mat_face, &mat_screen, &mat_face);
     }
 
     int key_idx[] = {1, 9, 10, 152, 78, 308, 234, 454};
     int key_num = sizeof(key_idx) / sizeof(int);
     for (int i = 0; i < key_num; i ++)
-        render_facemesh_keypoint (ofstx, ofsty, texw, texh, mat_face, facemesh->joint, key_idx[i]);
-
-    for (int eye_id = 0; eye_id < 2; eye_id ++)
     {
-        fvec3 *iris = irismesh[eye_id].iris_landmark;
-
-        float mat_eye[16];
-        {
-            eye_region_t *eye_rgn = &facemesh->eye_rgn[eye_id];
-            float scale_x = eye_rgn->size.x;
-            float scale_y = eye_rgn->size.y;
-            float pivot_x = eye_rgn->center.x;
-            float pivot_y = eye_rgn->center.y;
-            float rotation= eye_rgn->rotation;
-
-            matrix_identity (mat_eye);
-            matrix_translate (mat_eye, pivot_x, pivot_y, 0);
-            matrix_rotate (mat_eye, RAD_TO_DEG(rotation), 0, 0, 1);
-            matrix_scale (mat_eye, scale_x, scale_y, 1.0f);
-            matrix_translate (mat_eye, -0.5f, -0.5f, 0);
-        }
-
-        float mat[16];
-        matrix_mult (mat, mat_face, mat_eye);
-
-        int eye_idx0[] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
-        int idx_num0 = sizeof(eye_idx0) / sizeof(int);
-        render_lines (ofstx, ofsty, texw, texh, mat, irismesh, eye_idx0, idx_num0);
-
-        int eye_idx1[] = {0, 9, 10, 11, 12, 13, 14, 15, 8};
-        int idx_num1 = sizeof(eye_idx1) / sizeof(int);
-        render_lines (ofstx, ofsty, texw, texh, mat, irismesh, eye_idx1, idx_num1);
-
-        for (int i = 0; i < 5; i ++)
-        {
-            float vec[2] = {iris[i].x, iris[i].y};
-            matrix_multvec2 (mat, vec, vec);
+        fvec3 key;
+        affine_transform_vec3 (&mat_face, (float *)&facemesh->joint[key_idx[i]], (float *)&key, 1);
 
-            float x = vec[0] * texw + ofstx;
-            float y = vec[1] * texh + ofsty;
+        int r = 4;
+        draw_2d_fillrect (key.x - (r/2), key.y - (r/2), r, r, col_cyan);
+    }
 
-            int r = 4;
-            draw_2d_fillrect (x - (r/2), y - (r/2), r, r, col_green);
-        }
+    for (int eye_id = 0; eye_id < 2; eye_id ++)
+    {
+        /* eye ROI --> face ROI --> screen */
+        eye_region_t *eye_rgn = &facemesh->eye_rgn[eye_id];
+        affine_t mat;
+        affine_roi_to_image (&mat, eye_rgn->center.x, eye_rgn->center.y,
+                             eye_rgn->size.x, eye_rgn->size.y, eye_rgn->rotation);
+        affine_mult (&mat, &mat_face, &mat);
 
-        {
-            float vec0[2] = {iris[0].x, iris[0].y};
-            float vec1[2] = {iris[1].x, iris[1].y};
-            matrix_multvec2 (mat, vec0, vec0);
-            matrix_multvec2 (mat, vec1, vec1);
-
-            float x0 = vec0[0] * texw + ofstx;
-            float y0 = vec0[1] * texh + ofsty;
-            float x1 = vec1[0] * texw + ofstx;
-            float y1 = vec1[1] * texh + ofsty;
-
-            float len = sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
-            draw_2d_circle (x0, y0, len, col_green, 4);
-        }
+        render_eye_iris_mesh (&mat, &irismesh[eye_id], 0);
     }
 }
 
@@ -698,17 +578,25 @@ main(int argc, char *argv[])
     int use_quantized_tflite = 0;
     int enable_video = 0;
     int enable_camera = 1;
+    int enable_iris_gating = 1;
+    int iris_interval = 1;
     UNUSED (argc);
     UNUSED (*argv);
 
     {
         int c;
-        const char *optstring = "eqv:x";
+        const char *optstring = "egi:qv:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1) 
         {
             switch (c)
             {
+            case 'g':
+                enable_iris_gating = 0;
+                break;
+            case 'i':
+                iris_interval = atoi (optarg);
+                break;
             case 'q':
                 use_quantized_tflite = 1;
                 break;
@@ -742,6 +630,10 @@ main(int argc, char *argv[])
     init_dbgstr (win_w, win_h);
 
     init_tflite_facemesh (use_quantized_tflite);
+    if (enable_iris_gating)
+        set_iris_gating_param (0.1f, 0.05f, 10, iris_interval);
+    else
+        set_iris_gating_param (0.0f, 0.0f, 0, iris_interval);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the FBO binding */
@@ -846,19 +738,26 @@ main(int argc, char *argv[])
         }
 
         /* --------------------------------------- *
-         *  Iris landmark
+         *  Iris landmark (or the results held while the eye is closed or still)
          * --------------------------------------- */
         invoke_ms2 = 0;
         for (int face_id = 0; face_id < face_detect_ret.num; face_id ++)
         {
+            face_t *face = &face_detect_ret.faces[face_id];
+
             for (int eye_id = 0; eye_id < 2; eye_id ++)
             {
-                feed_iris_landmark_image (&captex, win_w, win_h, &face_detect_ret.faces[face_id], &face_mesh_ret[face_id], eye_id);
+                if (hold_iris_landmark (face_id, eye_id, face, &face_mesh_ret[face_id], &iris_mesh_ret[face_id][eye_id]))
+                    continue;
+
+                feed_iris_landmark_image (&captex, win_w, win_h, face, &face_mesh_ret[face_id], eye_id);
 
                 ttime[6] = pmeter_get_time_ms ();
                 invoke_irismesh_landmark (&iris_mesh_ret[face_id][eye_id]);
                 ttime[7] = pmeter_get_time_ms ();
                 invoke_ms2 += ttime[7] - ttime[6];
+
+                update_iris_landmark (face_id, eye_id, face, &face_mesh_ret[face_id], &iris_mesh_ret[face_id][eye_id]);
             }
         }
 
@@ -924,8 +823,10 @@ main(int argc, char *argv[])
         glViewport (0, 0, win_w, win_h);
         draw_pmeter (0, 40);
 
-        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite0 :%5.1f [ms]\nTFLite1 :%5.1f [ms]\nTFLite2 :%5.1f [ms]",
-            interval, invoke_ms0, invoke_ms1, invoke_ms2);
+        iris_gating_stats_t gstats;
+        get_iris_gating_stats (&gstats);
+        sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite0 :%5.1f [ms]\nTFLite1 :%5.1f [ms]\nTFLite2 :%5.1f [ms]\nIrisSkip:%5.1f [%%]",
+            interval, invoke_ms0, invoke_ms1, invoke_ms2, gstats.invoke_skip_rate * 100);
         draw_dbgstr (strbuf, 10, 10);
 
         egl_swap();
@@ -3,8 +3,11 @@
  * Copyright (c) 2020 terryky1220@gmail.com
  * ------------------------------------------------ */
 #include "util_tflite.h"
+#include "util_anchor_decode.h"
+#include "util_nms.h"
+#include "util_affine.h"
 #include "tflite_facemesh.h"
-#include <list>
+#include <algorithm>
 
 /* 
  * https://github.com/google/mediapipe/tree/master/mediapipe/models/face_detection_front.tflite
@@ -33,7 +36,24 @@ static tflite_tensor_t      s_iris_tensor_input;
 static tflite_tensor_t      s_iris_tensor_iris;
 static tflite_tensor_t      s_iris_tensor_eye;
 
-static std::list<fvec2> s_anchors;
+static anchor_decoder_t s_anchor_decoder;
+static nms_context_t    s_nms;
+
+/* iris gating */
+typedef struct _iris_gate_t
+{
+    int                 valid;
+    int                 num_held;   /* frames since the last invocation */
+    eye_region_t        rgn;        /* eye ROI of the last invocation, in image coordinates */
+    irismesh_result_t   irismesh;
+} iris_gate_t;
+
+static float                s_iris_close_thresh    = 0.1f;
+static float                s_iris_motion_thresh   = 0.05f;
+static int                  s_iris_max_hold        = 10;
+static int                  s_iris_update_interval = 1;
+static iris_gate_t          s_iris_gate[MAX_FACE_NUM][2];
+static iris_gating_stats_t  s_iris_stats;
 
 /*
  * determine where the anchor points are scatterd.
@@ -43,33 +63,15 @@ static int
 create_blazeface_anchors(int input_w, int input_h)
 {
     /* ANCHORS_CONFIG  */
-    int strides[2] = {8, 16};
-    int anchors[2] = {2,  6};
-
-    int numtotal = 0;
-
-    for (int i = 0; i < 2; i ++)
-    {
-        int stride = strides[i];
-        int gridCols = (input_w + stride -1) / stride;
-        int gridRows = (input_h + stride -1) / stride;
-        int anchorNum = anchors[i];
-
-        fvec2 anchor;
-        for (int gridY = 0; gridY < gridRows; gridY ++)
-        {
-            anchor.y = stride * (gridY + 0.5f);
-            for (int gridX = 0; gridX < gridCols; gridX ++)
-            {
-                anchor.x = stride * (gridX + 0.5f);
-                for (int n = 0; n < anchorNum; n ++)
-                {
-                    s_anchors.push_back (anchor);
-                    numtotal ++;
-                }
-            }
-        }
-    }
+    static const anchor_layer_t s_layers[] = {
+        { 8, 2},    /* stride, anchors per cell */
+        {16, 6},
+    };
+    int num_layers = sizeof (s_layers) / sizeof (s_layers[0]);
+
+    int numtotal = init_anchor_decoder_grid (&s_anchor_decoder, s_layers, num_layers,
+                                             input_w, input_h, kFaceKeyNum, 16);
+    init_nms (&s_nms, numtotal);
     return numtotal;
 }
 
@@ -184,157 +186,67 @@ capture_to_img (char *lpFName, int nW, int nH, float *lpBuf)
 /* -------------------------------------------------- *
  * Invoke TensorFlow Lite (Face detection)
  * -------------------------------------------------- */
-static float *
-get_bbox_ptr (int anchor_idx)
+static int
+decode_bounds (float score_thresh)
 {
-    int idx = 16 * anchor_idx;
-    float *bboxes_ptr = (float *)s_detect_tensor_bboxes.ptr;
+    anchor_decoder_t *dec = &s_anchor_decoder;
 
-    return &bboxes_ptr[idx];
-}
+    /* only the anchors above the threshold are decoded. */
+    set_anchor_score_thresh (dec, score_thresh);
+    int num = decode_anchors (dec, (float *)s_detect_tensor_scores.ptr,
+                                   (float *)s_detect_tensor_bboxes.ptr);
 
-static int
-decode_bounds (std::list<face_t> &face_list, float score_thresh, int input_img_w, int input_img_h)
-{
-    face_t face_item;
-    float  *scores_ptr = (float *)s_detect_tensor_scores.ptr;
-    
-    int i = 0;
-    for (auto itr = s_anchors.begin(); itr != s_anchors.end(); i ++, itr ++)
+    /* NMS candidates (SoA) */
+    for (int i = 0; i < num; i ++)
     {
-        fvec2 anchor = *itr;
-        float score0 = scores_ptr[i];
-        float score = 1.0f / (1.0f + exp(-score0));
-
-        if (score > score_thresh)
-        {
-            float *p = get_bbox_ptr (i);
-
-            /* boundary box */
-            float sx = p[0];
-            float sy = p[1];
-            float w  = p[2];
-            float h  = p[3];
-
-            float cx = sx + anchor.x;
-            float cy = sy + anchor.y;
-
-            cx /= (float)input_img_w;
-            cy /= (float)input_img_h;
-            w  /= (float)input_img_w;
-            h  /= (float)input_img_h;
-
-            fvec2 topleft, btmright;
-            topleft.x  = cx - w * 0.5f;
-            topleft.y  = cy - h * 0.5f;
-            btmright.x = cx + w * 0.5f;
-            btmright.y = cy + h * 0.5f;
-
-            face_item.score    = score;
-            face_item.topleft  = topleft;
-            face_item.btmright = btmright;
-
-            /* landmark positions (6 keys) */
-            for (int j = 0; j < kFaceKeyNum; j ++)
-            {
-                float lx = p[4 + (2 * j) + 0];
-                float ly = p[4 + (2 * j) + 1];
-                lx += anchor.x;
-                ly += anchor.y;
-                lx /= (float)input_img_w;
-                ly /= (float)input_img_h;
-
-                face_item.keys[j].x = lx;
-                face_item.keys[j].y = ly;
-            }
-
-            face_list.push_back (face_item);
-        }
+        anchor_box_t *box = &dec->boxes[i];
+        nms_set_box (&s_nms, i, box->x1, box->y1, box->x2, box->y2, box->score);
     }
-    return 0;
+    s_nms.num = num;
+
+    return num;
 }
 
 /* -------------------------------------------------- *
  *  Apply NonMaxSuppression:
  *      https://github.com/tensorflow/tfjs/blob/master/tfjs-core/src/ops/image_ops.ts
  * -------------------------------------------------- */
-static float
-calc_intersection_over_union (face_t &face0, face_t &face1)
-{
-    float sx0 = face0.topleft.x;
-    float sy0 = face0.topleft.y;
-    float ex0 = face0.btmright.x;
-    float ey0 = face0.btmright.y;
-    float sx1 = face1.topleft.x;
-    float sy1 = face1.topleft.y;
-    float ex1 = face1.btmright.x;
-    float ey1 = face1.btmright.y;
-    
-    float xmin0 = std::min (sx0, ex0);
-    float ymin0 = std::min (sy0, ey0);
-    float xmax0 = std::max (sx0, ex0);
-    float ymax0 = std::max (sy0, ey0);
-    float xmin1 = std::min (sx1, ex1);
-    float ymin1 = std::min (sy1, ey1);
-    float xmax1 = std::max (sx1, ex1);
-    float ymax1 = std::max (sy1, ey1);
-    
-    float area0 = (ymax0 - ymin0) * (xmax0 - xmin0);
-    float area1 = (ymax1 - ymin1) * (xmax1 - xmin1);
-    if (area0 <= 0 || area1 <= 0)
-        return 0.0f;
-
-    float intersect_xmin = std::max (xmin0, xmin1);
-    float intersect_ymin = std::max (ymin0, ymin1);
-    float intersect_xmax = std::min (xmax0, xmax1);
-    float intersect_ymax = std::min (ymax0, ymax1);
-
-    float intersect_area = std::max (intersect_ymax - intersect_ymin, 0.0f) *
-                           std::max (intersect_xmax - intersect_xmin, 0.0f);
-    
-    return intersect_area / (area0 + area1 - intersect_area);
-}
-
-static bool
-compare (face_t &v1, face_t &v2)
+static void
+set_face_item (face_t &face, float score, float x1, float y1, float x2, float y2, const float *keys)
 {
-    if (v1.score > v2.score)
-        return true;
-    else
-        return false;
+    face.score      = score;
+    face.topleft.x  = x1;
+    face.topleft.y  = y1;
+    face.btmright.x = x2;
+    face.btmright.y = y2;
+
+    /* landmark positions (6 keys) */
+    for (int j = 0; j < kFaceKeyNum; j ++)
+    {
+        face.keys[j].x = keys[2 * j + 0];
+        face.keys[j].y = keys[2 * j + 1];
+    }
 }
 
 static int
-non_max_suppression (std::list<face_t> &face_list, std::list<face_t> &face_sel_list, float iou_thresh)
+non_max_suppression (face_t *face_sel, int max_faces, float iou_thresh)
 {
-    face_list.sort (compare);
+    anchor_decoder_t *dec = &s_anchor_decoder;
+    int num_sel;
 
-    for (auto itr = face_list.begin(); itr != face_list.end(); itr ++)
+    nms_blend_t blend[MAX_FACE_NUM];
+    float       blend_keys[MAX_FACE_NUM * kFaceKeyNum * 2];
+
+    num_sel = nms_select (&s_nms, iou_thresh, max_faces,
+                          dec->keys, kFaceKeyNum * 2, blend, blend_keys);
+    for (int i = 0; i < num_sel; i ++)
     {
-        face_t face_candidate = *itr;
-
-        int ignore_candidate = false;
-        for (auto itr_sel = face_sel_list.rbegin(); itr_sel != face_sel_list.rend(); itr_sel ++)
-        {
-            face_t face_sel = *itr_sel;
-
-            float iou = calc_intersection_over_union (face_candidate, face_sel);
-            if (iou >= iou_thresh)
-            {
-                ignore_candidate = true;
-                break;
-            }
-        }
-
-        if (!ignore_candidate)
-        {
-            face_sel_list.push_back(face_candidate);
-            if (face_sel_list.size() >= MAX_FACE_NUM)
-                break;
-        }
+        nms_blend_t *b = &blend[i];
+        set_face_item (face_sel[i], b->score, b->x1, b->y1, b->x2, b->y2,
+                       &blend_keys[i * kFaceKeyNum * 2]);
     }
 
-    return 0;
+    return num_sel;
 }
 
 /* -------------------------------------------------- *
@@ -425,7 +337,7 @@ compute_face_rect (face_t &face)
 }
 
 static bool
-sort_right_major (face_t &v1, face_t &v2)
+sort_right_major (const face_t &v1, const face_t &v2)
 {
     if (v1.keys[kRightEye].x > v2.keys[kRightEye].x)
         return true;
@@ -434,25 +346,20 @@ sort_right_major (face_t &v1, face_t &v2)
 }
 
 static void
-pack_face_result (face_detect_result_t *facedet_result, std::list<face_t> &face_list)
+pack_face_result (face_detect_result_t *facedet_result, face_t *face_sel, int num_faces)
 {
-    face_list.sort (sort_right_major);
+    std::stable_sort (face_sel, face_sel + num_faces, sort_right_major);
 
-    int num_faces = 0;
-    for (auto itr = face_list.begin(); itr != face_list.end(); itr ++)
+    for (int i = 0; i < num_faces; i ++)
     {
-        face_t face = *itr;
+        face_t &face = face_sel[i];
 
         compute_rotation (face);
         compute_face_rect (face);
 
-        memcpy (&facedet_result->faces[num_faces], &face, sizeof (face));
-        num_faces ++;
-        facedet_result->num = num_faces;
-
-        if (num_faces >= MAX_FACE_NUM)
-            break;
+        memcpy (&facedet_result->faces[i], &face, sizeof (face));
     }
+    facedet_result->num = num_faces;
 }
 
 
@@ -471,22 +378,13 @@ invoke_face_detect (face_detect_result_t *facedet_result)
 
     /* decode boundary box and landmark keypoints */
     float score_thresh = 0.75f;
-    std::list<face_t> face_list;
-
-    int input_img_w = s_detect_tensor_input.dims[2];
-    int input_img_h = s_detect_tensor_input.dims[1];
-    decode_bounds (face_list, score_thresh, input_img_w, input_img_h);
+    face_t face_sel[MAX_FACE_NUM];
 
+    decode_bounds (score_thresh);
 
-#if 1 /* USE NMS */
     float iou_thresh = 0.3f;
-    std::list<face_t> face_nms_list;
-
-    non_max_suppression (face_list, face_nms_list, iou_thresh);
-    pack_face_result (facedet_result, face_nms_list);
-#else
-    pack_face_result (facedet_result, face_list);
-#endif
+    int num_faces = non_max_suppression (face_sel, MAX_FACE_NUM, iou_thresh);
+    pack_face_result (facedet_result, face_sel, num_faces);
 
     return 0;
 }
@@ -496,28 +394,8 @@ invoke_face_detect (face_detect_result_t *facedet_result)
  * Invoke TensorFlow Lite (Facemesh landmark)
  * -------------------------------------------------- */
 static void
-compute_eye_roi_one (face_landmark_result_t *facemesh_result, int id, int idx0, int idx1)
+set_eye_roi (face_landmark_result_t *facemesh_result, int id, float cx, float cy, float w, float h, float rotation)
 {
-    float x0 = facemesh_result->joint[idx0].x;
-    float y0 = facemesh_result->joint[idx0].y;
-    float x1 = facemesh_result->joint[idx1].x;
-    float y1 = facemesh_result->joint[idx1].y;
-
-    float cx = (x0 + x1) / 2.0f;
-    float cy = (y0 + y1) / 2.0f;
-    float w = std::abs(x1 - x0);
-    float h = std::abs(y1 - y0);
-
-    {
-        float long_side = std::max (w, h);
-        w = h = long_side;
-    }
-    {
-        float scale = 2.3f;
-        w *= scale;
-        h *= scale;
-    }
-
     float dx = w / 2.0f;
     float dy = h / 2.0f;
 
@@ -527,10 +405,9 @@ compute_eye_roi_one (face_landmark_result_t *facemesh_result, int id, int idx0,
     eye_pos[2].x = +dx;  eye_pos[2].y = +dy;
     eye_pos[3].x = -dx;  eye_pos[3].y = +dy;
 
-    float rotation = 0.0f;
     for (int i = 0; i < 4; i ++)
     {
-        rot_vec (*eye_pos, rotation);
+        rot_vec (eye_pos[i], rotation);
         eye_pos[i].x += cx;
         eye_pos[i].y += cy;
     }
@@ -543,6 +420,32 @@ compute_eye_roi_one (face_landmark_result_t *facemesh_result, int id, int idx0,
     eye_rgn->size.y   = h;
 }
 
+static void
+compute_eye_roi_one (face_landmark_result_t *facemesh_result, int id, int idx0, int idx1)
+{
+    float x0 = facemesh_result->joint[idx0].x;
+    float y0 = facemesh_result->joint[idx0].y;
+    float x1 = facemesh_result->joint[idx1].x;
+    float y1 = facemesh_result->joint[idx1].y;
+
+    float cx = (x0 + x1) / 2.0f;
+    float cy = (y0 + y1) / 2.0f;
+    float w = std::abs(x1 - x0);
+    float h = std::abs(y1 - y0);
+
+    {
+        float long_side = std::max (w, h);
+        w = h = long_side;
+    }
+    {
+        float scale = 2.3f;
+        w *= scale;
+        h *= scale;
+    }
+
+    set_eye_roi (facemesh_result, id, cx, cy, w, h, 0.0f);
+}
+
 static void
 compute_eye_roi (face_landmark_result_t *facemesh_result)
 {
@@ -1533,3 +1436,150 @@ get_static_facemesh_landmark (face_detect_result_t   *facedet_result,
     return 0;
 }
 
+
+/* -------------------------------------------------- *
+ *  Iris gating
+ * -------------------------------------------------- */
+void
+set_iris_gating_param (float close_thresh, float motion_thresh, int max_hold, int update_interval)
+{
+    s_iris_close_thresh    = close_thresh;
+    s_iris_motion_thresh   = motion_thresh;
+    s_iris_max_hold        = max_hold;
+    s_iris_update_interval = update_interval;
+
+    for (int i = 0; i < MAX_FACE_NUM; i ++)
+    {
+        s_iris_gate[i][0].valid = 0;
+        s_iris_gate[i][1].valid = 0;
+    }
+}
+
+/* eyelid aperture relative to the eye width. about 0.3 for an open eye. */
+static float
+compute_eye_aperture (face_landmark_result_t *facemesh, int eye_id)
+{
+    static const int s_eye_idx[2][4] = {
+        { 33, 133, 159, 145},   /* corner, corner, upper lid, lower lid */
+        {362, 263, 386, 374},
+    };
+    const int *idx = s_eye_idx[eye_id];
+    fvec3 *joint = facemesh->joint;
+
+    float wx = joint[idx[1]].x - joint[idx[0]].x;
+    float wy = joint[idx[1]].y - joint[idx[0]].y;
+    float hx = joint[idx[3]].x - joint[idx[2]].x;
+    float hy = joint[idx[3]].y - joint[idx[2]].y;
+    float width = std::sqrt (wx * wx + wy * wy);
+
+    if (width <= 0.0f)
+        return 0.0f;
+    return std::sqrt (hx * hx + hy * hy) / width;
+}
+
+/* eye ROI: face ROI coordinates <--> image coordinates */
+static void
+eye_roi_to_image (eye_region_t *dst, eye_region_t *src, face_t *face)
+{
+    affine_t mat;
+    affine_roi_to_image (&mat, face->face_cx, face->face_cy, face->face_w, face->face_h, face->rotation);
+    affine_transform_vec2 (&mat, (float *)&src->center, (float *)&dst->center, 1);
+
+    dst->size.x   = src->size.x * face->face_w;
+    dst->size.y   = src->size.y * face->face_h;
+    dst->rotation = src->rotation + face->rotation;
+}
+
+static void
+eye_roi_from_image (face_landmark_result_t *facemesh, int eye_id, eye_region_t *src, face_t *face)
+{
+    float c  = std::cos (face->rotation);
+    float s  = std::sin (face->rotation);
+    float dx = src->center.x - face->face_cx;
+    float dy = src->center.y - face->face_cy;
+
+    float cx = ( dx * c + dy * s) / face->face_w + 0.5f;
+    float cy = (-dx * s + dy * c) / face->face_h + 0.5f;
+    float w  = src->size.x / face->face_w;
+    float h  = src->size.y / face->face_h;
+
+    set_eye_roi (facemesh, eye_id, cx, cy, w, h, src->rotation - face->rotation);
+}
+
+/*
+ *  returns 1 when the iris landmark of the eye is held: (irismesh) is filled
+ *  with the last result, and the eye ROI of (facemesh) may be replaced.
+ *  returns 0 when the iris landmark should be invoked for the eye.
+ */
+int
+hold_iris_landmark (int face_id, int eye_id, face_t *face, face_landmark_result_t *facemesh,
+                    irismesh_result_t *irismesh)
+{
+    iris_gate_t *gate = &s_iris_gate[face_id][eye_id];
+    eye_region_t rgn;
+    int hold = 0;
+
+    s_iris_stats.num_eyes ++;
+
+    eye_roi_to_image (&rgn, &facemesh->eye_rgn[eye_id], face);
+
+    /* the faces may have been reordered. the ROI must overlap the last one. */
+    float size  = gate->rgn.size.x;
+    float dx    = rgn.center.x - gate->rgn.center.x;
+    float dy    = rgn.center.y - gate->rgn.center.y;
+    float shift = std::sqrt (dx * dx + dy * dy);
+    if (!gate->valid || shift > size * 0.5f)
+    {
+        gate->valid = 0;
+    }
+    else if (compute_eye_aperture (facemesh, eye_id) < s_iris_close_thresh)
+    {
+        s_iris_stats.num_closed ++;
+        hold = 1;
+    }
+    else if (gate->num_held < s_iris_max_hold &&
+             shift < size * s_iris_motion_thresh &&
+             std::abs (rgn.size.x / size - 1.0f) < s_iris_motion_thresh &&
+             std::abs (normalize_radians (rgn.rotation - gate->rgn.rotation)) < s_iris_motion_thresh)
+    {
+        eye_roi_from_image (facemesh, eye_id, &gate->rgn, face);
+        s_iris_stats.num_still ++;
+        hold = 1;
+    }
+    else if (gate->num_held + 1 < s_iris_update_interval)
+    {
+        hold = 1;
+    }
+
+    if (hold)
+    {
+        *irismesh = gate->irismesh;
+        gate->num_held ++;
+    }
+
+    return hold;
+}
+
+/* store the result of the iris landmark invoked for the eye. */
+void
+update_iris_landmark (int face_id, int eye_id, face_t *face, face_landmark_result_t *facemesh,
+                      irismesh_result_t *irismesh)
+{
+    iris_gate_t *gate = &s_iris_gate[face_id][eye_id];
+
+    eye_roi_to_image (&gate->rgn, &facemesh->eye_rgn[eye_id], face);
+    gate->irismesh = *irismesh;
+    gate->num_held = 0;
+    gate->valid    = 1;
+
+    s_iris_stats.num_invoke ++;
+}
+
+void
+get_iris_gating_stats (iris_gating_stats_t *stats)
+{
+    s_iris_stats.invoke_skip_rate = (s_iris_stats.num_eyes > 0) ?
+        1.0f - (float)s_iris_stats.num_invoke / (float)s_iris_stats.num_eyes : 0.0f;
+
+    *stats = s_iris_stats;
+}
@@ -87,6 +87,27 @@ typedef struct _irismesh_result_t
 } irismesh_result_t;
 
 
+/*
+ *  iris gating:
+ *    the iris landmark of an eye is not invoked, and the last result is held
+ *      - while the eye is closed (eyelid aperture / eye width < close_thresh),
+ *      - while the eye ROI moved less than (motion_thresh) of its size since the
+ *        last invocation, up to (max_hold) frames. the eye ROI of the last
+ *        invocation is reused.
+ *      - for (update_interval - 1) frames after each invocation.
+ *    the held iris is relative to the eye ROI, so it is re-projected with the
+ *    eye ROI of the current facemesh.
+ */
+typedef struct _iris_gating_stats_t
+{
+    int     num_eyes;
+    int     num_invoke;         /* eyes the iris landmark ran */
+    int     num_closed;         /* eyes held because they were closed */
+    int     num_still;          /* eyes held because they didn't move */
+    float   invoke_skip_rate;   /* [0, 1] */
+} iris_gating_stats_t;
+
+
 int  init_tflite_facemesh (int use_quantized_tflite);
 
 void *get_face_detect_input_buf (int *w, int *h);
@@ -98,6 +119,14 @@ int  invoke_facemesh_landmark (face_landmark_result_t *facemesh_result);
 void *get_irismesh_landmark_input_buf (int *w, int *h);
 int  invoke_irismesh_landmark (irismesh_result_t *eyemesh_result);
 
+/* close_thresh = 0, motion_thresh = 0, update_interval <= 1: no gating */
+void set_iris_gating_param (float close_thresh, float motion_thresh, int max_hold, int update_interval);
+int  hold_iris_landmark    (int face_id, int eye_id, face_t *face, face_landmark_result_t *facemesh,
+                            irismesh_result_t *irismesh);
+void update_iris_landmark  (int face_id, int eye_id, face_t *face, face_landmark_result_t *facemesh,
+                            irismesh_result_t *irismesh);
+void get_iris_gating_stats (iris_gating_stats_t *stats);
+
 int
 get_static_facemesh_landmark (face_detect_result_t   *facedet_result,
                               face_landmark_result_t *facemesh_result);
@@ -14,6 +14,7 @@
 #include "util_pmeter.h"
 #include "util_texture.h"
 #include "util_render2d.h"
+#include "util_landmark_filter.h"
 #include "util_matrix.h"
 #include "tflite_objectron.h"
 #include "camera_capture.h"
@@ -295,6 +296,7 @@ main(int argc, char *argv[])
     double ttime[10] = {0}, interval, invoke_ms0 = 0;
     int use_quantized_tflite = 0;
     int enable_camera = 1;
+    int filter_type = LANDMARK_FILTER_NONE;
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
@@ -303,12 +305,17 @@ main(int argc, char *argv[])
 
     {
         int c;
-        const char *optstring = "qv:x";
+        const char *optstring = "f:qv:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1)
         {
             switch (c)
             {
+            case 'f':
+                filter_type = parse_landmark_filter_type (optarg);
+                if (filter_type < 0)
+                    return -1;
+                break;
             case 'q':
                 use_quantized_tflite = 1;
                 break;
@@ -341,6 +348,7 @@ main(int argc, char *argv[])
     init_dbgstr (win_w, win_h);
 
     init_tflite_objectron (use_quantized_tflite);
+    set_objectron_filter (filter_type);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the FBO binding */
@@ -428,6 +436,8 @@ main(int argc, char *argv[])
         ttime[3] = pmeter_get_time_ms ();
         invoke_ms0 = ttime[3] - ttime[2];
 
+        filter_objectron_result (&objectron_ret, ttime[1]);
+
         /* --------------------------------------- *
          *  render scene (left half)
          * --------------------------------------- */
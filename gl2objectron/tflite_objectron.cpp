@@ -20,7 +20,10 @@
 
 #include "util_tflite.h"
 #include "tflite_objectron.h"
-#include <list>
+#include "util_worker.h"
+#include "util_simd_math.h"
+#include "util_landmark_filter.h"
+#include <algorithm>
 #include "Eigen/Dense"
 
 /* 
@@ -43,11 +46,24 @@ static tflite_tensor_t      s_detect_tensor_heatmap;
 
 static int s_need_post_logistic = 0;
 
+/* heatmap post-process buffers. allocated once in init_tflite_objectron() */
+#define LOCAL_MAX_DISTANCE  2           /* (5x5) MAX filter */
+
+static int   s_hmp_w, s_hmp_h;
+static float *s_belief_map;             /* sigmoid applied heatmap (or the tensor itself) */
+static float *s_belief_buf;
+static float *s_dilate_tmp;             /* horizontal pass of the MAX filter */
+static float *s_dilated_map;
+static float *s_line_g;                 /* van Herk/Gil-Werman block prefix/suffix max */
+static float *s_line_h;
+static int   *s_center_idx;
+
 /*
  * https://github.com/google/mediapipe/tree/master/mediapipe/graphs/object_detection_3d/calculators/tflite_tensors_to_objects_calculator.cc
  */
 Eigen::Matrix<float, 4, 4, Eigen::RowMajor> projection_matrix_;
 Eigen::Matrix<float, 8, 4, Eigen::RowMajor> epnp_alpha_;
+Eigen::Matrix<float, 4, 4, Eigen::RowMajor> epnp_alpha_gram_;  /* epnp_alpha_^T * epnp_alpha_ */
 
 /* -------------------------------------------------- *
  *  Create TFLite Interpreter
@@ -82,6 +98,27 @@ init_tflite_objectron (int use_quantized_tflite)
          0.0f, 1.0f, -1.0f, 1.0f,  0.0f, 1.0f, 1.0f, -1.0f, -2.0f,  1.0f,  1.0f,
          1.0f;
 
+    epnp_alpha_gram_ = epnp_alpha_.transpose() * epnp_alpha_;
+
+    s_hmp_w = s_detect_tensor_heatmap.dims[2];
+    s_hmp_h = s_detect_tensor_heatmap.dims[1];
+
+    int hmp_size = s_hmp_w * s_hmp_h;
+    int kern_len = 2 * LOCAL_MAX_DISTANCE + 1;
+    int line_len = std::max (s_hmp_w, s_hmp_h) + 2 * LOCAL_MAX_DISTANCE + kern_len;
+
+    s_belief_buf  = (float *)malloc (hmp_size * sizeof (float));
+    s_dilate_tmp  = (float *)malloc (hmp_size * sizeof (float));
+    s_dilated_map = (float *)malloc (hmp_size * sizeof (float));
+    s_line_g      = (float *)malloc (line_len * sizeof (float));
+    s_line_h      = (float *)malloc (line_len * sizeof (float));
+    s_center_idx  = (int   *)malloc (hmp_size * sizeof (int));
+    if (!s_belief_buf || !s_dilate_tmp || !s_dilated_map || !s_line_g || !s_line_h || !s_center_idx)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -97,107 +134,102 @@ get_objectron_input_buf (int *w, int *h)
 /* -------------------------------------------------- *
  * Invoke TensorFlow Lite (3D Object detection)
  * -------------------------------------------------- */
-static float
-get_heatmap_val (int x, int y)
+static void
+compute_belief_map ()
 {
-    int hmp_w = s_detect_tensor_heatmap.dims[2];
     float *heatmap = (float *)s_detect_tensor_heatmap.ptr;
 
-    float val = heatmap[hmp_w * y + x];
-
     if (s_need_post_logistic)
     {
-        const float cutoff_upper = 16.619047164916992188f;
-        const float cutoff_lower = -9.f;
-
-        if (val > cutoff_upper)
-            val = 1.0f;
-        else if (val < cutoff_lower)
-            val = std::exp(val);
-        else
-            val = 1.f / (1.f + std::exp(-val));
+        vsigmoid (heatmap, s_belief_buf, s_hmp_w * s_hmp_h);
+        s_belief_map = s_belief_buf;
+    }
+    else
+    {
+        s_belief_map = heatmap;
     }
+}
 
-    return val;
+static inline float
+get_heatmap_val (int x, int y)
+{
+    return s_belief_map[s_hmp_w * y + x];
 }
 
-static float
-get_max_value (int cx, int cy, int hmp_w, int hmp_h, int kern_size)
+/*
+ *  1D MAX filter of radius (rad) by van Herk/Gil-Werman: 3 compares per pixel
+ *  regardless of the kernel size.
+ *  out of range pixels and negative values count as 0, as the brute force kernel
+ *  started from (max_val = 0).
+ */
+static void
+max_filter_1d (const float *src, int src_stride, float *dst, int dst_stride, int num, int rad)
 {
-    int sx = cx - (kern_size / 2);
-    int ex = cx + (kern_size / 2) + 1;
-    int sy = cy - (kern_size / 2);
-    int ey = cy + (kern_size / 2) + 1;
-
-    sx = std::max (sx, 0);
-    ex = std::min (ex, hmp_w);
-    sy = std::max (sy, 0);
-    ey = std::min (ey, hmp_h);
-
-    float max_val = 0;
-    for (int y = sy; y < ey; y ++)
+    float *g = s_line_g;
+    float *h = s_line_h;
+    int kern = 2 * rad + 1;
+    int len  = ((num + 2 * rad + kern - 1) / kern) * kern;
+
+    for (int i = 0; i < len; i ++)
     {
-        for (int x = sx; x < ex; x ++)
-        {
-            float val = get_heatmap_val (x, y);
-            max_val = std::max (val, max_val);
-        }
+        int j = i - rad;
+        h[i] = (j >= 0 && j < num) ? std::max (src[j * src_stride], 0.0f) : 0.0f;
+    }
+
+    for (int blk = 0; blk < len; blk += kern)
+    {
+        g[blk] = h[blk];
+        for (int i = blk + 1; i < blk + kern; i ++)
+            g[i] = std::max (g[i - 1], h[i]);
+
+        for (int i = blk + kern - 2; i >= blk; i --)
+            h[i] = std::max (h[i + 1], h[i]);
     }
 
-    return max_val;
+    for (int i = 0; i < num; i ++)
+        dst[i * dst_stride] = std::max (h[i], g[i + kern - 1]);
 }
 
 static void
-dilate_heatmap (float *dst_hmp, int hmp_w, int hmp_h, int kern_size)
+dilate_heatmap (float *dst_hmp, int hmp_w, int hmp_h, int rad)
 {
     for (int y = 0; y < hmp_h; y ++)
-    {
-        for (int x = 0; x < hmp_w; x ++)
-        {
-            dst_hmp[hmp_w * y + x] = get_max_value (x, y, hmp_w, hmp_h, kern_size);
-        }
-    }
+        max_filter_1d (&s_belief_map[hmp_w * y], 1, &s_dilate_tmp[hmp_w * y], 1, hmp_w, rad);
+
+    for (int x = 0; x < hmp_w; x ++)
+        max_filter_1d (&s_dilate_tmp[x], hmp_w, &dst_hmp[x], hmp_w, hmp_h, rad);
 }
 
-static void
-extract_center_keypoints (std::list<fvec2> &center_points)
+static int
+extract_center_keypoints (int *center_idx)
 {
-    int hmp_w = s_detect_tensor_heatmap.dims[2];
-    int hmp_h = s_detect_tensor_heatmap.dims[1];
-
-    float *max_filtered_heatmap = (float *)malloc (hmp_w * hmp_h * sizeof (float));
+    int hmp_w = s_hmp_w;
+    int hmp_h = s_hmp_h;
 
     /* apply (5x5) MAX filter */
-    int local_max_distance = 2;
-    int kernel_size = static_cast<int>(local_max_distance * 2 + 1 + 0.5f);
-    dilate_heatmap (max_filtered_heatmap, hmp_w, hmp_h, kernel_size);
+    dilate_heatmap (s_dilated_map, hmp_w, hmp_h, LOCAL_MAX_DISTANCE);
 
+    int num_centers = 0;
     float heatmap_threshold = 0.6f;
-    for (int y = 0; y < hmp_h; y ++)
+    for (int i = 0; i < hmp_w * hmp_h; i ++)
     {
-        for (int x = 0; x < hmp_w; x ++)
-        {
-            float center_hmp_val = get_heatmap_val (x, y);
-            float max_hmp_val    = max_filtered_heatmap[hmp_w * y + x];
+        float center_hmp_val = s_belief_map[i];
+        float max_hmp_val    = s_dilated_map[i];
 
-            if ((center_hmp_val >= heatmap_threshold) &&
-                (center_hmp_val >= max_hmp_val))
-            {
-                fvec2 locations;
-                locations.x = x;
-                locations.y = y;
-                center_points.push_back (locations);
-            }
+        if ((center_hmp_val >= heatmap_threshold) &&
+            (center_hmp_val >= max_hmp_val))
+        {
+            center_idx[num_centers ++] = i;
         }
     }
 
-    free (max_filtered_heatmap);
+    return num_centers;
 }
 
 /*
  *  (cx, cy): Tile id. (cx: 0-30), (cy: 0-40)
  */
-void
+static void
 decode_by_voting (int cx, int cy, float offset_scale_x, float offset_scale_y, object_t *obj)
 {
     float *offsetmap = (float *)s_detect_tensor_offsetmap.ptr;
@@ -206,7 +238,7 @@ decode_by_voting (int cx, int cy, float offset_scale_x, float offset_scale_y, ob
     float *center_offset = &offsetmap[16 * ((cy * map_w) + cx)];
 
     /* transform BBOX offsetmap. (relative offset) --> (absolute offset) */
-    float *center_votes = (float *)malloc (16 * map_w * map_h * sizeof (float));
+    float center_votes[16];
     for (int i = 0; i < 8; i ++)
     {
         center_votes[2 * i    ] = cx + center_offset[2 * i    ] * offset_scale_x;
@@ -259,8 +291,6 @@ decode_by_voting (int cx, int cy, float offset_scale_x, float offset_scale_y, ob
         obj->bbox[i].x = x_sum / votes;
         obj->bbox[i].y = y_sum / votes;
     }
-
-    free (center_votes);
 }
 
 
@@ -281,11 +311,16 @@ IsIdentical (const object_t& box_1, const object_t& box_2)
 }
 
 
+/*
+ *  compared in the tile space. the boxes are normalized after all the
+ *  duplicates are eliminated.
+ */
 static bool
-IsNewBox (std::list<object_t> *obj_list, object_t *obj_item)
+IsNewBox (object_t *obj_list, int num_obj, object_t *obj_item)
 {
-    for (auto& b : *obj_list)
+    for (int i = 0; i < num_obj; i ++)
     {
+        object_t &b = obj_list[i];
         if (IsIdentical (b, *obj_item))
         {
             if (b.belief < obj_item->belief)
@@ -300,6 +335,11 @@ IsNewBox (std::list<object_t> *obj_list, object_t *obj_item)
 
 
 
+/*
+ *  The (16x12) EPnP matrix m has only 4 non-zero entries per row, so (m^T * m)
+ *  is built directly from the (4x4) gram matrices of the control point weights
+ *  instead of the dense (12x16)*(16x12) product.
+ */
 static int
 Lift2DTo3D(
     const Eigen::Matrix<float, 4, 4, Eigen::RowMajor>& projection_matrix,
@@ -310,7 +350,9 @@ Lift2DTo3D(
     const float cx = projection_matrix(0, 2);
     const float cy = projection_matrix(1, 2);
 
-    Eigen::Matrix<float, 16, 12, Eigen::RowMajor> m = Eigen::Matrix<float, 16, 12, Eigen::RowMajor>::Zero(16, 12);
+    Eigen::Matrix<float, 4, 4, Eigen::RowMajor> gram_u = Eigen::Matrix<float, 4, 4, Eigen::RowMajor>::Zero();
+    Eigen::Matrix<float, 4, 4, Eigen::RowMajor> gram_v = Eigen::Matrix<float, 4, 4, Eigen::RowMajor>::Zero();
+    Eigen::Matrix<float, 4, 4, Eigen::RowMajor> gram_w = Eigen::Matrix<float, 4, 4, Eigen::RowMajor>::Zero();
 
     float u, v;
     for (int i = 0; i < 8; ++i)
@@ -326,22 +368,35 @@ Lift2DTo3D(
             u = keypoint2d.x * 2 - 1;
             v = 1 - keypoint2d.y * 2;  // (1 - keypoint2d.y()) * 2 - 1
         }
-        
-        for (int j = 0; j < 4; ++j)
+
+        // rows (2i, 2i+1) of m are (fx, 0, cx + u) and (0, fy, cy + v),
+        // each weighted by the 4 control point alphas.
+        const float cu = cx + u;
+        const float cv = cy + v;
+        Eigen::Matrix<float, 4, 4, Eigen::RowMajor> aa =
+            epnp_alpha_.row(i).transpose() * epnp_alpha_.row(i);
+        gram_u += cu * aa;
+        gram_v += cv * aa;
+        gram_w += (cu * cu + cv * cv) * aa;
+    }
+
+    Eigen::Matrix<float, 12, 12, Eigen::RowMajor> mt_m = Eigen::Matrix<float, 12, 12, Eigen::RowMajor>::Zero();
+    for (int j = 0; j < 4; ++j)
+    {
+        for (int l = 0; l < 4; ++l)
         {
-            // For each of the 4 control points, formulate two rows of the
-            // m matrix (two equations).
-            const float control_alpha = epnp_alpha_(i, j);
-            m(i * 2,     j * 3    ) =       fx * control_alpha;
-            m(i * 2,     j * 3 + 2) = (cx + u) * control_alpha;
-            m(i * 2 + 1, j * 3 + 1) =       fy * control_alpha;
-            m(i * 2 + 1, j * 3 + 2) = (cy + v) * control_alpha;
+            mt_m(j * 3,     l * 3    ) = fx * fx * epnp_alpha_gram_(j, l);
+            mt_m(j * 3,     l * 3 + 2) = fx * gram_u(j, l);
+            mt_m(j * 3 + 1, l * 3 + 1) = fy * fy * epnp_alpha_gram_(j, l);
+            mt_m(j * 3 + 1, l * 3 + 2) = fy * gram_v(j, l);
+            mt_m(j * 3 + 2, l * 3    ) = fx * gram_u(j, l);
+            mt_m(j * 3 + 2, l * 3 + 1) = fy * gram_v(j, l);
+            mt_m(j * 3 + 2, l * 3 + 2) = gram_w(j, l);
         }
     }
 
     // This is a self adjoint matrix. Use SelfAdjointEigenSolver for a fast
     // and stable solution.
-    Eigen::Matrix<float, 12, 12, Eigen::RowMajor> mt_m = m.transpose() * m;
     Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 12, 12, Eigen::RowMajor>> eigen_solver(mt_m);
     if (eigen_solver.info() != Eigen::Success)
     {
@@ -418,22 +473,14 @@ Project3DTo2D (bool portrait, object_t *object)
 
 
 
+/* lift all the boxes of the frame to 3D. one job per box. */
 static void
-pack_objectron_result (objectron_result_t *objectron_result, std::list<object_t> &bbox_list)
+lift_object_job (void *arg, int idx)
 {
-    int num_obj = 0;
-    for (auto itr = bbox_list.begin(); itr != bbox_list.end(); itr ++)
-    {
-        object_t obj_item = *itr;
-
-        memcpy (&objectron_result->objects[num_obj], &obj_item, sizeof (obj_item));
-
-        num_obj++;
-        objectron_result->num = num_obj;
+    object_t *obj = &((object_t *)arg)[idx];
 
-        if (num_obj >= MAX_OBJECT_NUM)
-            break;
-    }
+    Lift2DTo3D (projection_matrix_, /*portrait*/ true, obj);
+    Project3DTo2D (/*portrait*/ true, obj);
 }
 
 
@@ -459,40 +506,98 @@ invoke_objectron (objectron_result_t *objectron_result)
     float offset_scaley = ofstmap_h;
 #endif
 
-    std::list<fvec2> center_points;
-    extract_center_keypoints (center_points);
+    compute_belief_map ();
+
+    int num_centers = extract_center_keypoints (s_center_idx);
 
-    std::list<object_t> obj_list;
-    for (auto &center_point : center_points)
+    object_t *objects = objectron_result->objects;
+    int num_obj = 0;
+    for (int n = 0; n < num_centers; n ++)
     {
-        int cx = static_cast<int>(std::round(center_point.x));
-        int cy = static_cast<int>(std::round(center_point.y));
+        int cx = s_center_idx[n] % s_hmp_w;
+        int cy = s_center_idx[n] / s_hmp_w;
         object_t obj_item = {0};
 
         obj_item.belief = get_heatmap_val (cx, cy);
         decode_by_voting (cx, cy, offset_scalex, offset_scaley, &obj_item);
 
+        obj_item.center_x = cx / (float)ofstmap_w;
+        obj_item.center_y = cy / (float)ofstmap_h;
+
         /* eliminate duplicate bbox */
-        if (!IsNewBox (&obj_list, &obj_item))
+        if (!IsNewBox (objects, num_obj, &obj_item))
         {
             continue;
         }
 
+        if (num_obj < MAX_OBJECT_NUM)
+            objects[num_obj ++] = obj_item;
+    }
+
+    for (int n = 0; n < num_obj; n ++)
+    {
         for (int i = 0; i < 8; i ++)
         {
-            obj_item.bbox[i].x /= offset_scalex;
-            obj_item.bbox[i].y /= offset_scaley;
+            objects[n].bbox[i].x /= offset_scalex;
+            objects[n].bbox[i].y /= offset_scaley;
         }
+    }
+
+    run_worker_jobs (lift_object_job, objects, num_obj);
 
-        Lift2DTo3D (projection_matrix_, /*portrait*/ true, &obj_item);
-        Project3DTo2D (/*portrait*/ true, &obj_item);
+    objectron_result->num = num_obj;
+
+    return 0;
+}
 
-        obj_item.center_x = center_point.x / (float)ofstmap_w;
-        obj_item.center_y = center_point.y / (float)ofstmap_h;
-        obj_list.push_back (obj_item);
+
+/* -------------------------------------------------- *
+ *  Keypoint filter
+ * -------------------------------------------------- */
+static landmark_filter_t    s_filter;
+
+int
+set_objectron_filter (int filter_type)
+{
+    return set_landmark_filter (&s_filter, filter_type, 9 * 2);
+}
+
+/* the center and the 8 vertices of the projected box. */
+void
+filter_objectron_result (objectron_result_t *objectron_result, double time_ms)
+{
+    float keys[MAX_OBJECT_NUM][9 * 2];
+    object_t *objects = objectron_result->objects;
+    int num_obj = objectron_result->num;
+
+    if (!is_landmark_filter_enabled (&s_filter))
+        return;
+
+    for (int n = 0; n < num_obj; n ++)
+    {
+        keys[n][0] = objects[n].center_x;
+        keys[n][1] = objects[n].center_y;
+        for (int i = 0; i < 8; i ++)
+        {
+            keys[n][2 * i + 2] = objects[n].bbox[i].x;
+            keys[n][2 * i + 3] = objects[n].bbox[i].y;
+        }
     }
 
-    pack_objectron_result (objectron_result, obj_list);
+    /* the center is inside the box of the vertices. */
+    filter_landmark_points (&s_filter, &keys[0][0], num_obj, 9, 2, NULL, time_ms);
 
-    return 0;
+    for (int n = 0; n < num_obj; n ++)
+    {
+        objects[n].center_x = keys[n][0];
+        objects[n].center_y = keys[n][1];
+        for (int i = 0; i < 8; i ++)
+        {
+            objects[n].bbox[i].x = keys[n][2 * i + 2];
+            objects[n].bbox[i].y = keys[n][2 * i + 3];
+        }
+    }
+
+    /* the 3D box from the filtered 2D box */
+    run_worker_jobs (lift_object_job, objects, num_obj);
 }
@@ -46,6 +46,10 @@ int  init_tflite_objectron (int use_quantized_tflite);
 void *get_objectron_input_buf (int *w, int *h);
 int  invoke_objectron (objectron_result_t *objectron_result);
 
+/* temporal filter of the 2D keypoints (enum landmark_filter_type, 0: off). the 3D box is lifted again. */
+int  set_objectron_filter (int filter_type);
+void filter_objectron_result (objectron_result_t *objectron_result, double time_ms);
+
 #ifdef __cplusplus
 }
 #endif
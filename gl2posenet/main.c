@@ -4,6 +4,7 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <float.h>
@@ -13,6 +14,10 @@
 #include "util_pmeter.h"
 #include "util_texture.h"
 #include "util_render2d.h"
+#include "util_async_infer.h"
+#include "util_point_predict.h"
+#include "util_landmark_filter.h"
+#include "util_qos.h"
 #include "tflite_posenet.h"
 #include "ssbo_tensor.h"
 #include "camera_capture.h"
@@ -357,6 +362,52 @@ render_posenet_heatmap (int ofstx, int ofsty, int draw_w, int draw_h, posenet_re
 }
 
 
+/* -------------------------------------------------- *
+ *  asynchronous inference:
+ *    the keypoints of the last result are extrapolated to the display time.
+ * -------------------------------------------------- */
+static int
+posenet_job (void *arg)
+{
+    return invoke_posenet ((posenet_result_t *)arg);
+}
+
+static void
+update_pose_predictor (point_predictor_t *pp, posenet_result_t *pose_ret, double time_ms)
+{
+    float values[MAX_POSE_NUM][kPoseKeyNum * 2];
+
+    for (int i = 0; i < pose_ret->num; i ++)
+    {
+        for (int j = 0; j < kPoseKeyNum; j ++)
+        {
+            values[i][2 * j + 0] = pose_ret->pose[i].key[j].x;
+            values[i][2 * j + 1] = pose_ret->pose[i].key[j].y;
+        }
+    }
+    update_point_predictor (pp, &values[0][0], NULL, pose_ret->num, time_ms, NULL);
+}
+
+static void
+predict_pose (point_predictor_t *pp, posenet_result_t *pose_last, double time_ms, posenet_result_t *pose_ret)
+{
+    /* the tracks are in the order of the last result. */
+    *pose_ret = *pose_last;
+
+    for (int i = 0; i < pp->num_tracks; i ++)
+    {
+        float values[kPoseKeyNum * 2];
+        predict_point_track (pp, i, time_ms, values);
+
+        for (int j = 0; j < kPoseKeyNum; j ++)
+        {
+            pose_ret->pose[i].key[j].x = values[2 * j + 0];
+            pose_ret->pose[i].key[j].y = values[2 * j + 1];
+        }
+    }
+}
+
+
 /* Adjust the texture size to fit the window size
  *
  *                      Portrait
@@ -401,6 +452,45 @@ adjust_texture (int win_w, int win_h, int texw, int texh,
 }
 
 
+/* -------------------------------------------------- *
+ *  QoS knobs (in the order to degrade)
+ *    1. inference interval: the model runs every Nth frame.
+ *    2. max poses         : MAX_POSE_NUM ==> 3 ==> 1
+ * -------------------------------------------------- */
+typedef struct _qos_state_t
+{
+    int infer_interval;
+} qos_state_t;
+
+static int s_qos_max_poses[] = {MAX_POSE_NUM, 3, 1};
+
+static int
+qos_set_infer_interval (void *arg, int level)
+{
+    qos_state_t *qs = (qos_state_t *)arg;
+    qs->infer_interval = level + 1;
+    return 0;
+}
+
+static int
+qos_set_max_poses (void *arg, int level)
+{
+    UNUSED (arg);
+    return set_posenet_max_poses (s_qos_max_poses[level]);
+}
+
+static void
+init_posenet_qos (qos_ctrl_t *qc, qos_state_t *qs, double target_ms)
+{
+    qs->infer_interval = 1;
+
+    init_qos_ctrl (qc, target_ms);
+    add_qos_knob (qc, "infer_int", 2, qos_set_infer_interval, qs);
+    add_qos_knob (qc, "max_poses", 2, qos_set_max_poses,      qs);
+    add_qos_stage (qc, "posenet");
+}
+
+
 /*--------------------------------------------------------------------------- *
  *      M A I N    F U N C T I O N
  *--------------------------------------------------------------------------- */
@@ -419,6 +509,15 @@ main(int argc, char *argv[])
     double ttime[10] = {0}, interval, invoke_ms;
     int use_quantized_tflite = 0;
     int enable_camera = 1;
+    int enable_async = 0;
+    int filter_type = LANDMARK_FILTER_NONE;
+    float qos_target_ms = 0.0f;
+    qos_ctrl_t  qos_ctrl;
+    qos_state_t qos_state;
+    posenet_result_t  pose_job = {0};   /* written by the inference thread */
+    posenet_result_t  pose_last = {0};
+    point_predictor_t pose_predictor;
+    double job_time = 0;
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
@@ -427,15 +526,26 @@ main(int argc, char *argv[])
 
     {
         int c;
-        const char *optstring = "qv:x";
+        const char *optstring = "af:qt:v:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1)
         {
             switch (c)
             {
+            case 'a':
+                enable_async = 1;
+                break;
+            case 'f':
+                filter_type = parse_landmark_filter_type (optarg);
+                if (filter_type < 0)
+                    return -1;
+                break;
             case 'q':
                 use_quantized_tflite = 1;
                 break;
+            case 't':
+                qos_target_ms = atof (optarg);
+                break;
 #if defined (USE_INPUT_VIDEO_DECODE)
             case 'v':
                 enable_video = 1;
@@ -469,6 +579,30 @@ main(int argc, char *argv[])
 #endif
 
     init_tflite_posenet (use_quantized_tflite, ssbo);
+    set_posenet_filter (filter_type);
+
+#if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2) || defined (USE_INPUT_SSBO)
+    if (enable_async)
+    {
+        fprintf (stderr, "the GPU delegate needs the GL context. async inference disabled.\n");
+        enable_async = 0;
+    }
+#endif
+    if (enable_async)
+    {
+        init_async_infer ();
+        init_point_predictor (&pose_predictor, kPoseKeyNum * 2, 1.0f, 0.1f);
+    }
+
+    if (enable_async && qos_target_ms > 0.0f)
+    {
+        fprintf (stderr, "the frame rate doesn't wait for the inference. QoS disabled.\n");
+        qos_target_ms = 0.0f;
+    }
+    if (qos_target_ms > 0.0f)
+    {
+        init_posenet_qos (&qos_ctrl, &qos_state, qos_target_ms);
+    }
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the context */
@@ -540,13 +674,56 @@ main(int argc, char *argv[])
         }
 #endif
 
-        /* invoke pose estimation using TensorflowLite */
-        feed_posenet_image (&captex, ssbo, win_w, win_h);
+        if (enable_async)
+        {
+            /* the inference runs on its own thread at its own rate. */
+            int state = poll_async_infer ();
+            if (state == ASYNC_INFER_DONE)
+            {
+                pose_last = pose_job;
+                filter_posenet_result (&pose_last, job_time);
+                update_pose_predictor (&pose_predictor, &pose_last, job_time);
+            }
+            if (state != ASYNC_INFER_BUSY)
+            {
+                feed_posenet_image (&captex, ssbo, win_w, win_h);
+                job_time = ttime[1];    /* the time the frame was captured */
+                submit_async_infer (posenet_job, &pose_job);
+            }
+
+            predict_pose (&pose_predictor, &pose_last, pmeter_get_time_ms (), &pose_ret);
+
+            async_infer_stats_t astats;
+            get_async_infer_stats (&astats);
+            invoke_ms = astats.invoke_ms;
+        }
+        else if (qos_target_ms > 0.0f && (count % qos_state.infer_interval) != 0)
+        {
+            /* QoS: reuse the last result on this frame. */
+            pose_ret  = pose_last;
+            invoke_ms = 0;
+        }
+        else
+        {
+            /* invoke pose estimation using TensorflowLite */
+            feed_posenet_image (&captex, ssbo, win_w, win_h);
+
+            ttime[2] = pmeter_get_time_ms ();
+            invoke_posenet (&pose_ret);
+            ttime[3] = pmeter_get_time_ms ();
+            invoke_ms = ttime[3] - ttime[2];
+
+            filter_posenet_result (&pose_ret, ttime[1]);
 
-        ttime[2] = pmeter_get_time_ms ();
-        invoke_posenet (&pose_ret);
-        ttime[3] = pmeter_get_time_ms ();
-        invoke_ms = ttime[3] - ttime[2];
+            if (qos_target_ms > 0.0f)
+                pose_last = pose_ret;
+        }
+
+        if (qos_target_ms > 0.0f && count > 0)
+        {
+            double stage_ms[] = {invoke_ms};
+            update_qos_ctrl (&qos_ctrl, interval, stage_ms);
+        }
 
         glClear (GL_COLOR_BUFFER_BIT);
 
@@ -565,6 +742,19 @@ main(int argc, char *argv[])
         draw_pmeter (0, 40);
 
         sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite  :%5.1f [ms]", interval, invoke_ms);
+        if (enable_async)
+        {
+            async_infer_stats_t astats;
+            get_async_infer_stats (&astats);
+            sprintf (strbuf + strlen (strbuf), "\nInfer   :%5.1f [fps]", astats.infer_fps);
+        }
+        if (qos_target_ms > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nQoS     :%5.1f/%.1f [ms] L(", qos_ctrl.frame_ms, qos_target_ms);
+            for (int i = 0; i < qos_ctrl.num_knobs; i ++)
+                sprintf (strbuf + strlen (strbuf), "%s%d", i ? "," : "", get_qos_knob_level (&qos_ctrl, i));
+            strcat (strbuf, ")");
+        }
         draw_dbgstr (strbuf, 10, 10);
 
         egl_swap();
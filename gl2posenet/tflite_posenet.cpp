@@ -4,8 +4,10 @@
  * ------------------------------------------------ */
 #include "util_tflite.h"
 #include "tflite_posenet.h"
+#include "util_worker.h"
 #include "ssbo_tensor.h"
-#include <list>
+#include "util_landmark_filter.h"
+#include <algorithm>
 #include <float.h>
 
 /* 
@@ -21,6 +23,8 @@
 //#define POSENET_QUANT_MODEL_PATH  "./posenet_model/posenet_mobilenet_v1_100_257x257_multi_kpt_stripped_integer_quant.tflite"
 #define POSENET_QUANT_MODEL_PATH    "./posenet_model/model-mobilenet_v1_101_257_integer_quant.tflite"
 
+#define KEYPOINT_SCORE_THRESH       0.5f    /* of the root parts, and of the keypoints to filter */
+
 static tflite_interpreter_t s_interpreter;
 static tflite_tensor_t      s_tensor_input;
 static tflite_tensor_t      s_tensor_heatmap;
@@ -48,6 +52,12 @@ typedef struct keypoint_t {
     int   valid;
 } keypoint_t;
 
+/* work buffers of the multi pose decoder, allocated in init_tflite_posenet() */
+static float        *s_row_max;         /* [hmp_h][hmp_w][kPoseKeyNum] horizontal max filter  */
+static float        *s_local_max;       /* [hmp_h][hmp_w][kPoseKeyNum] max in the local window */
+static part_score_t *s_part_queue;      /* binary heap of the root part candidates */
+static int          s_part_queue_num;
+
 
 static int pose_edges[][2] =
 {
@@ -110,6 +120,11 @@ init_tflite_posenet(int use_quantized_tflite, ssbo_t *ssbo)
     /* displacement forward vector dimention */
     s_edge_num = s_tensor_fw_disp.dims[3] / 2;
 
+    int num_parts = s_hmp_w * s_hmp_h * kPoseKeyNum;
+    s_row_max    = (float *)malloc (num_parts * sizeof (float));
+    s_local_max  = (float *)malloc (num_parts * sizeof (float));
+    s_part_queue = (part_score_t *)malloc (num_parts * sizeof (part_score_t));
+
     return 0;
 }
 
@@ -151,27 +166,38 @@ get_offset_vector (float *ofst_x, float *ofst_y, int idx_y, int idx_x, int pose_
     *ofst_y = offsets_ptr[idx1];
 }
 
-/* enqueue an item in descending order. */
-static void
-enqueue_score (std::list<part_score_t> &queue, int x, int y, int key, float score)
+/*
+ *  priority of the part queue: higher score first. for the same score, the
+ *  part found first in the (y, x, key) scan order comes first.
+ */
+static bool
+part_score_less (const part_score_t &a, const part_score_t &b)
 {
-    std::list<part_score_t>::iterator itr;
-    for (itr = queue.begin(); itr != queue.end(); itr++)
-    {
-        if (itr->score < score)
-            break;
-    }
+    if (a.score != b.score)
+        return a.score < b.score;
+    if (a.idx_y != b.idx_y)
+        return a.idx_y > b.idx_y;
+    if (a.idx_x != b.idx_x)
+        return a.idx_x > b.idx_x;
+    return a.key_id > b.key_id;
+}
 
-    part_score_t item;
-    item.score = score;
-    item.idx_x = x;
-    item.idx_y = y;
-    item.key_id= key;
-    queue.insert(itr, item);
+static bool
+dequeue_score (part_score_t *part)
+{
+    if (s_part_queue_num <= 0)
+        return false;
+
+    std::pop_heap (s_part_queue, s_part_queue + s_part_queue_num, part_score_less);
+    s_part_queue_num --;
+    *part = s_part_queue[s_part_queue_num];
+    return true;
 }
 
 /*
- * If the score is the highest in local window, return true.
+ *  max of the local window around each pixel, for all the keys at once.
+ *  the (2 * max_rad + 1)^2 window is separated into a horizontal and a
+ *  vertical pass.
  *
  *    xs    xe
  *   +--+--+--+
@@ -182,49 +208,90 @@ enqueue_score (std::list<part_score_t> &queue, int x, int y, int key, float scor
  *   |  |  |  | ye
  *   +--+--+--+
  */
-static bool
-score_is_max_in_local_window (int key, float score, int idx_y, int idx_x, int max_rad)
+static void
+compute_local_max (int max_rad)
 {
-    int xs = std::max (idx_x - max_rad,     0);
-    int ys = std::max (idx_y - max_rad,     0);
-    int xe = std::min (idx_x + max_rad + 1, s_hmp_w);
-    int ye = std::min (idx_y + max_rad + 1, s_hmp_h);
+    float *heatmap_ptr = (float *)s_tensor_heatmap.ptr;
+    int stride_x = kPoseKeyNum;
+    int stride_y = kPoseKeyNum * s_hmp_w;
 
-    for (int y = ys; y < ye; y ++)
+    for (int y = 0; y < s_hmp_h; y ++)
     {
-        for (int x = xs; x < xe; x ++)
+        for (int x = 0; x < s_hmp_w; x ++)
         {
-            /* if a higher score is found, return false */
-            if (get_heatmap_score (y, x, key) > score)
-                return false;
+            int xs = std::max (x - max_rad,     0);
+            int xe = std::min (x + max_rad + 1, s_hmp_w);
+            float *src = &heatmap_ptr[y * stride_y + xs * stride_x];
+            float *dst = &s_row_max  [y * stride_y + x  * stride_x];
+
+            memcpy (dst, src, kPoseKeyNum * sizeof (float));
+            for (int i = xs + 1; i < xe; i ++)
+            {
+                src += stride_x;
+                for (int key = 0; key < kPoseKeyNum; key ++)
+                    dst[key] = std::max (dst[key], src[key]);
+            }
+        }
+    }
+
+    for (int y = 0; y < s_hmp_h; y ++)
+    {
+        int ys = std::max (y - max_rad,     0);
+        int ye = std::min (y + max_rad + 1, s_hmp_h);
+
+        for (int x = 0; x < s_hmp_w; x ++)
+        {
+            float *src = &s_row_max  [ys * stride_y + x * stride_x];
+            float *dst = &s_local_max[y  * stride_y + x * stride_x];
+
+            memcpy (dst, src, kPoseKeyNum * sizeof (float));
+            for (int i = ys + 1; i < ye; i ++)
+            {
+                src += stride_y;
+                for (int key = 0; key < kPoseKeyNum; key ++)
+                    dst[key] = std::max (dst[key], src[key]);
+            }
         }
     }
-    return true;
 }
 
 static void
-build_score_queue (std::list<part_score_t> &queue, float thresh, int max_rad)
+build_score_queue (float thresh, int max_rad)
 {
+    float *heatmap_ptr = (float *)s_tensor_heatmap.ptr;
+    int num = 0;
+
+    compute_local_max (max_rad);
+
     for (int y = 0; y < s_hmp_h; y ++)
     {
         for (int x = 0; x < s_hmp_w; x ++)
         {
+            int idx = (y * s_hmp_w * kPoseKeyNum) + (x * kPoseKeyNum);
+
             for (int key = 0; key < kPoseKeyNum; key ++)
             {
-                float score = get_heatmap_score (y, x, key);
+                float score = heatmap_ptr[idx + key];
 
                 /* if this score is lower than thresh, skip this pixel. */
                 if (score < thresh)
                     continue;
 
                 /* if there is a higher score near this pixel, skip this pixel. */
-                if (!score_is_max_in_local_window (key, score, y, x, max_rad))
+                if (score < s_local_max[idx + key])
                     continue;
 
-                enqueue_score (queue, x, y, key, score);
+                part_score_t *item = &s_part_queue[num ++];
+                item->score = score;
+                item->idx_x = x;
+                item->idx_y = y;
+                item->key_id= key;
             }
         }
     }
+
+    s_part_queue_num = num;
+    std::make_heap (s_part_queue, s_part_queue + num, part_score_less);
 }
 
 /*
@@ -407,37 +474,85 @@ regist_detected_pose (posenet_result_t *pose_result, keypoint_t *keys, float sco
 }
 
 
+/* the number of poses to decode (<= MAX_POSE_NUM) */
+static int s_max_pose_num = MAX_POSE_NUM;
+
+int
+set_posenet_max_poses (int max_poses)
+{
+    if (max_poses < 1 || max_poses > MAX_POSE_NUM)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    s_max_pose_num = max_poses;
+    return 0;
+}
+
+
+typedef struct pose_decode_job_t {
+    part_score_t *roots;
+    keypoint_t   (*keys)[kPoseKeyNum];
+} pose_decode_job_t;
+
 static void
-decode_multiple_poses (posenet_result_t *pose_result)
+decode_pose_job (void *arg, int idx)
 {
-    std::list<part_score_t> queue;
+    pose_decode_job_t *job = (pose_decode_job_t *)arg;
+
+    memset (job->keys[idx], 0, sizeof (job->keys[idx]));
+    decode_pose (job->roots[idx], job->keys[idx]);
+}
 
-    float score_thresh  = 0.5f;
+/*
+ *  the root parts are taken from the queue in batches. the poses of a batch
+ *  are decoded in parallel, then accepted one by one in the queue order,
+ *  so the result is the same as decoding them one at a time.
+ */
+static void
+decode_multiple_poses (posenet_result_t *pose_result)
+{
     int   local_max_rad = 1;
-    build_score_queue (queue, score_thresh, local_max_rad);
+    build_score_queue (KEYPOINT_SCORE_THRESH, local_max_rad);
+
+    part_score_t roots[MAX_POSE_NUM];
+    keypoint_t   key_points[MAX_POSE_NUM][kPoseKeyNum];
+    pose_decode_job_t job = {roots, key_points};
+
+    float nms_rad = 20.0f;
 
     memset (pose_result, 0, sizeof (posenet_result_t));
-    while (pose_result->num < MAX_POSE_NUM && !queue.empty())
+    while (pose_result->num < s_max_pose_num && s_part_queue_num > 0)
     {
-        part_score_t &root = queue.front();
+        /* at most one root per remaining pose slot. skip the suppressed ones. */
+        int num_roots = 0;
+        part_score_t root;
+        while (num_roots < s_max_pose_num - pose_result->num && dequeue_score (&root))
+        {
+            float pos_x, pos_y;
+            get_index_to_pos (root.idx_x, root.idx_y, root.key_id, &pos_x, &pos_y);
 
-        float pos_x, pos_y;
-        get_index_to_pos (root.idx_x, root.idx_y, root.key_id, &pos_x, &pos_y);
+            if (within_nms_of_corresponding_point (pose_result, pos_x, pos_y, root.key_id, nms_rad))
+                continue;
 
-        float nms_rad = 20.0f;
-        if (within_nms_of_corresponding_point (pose_result, pos_x, pos_y, root.key_id, nms_rad))
-        {
-            queue.pop_front();
-            continue;
+            roots[num_roots ++] = root;
         }
 
-        keypoint_t key_points[kPoseKeyNum] = {0};
-        decode_pose (root, key_points);
+        run_worker_jobs (decode_pose_job, &job, num_roots);
+
+        for (int i = 0; i < num_roots; i ++)
+        {
+            /* check again against the poses accepted in this batch. */
+            float pos_x, pos_y;
+            get_index_to_pos (roots[i].idx_x, roots[i].idx_y, roots[i].key_id, &pos_x, &pos_y);
 
-        float score = get_instance_score (pose_result, key_points, nms_rad);
-        regist_detected_pose (pose_result, key_points, score);
+            if (within_nms_of_corresponding_point (pose_result, pos_x, pos_y, roots[i].key_id, nms_rad))
+                continue;
 
-        queue.pop_front();
+            float score = get_instance_score (pose_result, key_points[i], nms_rad);
+            regist_detected_pose (pose_result, key_points[i], score);
+        }
     }
 }
 
@@ -530,3 +645,47 @@ invoke_posenet (posenet_result_t *pose_result)
     return 0;
 }
 
+
+/* -------------------------------------------------- *
+ *  Keypoint filter
+ * -------------------------------------------------- */
+static landmark_filter_t    s_filter;
+
+int
+set_posenet_filter (int filter_type)
+{
+    return set_landmark_filter (&s_filter, filter_type, kPoseKeyNum * 2);
+}
+
+void
+filter_posenet_result (posenet_result_t *pose_result, double time_ms)
+{
+    float keys[MAX_POSE_NUM][kPoseKeyNum * 2];
+    unsigned char valid[MAX_POSE_NUM][kPoseKeyNum];
+
+    if (!is_landmark_filter_enabled (&s_filter))
+        return;
+
+    for (int i = 0; i < pose_result->num; i ++)
+    {
+        for (int j = 0; j < kPoseKeyNum; j ++)
+        {
+            keys[i][2 * j + 0] = pose_result->pose[i].key[j].x;
+            keys[i][2 * j + 1] = pose_result->pose[i].key[j].y;
+
+            /* the undetected keypoints are not in the box of the pose. */
+            valid[i][j] = (pose_result->pose[i].key[j].score >= KEYPOINT_SCORE_THRESH);
+        }
+    }
+
+    filter_landmark_points (&s_filter, &keys[0][0], pose_result->num, kPoseKeyNum, 2, &valid[0][0], time_ms);
+
+    for (int i = 0; i < pose_result->num; i ++)
+    {
+        for (int j = 0; j < kPoseKeyNum; j ++)
+        {
+            pose_result->pose[i].key[j].x = keys[i][2 * j + 0];
+            pose_result->pose[i].key[j].y = keys[i][2 * j + 1];
+        }
+    }
+}
@@ -63,6 +63,11 @@ extern int init_tflite_posenet (int use_quantized_tflite, ssbo_t *ssbo);
 extern void  *get_posenet_input_buf (int *w, int *h);
 
 extern int invoke_posenet (posenet_result_t *pose_result);
+extern int set_posenet_max_poses (int max_poses);
+
+/* temporal filter of the keypoints (enum landmark_filter_type, 0: off) */
+extern int  set_posenet_filter (int filter_type);
+extern void filter_posenet_result (posenet_result_t *pose_result, double time_ms);
     
 #ifdef __cplusplus
 }
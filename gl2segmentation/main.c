@@ -4,8 +4,10 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
 #include <float.h>
 #include <GLES2/gl2.h>
 #include "util_egl.h"
@@ -13,12 +15,21 @@
 #include "util_pmeter.h"
 #include "util_texture.h"
 #include "util_render2d.h"
+#include "util_motion_gate.h"
 #include "tflite_deeplab.h"
 #include "camera_capture.h"
 #include "video_decode.h"
+#include "util_video_encode.h"
+#include "util_segmap.h"
 
 #define UNUSED(x) (void)(x)
 
+/* [1]: argmax and colorize in the fragment shader (needs GL_OES_texture_float) */
+#define SEGMAP_ARGMAX_ON_GPU    0
+
+static segmap_texture_t s_segmap_tex;
+static segmap_texture_t s_heatmap_tex;
+
 
 #if defined (USE_INPUT_CAMERA_CAPTURE)
 static void
@@ -110,7 +121,6 @@ init_video_texture (texture_2d_t *captex, const char *fname)
     get_video_pixformat (&vid_fmt);
 
     create_2d_texture_ex (captex, NULL, vid_w, vid_h, vid_fmt);
-    start_video_decode ();
 
     return 0;
 }
@@ -118,8 +128,8 @@ init_video_texture (texture_2d_t *captex, const char *fname)
 
 
 /* resize image to DNN network input size and convert to fp32. */
-void
-feed_deeplab_image(texture_2d_t *srctex, int win_w, int win_h)
+int
+feed_deeplab_image(texture_2d_t *srctex, int win_w, int win_h, motion_gate_t *gate)
 {
     int x, y, w, h;
     float *buf_fp32 = (float *)get_deeplab_input_buf (&w, &h);
@@ -136,6 +146,10 @@ feed_deeplab_image(texture_2d_t *srctex, int win_w, int win_h)
     glPixelStorei (GL_PACK_ALIGNMENT, 4);
     glReadPixels (0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, buf_ui8);
 
+    /* the scene hasn't changed. reuse the last output of the model. */
+    if (gate && !check_motion_gate (gate, buf_ui8, w, h))
+        return 0;
+
     /* convert UI8 [0, 255] ==> FP32 [ 0, 1] */
     float mean =   0.0f;
     float std  = 255.0f;
@@ -153,7 +167,7 @@ feed_deeplab_image(texture_2d_t *srctex, int win_w, int win_h)
         }
     }
 
-    return;
+    return 1;
 }
 
 void
@@ -163,50 +177,28 @@ render_deeplab_result (int ofstx, int ofsty, int draw_w, int draw_h, deeplab_res
     int segmap_w  = deeplab_ret->segmentmap_dims[0];
     int segmap_h  = deeplab_ret->segmentmap_dims[1];
     int segmap_c  = deeplab_ret->segmentmap_dims[2];
-    int x, y, c;
-    unsigned int imgbuf[segmap_h][segmap_w];
+    int c;
+    static uint32_t *s_imgbuf = NULL;
+    static uint32_t s_palette[MAX_DETECT_CLASS + 1];
 
-    /* find the most confident class for each pixel. */
-    for (y = 0; y < segmap_h; y ++)
+    if (s_imgbuf == NULL)
     {
-        for (x = 0; x < segmap_w; x ++)
-        {
-            int max_id;
-            float conf_max = 0;
-            for (c = 0; c < 21; c ++)
-            {
-                float confidence = segmap[(y * segmap_w * segmap_c)+ (x * segmap_c) + c];
-                if (c == 0 || confidence > conf_max)
-                {
-                    conf_max = confidence;
-                    max_id = c;
-                }
-            }
-            float *col = get_deeplab_class_color (max_id);
-            unsigned char r = ((int)(col[0] * 255)) & 0xff;
-            unsigned char g = ((int)(col[1] * 255)) & 0xff;
-            unsigned char b = ((int)(col[2] * 255)) & 0xff;
-            unsigned char a = ((int)(col[3] * 255)) & 0xff;
-            imgbuf[y][x] = (a << 24) | (b << 16) | (g << 8) | (r);
-        }
-    }
-    
-    GLuint texid;
-    glGenTextures (1, &texid );
-    glBindTexture (GL_TEXTURE_2D, texid);
-
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        s_imgbuf = (uint32_t *)malloc (segmap_w * segmap_h * sizeof (uint32_t));
 
-    glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+        for (c = 0; c < MAX_DETECT_CLASS + 1; c ++)
+            s_palette[c] = segmap_color_to_rgba (get_deeplab_class_color (c));
+    }
 
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA,
-        segmap_w, segmap_h, 0, GL_RGBA,
-        GL_UNSIGNED_BYTE, imgbuf);
+    /* find the most confident class for each pixel. */
+    if (!SEGMAP_ARGMAX_ON_GPU ||
+        draw_segmap_gpu (segmap, 1, segmap_w, segmap_h, segmap_c, s_palette,
+                         ofstx, ofsty, draw_w, draw_h) < 0)
+    {
+        segmap_argmax_f32 (segmap, segmap_w, segmap_h, segmap_c, s_palette, s_imgbuf);
 
-    draw_2d_texture (texid, ofstx, ofsty, draw_w, draw_h, 0);
+        update_segmap_texture (&s_segmap_tex, s_imgbuf, segmap_w, segmap_h, GL_RGBA);
+        draw_2d_texture (s_segmap_tex.texid, ofstx, ofsty, draw_w, draw_h, 0);
+    }
 
     /* class name */
     for (c = 0; c < 21; c ++)
@@ -218,8 +210,6 @@ render_deeplab_result (int ofstx, int ofsty, int draw_w, int draw_h, deeplab_res
         sprintf (buf, "%2d:%s", c, name);
         draw_dbgstr_ex (buf, ofstx, ofsty + c * 22 * 0.7, 0.7f, col_str, col);
     }
-
-    glDeleteTextures (1, &texid);
 }
 
 void
@@ -230,12 +220,14 @@ render_deeplab_heatmap (int ofstx, int ofsty, int draw_w, int draw_h, deeplab_re
     int segmap_h  = deeplab_ret->segmentmap_dims[1];
     int segmap_c  = deeplab_ret->segmentmap_dims[2];
     int x, y;
-    unsigned char imgbuf[segmap_h][segmap_w];
+    static unsigned char *s_imgbuf = NULL;
     static int s_count = 0;
     int key_id = (s_count /10)% 21;
     s_count ++;
     float conf_min, conf_max;
 
+    if (s_imgbuf == NULL)
+        s_imgbuf = (unsigned char *)malloc (segmap_w * segmap_h);
 
 #if 1
     conf_min =  0.0f;
@@ -262,28 +254,12 @@ render_deeplab_heatmap (int ofstx, int ofsty, int draw_w, int draw_h, deeplab_re
             confidence = (confidence - conf_min) / (conf_max - conf_min);
             if (confidence < 0.0f) confidence = 0.0f;
             if (confidence > 1.0f) confidence = 1.0f;
-            imgbuf[y][x] = confidence * 255;
+            s_imgbuf[y * segmap_w + x] = confidence * 255;
         }
     }
-    
-    GLuint texid;
-    glGenTextures (1, &texid );
-    glBindTexture (GL_TEXTURE_2D, texid);
-
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
-
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_LUMINANCE,
-        segmap_w, segmap_h, 0, GL_LUMINANCE,
-        GL_UNSIGNED_BYTE, imgbuf);
-
-    draw_2d_colormap (texid, ofstx, ofsty, draw_w, draw_h, 0.8f, 0);
-
-    glDeleteTextures (1, &texid);
+    update_segmap_texture (&s_heatmap_tex, s_imgbuf, segmap_w, segmap_h, GL_LUMINANCE);
+    draw_2d_colormap (s_heatmap_tex.texid, ofstx, ofsty, draw_w, draw_h, 0.8f, 0);
 
     {
         char strbuf[128];
@@ -294,6 +270,102 @@ render_deeplab_heatmap (int ofstx, int ofsty, int draw_w, int draw_h, deeplab_re
 }
 
 
+/* stop recording (the video or the camera frames) and finalize the file on Ctrl-C. */
+static volatile sig_atomic_t s_stop_request = 0;
+
+static void
+on_sigint (int sig)
+{
+    UNUSED (sig);
+    s_stop_request = 1;
+}
+
+#if defined (USE_INPUT_VIDEO_DECODE)
+
+/* -------------------------------------------------------------------- *
+ *  Offline mode:
+ *    run every frame of the video file through the whole pipeline
+ *    exactly once, as fast as possible, and dump the per-frame results.
+ *
+ *    the class-id mask of each frame is appended to the output file as
+ *    a binary PGM image, so the file is a plain netpbm image sequence.
+ * -------------------------------------------------------------------- */
+static void
+write_deeplab_result (FILE *fp, int frame_no, int64_t pts_us, deeplab_result_t *deeplab_ret)
+{
+    float *segmap = deeplab_ret->segmentmap;
+    int segmap_w  = deeplab_ret->segmentmap_dims[0];
+    int segmap_h  = deeplab_ret->segmentmap_dims[1];
+    int segmap_c  = deeplab_ret->segmentmap_dims[2];
+    static unsigned char *s_mask = NULL;
+
+    if (s_mask == NULL)
+        s_mask = (unsigned char *)malloc (segmap_w * segmap_h);
+
+    /* find the most confident class for each pixel. */
+    for (int i = 0; i < segmap_w * segmap_h; i ++)
+    {
+        float *conf = &segmap[i * segmap_c];
+        int max_id = 0;
+        for (int c = 1; c < segmap_c; c ++)
+        {
+            if (conf[c] > conf[max_id])
+                max_id = c;
+        }
+        s_mask[i] = max_id;
+    }
+
+    fprintf (fp, "P5\n# frame %d pts %lld\n%d %d\n255\n", frame_no, (long long)pts_us, segmap_w, segmap_h);
+    fwrite (s_mask, 1, segmap_w * segmap_h, fp);
+}
+
+static int
+run_offline_video (texture_2d_t *captex, int win_w, int win_h, const char *fname, int frame_base)
+{
+    int64_t pts_us;
+    int num_frames = 0;
+
+    FILE *fp = fopen (fname, "wb");
+    if (fp == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d): can't open %s\n", __FILE__, __LINE__, fname);
+        return -1;
+    }
+
+    double ttime_start = pmeter_get_time_ms ();
+
+    while (decode_next_video_frame (&pts_us) == 0)
+    {
+        deeplab_result_t deeplab_result;
+
+        update_video_texture (captex);
+
+        feed_deeplab_image (captex, win_w, win_h, NULL);
+        invoke_deeplab (&deeplab_result);
+
+        write_deeplab_result (fp, frame_base + num_frames, pts_us, &deeplab_result);
+        num_frames ++;
+    }
+
+    double elapsed_ms = pmeter_get_time_ms () - ttime_start;
+    fclose (fp);
+
+    fprintf (stderr, "-------------------------------------------\n");
+    fprintf (stderr, " offline: %d frames, %.1f [ms], %.2f [frames/s]\n", num_frames,
+             elapsed_ms, (elapsed_ms > 0) ? num_frames * 1000.0 / elapsed_ms : 0);
+    fprintf (stderr, " result : %s\n", fname);
+
+    video_decode_stats_t vstats;
+    get_video_decode_stats (&vstats);
+    fprintf (stderr, " decode : %d frames, %.2f [frames/s], %d threads\n",
+             vstats.decoded_frames, vstats.decode_fps, vstats.decode_threads);
+    fprintf (stderr, "-------------------------------------------\n");
+
+    return 0;
+}
+#endif /* USE_INPUT_VIDEO_DECODE */
+
+
 /* Adjust the texture size to fit the window size
  *
  *                      Portrait
@@ -354,26 +426,64 @@ main(int argc, char *argv[])
     texture_2d_t captex = {0};
     double ttime[10] = {0}, interval, invoke_ms;
     int enable_camera = 1;
+    float motion_thresh = 0.0f;
+    int motion_max_stale = 30;
+    motion_gate_t motion_gate;
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
     int enable_video = 0;
+    char *offline_fname = NULL;
+    char *record_fname = NULL;
+    char seg_out_fname[256];
+    int num_segments = 1;
+    int frame_base = 0;
 #endif
 
     {
         int c;
-        const char *optstring = "v:x";
+        const char *optstring = "b:c:j:m:M:o:p:P:s:v:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1)
         {
             switch (c)
             {
 #if defined (USE_INPUT_VIDEO_DECODE)
+            case 'b':
+                offline_fname = optarg;
+                break;
+            case 'j':
+                set_video_decode_threads (atoi (optarg));
+                break;
+            case 'o':
+                record_fname = optarg;
+                break;
+            case 's':
+                num_segments = atoi (optarg);
+                break;
             case 'v':
                 enable_video = 1;
                 input_name = optarg;
                 break;
 #endif
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+            case 'c':
+                if (set_capture_record_file (optarg) == 0)
+                    signal (SIGINT, on_sigint);
+                break;
+            case 'p':
+                set_capture_replay_file (optarg, 1);
+                break;
+            case 'P':
+                set_capture_replay_file (optarg, 0);
+                break;
+#endif
+            case 'm':
+                motion_thresh = atof (optarg);
+                break;
+            case 'M':
+                motion_max_stale = atoi (optarg);
+                break;
             case 'x':
                 enable_camera = 0;
                 break;
@@ -390,13 +500,39 @@ main(int argc, char *argv[])
     if (input_name == NULL)
         input_name = input_name_default;
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+    /*
+     *  segment-parallel offline mode:
+     *  fork one worker process per segment. each worker continues below
+     *  with its own EGL context, interpreters and decoder.
+     */
+    if (enable_video && offline_fname && num_segments > 1)
+    {
+        int ret = start_video_segment_workers (input_name, num_segments, offline_fname,
+                                               seg_out_fname, &frame_base);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            return 0;   /* parent: all the segments are merged. */
+
+        offline_fname = seg_out_fname;
+    }
+
+    if (offline_fname)
+        egl_init_with_pbuffer_surface (2, 0, 0, 0, win_w * 2, win_h);
+    else
+#endif
     egl_init_with_platform_window_surface (2, 0, 0, 0, win_w * 2, win_h);
 
     init_2d_renderer (win_w, win_h);
     init_pmeter (win_w, win_h, 500);
     init_dbgstr (win_w, win_h);
+#if SEGMAP_ARGMAX_ON_GPU
+    init_segmap_gpu (win_w, win_h);
+#endif
 
     init_tflite_deeplab ();
+    init_motion_gate (&motion_gate, motion_thresh, motion_max_stale);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the context */
@@ -412,6 +548,15 @@ main(int argc, char *argv[])
         texw = captex.width;
         texh = captex.height;
         enable_camera = 0;
+
+        if (offline_fname)
+        {
+            glViewport (0, 0, win_w, win_h);
+            if (run_offline_video (&captex, win_w, win_h, offline_fname, frame_base) < 0)
+                return -1;
+            return 0;
+        }
+        start_video_decode ();
     }
     else
 #endif
@@ -436,9 +581,17 @@ main(int argc, char *argv[])
 
     glClearColor (0.f, 0.f, 0.f, 1.0f);
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+    /* record the rendered frames (with overlays) to a video file. */
+    if (record_fname && init_video_encode (record_fname, 0, 0, 30) == 0)
+        signal (SIGINT, on_sigint);
+    else
+        record_fname = NULL;
+#endif
+
+    deeplab_result_t deeplab_result = {0};
     for (count = 0; ; count ++)
     {
-        deeplab_result_t deeplab_result;
         char strbuf[512];
 
         PMETER_RESET_LAP ();
@@ -465,12 +618,14 @@ main(int argc, char *argv[])
         }
 #endif
         /* invoke pose estimation using TensorflowLite */
-        feed_deeplab_image (&captex, win_w, win_h);
-
-        ttime[2] = pmeter_get_time_ms ();
-        invoke_deeplab (&deeplab_result);
-        ttime[3] = pmeter_get_time_ms ();
-        invoke_ms = ttime[3] - ttime[2];
+        invoke_ms = 0;
+        if (feed_deeplab_image (&captex, win_w, win_h, &motion_gate))
+        {
+            ttime[2] = pmeter_get_time_ms ();
+            invoke_deeplab (&deeplab_result);
+            ttime[3] = pmeter_get_time_ms ();
+            invoke_ms = ttime[3] - ttime[2];
+        }
 
         /* draw original image. */
         glClear (GL_COLOR_BUFFER_BIT);
@@ -489,11 +644,54 @@ main(int argc, char *argv[])
         draw_pmeter (0, 40);
 
         sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite  :%5.1f [ms]", interval, invoke_ms);
+        if (motion_thresh > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nSkip    :%5.1f [%%]",
+                get_motion_gate_skip_rate (&motion_gate) * 100);
+        }
+#if defined (USE_INPUT_VIDEO_DECODE)
+        if (enable_video)
+        {
+            video_decode_stats_t vstats;
+            get_video_decode_stats (&vstats);
+            sprintf (strbuf + strlen (strbuf), "\nVDEC    :%5.1f [fps] Q(%d, %d)/%d",
+                vstats.decode_fps, vstats.yuv_queue_num, vstats.rgba_queue_num, vstats.queue_depth);
+        }
+        if (record_fname)
+        {
+            video_encode_stats_t estats;
+            get_video_encode_stats (&estats);
+            sprintf (strbuf + strlen (strbuf), "\nVENC    : drop %d Q %d/%d",
+                estats.dropped_frames, estats.queue_num, estats.queue_depth);
+        }
+#endif
         draw_dbgstr (strbuf, 10, 10);
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+        if (record_fname)
+        {
+            video_encode_capture_frame ((int64_t)(ttime[1] * 1000));
+        }
+#endif
         egl_swap();
+
+        if (s_stop_request)
+            break;
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+        /* the max speed replay runs through the recording once. */
+        if (is_capture_replay_end ())
+            break;
+#endif
     }
 
+#if defined (USE_INPUT_VIDEO_DECODE)
+    if (record_fname)
+        exit_video_encode ();
+#endif
+#if defined (USE_INPUT_CAMERA_CAPTURE)
+    stop_capture ();
+#endif
+
     return 0;
 }
 
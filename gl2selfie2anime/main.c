@@ -4,6 +4,7 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
@@ -14,6 +15,7 @@
 #include "util_texture.h"
 #include "util_render2d.h"
 #include "util_matrix.h"
+#include "util_roi_cache.h"
 #include "tflite_selfie2anime.h"
 #include "camera_capture.h"
 #include "video_decode.h"
@@ -156,8 +158,13 @@ feed_face_detect_image(texture_2d_t *srctex, int win_w, int win_h)
     return;
 }
 
-void
-feed_selfie2anime_image(texture_2d_t *srctex, int win_w, int win_h, face_detect_result_t *detection, unsigned int face_id)
+/*
+ *  crop the face and convert to fp32.
+ *  returns 0 when the cached output of (*slot) is reused.
+ */
+int
+feed_selfie2anime_image(texture_2d_t *srctex, int win_w, int win_h, face_detect_result_t *detection, unsigned int face_id,
+                        roi_cache_t *cache, int *slot)
 {
     int x, y, w, h;
     float *buf_fp32 = (float *)get_selfie2anime_input_buf (&w, &h);
@@ -196,6 +203,18 @@ feed_selfie2anime_image(texture_2d_t *srctex, int win_w, int win_h, face_detect_
     glPixelStorei (GL_PACK_ALIGNMENT, 4);
     glReadPixels (0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, buf_ui8);
 
+    *slot = face_id;
+    if (cache)
+    {
+        face_t *face = &(detection->faces[face_id]);
+        float roi[5] = {face->face_cx, face->face_cy, face->face_w, face->face_h, face->rotation};
+        uint64_t hash = calc_image_dhash (buf_ui8, w, h);
+
+        /* the face hasn't moved. reuse the last anime face of it. */
+        if (check_roi_cache (cache, roi, hash, slot) || *slot < 0)
+            return 0;
+    }
+
     /* convert UI8 [0, 255] ==> FP32 [0, 1] */
     float mean = 0.0f;
     float std  = 255.0f;
@@ -213,7 +232,7 @@ feed_selfie2anime_image(texture_2d_t *srctex, int win_w, int win_h, face_detect_
         }
     }
 
-    return;
+    return 1;
 }
 
 
@@ -396,6 +415,11 @@ main(int argc, char *argv[])
     texture_2d_t captex = {0};
     double ttime[10] = {0}, interval, invoke_ms0 = 0, invoke_ms1 = 0;
     int enable_camera = 1;
+    float cache_thresh = 0.0f;
+    int cache_max_age = 30;
+    roi_cache_t roi_cache;
+    /* the outputs are kept across the frames (indexed by the cache slot) */
+    selfie2anime_result_t selfie2anime_result[ROI_CACHE_MAX_ENTRY] = {{0}};
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
@@ -404,7 +428,7 @@ main(int argc, char *argv[])
 
     {
         int c;
-        const char *optstring = "v:x";
+        const char *optstring = "c:C:v:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1)
         {
@@ -416,6 +440,12 @@ main(int argc, char *argv[])
                 input_name = optarg;
                 break;
 #endif
+            case 'c':
+                cache_thresh = atof (optarg);
+                break;
+            case 'C':
+                cache_max_age = atoi (optarg);
+                break;
             case 'x':
                 enable_camera = 0;
                 break;
@@ -439,6 +469,7 @@ main(int argc, char *argv[])
     init_dbgstr (win_w, win_h);
 
     init_tflite_selfie2anime ();
+    init_roi_cache (&roi_cache, cache_thresh, cache_max_age);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the context */
@@ -484,7 +515,7 @@ main(int argc, char *argv[])
     for (count = 0; ; count ++)
     {
         face_detect_result_t    face_detect_ret = {0};
-        selfie2anime_result_t   selfie2anime_result[MAX_FACE_NUM] = {0};
+        int face_slot[MAX_FACE_NUM];
         char strbuf[512];
 
         PMETER_RESET_LAP ();
@@ -525,16 +556,27 @@ main(int argc, char *argv[])
          *  Selfie to Anime
          * --------------------------------------- */
         invoke_ms1 = 0;
+        if (cache_thresh > 0.0f)
+            begin_roi_cache_frame (&roi_cache);
+
         for (int face_id = 0; face_id < face_detect_ret.num; face_id ++)
         {
-            feed_selfie2anime_image (&captex, win_w, win_h, &face_detect_ret, face_id);
+            roi_cache_t *cache = (cache_thresh > 0.0f) ? &roi_cache : NULL;
+            int slot;
 
-            ttime[4] = pmeter_get_time_ms ();
-            invoke_selfie2anime (&selfie2anime_result[face_id]);
-            ttime[5] = pmeter_get_time_ms ();
-            invoke_ms1 += ttime[5] - ttime[4];
+            if (feed_selfie2anime_image (&captex, win_w, win_h, &face_detect_ret, face_id, cache, &slot))
+            {
+                ttime[4] = pmeter_get_time_ms ();
+                invoke_selfie2anime (&selfie2anime_result[slot]);
+                ttime[5] = pmeter_get_time_ms ();
+                invoke_ms1 += ttime[5] - ttime[4];
+            }
+            face_slot[face_id] = slot;
         }
 
+        if (cache_thresh > 0.0f)
+            end_roi_cache_frame (&roi_cache);
+
         /* --------------------------------------- *
          *  render scene (left half)
          * --------------------------------------- */
@@ -564,7 +606,10 @@ main(int argc, char *argv[])
 
         for (int face_id = 0; face_id < face_detect_ret.num; face_id ++)
         {
-            render_animface_image (&captex, draw_x, draw_y, draw_w, draw_h, &face_detect_ret, face_id, &selfie2anime_result[face_id]);
+            int slot = face_slot[face_id];
+            if (slot < 0)
+                continue;
+            render_animface_image (&captex, draw_x, draw_y, draw_w, draw_h, &face_detect_ret, face_id, &selfie2anime_result[slot]);
         }
 
         /* --------------------------------------- *
@@ -575,6 +620,11 @@ main(int argc, char *argv[])
 
         sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite0 :%5.1f [ms]\nTFLite1 :%5.1f [ms]",
             interval, invoke_ms0, invoke_ms1);
+        if (cache_thresh > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nCache   :%5.1f [%%]",
+                get_roi_cache_hit_rate (&roi_cache) * 100);
+        }
         draw_dbgstr (strbuf, 10, 10);
 
         egl_swap();
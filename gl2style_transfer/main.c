@@ -4,6 +4,7 @@
  * ------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <float.h>
@@ -13,12 +14,17 @@
 #include "util_pmeter.h"
 #include "util_texture.h"
 #include "util_render2d.h"
+#include "util_motion_gate.h"
+#include "util_render_target.h"
+#include "util_worker.h"
 #include "tflite_style_transfer.h"
 #include "camera_capture.h"
 #include "video_decode.h"
 
 #define UNUSED(x) (void)(x)
 
+#define STYLE_TILE_OVERLAP  32      /* [pixel] min overlap of the tiles */
+
 
 #if defined (USE_INPUT_CAMERA_CAPTURE)
 static void
@@ -118,8 +124,8 @@ init_video_texture (texture_2d_t *captex, const char *fname)
 
 
 /* resize image to DNN network input size and convert to fp32. */
-void
-feed_style_transfer_image(int is_predict, texture_2d_t *srctex, int win_w, int win_h)
+int
+feed_style_transfer_image(int is_predict, texture_2d_t *srctex, int win_w, int win_h, motion_gate_t *gate)
 {
     int x, y, w, h;
     float *buf_fp32;
@@ -148,6 +154,10 @@ feed_style_transfer_image(int is_predict, texture_2d_t *srctex, int win_w, int w
     glPixelStorei (GL_PACK_ALIGNMENT, 4);
     glReadPixels (0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, buf_ui8);
 
+    /* the scene hasn't changed. reuse the last output of the model. */
+    if (gate && !check_motion_gate (gate, buf_ui8, w, h))
+        return 0;
+
     /* convert UI8 [0, 255] ==> FP32 [ 0, 1] */
     float mean =   0.0f;
     float std  = 255.0f;
@@ -165,7 +175,30 @@ feed_style_transfer_image(int is_predict, texture_2d_t *srctex, int win_w, int w
         }
     }
 
-    return;
+    return 1;
+}
+
+/* read the content image at (rtarget) resolution for the tiled mode. */
+static int
+feed_style_transfer_tiled_image (texture_2d_t *srctex, int win_w, int win_h, motion_gate_t *gate,
+                                 render_target_t *rtarget, render_target_t *fb, unsigned char *buf_ui8)
+{
+    set_render_target (rtarget);
+    glClear (GL_COLOR_BUFFER_BIT);
+
+    /* the 2D renderer maps the window size to the render target. */
+    draw_2d_texture_ex (srctex, 0, 0, win_w, win_h, 1);
+
+    glPixelStorei (GL_PACK_ALIGNMENT, 4);
+    glReadPixels (0, 0, rtarget->width, rtarget->height, GL_RGBA, GL_UNSIGNED_BYTE, buf_ui8);
+
+    set_render_target (fb);
+
+    /* the scene hasn't changed. reuse the last output of the model. */
+    if (gate && !check_motion_gate (gate, buf_ui8, rtarget->width, rtarget->height))
+        return 0;
+
+    return 1;
 }
 
 void
@@ -189,14 +222,22 @@ feed_blend_style (style_predict_t *style0, style_predict_t *style1, float ratio)
     int size;
     float *s0 = style0->param;
     float *s1 = style1->param;
-    float *d = get_style_transfer_style_input_buf (&size);
 
+    get_style_transfer_style_input_buf (&size);
     if (style0->size != size || style1->size != size)
     {
         fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
         return;
     }
-    
+
+    float *blend = (float *)malloc (size * sizeof (float));
+    float *d = blend;
+    if (blend == NULL)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return;
+    }
+
     for (int i = 0; i < size; i ++)
     {
         float src0 = *s0;
@@ -207,6 +248,10 @@ feed_blend_style (style_predict_t *style0, style_predict_t *style1, float ratio)
         s0 ++;
         s1 ++;
     }
+
+    /* to all the interpreters of the tiled mode too. */
+    feed_style_transfer_style (blend, size);
+    free (blend);
 }
 
 
@@ -248,6 +293,21 @@ update_style_transfered_texture (style_transfer_t *transfer)
     return s_texid;
 }
 
+/* upload the result of the tiled mode (RGBA) */
+static int
+update_style_tiled_texture (unsigned char *img, int img_w, int img_h)
+{
+    static int s_texid = 0;
+
+    if (s_texid == 0)
+        s_texid = create_2d_texture (img, img_w, img_h);
+
+    glBindTexture (GL_TEXTURE_2D, s_texid);
+    glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, img_w, img_h, GL_RGBA, GL_UNSIGNED_BYTE, img);
+
+    return s_texid;
+}
+
 
 /* Adjust the texture size to fit the window size
  *
@@ -313,6 +373,12 @@ main(int argc, char *argv[])
     float style_ratio = -0.1f;
     double ttime[10] = {0}, interval, invoke_ms;
     int enable_camera = 1;
+    float motion_thresh = 0.0f;
+    int motion_max_stale = 30;
+    motion_gate_t motion_gate;
+    int tile_w = 0, tile_h = 0, num_tiles = 0;
+    render_target_t tile_rt = {0}, fb = {0};
+    unsigned char *tile_src = NULL, *tile_dst = NULL;
     UNUSED (argc);
     UNUSED (*argv);
 #if defined (USE_INPUT_VIDEO_DECODE)
@@ -322,7 +388,7 @@ main(int argc, char *argv[])
     /* gl2style_transfer [content_file_name] [style_file_name] */
     {
         int c;
-        const char *optstring = "v:x";
+        const char *optstring = "m:M:t:v:x";
 
         while ((c = getopt (argc, argv, optstring)) != -1)
         {
@@ -334,6 +400,15 @@ main(int argc, char *argv[])
                 input_name = optarg;
                 break;
 #endif
+            case 'm':
+                motion_thresh = atof (optarg);
+                break;
+            case 'M':
+                motion_max_stale = atoi (optarg);
+                break;
+            case 't':
+                tile_w = atoi (optarg);
+                break;
             case 'x':
                 enable_camera = 0;
                 break;
@@ -362,6 +437,7 @@ main(int argc, char *argv[])
     init_dbgstr (win_w, win_h);
 
     init_tflite_style_transfer ();
+    init_motion_gate (&motion_gate, motion_thresh, motion_max_stale);
 
 #if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
     /* we need to recover framebuffer because GPU Delegate changes the context */
@@ -399,6 +475,29 @@ main(int argc, char *argv[])
     }
     adjust_texture (win_w, win_h, texw, texh, &draw_x, &draw_y, &draw_w, &draw_h);
 
+    /* tiled mode: stylize at (tile_w) width, with the aspect of the content. */
+    if (tile_w > 0)
+    {
+        int num_pool = get_worker_num ();
+#if defined (USE_GL_DELEGATE) || defined (USE_GPU_DELEGATEV2)
+        fprintf (stderr, "the GPU delegate needs the GL context. the tiles run one by one.\n");
+        num_pool = 1;
+#endif
+        tile_h = tile_w * texh / texw;
+        num_pool = init_style_transfer_pool (num_pool);
+        fprintf (stderr, "tiled mode: %dx%d, %d interpreter(s)\n", tile_w, tile_h, num_pool);
+
+        create_render_target (&fb, win_w, win_h, 0);
+        create_render_target (&tile_rt, tile_w, tile_h, RENDER_TARGET_COLOR);
+        tile_src = (unsigned char *)malloc (tile_w * tile_h * 4);
+        tile_dst = (unsigned char *)calloc (1, tile_w * tile_h * 4);
+        if (tile_src == NULL || tile_dst == NULL)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            return -1;
+        }
+    }
+
     glClearColor (0.f, 0.f, 0.f, 1.0f);
 
     /* --------------------------------------- *
@@ -415,13 +514,13 @@ main(int argc, char *argv[])
 
         /* predict style of original image */
         glClear (GL_COLOR_BUFFER_BIT);
-        feed_style_transfer_image (1, &captex, win_w, win_h);
+        feed_style_transfer_image (1, &captex, win_w, win_h, NULL);
         invoke_style_predict (&style_predict[0]);
         store_style_predict (&style_predict[0]);
 
         /* predict style of target image */
         glClear (GL_COLOR_BUFFER_BIT);
-        feed_style_transfer_image (1, &styletex, win_w, win_h);
+        feed_style_transfer_image (1, &styletex, win_w, win_h, NULL);
         invoke_style_predict (&style_predict[1]);
         store_style_predict (&style_predict[1]);
     }
@@ -429,6 +528,8 @@ main(int argc, char *argv[])
     /* --------------------------------------- *
      *  Style transfer
      * --------------------------------------- */
+    int transfered_texid = 0;
+    float last_style_ratio = -FLT_MAX;
     for (count = 0; ; count ++)
     {
         style_transfer_t style_transfered = {0};
@@ -470,19 +571,43 @@ main(int argc, char *argv[])
         style_ratio = 1.0f;
 #endif
 
-        /* feed style parameter and original image */
-        feed_blend_style (&style_predict[0], &style_predict[1], style_ratio);
-        feed_style_transfer_image (0, &captex, win_w, win_h);
+        /* feed style parameter (only when changed. the output depends on it too) */
+        if (style_ratio != last_style_ratio)
+        {
+            feed_blend_style (&style_predict[0], &style_predict[1], style_ratio);
+            reset_motion_gate (&motion_gate);
+        }
+        last_style_ratio = style_ratio;
 
-        /* invoke pose estimation using TensorflowLite */
-        ttime[2] = pmeter_get_time_ms ();
-        invoke_style_transfer (&style_transfered);
-        ttime[3] = pmeter_get_time_ms ();
-        invoke_ms = ttime[3] - ttime[2];
+        /* feed original image */
+        invoke_ms = 0;
+        if (tile_w > 0)
+        {
+            if (feed_style_transfer_tiled_image (&captex, win_w, win_h, &motion_gate, &tile_rt, &fb, tile_src))
+            {
+                ttime[2] = pmeter_get_time_ms ();
+                num_tiles = invoke_style_transfer_tiled (tile_src, tile_w, tile_h, STYLE_TILE_OVERLAP, tile_dst);
+                ttime[3] = pmeter_get_time_ms ();
+                invoke_ms = ttime[3] - ttime[2];
+
+                /* on failure, keep showing the last stylized frame. */
+                if (num_tiles >= 0)
+                    transfered_texid = update_style_tiled_texture (tile_dst, tile_w, tile_h);
+            }
+        }
+        else if (feed_style_transfer_image (0, &captex, win_w, win_h, &motion_gate))
+        {
+            /* invoke pose estimation using TensorflowLite */
+            ttime[2] = pmeter_get_time_ms ();
+            invoke_style_transfer (&style_transfered);
+            ttime[3] = pmeter_get_time_ms ();
+            invoke_ms = ttime[3] - ttime[2];
+
+            transfered_texid = update_style_transfered_texture (&style_transfered);
+        }
 
         /* visualize the style transform results. */
         glClear (GL_COLOR_BUFFER_BIT);
-        int transfered_texid = update_style_transfered_texture (&style_transfered);
 #if 0
         if (style_ratio < 0.0f)     /* render original content image */
             draw_2d_texture_ex (&captex, draw_x, draw_y, draw_w, draw_h, 0);
@@ -503,6 +628,15 @@ main(int argc, char *argv[])
 
         sprintf (strbuf, "Interval:%5.1f [ms]\nTFLite  :%5.1f [ms]\nstyle_ratio=%.1f", 
                                 interval, invoke_ms, style_ratio);
+        if (tile_w > 0 && num_tiles >= 0)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nTiles   :%d (%dx%d)", num_tiles, tile_w, tile_h);
+        }
+        if (motion_thresh > 0.0f)
+        {
+            sprintf (strbuf + strlen (strbuf), "\nSkip    :%5.1f [%%]",
+                get_motion_gate_skip_rate (&motion_gate) * 100);
+        }
         draw_dbgstr (strbuf, 10, 10);
 
         egl_swap();
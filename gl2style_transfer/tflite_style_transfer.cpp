@@ -3,8 +3,10 @@
  * Copyright (c) 2019 terryky1220@gmail.com
  * ------------------------------------------------ */
 #include "util_tflite.h"
+#include "util_worker.h"
 #include "tflite_style_transfer.h"
 #include <list>
+#include <algorithm>
 
 
 #if 0
@@ -21,10 +23,40 @@ static tflite_interpreter_t s_interpreter_style_predict;
 static tflite_tensor_t      s_predict_tensor_input;
 static tflite_tensor_t      s_predict_tensor_output;
 
-static tflite_interpreter_t s_interpreter_style_transfer;
-static tflite_tensor_t      s_transfer_tensor_content_in;
-static tflite_tensor_t      s_transfer_tensor_style_in;
-static tflite_tensor_t      s_transfer_tensor_output;
+typedef struct _transfer_interpreter_t
+{
+    tflite_interpreter_t    interpreter;
+    tflite_tensor_t         content_in;
+    tflite_tensor_t         style_in;
+    tflite_tensor_t         output;
+} transfer_interpreter_t;
+
+/* [0] is the interpreter of the non-tiled mode. */
+static transfer_interpreter_t s_transfer[STYLE_TRANSFER_MAX_POOL];
+static int                    s_num_transfer;
+
+/* tiled mode */
+static float                *s_tile_out;        /* [num_tiles][tile_h][tile_w][3] */
+static int                  s_tile_out_size;
+static float                *s_tile_weight;     /* [num_x][tile_w], [num_y][tile_h] */
+static int                  s_tile_weight_size;
+static float                *s_blend_acc;       /* [num_bands][img_w][4] R, G, B, weight */
+static int                  s_blend_acc_size;
+
+
+static int
+create_transfer_interpreter (transfer_interpreter_t *t)
+{
+    tflite_interpreter_t *p = &t->interpreter;
+
+    if (tflite_create_interpreter_from_file (p, STYLE_TRANSFER_MODEL_PATH) < 0)
+        return -1;
+    tflite_get_tensor_by_name (p, 0, "content_image",               &t->content_in);
+    tflite_get_tensor_by_name (p, 0, "mobilenet_conv/Conv/BiasAdd", &t->style_in);
+    tflite_get_tensor_by_name (p, 1, "transformer/expand/conv3/conv/Sigmoid", &t->output);
+
+    return 0;
+}
 
 
 int
@@ -39,15 +71,45 @@ init_tflite_style_transfer ()
     tflite_get_tensor_by_name (p, 1, "mobilenet_conv/Conv/BiasAdd", &s_predict_tensor_output);
 
     /* transfeer */
-    p = &s_interpreter_style_transfer;
-    tflite_create_interpreter_from_file (p, STYLE_TRANSFER_MODEL_PATH);
-    tflite_get_tensor_by_name (p, 0, "content_image",               &s_transfer_tensor_content_in);
-    tflite_get_tensor_by_name (p, 0, "mobilenet_conv/Conv/BiasAdd", &s_transfer_tensor_style_in);
-    tflite_get_tensor_by_name (p, 1, "transformer/expand/conv3/conv/Sigmoid", &s_transfer_tensor_output);
+    create_transfer_interpreter (&s_transfer[0]);
+    s_num_transfer = 1;
 
     return 0;
 }
 
+/*
+ *  the interpreters to run the tiles in parallel.
+ *  they share the threads, so each of them runs on a single thread.
+ */
+int
+init_style_transfer_pool (int num_interpreters)
+{
+    if (num_interpreters > STYLE_TRANSFER_MAX_POOL)
+        num_interpreters = STYLE_TRANSFER_MAX_POOL;
+
+    for (int i = s_num_transfer; i < num_interpreters; i ++)
+    {
+        if (create_transfer_interpreter (&s_transfer[i]) < 0)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            break;
+        }
+
+        /* the same style as the others */
+        memcpy (s_transfer[i].style_in.ptr, s_transfer[0].style_in.ptr,
+                s_transfer[0].style_in.dims[3] * sizeof (float));
+        s_num_transfer = i + 1;
+    }
+
+    if (s_num_transfer > 1)
+    {
+        for (int i = 0; i < s_num_transfer; i ++)
+            s_transfer[i].interpreter.interpreter->SetNumThreads (1);
+    }
+
+    return s_num_transfer;
+}
+
 void *
 get_style_predict_input_buf (int *w, int *h)
 {
@@ -59,16 +121,35 @@ get_style_predict_input_buf (int *w, int *h)
 void *
 get_style_transfer_style_input_buf (int *size)
 {
-    *size = s_transfer_tensor_style_in.dims[3];
-    return (float *)s_transfer_tensor_style_in.ptr;
+    *size = s_transfer[0].style_in.dims[3];
+    return (float *)s_transfer[0].style_in.ptr;
 }
 
 void *
 get_style_transfer_content_input_buf (int *w, int *h)
 {
-    *w = s_transfer_tensor_content_in.dims[2];
-    *h = s_transfer_tensor_content_in.dims[1];
-    return (float *)s_transfer_tensor_content_in.ptr;
+    *w = s_transfer[0].content_in.dims[2];
+    *h = s_transfer[0].content_in.dims[1];
+    return (float *)s_transfer[0].content_in.ptr;
+}
+
+/*
+ *  the input tensors are not overwritten by Invoke(), so the style bottleneck
+ *  is set only when the style changes.
+ */
+int
+feed_style_transfer_style (const float *style, int size)
+{
+    if (size != s_transfer[0].style_in.dims[3])
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    for (int i = 0; i < s_num_transfer; i ++)
+        memcpy (s_transfer[i].style_in.ptr, style, size * sizeof (float));
+
+    return 0;
 }
 
 
@@ -100,21 +181,265 @@ invoke_style_predict (style_predict_t *predict_result)
 int
 invoke_style_transfer (style_transfer_t *transfered_result)
 {
-    if (s_interpreter_style_transfer.interpreter->Invoke() != kTfLiteOk)
+    transfer_interpreter_t *t = &s_transfer[0];
+
+    if (t->interpreter.interpreter->Invoke() != kTfLiteOk)
     {
         fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
         return -1;
     }
 
-    //int s0 = s_transfer_tensor_output.dims[0];
-    int s1 = s_transfer_tensor_output.dims[1];
-    int s2 = s_transfer_tensor_output.dims[2];
-    //int s3 = s_transfer_tensor_output.dims[3];
+    //int s0 = t->output.dims[0];
+    int s1 = t->output.dims[1];
+    int s2 = t->output.dims[2];
+    //int s3 = t->output.dims[3];
     //fprintf (stderr, "style output dim: (%dx%dx%dx%d)\n", s0, s1, s2, s3);
 
     transfered_result->h = s1;
     transfered_result->w = s2;
-    transfered_result->img = s_transfer_tensor_output.ptr;
+    transfered_result->img = t->output.ptr;
 
     return 0;
 }
+
+
+
+/* -------------------------------------------------- *
+ *  Tiled style transfer
+ *
+ *    the image is split into the tiles of the model input size, which
+ *    overlap (overlap) pixels at least. the last tile of each row (column)
+ *    is aligned to the image edge. the tiles are blended with the weights
+ *    which ramp up linearly over (overlap) pixels from the inner edges.
+ * -------------------------------------------------- */
+typedef struct _tile_job_t
+{
+    const unsigned char *src;           /* RGBA */
+    unsigned char       *dst;           /* RGBA */
+    int     img_w, img_h;
+    int     tile_w, tile_h;
+    int     num_x, num_y;
+    int     pos_x[STYLE_TILE_MAX_DIV];
+    int     pos_y[STYLE_TILE_MAX_DIV];
+    float   *weight_x;                  /* [num_x][tile_w] */
+    float   *weight_y;                  /* [num_y][tile_h] */
+    float   *acc;                       /* [num_bands][img_w][4] */
+    int     band_h;
+    int     err;
+} tile_job_t;
+
+/* the buffers are kept, and grown to (size) floats when needed. */
+static int
+reserve_tile_buf (float **buf, int *buf_size, int size)
+{
+    if (*buf_size >= size)
+        return 0;
+
+    if (*buf)
+        free (*buf);
+    *buf = (float *)malloc (size * sizeof (float));
+    *buf_size = *buf ? size : 0;
+
+    return *buf ? 0 : -1;
+}
+
+static int
+calc_tile_pos (int img_size, int tile_size, int overlap, int *pos)
+{
+    int step = tile_size - overlap;
+
+    if (img_size <= tile_size || step <= 0)
+    {
+        pos[0] = 0;
+        return 1;
+    }
+
+    int num = (img_size - tile_size + step - 1) / step + 1;
+    if (num > STYLE_TILE_MAX_DIV)
+        return -1;
+
+    for (int i = 0; i < num - 1; i ++)
+        pos[i] = i * step;
+    pos[num - 1] = img_size - tile_size;
+
+    return num;
+}
+
+static void
+calc_tile_weight (int img_size, int tile_size, int overlap, int pos, float *weight)
+{
+    for (int i = 0; i < tile_size; i ++)
+    {
+        float w = 1.0f;
+
+        if (overlap > 0 && pos > 0)
+            w = std::min (w, (i + 0.5f) / overlap);
+        if (overlap > 0 && pos + tile_size < img_size)
+            w = std::min (w, (tile_size - i - 0.5f) / overlap);
+
+        weight[i] = w;
+    }
+}
+
+/* the tiles of the interpreter (job_idx): job_idx, job_idx + num_transfer, ... */
+static void
+invoke_tile_job (void *arg, int job_idx)
+{
+    tile_job_t *job = (tile_job_t *)arg;
+    transfer_interpreter_t *t = &s_transfer[job_idx];
+    int tw = job->tile_w;
+    int th = job->tile_h;
+    int num_tiles = job->num_x * job->num_y;
+
+    for (int tile = job_idx; tile < num_tiles; tile += s_num_transfer)
+    {
+        int x0 = job->pos_x[tile % job->num_x];
+        int y0 = job->pos_y[tile / job->num_x];
+        float *d = (float *)t->content_in.ptr;
+
+        /* UI8 [0, 255] ==> FP32 [0, 1]. (the edges are repeated if the image is smaller) */
+        for (int y = 0; y < th; y ++)
+        {
+            int sy = std::min (y0 + y, job->img_h - 1);
+            const unsigned char *s = job->src + sy * job->img_w * 4;
+
+            for (int x = 0; x < tw; x ++)
+            {
+                int sx = std::min (x0 + x, job->img_w - 1);
+                *d ++ = s[sx * 4 + 0] / 255.0f;
+                *d ++ = s[sx * 4 + 1] / 255.0f;
+                *d ++ = s[sx * 4 + 2] / 255.0f;
+            }
+        }
+
+        if (t->interpreter.interpreter->Invoke() != kTfLiteOk)
+        {
+            fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+            job->err = -1;
+            return;
+        }
+
+        memcpy (&s_tile_out[tile * tw * th * 3], t->output.ptr, tw * th * 3 * sizeof (float));
+    }
+}
+
+/* blend the tiles into the rows [band_h * job_idx, band_h * (job_idx + 1)) */
+static void
+blend_tile_job (void *arg, int job_idx)
+{
+    tile_job_t *job = (tile_job_t *)arg;
+    int img_w = job->img_w;
+    int tw = job->tile_w;
+    int th = job->tile_h;
+    int y_begin = job->band_h * job_idx;
+    int y_end   = std::min (y_begin + job->band_h, job->img_h);
+    float *acc  = &job->acc[job_idx * img_w * 4];
+
+    for (int y = y_begin; y < y_end; y ++)
+    {
+        memset (acc, 0, img_w * 4 * sizeof (float));
+
+        for (int ty = 0; ty < job->num_y; ty ++)
+        {
+            int ly = y - job->pos_y[ty];
+            if (ly < 0 || ly >= th)
+                continue;
+
+            float wy = job->weight_y[ty * th + ly];
+
+            for (int tx = 0; tx < job->num_x; tx ++)
+            {
+                int x0 = job->pos_x[tx];
+                int x1 = std::min (x0 + tw, img_w);
+                const float *wx = &job->weight_x[tx * tw];
+                const float *s  = &s_tile_out[((ty * job->num_x + tx) * th + ly) * tw * 3];
+                float *a = &acc[x0 * 4];
+
+                for (int x = 0; x < x1 - x0; x ++)
+                {
+                    float w = wx[x] * wy;
+                    a[0] += w * s[0];
+                    a[1] += w * s[1];
+                    a[2] += w * s[2];
+                    a[3] += w;
+                    a += 4;
+                    s += 3;
+                }
+            }
+        }
+
+        unsigned char *d = job->dst + y * img_w * 4;
+        const float   *a = acc;
+        for (int x = 0; x < img_w; x ++)
+        {
+            float scale = 255.0f / a[3];
+            *d ++ = (unsigned char)std::min (a[0] * scale, 255.0f);
+            *d ++ = (unsigned char)std::min (a[1] * scale, 255.0f);
+            *d ++ = (unsigned char)std::min (a[2] * scale, 255.0f);
+            *d ++ = 0xFF;
+            a += 4;
+        }
+    }
+}
+
+int
+invoke_style_transfer_tiled (const unsigned char *src_rgba, int img_w, int img_h, int overlap,
+                             unsigned char *dst_rgba)
+{
+    transfer_interpreter_t *t = &s_transfer[0];
+    tile_job_t job = {0};
+
+    job.src    = src_rgba;
+    job.dst    = dst_rgba;
+    job.img_w  = img_w;
+    job.img_h  = img_h;
+    job.tile_w = t->content_in.dims[2];
+    job.tile_h = t->content_in.dims[1];
+
+    if (t->output.dims[2] != job.tile_w || t->output.dims[1] != job.tile_h)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    job.num_x = calc_tile_pos (img_w, job.tile_w, overlap, job.pos_x);
+    job.num_y = calc_tile_pos (img_h, job.tile_h, overlap, job.pos_y);
+    if (job.num_x < 0 || job.num_y < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d): too many tiles\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    int num_tiles = job.num_x * job.num_y;
+    int num_bands = get_worker_num () * 4;
+    job.band_h    = (img_h + num_bands - 1) / num_bands;
+    num_bands     = (img_h + job.band_h - 1) / job.band_h;
+
+    if (reserve_tile_buf (&s_tile_out, &s_tile_out_size, num_tiles * job.tile_w * job.tile_h * 3) < 0 ||
+        reserve_tile_buf (&s_tile_weight, &s_tile_weight_size, job.num_x * job.tile_w + job.num_y * job.tile_h) < 0 ||
+        reserve_tile_buf (&s_blend_acc, &s_blend_acc_size, num_bands * img_w * 4) < 0)
+    {
+        fprintf (stderr, "ERR: %s(%d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    job.weight_x = s_tile_weight;
+    job.weight_y = s_tile_weight + job.num_x * job.tile_w;
+    job.acc      = s_blend_acc;
+
+    for (int i = 0; i < job.num_x; i ++)
+        calc_tile_weight (img_w, job.tile_w, overlap, job.pos_x[i], &job.weight_x[i * job.tile_w]);
+    for (int i = 0; i < job.num_y; i ++)
+        calc_tile_weight (img_h, job.tile_h, overlap, job.pos_y[i], &job.weight_y[i * job.tile_h]);
+
+    /* a single interpreter runs on the calling thread (for the GPU delegate). */
+    run_worker_jobs (invoke_tile_job, &job, std::min (s_num_transfer, num_tiles));
+
+    if (job.err == 0)
+        run_worker_jobs (blend_tile_job, &job, num_bands);
+
+    if (job.err)
+        return -1;
+
+    return num_tiles;
+}
@@ -9,6 +9,8 @@
 extern "C" {
 #endif
 
+#define STYLE_TRANSFER_MAX_POOL  4      /* interpreters to run the tiles in parallel */
+#define STYLE_TILE_MAX_DIV      16      /* max tiles per row (column) */
 
 typedef struct _style_predict_t
 {
@@ -24,13 +26,22 @@ typedef struct _style_transfer_t
 
 
 int init_tflite_style_transfer ();
+int init_style_transfer_pool (int num_interpreters);
 void  *get_style_predict_input_buf (int *w, int *h);
 void  *get_style_transfer_style_input_buf (int *size);
 void  *get_style_transfer_content_input_buf (int *w, int *h);
+int   feed_style_transfer_style (const float *style, int size);
 
 int invoke_style_predict (style_predict_t  *predict_result);
 int invoke_style_transfer(style_transfer_t *transfer_result);
-    
+
+/*
+ *  stylizes an image larger than the model input by the overlapping tiles.
+ *  returns the number of the tiles, or -1 on error.
+ */
+int invoke_style_transfer_tiled (const unsigned char *src_rgba, int img_w, int img_h, int overlap,
+                                 unsigned char *dst_rgba);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,8 +3,16 @@
  * Copyright (c) 2019 terryky1220@gmail.com
  * ------------------------------------------------ */
 #include "util_tflite.h"
+#include "util_nms.h"
 #include "tflite_textdet.h"
-#include <list>
+#include <algorithm>
+#include <math.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 /* 
  * https://tfhub.dev/sayakpaul/lite-model/east-text-detector/int8/1
@@ -18,6 +26,17 @@ static tflite_tensor_t      s_detect_tensor_input;
 static tflite_tensor_t      s_detect_tensor_scores;
 static tflite_tensor_t      s_detect_tensor_geometry;
 
+static nms_context_t        s_nms;
+static int                  *s_cand_idx;            /* score map pixels above the threshold */
+static float                *s_text_quad;           /* [num][8] rotated box of each NMS candidate */
+static float                *s_text_score;          /* max score of the merged candidates */
+
+/* sin/cos of the EAST angle. the geometry angle is in [-pi/4, pi/4]. */
+#define SINCOS_TABLE_SIZE   1024
+#define SINCOS_TABLE_RANGE  (float)(M_PI * 0.5)     /* [-pi/2, pi/2] */
+static float                s_sin_table[SINCOS_TABLE_SIZE + 1];
+static float                s_cos_table[SINCOS_TABLE_SIZE + 1];
+
 
 
 
@@ -44,6 +63,21 @@ init_tflite_textdet(int use_quantized_tflite, detect_config_t *config)
     tflite_get_tensor_by_name (&s_detect_interpreter, 1, "feature_fusion/Conv_7/Sigmoid", &s_detect_tensor_scores);
     tflite_get_tensor_by_name (&s_detect_interpreter, 1, "feature_fusion/concat_3",       &s_detect_tensor_geometry);
 
+    /* every score map pixel can be a candidate */
+    int score_w = s_detect_tensor_scores.dims[2];
+    int score_h = s_detect_tensor_scores.dims[1];
+    init_nms (&s_nms, score_w * score_h);
+    s_cand_idx   = (int   *)malloc (score_w * score_h * sizeof (int));
+    s_text_quad  = (float *)malloc (score_w * score_h * sizeof (float) * 8);
+    s_text_score = (float *)malloc (score_w * score_h * sizeof (float));
+
+    for (int i = 0; i <= SINCOS_TABLE_SIZE; i ++)
+    {
+        float angle = -SINCOS_TABLE_RANGE + 2.0f * SINCOS_TABLE_RANGE * i / SINCOS_TABLE_SIZE;
+        s_sin_table[i] = sinf (angle);
+        s_cos_table[i] = cosf (angle);
+    }
+
     config->score_thresh = 0.75f;
     config->iou_thresh   = 0.3f;
 
@@ -73,155 +107,196 @@ get_geometry_ptr (int x, int y)
     return &geom_ptr[idx];
 }
 
-/*
- * https://colab.research.google.com/github/sayakpaul/Adventures-in-TensorFlow-Lite/blob/master/EAST_TFLite.ipynb
- */
+/* nearest entry. (step: pi/1024 rad) */
+static inline void
+lookup_sincos (float angle, float *sin_val, float *cos_val)
+{
+    float pos = (angle + SINCOS_TABLE_RANGE) * (SINCOS_TABLE_SIZE / (2.0f * SINCOS_TABLE_RANGE)) + 0.5f;
+    int   idx = (int)pos;
+
+    idx = std::max (idx, 0);
+    idx = std::min (idx, SINCOS_TABLE_SIZE);
+
+    *sin_val = s_sin_table[idx];
+    *cos_val = s_cos_table[idx];
+}
+
+/* pick up the pixels with (score >= score_thresh) in raster order, 4 at a time. */
 static int
-decode_bounds (std::list<detect_region_t> &detect_list, float score_thresh, int input_img_w, int input_img_h)
+collect_candidates (const float *scores, int num, float score_thresh, int *cand_idx)
 {
-    detect_region_t detect_item;
-    float  *scores_ptr = (float *)s_detect_tensor_scores.ptr;
-    float img_w = (float)s_detect_tensor_input.dims[2];
-    float img_h = (float)s_detect_tensor_input.dims[1];
-    int score_w = s_detect_tensor_scores.dims[2];
-    int score_h = s_detect_tensor_scores.dims[1];
+    int num_cand = 0;
+    int i = 0;
 
-    for (int y = 0; y < score_h; y ++) 
+#if defined (__SSE2__)
+    __m128 vth = _mm_set1_ps (score_thresh);
+    for (; i + 4 <= num; i += 4)
     {
-        for (int x = 0; x < score_w; x ++)
+        int mask = _mm_movemask_ps (_mm_cmpge_ps (_mm_loadu_ps (&scores[i]), vth));
+        while (mask)
         {
-            float score = scores_ptr[score_w * y + x];
+            cand_idx[num_cand ++] = i + __builtin_ctz (mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    const uint32_t bits[4] = {1, 2, 4, 8};
+    float32x4_t vth   = vdupq_n_f32 (score_thresh);
+    uint32x4_t  vbits = vld1q_u32 (bits);
+    for (; i + 4 <= num; i += 4)
+    {
+        uint32x4_t m4 = vandq_u32 (vcgeq_f32 (vld1q_f32 (&scores[i]), vth), vbits);
+        uint32x2_t m2 = vorr_u32 (vget_low_u32 (m4), vget_high_u32 (m4));
+        int mask = vget_lane_u32 (m2, 0) | vget_lane_u32 (m2, 1);
+        while (mask)
+        {
+            cand_idx[num_cand ++] = i + __builtin_ctz (mask);
+            mask &= mask - 1;
+        }
+    }
+#endif
 
-            if (score < score_thresh)
-                continue;
+    for (; i < num; i ++)
+    {
+        if (scores[i] >= score_thresh)
+            cand_idx[num_cand ++] = i;
+    }
 
-            float *geom_ptr = get_geometry_ptr (x, y);
+    return num_cand;
+}
 
-            float offset_x = x * 4;
-            float offset_y = y * 4;
-            float angle = geom_ptr[4];
-            float h = geom_ptr[0] + geom_ptr[2];
-            float w = geom_ptr[1] + geom_ptr[3];
+/*
+ *  rotated box of the pixel (x, y):
+ *    the box (end - (w, h)) - (end) rotated by (angle) around (end).
+ *    vertices: (end), (end - w*u), (end - w*u - h*v), (end - h*v)
+ *        u = (cos, -sin): width direction, v = (sin, cos): height direction
+ */
+static void
+decode_quad (int x, int y, float *quad)
+{
+    float *geom_ptr = get_geometry_ptr (x, y);
+    float sin_a, cos_a;
 
-            float end_x = offset_x + cos(angle) * geom_ptr[1] + sin(angle) * geom_ptr[2];
-            float end_y = offset_y - sin(angle) * geom_ptr[1] + cos(angle) * geom_ptr[2];
-            float start_x = end_x - w;
-            float start_y = end_y - h;
+    lookup_sincos (geom_ptr[4], &sin_a, &cos_a);
 
-            fvec2 topleft, btmright;
-            topleft.x  = start_x / img_w;
-            topleft.y  = start_y / img_h;
-            btmright.x = end_x   / img_w;
-            btmright.y = end_y   / img_h;
+    float offset_x = x * 4;
+    float offset_y = y * 4;
+    float h = geom_ptr[0] + geom_ptr[2];
+    float w = geom_ptr[1] + geom_ptr[3];
 
-            detect_item.score    = score;
-            detect_item.topleft  = topleft;
-            detect_item.btmright = btmright;
-            detect_item.angle    = angle;
+    float end_x = offset_x + cos_a * geom_ptr[1] + sin_a * geom_ptr[2];
+    float end_y = offset_y - sin_a * geom_ptr[1] + cos_a * geom_ptr[2];
+    float wu_x  =  w * cos_a, wu_y = -w * sin_a;
+    float hv_x  =  h * sin_a, hv_y =  h * cos_a;
 
-            detect_list.push_back (detect_item);
-        }
-    }
-    return 0;
+    quad[0] = end_x;                quad[1] = end_y;
+    quad[2] = end_x - wu_x;         quad[3] = end_y - wu_y;
+    quad[4] = end_x - wu_x - hv_x;  quad[5] = end_y - wu_y - hv_y;
+    quad[6] = end_x - hv_x;         quad[7] = end_y - hv_y;
 }
 
-/* -------------------------------------------------- *
- *  Apply NonMaxSuppression:
- *      https://github.com/tensorflow/tfjs/blob/master/tfjs-core/src/ops/image_ops.ts
- * -------------------------------------------------- */
-static float
-calc_intersection_over_union (detect_region_t &region0, detect_region_t &region1)
+static void
+set_nms_candidate (int idx, float score)
 {
-    float sx0 = region0.topleft.x;
-    float sy0 = region0.topleft.y;
-    float ex0 = region0.btmright.x;
-    float ey0 = region0.btmright.y;
-    float sx1 = region1.topleft.x;
-    float sy1 = region1.topleft.y;
-    float ex1 = region1.btmright.x;
-    float ey1 = region1.btmright.y;
-    
-    float xmin0 = std::min (sx0, ex0);
-    float ymin0 = std::min (sy0, ey0);
-    float xmax0 = std::max (sx0, ex0);
-    float ymax0 = std::max (sy0, ey0);
-    float xmin1 = std::min (sx1, ex1);
-    float ymin1 = std::min (sy1, ey1);
-    float xmax1 = std::max (sx1, ex1);
-    float ymax1 = std::max (sy1, ey1);
-    
-    float area0 = (ymax0 - ymin0) * (xmax0 - xmin0);
-    float area1 = (ymax1 - ymin1) * (xmax1 - xmin1);
-    if (area0 <= 0 || area1 <= 0)
-        return 0.0f;
-
-    float intersect_xmin = std::max (xmin0, xmin1);
-    float intersect_ymin = std::max (ymin0, ymin1);
-    float intersect_xmax = std::min (xmax0, xmax1);
-    float intersect_ymax = std::min (ymax0, ymax1);
-
-    float intersect_area = std::max (intersect_ymax - intersect_ymin, 0.0f) *
-                           std::max (intersect_xmax - intersect_xmin, 0.0f);
-    
-    return intersect_area / (area0 + area1 - intersect_area);
-}
+    const float *q = &s_text_quad[8 * idx];
+    float x1 = std::min (std::min (q[0], q[2]), std::min (q[4], q[6]));
+    float x2 = std::max (std::max (q[0], q[2]), std::max (q[4], q[6]));
+    float y1 = std::min (std::min (q[1], q[3]), std::min (q[5], q[7]));
+    float y2 = std::max (std::max (q[1], q[3]), std::max (q[5], q[7]));
 
-static bool
-compare (detect_region_t &v1, detect_region_t &v2)
-{
-    if (v1.score > v2.score)
-        return true;
-    else
-        return false;
+    nms_set_box (&s_nms, idx, x1, y1, x2, y2, score);
 }
 
+/*
+ *  https://colab.research.google.com/github/sayakpaul/Adventures-in-TensorFlow-Lite/blob/master/EAST_TFLite.ipynb
+ *
+ *  Locality-Aware NMS (EAST: https://arxiv.org/abs/1704.03155):
+ *    the candidates come in raster order, and a candidate overlapping the
+ *    previous (merged) one is merged into it, weighted by the score.
+ *    the merged score is the sum of the scores, which ranks the text lines
+ *    supported by many pixels first in the following standard NMS.
+ */
 static int
-non_max_suppression (std::list<detect_region_t> &detect_list, std::list<detect_region_t> &detect_sel_list, float iou_thresh)
+decode_bounds (float score_thresh, float iou_thresh)
 {
-    detect_list.sort (compare);
+    float  *scores_ptr = (float *)s_detect_tensor_scores.ptr;
+    int score_w = s_detect_tensor_scores.dims[2];
+    int score_h = s_detect_tensor_scores.dims[1];
+    int num = 0;
+    float quad[8];
+
+    int num_cand = collect_candidates (scores_ptr, score_w * score_h, score_thresh, s_cand_idx);
 
-    for (auto itr = detect_list.begin(); itr != detect_list.end(); itr ++)
+    for (int n = 0; n < num_cand; n ++)
     {
-        detect_region_t detect_candidate = *itr;
+        int   x     = s_cand_idx[n] % score_w;
+        int   y     = s_cand_idx[n] / score_w;
+        float score = scores_ptr[s_cand_idx[n]];
 
-        int ignore_candidate = false;
-        for (auto itr_sel = detect_sel_list.rbegin(); itr_sel != detect_sel_list.rend(); itr_sel ++)
+        decode_quad (x, y, quad);
+
+        if (num > 0)
         {
-            detect_region_t detect_sel = *itr_sel;
+            float *prev = &s_text_quad[8 * (num - 1)];
+            float prev_score = s_nms.score[num - 1];
 
-            float iou = calc_intersection_over_union (detect_candidate, detect_sel);
-            if (iou >= iou_thresh)
+            if (nms_quad_iou (prev, quad) > iou_thresh)
             {
-                ignore_candidate = true;
-                break;
+                float w_sum = prev_score + score;
+                for (int i = 0; i < 8; i ++)
+                    prev[i] = (prev[i] * prev_score + quad[i] * score) / w_sum;
+
+                s_nms.score[num - 1]  = w_sum;
+                s_text_score[num - 1] = std::max (s_text_score[num - 1], score);
+                continue;
             }
+            set_nms_candidate (num - 1, prev_score);
         }
 
-        if (!ignore_candidate)
-        {
-            detect_sel_list.push_back(detect_candidate);
-            if (detect_sel_list.size() >= MAX_TEXT_NUM)
-                break;
-        }
+        memcpy (&s_text_quad[8 * num], quad, sizeof (quad));
+        s_nms.score[num]  = score;
+        s_text_score[num] = score;
+        num ++;
     }
 
-    return 0;
+    if (num > 0)
+        set_nms_candidate (num - 1, s_nms.score[num - 1]);
+
+    s_nms.num = num;
+
+    return num;
 }
 
+/* -------------------------------------------------- *
+ *  Apply NonMaxSuppression:
+ *      https://github.com/tensorflow/tfjs/blob/master/tfjs-core/src/ops/image_ops.ts
+ * -------------------------------------------------- */
 static void
-pack_detect_result (detect_result_t *detect_result, std::list<detect_region_t> &detect_list)
+pack_detect_result (detect_result_t *detect_result, int *sel_idx, int num_detects)
 {
-    int num_detects = 0;
-    for (auto itr = detect_list.begin(); itr != detect_list.end(); itr ++)
-    {
-        detect_region_t detect = *itr;
-        memcpy (&detect_result->texts[num_detects], &detect, sizeof (detect));
-        num_detects ++;
-        detect_result->num = num_detects;
+    float img_w = (float)s_detect_tensor_input.dims[2];
+    float img_h = (float)s_detect_tensor_input.dims[1];
 
-        if (num_detects >= MAX_TEXT_NUM)
-            break;
+    for (int i = 0; i < num_detects; i ++)
+    {
+        int idx = sel_idx[i];
+        const float *q = &s_text_quad[8 * idx];
+        detect_region_t *detect = &detect_result->texts[i];
+
+        /* back to (end - (w, h)) - (end) rotated around (end) */
+        float ux = q[0] - q[2], uy = q[1] - q[3];
+        float vx = q[0] - q[6], vy = q[1] - q[7];
+        float w  = sqrtf (ux * ux + uy * uy);
+        float h  = sqrtf (vx * vx + vy * vy);
+
+        detect->score      = s_text_score[idx];
+        detect->topleft.x  = (q[0] - w) / img_w;
+        detect->topleft.y  = (q[1] - h) / img_h;
+        detect->btmright.x = q[0] / img_w;
+        detect->btmright.y = q[1] / img_h;
+        detect->angle      = atan2f (-uy, ux);
     }
+    detect_result->num = num_detects;
 }
 
 
@@ -239,21 +314,13 @@ invoke_textdet (detect_result_t *detect_result, detect_config_t *config)
 
     /* decode boundary box and landmark keypoints */
     float score_thresh = config->score_thresh;
-    std::list<detect_region_t> detect_list;
+    int sel_idx[MAX_TEXT_NUM];
 
-    int input_img_w = s_detect_tensor_input.dims[2];
-    int input_img_h = s_detect_tensor_input.dims[1];
-    decode_bounds (detect_list, score_thresh, input_img_w, input_img_h);
+    float iou_thresh   = config->iou_thresh;
+    decode_bounds (score_thresh, iou_thresh);
 
-#if 1 /* USE NMS */
-    float iou_thresh = config->iou_thresh;
-    std::list<detect_region_t> detect_nms_list;
-
-    non_max_suppression (detect_list, detect_nms_list, iou_thresh);
-    pack_detect_result (detect_result, detect_nms_list);
-#else
-    pack_detect_result (detect_result, detect_list);
-#endif
+    int num_detects = nms_quad (&s_nms, s_text_quad, iou_thresh, MAX_TEXT_NUM, sel_idx);
+    pack_detect_result (detect_result, sel_idx, num_detects);
 
     return 0;
 }
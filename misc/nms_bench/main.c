@@ -0,0 +1,239 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "util_nms.h"
+
+/*
+ *  microbenchmark of util_nms.c
+ *
+ *    reference : sort, then the scan against the selected list with
+ *                the division based IoU (the former per-app implementation).
+ *    hard      : nms_hard() with the grid off/on.
+ *    weighted  : nms_weighted() with 6 keypoints.
+ */
+#define IOU_THRESH  0.3f
+#define NUM_KEYS    6
+
+typedef struct _box_t
+{
+    float score;
+    float x1, y1, x2, y2;
+    int   idx;
+} box_t;
+
+static double
+get_time_us ()
+{
+    struct timespec tv;
+    clock_gettime (CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec * 1000000.0 + tv.tv_nsec / 1000.0;
+}
+
+static float
+frand ()
+{
+    return (float)rand () / (float)RAND_MAX;
+}
+
+/* clustered boxes, like the raw output of a detector. */
+static void
+generate_boxes (box_t *boxes, float *keys, int num)
+{
+    int num_objs = num / 8 + 1;
+
+    for (int i = 0; i < num; i ++)
+    {
+        int   obj = rand () % num_objs;
+        float ocx = (float)((obj * 7919) % 97) / 97.0f;
+        float ocy = (float)((obj * 104729) % 89) / 89.0f;
+        float cx  = ocx + (frand () - 0.5f) * 0.01f;
+        float cy  = ocy + (frand () - 0.5f) * 0.01f;
+        float w   = 0.02f + frand () * 0.03f;
+        float h   = 0.02f + frand () * 0.03f;
+
+        boxes[i].score = frand ();
+        boxes[i].x1 = cx - w * 0.5f;
+        boxes[i].y1 = cy - h * 0.5f;
+        boxes[i].x2 = cx + w * 0.5f;
+        boxes[i].y2 = cy + h * 0.5f;
+        boxes[i].idx = i;
+
+        for (int k = 0; k < NUM_KEYS * 2; k ++)
+            keys[i * NUM_KEYS * 2 + k] = frand ();
+    }
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  reference implementation
+ * -------------------------------------------------------------------- */
+static float
+calc_iou (box_t *b0, box_t *b1)
+{
+    float area0 = (b0->y2 - b0->y1) * (b0->x2 - b0->x1);
+    float area1 = (b1->y2 - b1->y1) * (b1->x2 - b1->x1);
+    if (area0 <= 0 || area1 <= 0)
+        return 0.0f;
+
+    float ix1 = b0->x1 > b1->x1 ? b0->x1 : b1->x1;
+    float iy1 = b0->y1 > b1->y1 ? b0->y1 : b1->y1;
+    float ix2 = b0->x2 < b1->x2 ? b0->x2 : b1->x2;
+    float iy2 = b0->y2 < b1->y2 ? b0->y2 : b1->y2;
+    float iw  = ix2 - ix1 > 0 ? ix2 - ix1 : 0;
+    float ih  = iy2 - iy1 > 0 ? iy2 - iy1 : 0;
+    float inter = iw * ih;
+
+    return inter / (area0 + area1 - inter);
+}
+
+static int
+compare_box (const void *a, const void *b)
+{
+    const box_t *b0 = (const box_t *)a;
+    const box_t *b1 = (const box_t *)b;
+    if (b0->score > b1->score) return -1;
+    if (b0->score < b1->score) return  1;
+    return b0->idx - b1->idx;
+}
+
+static int
+reference_nms (box_t *boxes, int num, box_t *work, box_t *sel, int max_k, int *selected)
+{
+    int num_sel = 0;
+
+    memcpy (work, boxes, num * sizeof (box_t));
+    qsort (work, num, sizeof (box_t), compare_box);
+
+    for (int i = 0; i < num; i ++)
+    {
+        int ignore = 0;
+        for (int j = num_sel - 1; j >= 0; j --)
+        {
+            if (calc_iou (&work[i], &sel[j]) >= IOU_THRESH)
+            {
+                ignore = 1;
+                break;
+            }
+        }
+
+        if (!ignore)
+        {
+            sel[num_sel] = work[i];
+            selected[num_sel ++] = work[i].idx;
+            if (num_sel >= max_k)
+                break;
+        }
+    }
+    return num_sel;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  benchmark
+ * -------------------------------------------------------------------- */
+static void
+load_boxes (nms_context_t *nms, box_t *boxes, int num)
+{
+    for (int i = 0; i < num; i ++)
+        nms_set_box (nms, i, boxes[i].x1, boxes[i].y1, boxes[i].x2, boxes[i].y2, boxes[i].score);
+    nms->num = num;
+}
+
+static void
+run_bench (int num, int max_k, int loop)
+{
+    box_t *boxes = (box_t *)malloc (num * sizeof (box_t));
+    box_t *work  = (box_t *)malloc (num * sizeof (box_t));
+    box_t *sel   = (box_t *)malloc (num * sizeof (box_t));
+    float *keys  = (float *)malloc (num * NUM_KEYS * 2 * sizeof (float));
+    float *okeys = (float *)malloc (num * NUM_KEYS * 2 * sizeof (float));
+    int   *sel_ref  = (int *)malloc (num * sizeof (int));
+    int   *sel_nms  = (int *)malloc (num * sizeof (int));
+    nms_blend_t *blend = (nms_blend_t *)malloc (num * sizeof (nms_blend_t));
+    nms_context_t nms;
+    double t0, t_ref, t_flat, t_grid, t_wnms;
+    int n_ref = 0, n_flat = 0, n_grid = 0, n_wnms = 0;
+    int mismatch = 0;
+
+    srand (num);
+    generate_boxes (boxes, keys, num);
+    init_nms (&nms, num);
+
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+        n_ref = reference_nms (boxes, num, work, sel, max_k, sel_ref);
+    t_ref = (get_time_us () - t0) / loop;
+
+    nms.grid_mode = NMS_GRID_OFF;
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+    {
+        load_boxes (&nms, boxes, num);
+        n_flat = nms_hard (&nms, IOU_THRESH, max_k, sel_nms);
+    }
+    t_flat = (get_time_us () - t0) / loop;
+
+    if (n_flat != n_ref || memcmp (sel_nms, sel_ref, n_ref * sizeof (int)) != 0)
+        mismatch ++;
+
+    nms.grid_mode = NMS_GRID_ON;
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+    {
+        load_boxes (&nms, boxes, num);
+        n_grid = nms_hard (&nms, IOU_THRESH, max_k, sel_nms);
+    }
+    t_grid = (get_time_us () - t0) / loop;
+
+    if (n_grid != n_ref || memcmp (sel_nms, sel_ref, n_ref * sizeof (int)) != 0)
+        mismatch ++;
+
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+    {
+        load_boxes (&nms, boxes, num);
+        n_wnms = nms_weighted (&nms, IOU_THRESH, max_k, keys, NUM_KEYS * 2, blend, okeys);
+    }
+    t_wnms = (get_time_us () - t0) / loop;
+
+    fprintf (stderr, "%6d %6d | %10.2f %10.2f %10.2f %10.2f | %5d %5d %5d | %s\n",
+             num, max_k, t_ref, t_flat, t_grid, t_wnms, n_ref, n_grid, n_wnms,
+             mismatch ? "MISMATCH" : "OK");
+
+    exit_nms (&nms);
+    free (boxes);
+    free (work);
+    free (sel);
+    free (keys);
+    free (okeys);
+    free (sel_ref);
+    free (sel_nms);
+    free (blend);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+    int nums[] = {10, 100, 1000, 10000};
+
+    fprintf (stderr, "                [us/call]                                   | selected          |\n");
+    fprintf (stderr, "   num  max_k |  reference       flat       grid   weighted |   ref  grid  wnms |\n");
+    fprintf (stderr, "--------------+---------------------------------------------+-------------------+\n");
+
+    for (int i = 0; i < (int)(sizeof (nums) / sizeof (nums[0])); i ++)
+    {
+        int num  = nums[i];
+        int loop = (num <= 100) ? 10000 : (num <= 1000) ? 200 : 5;
+
+        run_bench (num, 10,  loop);
+        run_bench (num, num, loop);
+    }
+
+    return 0;
+}
@@ -0,0 +1,217 @@
+/* ------------------------------------------------ *
+ * The MIT License (MIT)
+ * Copyright (c) 2020 terryky1220@gmail.com
+ * ------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "util_topk.h"
+
+/*
+ *  microbenchmark of util_topk.c
+ *
+ *    reference : dequantize every score, then the insertion into the sorted
+ *                top-N list (the former gl2classification implementation).
+ *    f32 / u8  : topk_f32 (), topk_u8 ().
+ *    batch     : topk_batch_u8 () of NUM_CROP crops.
+ *
+ *  the scores look like the output of a classifier: a few peaks and a long
+ *  tail, which has a lot of ties once quantized.
+ */
+#define NUM_CLASS   1001
+#define NUM_CROP    10
+#define Q_SCALE     (1.0f / 256.0f)
+#define Q_ZEROP     0.0f
+
+static double
+get_time_us ()
+{
+    struct timespec tv;
+    clock_gettime (CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec * 1000000.0 + tv.tv_nsec / 1000.0;
+}
+
+static float
+frand ()
+{
+    return (float)rand () / (float)RAND_MAX;
+}
+
+static void
+generate_scores (float *logits, float *prob, uint8_t *qval, int num)
+{
+    float sum = 0.0f;
+
+    for (int i = 0; i < num; i ++)
+    {
+        logits[i] = frand () * 4.0f;
+        if (rand () % 200 == 0)
+            logits[i] += 8.0f + frand () * 4.0f;
+        sum += expf (logits[i]);
+    }
+
+    for (int i = 0; i < num; i ++)
+    {
+        prob[i] = expf (logits[i]) / sum;
+
+        int q = (int)(prob[i] / Q_SCALE + 0.5f + Q_ZEROP);
+        qval[i] = q > 255 ? 255 : q;
+    }
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  reference implementation
+ * -------------------------------------------------------------------- */
+static int
+reference_topk (const float *val, int num, int topn, topk_item_t *list)
+{
+    int list_num = 0;
+
+    for (int i = 0; i < num; i ++)
+    {
+        int pos;
+
+        /* search insert point */
+        for (pos = 0; pos < list_num; pos ++)
+        {
+            if (val[i] > list[pos].score)
+                break;
+        }
+        if (pos >= topn)
+            continue;
+
+        int last = (list_num < topn) ? list_num : topn - 1;
+        for (int j = last; j > pos; j --)
+            list[j] = list[j - 1];
+
+        list[pos].id    = i;
+        list[pos].score = val[i];
+        if (list_num < topn)
+            list_num ++;
+    }
+    return list_num;
+}
+
+static void
+dequantize (const uint8_t *qval, float *fval, int num)
+{
+    for (int i = 0; i < num; i ++)
+        fval[i] = (qval[i] - Q_ZEROP) * Q_SCALE;
+}
+
+static int
+compare_result (topk_item_t *a, topk_item_t *b, int num, float tolerance)
+{
+    for (int i = 0; i < num; i ++)
+    {
+        if (a[i].id != b[i].id || fabsf (a[i].score - b[i].score) > tolerance)
+            return 1;
+    }
+    return 0;
+}
+
+
+/* -------------------------------------------------------------------- *
+ *  benchmark
+ * -------------------------------------------------------------------- */
+static void
+run_bench (int topn, int loop)
+{
+    float   *logits = (float   *)malloc (NUM_CROP * NUM_CLASS * sizeof (float));
+    float   *prob   = (float   *)malloc (NUM_CROP * NUM_CLASS * sizeof (float));
+    float   *fval   = (float   *)malloc (NUM_CLASS * sizeof (float));
+    uint8_t *qval   = (uint8_t *)malloc (NUM_CROP * NUM_CLASS);
+    topk_item_t *ref = (topk_item_t *)malloc (NUM_CROP * topn * sizeof (topk_item_t));
+    topk_item_t *out = (topk_item_t *)malloc (NUM_CROP * topn * sizeof (topk_item_t));
+    double t0, t_ref_f, t_f32, t_ref_q, t_u8, t_smax, t_batch;
+    int n_ref = 0, n_out = 0;
+    int mismatch = 0;
+
+    srand (topn);
+    for (int b = 0; b < NUM_CROP; b ++)
+        generate_scores (&logits[b * NUM_CLASS], &prob[b * NUM_CLASS], &qval[b * NUM_CLASS], NUM_CLASS);
+
+    /* float */
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+        n_ref = reference_topk (prob, NUM_CLASS, topn, ref);
+    t_ref_f = (get_time_us () - t0) / loop;
+
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+        n_out = topk_f32 (prob, NUM_CLASS, topn, out);
+    t_f32 = (get_time_us () - t0) / loop;
+
+    if (n_out != n_ref || compare_result (ref, out, n_ref, 0.0f))
+        mismatch ++;
+
+    /* softmax of the logits: the same ids, the probability within the rounding. */
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+        n_out = topk_f32_softmax (logits, NUM_CLASS, topn, out);
+    t_smax = (get_time_us () - t0) / loop;
+
+    if (n_out != n_ref || compare_result (ref, out, n_ref, 1e-5f))
+        mismatch ++;
+
+    /* quantized */
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+    {
+        dequantize (qval, fval, NUM_CLASS);
+        n_ref = reference_topk (fval, NUM_CLASS, topn, ref);
+    }
+    t_ref_q = (get_time_us () - t0) / loop;
+
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+        n_out = topk_u8 (qval, NUM_CLASS, topn, Q_SCALE, Q_ZEROP, out);
+    t_u8 = (get_time_us () - t0) / loop;
+
+    if (n_out != n_ref || compare_result (ref, out, n_ref, 0.0f))
+        mismatch ++;
+
+    /* multi-crop */
+    t0 = get_time_us ();
+    for (int i = 0; i < loop; i ++)
+        n_out = topk_batch_u8 (qval, NUM_CROP, NUM_CLASS, NUM_CLASS, topn, Q_SCALE, Q_ZEROP, out);
+    t_batch = (get_time_us () - t0) / loop;
+
+    for (int b = 0; b < NUM_CROP; b ++)
+    {
+        dequantize (&qval[b * NUM_CLASS], fval, NUM_CLASS);
+        n_ref = reference_topk (fval, NUM_CLASS, topn, ref);
+        if (n_out != n_ref || compare_result (ref, &out[b * topn], n_ref, 0.0f))
+            mismatch ++;
+    }
+
+    fprintf (stderr, "%5d | %8.2f %8.2f %8.2f | %8.2f %8.2f %8.2f | %s\n",
+             topn, t_ref_f, t_f32, t_smax, t_ref_q, t_u8, t_batch,
+             mismatch ? "MISMATCH" : "OK");
+
+    free (logits);
+    free (prob);
+    free (fval);
+    free (qval);
+    free (ref);
+    free (out);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+    int topns[] = {1, 5, 10, 50};
+
+    fprintf (stderr, "      | [us/call] float            | quantized (u8)             |\n");
+    fprintf (stderr, " topn |      ref      f32  softmax |      ref       u8 batch%2d |\n", NUM_CROP);
+    fprintf (stderr, "------+----------------------------+----------------------------+\n");
+
+    for (int i = 0; i < (int)(sizeof (topns) / sizeof (topns[0])); i ++)
+        run_bench (topns[i], 20000);
+
+    return 0;
+}